@@ -7,8 +7,154 @@
 #include "rprintf.h"
 #include "synth/utils.h"
 
+// Write-back sector cache: FatFs rewrites the same FAT / directory sectors
+// several times per save, each of them otherwise a 4KB erase & 16 page
+// programs. On write back, sectors are compared against flash page by page:
+// unchanged pages are skipped and erases only happen when some bit has to
+// go back to 1.
+// The bootloader builds with NOR_CACHE_SECTORS=0: USB mass storage syncs after
+// every block anyway, sectors are compared & programmed straight from its buffer.
+
+#ifndef NOR_CACHE_SECTORS
+#define NOR_CACHE_SECTORS 2 // main RAM is short, 4 would make FatFs resaves erase free
+#endif
+#define NOR_PAGES_PER_SECTOR (W25Q_SECTOR_SIZE/W25Q_PAGE_SIZE)
+
+#if NOR_CACHE_SECTORS>0
+static struct
+{
+	DWORD sector;
+	uint32_t lastUse;
+	int8_t valid;
+	int8_t dirty;
+} cache[NOR_CACHE_SECTORS];
+
+static BYTE cacheData[NOR_CACHE_SECTORS][W25Q_SECTOR_SIZE];
+static uint32_t cacheUseCounter;
+#endif
+
+static void programSector(DWORD sector, const BYTE * data)
+{
+	BYTE page[W25Q_PAGE_SIZE];
+	uint32_t address=sector<<W25Q_SECTOR_BITS;
+	uint16_t toProgram=0;
+	int8_t needsErase=0;
+	
+	for(int p=0;p<NOR_PAGES_PER_SECTOR;++p)
+	{
+		BYTE changed=0,setBits=0;
+		
+		W25Q_read(address+p*W25Q_PAGE_SIZE,page,W25Q_PAGE_SIZE);
+
+		for(int i=0;i<W25Q_PAGE_SIZE;++i)
+		{
+			changed|=page[i]^data[p*W25Q_PAGE_SIZE+i];
+			setBits|=data[p*W25Q_PAGE_SIZE+i]&~page[i];
+		}
+		
+		if(changed)
+			toProgram|=1<<p;
+		needsErase|=setBits!=0;
+	}
+	
+	if(needsErase)
+	{
+		W25Q_eraseSector(sector);
+		
+		// pages that stay blank read back as all 1s already
+		toProgram=0;
+		for(int p=0;p<NOR_PAGES_PER_SECTOR;++p)
+			for(int i=0;i<W25Q_PAGE_SIZE;++i)
+				if(data[p*W25Q_PAGE_SIZE+i]!=0xff)
+				{
+					toProgram|=1<<p;
+					break;
+				}
+	}
+
+	for(int p=0;p<NOR_PAGES_PER_SECTOR;++p)
+		if(toProgram&(1<<p))
+			W25Q_programPage(address+p*W25Q_PAGE_SIZE,&data[p*W25Q_PAGE_SIZE]);
+}
+
+#if NOR_CACHE_SECTORS>0
+
+static void flushEntry(int entry)
+{
+	if(!cache[entry].dirty)
+		return;
+	
+	cache[entry].dirty=0;
+	
+	programSector(cache[entry].sector,cacheData[entry]);
+}
+
+static void syncCache(void)
+{
+	for(int i=0;i<NOR_CACHE_SECTORS;++i)
+		flushEntry(i);
+}
+
+static void writeEntry(DWORD sector, const BYTE * buff)
+{
+	int entry=-1;
+	
+	for(int i=0;i<NOR_CACHE_SECTORS;++i)
+		if(cache[i].valid && cache[i].sector==sector)
+			entry=i;
+	
+	if(entry<0)
+	{
+		// least recently used goes
+		entry=0;
+		for(int i=1;i<NOR_CACHE_SECTORS;++i)
+			if(!cache[i].valid || (cache[entry].valid && cache[i].lastUse<cache[entry].lastUse))
+				entry=i;
+		
+		flushEntry(entry);
+		
+		cache[entry].sector=sector;
+		cache[entry].valid=1;
+	}
+	
+	memcpy(cacheData[entry],buff,W25Q_SECTOR_SIZE);
+	cache[entry].dirty=1;
+	cache[entry].lastUse=++cacheUseCounter;
+}
+
+void nor_releaseSectors(DWORD sector, DWORD count)
+{
+	// whatever FatFs had there is gone, a write back would trample raw data
+	for(int i=0;i<NOR_CACHE_SECTORS;++i)
+		if(cache[i].valid && cache[i].sector>=sector && cache[i].sector<sector+count)
+			cache[i].valid=cache[i].dirty=0;
+}
+
+#else
+
+static void syncCache(void)
+{
+}
+
+static void writeEntry(DWORD sector, const BYTE * buff)
+{
+	programSector(sector,buff);
+}
+
+void nor_releaseSectors(DWORD sector, DWORD count)
+{
+}
+
+#endif
+
 DSTATUS nor_disk_initialize(void)
 {
+	// FatFs calls this on every mount
+	syncCache();
+#if NOR_CACHE_SECTORS>0
+	memset(cache,0,sizeof(cache));
+#endif
+	
 	if(W25Q_init())
 		return STA_NOINIT;
 	
@@ -30,7 +176,7 @@ DRESULT nor_disk_ioctl(BYTE ctrl, void *buff)
 	res=RES_OK;
 	switch(ctrl) {
 		case CTRL_SYNC:
-			/* nothing */
+			syncCache();
 			break;
 		case GET_SECTOR_SIZE:
 			*(WORD*)buff=W25Q_SECTOR_SIZE;
@@ -52,13 +198,15 @@ DRESULT nor_disk_read(BYTE* buff, DWORD sector, BYTE count)
 {
 //	rprintf(0,"nor_disk_read %x %d\n",sector,count);
 	
-	for(;count;--count)
-	{
-		W25Q_readSector(sector,buff);
-
-		buff+=W25Q_SECTOR_SIZE;
-		++sector;
-	}
+	W25Q_readSectors(sector,buff,count);
+	
+#if NOR_CACHE_SECTORS>0
+	// cached sectors may be newer than flash
+	
+	for(int i=0;i<NOR_CACHE_SECTORS;++i)
+		if(cache[i].valid && cache[i].sector>=sector && cache[i].sector<sector+count)
+			memcpy(&buff[(cache[i].sector-sector)<<W25Q_SECTOR_BITS],cacheData[i],W25Q_SECTOR_SIZE);
+#endif
 	
 	return RES_OK;
 }
@@ -69,7 +217,7 @@ DRESULT nor_disk_write(const BYTE* buff, DWORD sector, BYTE count)
 
 	for(;count;--count)
 	{
-		W25Q_writeSector(sector,buff);
+		writeEntry(sector,buff);
 		
 		buff+=W25Q_SECTOR_SIZE;
 		++sector;
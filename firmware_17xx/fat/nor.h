@@ -10,6 +10,9 @@ DRESULT nor_disk_ioctl(BYTE ctrl, void *buff);
 DRESULT nor_disk_read(BYTE* buff, DWORD sector, BYTE count);
 DRESULT nor_disk_write(const BYTE* buff, DWORD sector, BYTE count);
 
+// sectors of a file used as raw flash (see logstore.c), the cache drops them
+void nor_releaseSectors(DWORD sector, DWORD count);
+
 void nor_test(void);
 
 #endif /* NOR_H */
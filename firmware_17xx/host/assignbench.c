@@ -0,0 +1,292 @@
+///////////////////////////////////////////////////////////////////////////////
+// Voice assigner benchmark: voice sets vs the reference linear scans
+///////////////////////////////////////////////////////////////////////////////
+
+// A fixed seed stream of note on / off, hold pedal, release ends (voiceDone)
+// and ticks is replayed through synth/assigner.c and assigner_ref.c. Both
+// must emit the exact same voice events, then each one is timed alone.
+// Only the assigners are linked, the events land in a log or a counter.
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "synth/assigner.h"
+
+#define OP_COUNT 200000
+#define LOG_SIZE (4*OP_COUNT)
+#define MAX_HELD 10
+#define RELEASE_TICKS 3
+#define MIN_DURATION 0.3
+
+void ref_assigner_setPriority(int8_t part, assignerPriority_t prio);
+void ref_assigner_setVoiceMask(int8_t part, uint8_t mask);
+void ref_assigner_assignNote(int8_t part, uint8_t note, int8_t gate, uint16_t velocity, int8_t fromKeyboard);
+void ref_assigner_voiceDone(int8_t voice);
+void ref_assigner_allKeysOff(int8_t part);
+void ref_assigner_setPattern(int8_t part, const uint8_t * pattern, int8_t mono);
+void ref_assigner_holdEvent(int8_t part, int8_t hold);
+void ref_assigner_init(void);
+
+volatile uint32_t currentTick;
+
+typedef enum {opNote,opDone,opHold,opTick} opKind_t;
+
+struct op_s
+{
+	uint8_t kind,part,arg,gate;
+};
+
+struct event_s
+{
+	uint8_t note,voice;
+	int8_t gate;
+	uint8_t flags;
+	uint16_t velocity;
+};
+
+struct config_s
+{
+	const char * name;
+	assignerPriority_t prio;
+	int8_t mono;
+	uint8_t pattern[SYNTH_VOICE_COUNT];
+	uint8_t splitMask; // voices of part 1, 0 means no split
+};
+
+#define NN ASSIGNER_NO_NOTE
+
+static const struct config_s configs[]=
+{
+	{"poly, last",apLast,0,{0,NN,NN,NN,NN,NN},0},
+	{"poly, low",apLow,0,{0,NN,NN,NN,NN,NN},0},
+	{"poly, high",apHigh,0,{0,NN,NN,NN,NN,NN},0},
+	{"mono, last",apLast,1,{0,NN,NN,NN,NN,NN},0},
+	{"mono, low",apLow,1,{0,NN,NN,NN,NN,NN},0},
+	{"unison, high",apHigh,1,{NN,NN,NN,NN,NN,NN},0},
+	{"chord pattern, last",apLast,1,{0,4,7,NN,NN,NN},0},
+	{"poly, 2 part split",apLast,0,{0,NN,NN,NN,NN,NN},0x30},
+};
+
+static struct op_s ops[OP_COUNT];
+static struct event_s eventLog[2][LOG_SIZE];
+static int eventCount[2];
+static int logging,logSide;
+static uint32_t eventSum;
+
+static uint32_t seed;
+
+static uint32_t rnd(uint32_t n)
+{
+	seed=seed*1664525u+1013904223u;
+	return (seed>>8)%n;
+}
+
+static void logEvent(uint8_t note, int8_t gate, int8_t voice, uint16_t velocity, uint8_t flags)
+{
+	if(logging)
+	{
+		if(eventCount[logSide]<LOG_SIZE)
+			eventLog[logSide][eventCount[logSide]]=(struct event_s){note,voice,gate,flags,velocity};
+		++eventCount[logSide];
+	}
+	eventSum+=note+voice+gate;
+}
+
+void synth_assignerEvent(uint8_t note, int8_t gate, int8_t voice, uint16_t velocity, uint8_t flags)
+{
+	logEvent(note,gate,voice,velocity,flags);
+}
+
+void ref_assignerEvent(uint8_t note, int8_t gate, int8_t voice, uint16_t velocity, uint8_t flags)
+{
+	logEvent(note,gate,voice,velocity,flags);
+}
+
+static void buildOps(int8_t split)
+{
+	uint8_t held[2][MAX_HELD];
+	int heldCount[2]={0,0};
+	uint8_t hold[2]={0,0};
+	int i=0;
+
+	seed=0x5eed;
+
+	while(i<OP_COUNT-SYNTH_VOICE_COUNT-1)
+	{
+		int part=split?rnd(2):0;
+		uint32_t r=rnd(100);
+
+		if(r<40 && heldCount[part]<MAX_HELD)
+		{
+			uint8_t n=24+rnd(60);
+
+			for(int j=0;j<heldCount[part];++j)
+				if(held[part][j]==n)
+					n=NN;
+
+			if(n!=NN)
+			{
+				held[part][heldCount[part]++]=n;
+				ops[i++]=(struct op_s){opNote,part,n,1};
+			}
+		}
+		else if(r<78 && heldCount[part])
+		{
+			int j=rnd(heldCount[part]);
+
+			ops[i++]=(struct op_s){opNote,part,held[part][j],0};
+			held[part][j]=held[part][--heldCount[part]];
+		}
+		else if(r<80)
+		{
+			hold[part]=!hold[part];
+			ops[i++]=(struct op_s){opHold,part,0,hold[part]};
+		}
+		else
+		{
+			// release ends, in the order voices would finish their envelopes
+			for(int v=0;v<SYNTH_VOICE_COUNT && rnd(RELEASE_TICKS)==0;++v)
+				ops[i++]=(struct op_s){opDone,0,rnd(SYNTH_VOICE_COUNT),0};
+			ops[i++]=(struct op_s){opTick,0,0,0};
+		}
+	}
+
+	while(i<OP_COUNT)
+		ops[i++]=(struct op_s){opTick,0,0,0};
+}
+
+static void setup(const struct config_s * c, int ref)
+{
+	int8_t parts=c->splitMask?2:1;
+
+	currentTick=0;
+
+	if(ref)
+	{
+		ref_assigner_init();
+		if(c->splitMask)
+			ref_assigner_setVoiceMask(1,c->splitMask);
+		for(int8_t p=0;p<parts;++p)
+		{
+			ref_assigner_setPriority(p,c->prio);
+			ref_assigner_setPattern(p,c->pattern,c->mono);
+		}
+	}
+	else
+	{
+		assigner_init();
+		if(c->splitMask)
+			assigner_setVoiceMask(1,c->splitMask);
+		for(int8_t p=0;p<parts;++p)
+		{
+			assigner_setPriority(p,c->prio);
+			assigner_setPattern(p,c->pattern,c->mono);
+		}
+	}
+}
+
+static void replay(int ref)
+{
+	for(int i=0;i<OP_COUNT;++i)
+	{
+		const struct op_s * o=&ops[i];
+
+		switch(o->kind)
+		{
+		case opNote:
+			if(ref)
+				ref_assigner_assignNote(o->part,o->arg,o->gate,0x8000+o->arg,1);
+			else
+				assigner_assignNote(o->part,o->arg,o->gate,0x8000+o->arg,1);
+			break;
+		case opDone:
+			if(ref)
+				ref_assigner_voiceDone(o->arg);
+			else
+				assigner_voiceDone(o->arg);
+			break;
+		case opHold:
+			if(ref)
+				ref_assigner_holdEvent(o->part,o->gate);
+			else
+				assigner_holdEvent(o->part,o->gate);
+			break;
+		case opTick:
+			++currentTick;
+			break;
+		}
+	}
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+static double timeReplay(const struct config_s * c, int ref)
+{
+	double start,elapsed;
+	long count=0;
+
+	start=now();
+	do
+	{
+		setup(c,ref);
+		replay(ref);
+		count+=OP_COUNT;
+		elapsed=now()-start;
+	}
+	while(elapsed<MIN_DURATION);
+
+	return elapsed/count*1e9;
+}
+
+static int compare(const struct config_s * c)
+{
+	for(int side=0;side<2;++side)
+	{
+		logSide=side;
+		eventCount[side]=0;
+		setup(c,side);
+		replay(side);
+	}
+
+	if(eventCount[0]!=eventCount[1] || eventCount[0]>LOG_SIZE)
+		return 0;
+
+	return !memcmp(eventLog[0],eventLog[1],eventCount[0]*sizeof(struct event_s));
+}
+
+int main(int argc, char * argv[])
+{
+	int failures=0;
+
+	printf("| stream | events | reference ns/op | voice sets ns/op | speedup |\n");
+	printf("|--------|--------|-----------------|------------------|---------|\n");
+
+	for(int i=0;i<sizeof(configs)/sizeof(configs[0]);++i)
+	{
+		const struct config_s * c=&configs[i];
+		double ref,cur;
+		int same;
+
+		buildOps(c->splitMask!=0);
+
+		logging=1;
+		same=compare(c);
+		logging=0;
+
+		ref=timeReplay(c,1);
+		cur=timeReplay(c,0);
+
+		printf("| %s | %s | %.1f | %.1f | %.2fx |\n",c->name,same?"identical":"DIFFERENT",ref,cur,ref/cur);
+		failures+=!same;
+	}
+
+	printf("%d failures\n",failures);
+
+	return failures?1:0;
+}
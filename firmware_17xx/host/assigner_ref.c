@@ -0,0 +1,593 @@
+///////////////////////////////////////////////////////////////////////////////
+// Reference voice assigner, linear scans over the voices
+///////////////////////////////////////////////////////////////////////////////
+
+// Frozen copy of synth/assigner.c before the voice sets / note index rewrite,
+// symbols prefixed with ref_. assignbench checks both take the same
+// decisions and times them against each other.
+
+#include "synth/assigner.h"
+
+void ref_assignerEvent(uint8_t note, int8_t gate, int8_t voice, uint16_t velocity, uint8_t flags);
+void ref_assigner_allKeysOff(int8_t part);
+void ref_assigner_setPattern(int8_t part, const uint8_t * pattern, int8_t mono);
+struct allocation_s
+{
+	uint32_t timestamp;
+	uint16_t velocity;
+	uint8_t rootNote;
+	uint8_t note;
+	int8_t allocated;
+	int8_t gated;
+	int8_t keyPressed;
+	int8_t fromKeyboard;
+};
+
+// each part plays its own notes on its own voices, voice masks never overlap
+struct assignerPart_s
+{
+	uint32_t noteTimestamps[ASSIGNER_NOTE_COUNT]; // UINT32_MAX if not gated
+	uint16_t noteVelocities[ASSIGNER_NOTE_COUNT];
+	uint8_t patternOffsets[SYNTH_VOICE_COUNT];
+	assignerPriority_t priority;
+	uint8_t voiceMask;
+	int8_t mono;
+	int8_t hold;
+};
+
+static struct
+{
+	struct allocation_s allocation[SYNTH_VOICE_COUNT];
+	struct assignerPart_s part[SYNTH_PART_COUNT];
+} assigner;
+
+static const uint8_t polyPattern[SYNTH_VOICE_COUNT]={0,ASSIGNER_NO_NOTE,ASSIGNER_NO_NOTE,ASSIGNER_NO_NOTE,ASSIGNER_NO_NOTE,ASSIGNER_NO_NOTE};	
+
+static inline void setNoteState(struct assignerPart_s * p, uint8_t note, int8_t gate, uint16_t velocity, uint32_t timestamp)
+{
+	p->noteVelocities[note]=velocity;
+	if(gate)
+		p->noteTimestamps[note]=timestamp;
+	else
+		p->noteTimestamps[note]=UINT32_MAX;
+}
+
+static inline int8_t getNoteState(struct assignerPart_s * p, uint8_t note, uint16_t *velocity, uint32_t *timestamp)
+{
+	int8_t gate=p->noteTimestamps[note]!=UINT32_MAX;
+	if(gate && timestamp)
+		*timestamp=p->noteTimestamps[note];
+	if(gate && velocity)
+		*velocity=p->noteVelocities[note];
+	return gate;
+}
+
+static inline int8_t isVoiceDisabled(struct assignerPart_s * p, int8_t voice)
+{
+	return !(p->voiceMask&(1<<voice));
+}
+
+static inline int8_t getNoteAllocation(struct assignerPart_s * p, uint8_t note)
+{
+	int8_t vi,v=-1;
+
+	for(vi=0;vi<SYNTH_VOICE_COUNT;++vi)
+	{
+		if(isVoiceDisabled(p,vi))
+			continue;
+
+		if(assigner.allocation[vi].allocated && assigner.allocation[vi].rootNote==note)
+		{
+			v=vi;
+			break;
+		}
+	}
+
+	return v;
+}
+
+static inline int8_t getAvailableVoice(struct assignerPart_s * p, uint8_t note, uint32_t timestamp)
+{
+	int8_t v,oldestVoice=-1,sameNote=-1;
+	uint32_t oldestTimestamp=UINT32_MAX;
+
+	for(v=0;v<SYNTH_VOICE_COUNT;++v)
+	{
+		// never assign a disabled voice
+		
+		if(isVoiceDisabled(p,v))
+			continue;
+		
+		if(assigner.allocation[v].allocated)
+		{
+			// triggering a note that is still allocated to a voice should use this voice
+		
+			if(assigner.allocation[v].timestamp<timestamp && assigner.allocation[v].note==note)
+			{
+				sameNote=v;
+				break;
+			}
+		}
+		else
+		{
+			// else use oldest voice, if there is one
+
+			if (assigner.allocation[v].timestamp<oldestTimestamp)
+			{
+				oldestTimestamp=assigner.allocation[v].timestamp;
+				oldestVoice=v;
+			}
+		}
+	}
+	
+	if(sameNote>=0)
+		return sameNote;
+	else
+		return oldestVoice;
+}
+
+static inline int8_t getDispensableVoice(struct assignerPart_s * p, uint8_t note)
+{
+	int8_t v,res=-1;
+	uint32_t ts;
+
+	// first pass, steal oldest released voice
+	
+	ts=UINT32_MAX;
+		
+	for(v=0;v<SYNTH_VOICE_COUNT;++v)
+	{
+		if(isVoiceDisabled(p,v))
+			continue;
+		
+		if(!getNoteState(p,assigner.allocation[v].rootNote,NULL,NULL) && assigner.allocation[v].timestamp<ts)
+		{
+			ts=assigner.allocation[v].timestamp;
+			res=v;
+		}
+	}
+	
+	if(res>=0)
+		return res;
+	
+	// second pass, use priority rules to steal the less important held note
+	
+	ts=UINT32_MAX;
+		
+	for(v=0;v<SYNTH_VOICE_COUNT;++v)
+	{
+		if(isVoiceDisabled(p,v))
+			continue;
+		
+		switch(p->priority)
+		{
+		case apLast:
+			if(assigner.allocation[v].timestamp<ts)
+			{
+				res=v;
+				ts=assigner.allocation[v].timestamp;
+			}
+			break;
+		case apLow:
+			if(assigner.allocation[v].note>note)
+			{
+				res=v;
+				note=assigner.allocation[v].note;
+			}
+			break;
+		case apHigh:
+			if(assigner.allocation[v].note<note)
+			{
+				res=v;
+				note=assigner.allocation[v].note;
+			}
+			break;
+		}
+	}
+	
+	return res;
+}
+	
+void ref_assigner_voiceDone(int8_t voice)
+{
+	if (voice<0||voice>SYNTH_VOICE_COUNT)
+		return;
+
+	assigner.allocation[voice].allocated=0;
+	assigner.allocation[voice].keyPressed=0;
+	assigner.allocation[voice].note=ASSIGNER_NO_NOTE;
+	assigner.allocation[voice].rootNote=ASSIGNER_NO_NOTE;
+}
+
+LOWERCODESIZE static void voicesDone(struct assignerPart_s * p)
+{
+	int8_t v;
+	for(v=0;v<SYNTH_VOICE_COUNT;++v)
+	{
+		if(isVoiceDisabled(p,v))
+			continue;
+		
+		ref_assigner_voiceDone(v);
+		assigner.allocation[v].timestamp=0; // reset to voice 0 in case all voices stopped at once
+	}
+	// Release all keys and future holds too. This avoids potential
+	// problems with notes seemingly popping up from nowhere due to
+	// reassignment when future keys are released.
+    memset(p->noteTimestamps,UINT32_MAX,sizeof(p->noteTimestamps));
+}
+
+// This is different from voicesDone() in that it does not silence
+// the voice immediately but lets it go through its release phase as usual.
+// Also, only voices corresponding to keys that are down on the keyboard
+// are released.
+void ref_assigner_allKeysOff(int8_t part)
+{
+	struct assignerPart_s * p=&assigner.part[part];
+	int8_t v;
+	for(v=0;v<SYNTH_VOICE_COUNT;++v)
+	{
+		if (!isVoiceDisabled(p,v) && assigner.allocation[v].gated &&
+		    assigner.allocation[v].fromKeyboard)
+		{
+			ref_assignerEvent(assigner.allocation[v].note,0,v,assigner.allocation[v].velocity,0);
+		    	assigner.allocation[v].gated=0;
+		    	assigner.allocation[v].keyPressed=0;
+		}
+	}
+    memset(p->noteTimestamps,UINT32_MAX,sizeof(p->noteTimestamps));
+	p->hold=0;
+}
+
+// all parts, they keep their voices, priority & pattern
+void ref_assigner_panicOff(void)
+{
+	for(int8_t part=0;part<SYNTH_PART_COUNT;++part)
+	{
+		voicesDone(&assigner.part[part]);
+		assigner.part[part].hold=0;
+	}
+	
+	memset(assigner.allocation,0,sizeof(assigner.allocation));
+}
+
+void ref_assigner_setPriority(int8_t part, assignerPriority_t prio)
+{
+	struct assignerPart_s * p=&assigner.part[part];
+
+	if(prio==p->priority)
+		return;
+	
+	voicesDone(p);
+	
+	if(prio>2)
+		prio=0;
+	
+	p->priority=prio;
+}
+
+void ref_assigner_setVoiceMask(int8_t part, uint8_t mask)
+{
+	struct assignerPart_s * p=&assigner.part[part];
+
+	if(mask==p->voiceMask)
+		return;
+	
+	// voices taken from other parts are released there first
+	for(int8_t op=0;op<SYNTH_PART_COUNT;++op)
+		if(op!=part && (assigner.part[op].voiceMask&mask))
+		{
+			voicesDone(&assigner.part[op]);
+			assigner.part[op].voiceMask&=~mask;
+		}
+
+	voicesDone(p);
+	p->voiceMask=mask;
+}
+
+uint8_t ref_assigner_getVoiceMask(int8_t part)
+{
+	return assigner.part[part].voiceMask;
+}
+
+int8_t ref_assigner_getAssignment(int8_t voice, uint8_t * note)
+{
+	int8_t a;
+	
+	a=assigner.allocation[voice].allocated;
+	
+	if(a && note)
+		*note=assigner.allocation[voice].note;
+	
+	return a;
+}
+
+int8_t ref_assigner_getAnyPressed(int8_t part)
+{
+	struct assignerPart_s * p=&assigner.part[part];
+
+	for(uint8_t n=0;n<ASSIGNER_NOTE_COUNT;++n)
+		if(getNoteState(p,n,NULL,NULL))
+			return 1;
+	
+	return 0;
+}
+
+int8_t ref_assigner_getAnyAssigned(int8_t part)
+{
+	struct assignerPart_s * p=&assigner.part[part];
+	int8_t v;
+	int8_t f=0;
+	
+	for(v=0;v<SYNTH_VOICE_COUNT;++v)
+		if(!isVoiceDisabled(p,v))
+			f|=assigner.allocation[v].allocated;
+	
+	return f!=0;
+}
+
+int8_t ref_assigner_getMono(int8_t part)
+{
+	return assigner.part[part].mono;
+}
+
+void ref_assigner_assignNote(int8_t part, uint8_t note, int8_t gate, uint16_t velocity, int8_t fromKeyboard)
+{
+	struct assignerPart_s * p=&assigner.part[part];
+	uint32_t timestamp,restoredTimestamp,ts;
+	uint16_t restoredVelocity,vel;
+	uint8_t restoredNote;
+	uint8_t ni,n,flags=0;
+	int8_t v,vi;
+
+	// a part without voices
+	if(!p->voiceMask)
+		return;
+
+	timestamp=currentTick;
+
+	setNoteState(p,note,gate,velocity,timestamp);
+
+reassign:
+
+	if(gate)
+	{
+		if(p->mono)
+		{
+			// just handle legato & priority, from the part first voice
+			
+			v=__builtin_ctz(p->voiceMask);
+
+			if(p->priority!=apLast)
+				for(n=0;n<ASSIGNER_NOTE_COUNT;++n)
+					if(n!=note && getNoteState(p,n,NULL,NULL))
+					{
+						if (note>n && p->priority==apLow)
+							return;
+						if (note<n && p->priority==apHigh)
+							return;
+						
+						flags=ASSIGNER_EVENT_FLAG_LEGATO;
+					}
+		}
+		else
+		{
+			// first, try to get a free voice
+			v=getAvailableVoice(p,note,timestamp);
+
+			// no free voice, try to steal one
+			if(v<0)
+				v=getDispensableVoice(p,note);
+
+			// we might still have no voice
+			if(v<0)
+				return;
+		}
+
+		// try to assign the whole pattern of notes
+
+		for(vi=0;vi<SYNTH_VOICE_COUNT;++vi)
+		{
+			if(p->patternOffsets[vi]==ASSIGNER_NO_NOTE)
+				break;
+
+			n=note+p->patternOffsets[vi];
+
+			assigner.allocation[v].allocated=1;
+			assigner.allocation[v].gated=1;
+			assigner.allocation[v].keyPressed=1;
+			assigner.allocation[v].velocity=velocity;
+			assigner.allocation[v].rootNote=note;
+			assigner.allocation[v].note=n;
+			assigner.allocation[v].timestamp=timestamp;
+			assigner.allocation[v].fromKeyboard=fromKeyboard;
+
+			ref_assignerEvent(n,1,v,velocity,flags);
+
+			do
+				v=(v+1)%SYNTH_VOICE_COUNT;
+			while(isVoiceDisabled(p,v));
+		}
+	}
+	else if(getNoteAllocation(p,note)>=0) // note not allocated -> nothing to do
+	{
+		restoredNote=ASSIGNER_NO_NOTE;
+
+		// some still triggered notes might have been stolen, find them
+
+		if(p->priority==apLast)
+		{
+			restoredTimestamp=0;
+			for(n=0;n<ASSIGNER_NOTE_COUNT;++n)
+			{
+				if(getNoteState(p,n,&vel,&ts) && ts>restoredTimestamp && getNoteAllocation(p,n)<0)
+				{
+					restoredNote=n;
+					restoredVelocity=vel;
+					restoredTimestamp=ts;
+				}
+			}
+		}
+		else
+		{
+			for(ni=0;ni<ASSIGNER_NOTE_COUNT;++ni)
+			{
+				if(p->priority==apHigh)
+					n=127-ni;
+				else // apLow
+					n=ni;
+
+				if(getNoteState(p,n,&vel,NULL) && getNoteAllocation(p,n)<0)
+				{
+					restoredNote=n;
+					restoredVelocity=vel;
+					break;
+				}
+			}
+		}
+		
+		if(restoredNote==ASSIGNER_NO_NOTE)
+		{
+			// no note to restore, gate off all voices with rootNote=note
+			
+			for(v=0;v<SYNTH_VOICE_COUNT;++v)
+			{
+				if(isVoiceDisabled(p,v))
+					continue;
+				
+				if(assigner.allocation[v].allocated && assigner.allocation[v].rootNote==note)
+				{
+					assigner.allocation[v].keyPressed=0;
+					if(!p->hold)
+					{
+						assigner.allocation[v].gated=0;
+						ref_assignerEvent(assigner.allocation[v].note,0,v,velocity,0);
+					}
+				}
+			}
+		}
+		else
+		{
+			// restored notes can be assigned again
+			
+			note=restoredNote;
+			velocity=restoredVelocity;
+			gate=1;
+			flags=ASSIGNER_EVENT_FLAG_LEGATO;
+			
+			goto reassign;
+		}
+	}
+}
+
+LOWERCODESIZE void ref_assigner_setPattern(int8_t part, const uint8_t * pattern, int8_t mono)
+{
+	struct assignerPart_s * p=&assigner.part[part];
+	int8_t i,count=0;
+	
+	if(mono==p->mono && !memcmp(pattern,&p->patternOffsets[0],SYNTH_VOICE_COUNT))
+		return;
+
+        ref_assigner_allKeysOff(part);
+	
+	p->mono=mono;
+	memset(&p->patternOffsets[0],ASSIGNER_NO_NOTE,SYNTH_VOICE_COUNT);
+
+	for(i=0;i<SYNTH_VOICE_COUNT;++i)
+	{
+		if(pattern[i]==ASSIGNER_NO_NOTE)
+			break;
+		
+		p->patternOffsets[i]=pattern[i];
+		++count;
+	}
+
+	if(count>0)
+	{
+		p->patternOffsets[0]=0; // root note always has offset 0
+	}
+	else
+	{
+		// empty pattern means unison
+		memset(&p->patternOffsets[0],0,SYNTH_VOICE_COUNT);
+	}
+}
+
+void ref_assigner_getPattern(int8_t part, uint8_t * pattern, int8_t * mono)
+{
+	memcpy(pattern,assigner.part[part].patternOffsets,SYNTH_VOICE_COUNT);
+	
+	if(mono!=NULL)
+		*mono=assigner.part[part].mono;
+}
+
+LOWERCODESIZE void ref_assigner_latchPattern(int8_t part)
+{
+	struct assignerPart_s * p=&assigner.part[part];
+	uint8_t n;
+	int8_t count;
+	uint8_t pattern[SYNTH_VOICE_COUNT];	
+	count=0;
+	
+	memset(pattern,ASSIGNER_NO_NOTE,SYNTH_VOICE_COUNT);
+	
+	for(n=0;n<ASSIGNER_NOTE_COUNT;++n)
+		if(getNoteState(p,n,NULL,NULL))
+		{
+			pattern[count]=n;
+			
+			if(count>0)
+				pattern[count]-=pattern[0]; // it's a list of offsets to the root note
+						
+			++count;
+			
+			if(count>=SYNTH_VOICE_COUNT)
+				break;
+		}
+
+	ref_assigner_setPattern(part,pattern,1);
+}
+
+LOWERCODESIZE void ref_assigner_setPoly(int8_t part)
+{
+	ref_assigner_setPattern(part,polyPattern,0);
+}
+
+void ref_assigner_holdEvent(int8_t part, int8_t hold)
+{
+	struct assignerPart_s * p=&assigner.part[part];
+	int8_t v;
+
+	if (hold) {
+		p->hold=1;
+		return;
+	}
+
+	p->hold=0;
+	// Send gate off to all voices whose corresponding key is up
+	for(v=0;v<SYNTH_VOICE_COUNT;++v) {
+		if (!isVoiceDisabled(p,v) && 
+		    assigner.allocation[v].gated &&
+		    !assigner.allocation[v].keyPressed) {
+			ref_assignerEvent(assigner.allocation[v].note,0,v,assigner.allocation[v].velocity,0);
+		    	assigner.allocation[v].gated=0;
+		}
+	}
+}
+
+void ref_assigner_init(void)
+{
+	memset(&assigner,0,sizeof(assigner));
+
+	for(int8_t part=0;part<SYNTH_PART_COUNT;++part)
+	{
+		struct assignerPart_s * p=&assigner.part[part];
+		
+		memset(p->noteTimestamps,UINT32_MAX,sizeof(p->noteTimestamps));
+		memset(&p->patternOffsets[0],ASSIGNER_NO_NOTE,SYNTH_VOICE_COUNT);
+		p->patternOffsets[0]=0;
+	}
+
+	// every voice to the main part until others get some
+	assigner.part[0].voiceMask=(1<<SYNTH_VOICE_COUNT)-1;
+}
+
@@ -0,0 +1,38 @@
+///////////////////////////////////////////////////////////////////////////////
+// Host runner for the DMA_IRQHandler cycle budget benchmark (synth/bench.c)
+///////////////////////////////////////////////////////////////////////////////
+
+// Host "cycles" are wall time expressed in SYNTH_MASTER_CLOCK cycles, so
+// loads are relative to real time on this machine, not to the LPC1778.
+
+#include <stdio.h>
+
+#include "host.h"
+#include "synth/bench.h"
+#include "synth/dacspi.h"
+
+int main(int argc, char * argv[])
+{
+	const char * diskDir=(argc>1)?argv[1]:"../../disk";
+
+	host_init();
+
+	if(!host_importTree(diskDir,""))
+		fprintf(stderr,"warning: nothing imported from %s, using default waveforms\n",diskDir);
+
+	synth_init();
+
+	// table goes to stdout
+	rprintf_devopen(0,putchar);
+
+	bench_run();
+
+	// the DAC buffers are otherwise never read on the host, LTO would drop the stores
+	uint32_t checksum=0;
+	for(int32_t b=0;b<DACSPI_BUFFER_COUNT;++b)
+		for(int c=0;c<SYNTH_VOICE_COUNT*2;++c)
+			checksum+=host_dacspi_getOscValue(b,c);
+	fprintf(stderr,"DAC buffers checksum %08x\n",checksum);
+
+	return 0;
+}
@@ -0,0 +1,82 @@
+#ifndef HOST_H
+#define HOST_H
+
+////////////////////////////////////////////////////////////////////////////////
+// Host build glue: lets the synth engine run offline on x86-64 Linux
+////////////////////////////////////////////////////////////////////////////////
+
+#include "synth/synth.h"
+
+// dacspi replacement: the "DMA" ring is advanced by the caller, one half at a
+// time, and the DAC commands written by the engine are decoded back to 16bit
+
+void host_dacspi_tick(void); // advance DMA by half a ring & run DMA_IRQHandler, then PendSV_Handler
+int32_t host_dacspi_getLastSet(void); // first buffer updated by the last tick
+void host_dacspi_setPlayPosition(int32_t sample); // DMA position in the block being played
+uint16_t host_dacspi_getOscValue(int32_t buffer, int channel);
+uint16_t host_dacspi_getCVValue(int32_t buffer); // first board CV DAC
+
+// W25Q device model: RAM backed NOR flash behind the SSP1 bus of w25q.c; its
+// GPDMA reads only move when run, then end in W25Q_dmaInterrupt()
+
+struct host_w25qStats_s
+{
+	uint32_t sectorReads; // sectors worth of FAST_READ data clocked out
+	uint32_t readBytes; // the same, in bytes
+	uint32_t sectorErases;
+	uint32_t pageProgs;
+	uint32_t fastReads; // FAST_READ commands
+	uint32_t dmaBytes;
+	uint32_t protocolErrors; // commands while busy, writes without WEL, clocks without CS...
+	uint32_t eraseWaits; // status reads in a row that saw a running erase
+	uint32_t eraseSuspends;
+};
+
+void host_w25q_getStats(struct host_w25qStats_s * stats);
+void host_w25q_resetStats(void);
+uint32_t host_w25q_getEraseCount(uint32_t sector); // since the process started
+void host_w25q_powerCut(int32_t programBytes); // flash stops changing after that many programmed bytes, -1: powered
+void host_w25q_runDMA(uint32_t maxBytes); // move up to maxBytes of the pending DMA read
+
+// bus, for w25q.c
+void host_w25q_init(void);
+void host_w25q_select(int8_t selected);
+uint8_t host_w25q_transfer(uint8_t value);
+void host_w25q_startDMA(uint8_t * buffer, uint32_t size);
+
+// LPCUSB replacement: runs the OUT endpoint handler on a bulk packet, returns
+// what was sent on the IN endpoint since the last call
+
+void host_usb_receive(const uint8_t * packet, int len);
+int host_usb_transmit(uint8_t * buf, int maxLen);
+
+// UART MIDI out at 31250 bauds: what went out on the line during elapsedUs
+
+int host_uart_transmit(uint8_t * buf, int maxLen, uint32_t elapsedUs);
+
+// on-disk tree import (eg. the repo's disk/ folder) into the FatFs volume
+
+int8_t host_importTree(const char * hostPath, const char * fatPath);
+
+// interrupt masking (BLOCK_INT): longest stretch since the last reset, in
+// host CPU time & flash traffic, the target would lose DMA interrupts then
+
+struct host_maskStats_s
+{
+	uint32_t count;
+	uint32_t flashCount; // stretches that read or wrote the flash
+	double totalUs;
+	double longestUs;
+	uint32_t longestReadBytes; // FAST_READ data
+	uint32_t longestFastReads;
+	uint32_t longestPageProgs;
+};
+
+void host_getMaskStats(struct host_maskStats_s * stats);
+void host_resetMaskStats(void);
+
+// misc
+
+void host_init(void);
+
+#endif /* HOST_H */
@@ -0,0 +1,257 @@
+///////////////////////////////////////////////////////////////////////////////
+// Host replacement for dacspi.c: DAC command buffers without SPI / GPDMA
+///////////////////////////////////////////////////////////////////////////////
+
+#include "synth/dacspi.h"
+#include "host.h"
+
+#define DACSPI_CMD_SET_A 0x7000
+#define DACSPI_CMD_SET_B 0xf000
+
+static volatile uint8_t marker;
+
+// same as the firmware
+const struct dacspiProfile_s dacspiProfiles[dpCount] =
+{
+	/* dpStandard   */ {64,24,9,3},
+	/* dpLowLatency */ {32,24,9,3},
+	/* dpHighRate   */ {64,15,13,6},
+	/* dpPowerSave  */ {64,31,9,3},
+};
+
+// same as the firmware, repeated for each chained board
+const struct dacspiBoard_s dacspiBoard =
+{
+	.slots={{5,4},{1,0},{3,2},{2,1},{6,5},{4,3},{0,-1}},
+	.ampCV={0,1,2,3,8,9},
+	.cutoffCV={4,15,14,13,12,11},
+	.globalCV=
+	{
+		[cvAVol]=6,[cvBVol]=7,[cvCutoff]=UINT8_MAX,[cvResonance]=5,[cvAPitch]=UINT8_MAX,
+		[cvBPitch]=UINT8_MAX,[cvWaveMod]=UINT8_MAX,[cvAmp]=UINT8_MAX,[cvNoiseVol]=10,
+	},
+};
+
+static struct
+{
+	uint16_t oscCommands[SYNTH_VOICE_COUNT][DACSPI_BUFFER_COUNT][2];
+	uint32_t cvCommands[DACSPI_BOARD_COUNT][DACSPI_BUFFER_COUNT];
+	int lastSet;
+	int8_t pendSV;
+} dacspi;
+
+static struct
+{
+	dacspiProfile_t profile;
+	int32_t bufferCount;
+	int32_t curSet;
+	uint32_t tickRate;
+	uint32_t tickAccumulator;
+	volatile uint32_t playStart; // sample clock, for MIDI input timestamps
+	volatile int8_t playHalf;
+} ring=
+{
+	// standard profile, valid before dacspi_init() as the oscillators are set up first
+	.profile=dpStandard,
+	.bufferCount=64,
+	.tickRate=(24+1)*DACSPI_TIME_CONSTANT(9,3),
+	.playHalf=1,
+};
+
+// same as the firmware, minus the interrupt acknowledge
+void DMA_IRQHandler(void)
+{
+	int8_t half=marker>=ring.bufferCount/2;
+
+	// when second half is playing, update first and vice-versa
+	ring.curSet=half?0:ring.bufferCount/2;
+
+	// a new block started playing
+	ring.playStart+=ring.bufferCount/2;
+	ring.playHalf=half;
+	dacspi.lastSet=ring.curSet;
+
+	// render CVs and DACs (in sets of 16) from the parameters computed during the previous block
+
+	for(int32_t set=0;set<ring.bufferCount/2;set+=DACSPI_CV_COUNT)
+	{
+		synth_updateOscsEvent(ring.curSet,DACSPI_CV_COUNT);
+		ring.curSet+=DACSPI_CV_COUNT;
+	}
+
+	// next block control rate work
+
+	dacspi.pendSV=1;
+}
+
+void PendSV_Handler(void)
+{
+	static uint8_t phase=0;
+
+	dacspi.pendSV=0;
+
+	// compute next block parameters (in sets of 16)
+
+	for(int8_t sb=0;sb<ring.bufferCount/(DACSPI_CV_COUNT*2);++sb)
+		synth_updateCVsEvent(sb);
+
+	// update timer @ 500Hz, whatever the block size & sample rate
+
+	ring.tickAccumulator+=(ring.bufferCount/2)*ring.tickRate*TICKER_HZ*4;
+	while(ring.tickAccumulator>=SYNTH_MASTER_CLOCK)
+	{
+		ring.tickAccumulator-=SYNTH_MASTER_CLOCK;
+
+		synth_tickTimerEvent(phase);
+
+		++phase;
+		if(phase>=4)
+			phase=0;
+	}
+}
+
+void host_dacspi_tick(void)
+{
+	// the firmware interrupt fires when the DMA enters a ring half
+	marker=(marker>=ring.bufferCount/2)?0:ring.bufferCount/2;
+
+	DMA_IRQHandler();
+
+	// PendSV tail-chains right after it, unless another interrupt is pending
+	if(dacspi.pendSV)
+		PendSV_Handler();
+}
+
+void host_dacspi_setPlayPosition(int32_t sample)
+{
+	marker=((marker>=ring.bufferCount/2)?ring.bufferCount/2:0)+sample;
+}
+
+int32_t host_dacspi_getLastSet(void)
+{
+	return dacspi.lastSet;
+}
+
+uint16_t host_dacspi_getOscValue(int32_t buffer, int channel)
+{
+	return (dacspi.oscCommands[channel>>1][buffer][channel&1]&0xfff)<<4;
+}
+
+uint16_t host_dacspi_getCVValue(int32_t buffer)
+{
+	uint32_t cmd=dacspi.cvCommands[0][buffer];
+
+	return ((cmd&0xf)<<12)|((cmd>>16)&0xfff);
+}
+
+FORCEINLINE void dacspi_setOscValue(int32_t buffer, int channel, uint16_t value)
+{
+	dacspi.oscCommands[channel>>1][buffer][channel&1]=(value>>4)|((channel&1)?DACSPI_CMD_SET_B:DACSPI_CMD_SET_A);
+}
+
+FORCEINLINE void dacspi_setCVValue(int channel, uint16_t value, int8_t noDblBuf)
+{
+	uint32_t cmd=(0x100|((channel&0xf)<<4)|(value>>12))|((value&0xfff)<<16);
+	uint32_t * cvCommands=dacspi.cvCommands[channel/DACSPI_CV_COUNT];
+
+	channel%=DACSPI_CV_COUNT;
+
+	if(noDblBuf)
+	{
+		for(int set=0;set<ring.bufferCount;set+=DACSPI_CV_COUNT)
+			cvCommands[channel+set]=cmd;
+	}
+	else
+	{
+		cvCommands[channel+ring.curSet]=cmd;
+	}
+}
+
+static void startRing(dacspiProfile_t profile)
+{
+	const struct dacspiProfile_s * p=&dacspiProfiles[profile];
+
+	for(int8_t b=0;b<DACSPI_BOARD_COUNT;++b)
+		for(int32_t j=ring.bufferCount;ring.bufferCount && j<p->bufferCount;++j)
+			dacspi.cvCommands[b][j]=dacspi.cvCommands[b][j%ring.bufferCount];
+
+	ring.profile=profile;
+	ring.bufferCount=p->bufferCount;
+	ring.tickRate=(p->timerMatch+1)*DACSPI_TIME_CONSTANT(p->oscWaitStates,p->cvWaitStates);
+	ring.playHalf=1;
+
+	marker=ring.bufferCount-1;
+}
+
+void dacspi_init(void)
+{
+	memset(&dacspi,0,sizeof(dacspi));
+
+	startRing(dpStandard);
+}
+
+void dacspi_setProfile(dacspiProfile_t profile)
+{
+	if(profile>=dpCount)
+		profile=dpStandard;
+
+	startRing(profile);
+}
+
+dacspiProfile_t dacspi_getProfile(void)
+{
+	return ring.profile;
+}
+
+int32_t dacspi_getBlockSize(void)
+{
+	return ring.bufferCount/2;
+}
+
+uint32_t dacspi_getTickRate(void)
+{
+	return ring.tickRate;
+}
+
+uint32_t dacspi_getSampleRate(void)
+{
+	return SYNTH_MASTER_CLOCK/ring.tickRate;
+}
+
+uint32_t dacspi_getUpdateHz(void)
+{
+	return SYNTH_MASTER_CLOCK/(DACSPI_CV_COUNT*ring.tickRate);
+}
+
+uint32_t dacspi_getTimestamp(void)
+{
+	uint32_t start;
+	int32_t pos;
+	int8_t half;
+
+	// the DMA interrupt might preempt us
+	do
+	{
+		start=ring.playStart;
+		half=ring.playHalf;
+		pos=marker;
+	}
+	while(start!=ring.playStart);
+
+	if(pos>=ring.bufferCount/2)
+	{
+		pos-=ring.bufferCount/2;
+		half^=1;
+	}
+
+	// the DMA entered the next half, its interrupt is still pending
+	if(half)
+		start+=ring.bufferCount/2;
+
+	return start+pos;
+}
+
+uint32_t dacspi_getBlockTimestamp(void)
+{
+	return ring.playStart;
+}
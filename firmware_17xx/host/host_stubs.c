@@ -0,0 +1,401 @@
+///////////////////////////////////////////////////////////////////////////////
+// Host stubs for hardware facing modules (scan, ui, uart, usb, LPC drivers)
+///////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/stat.h>
+
+// POSIX and FatFs both define DIR
+#define DIR posix_DIR
+#include <dirent.h>
+#undef DIR
+
+#include "host.h"
+#include "diskio.h"
+#include "w25q.h"
+#include "synth/scan.h"
+#include "synth/ui.h"
+#include "synth/uart_midi.h"
+#include "usb/usbapi.h"
+
+uint32_t host_basepri=0;
+uint32_t host_primask=0;
+
+static struct
+{
+	struct host_maskStats_s stats;
+	struct host_w25qStats_s flashStart;
+	double start;
+} mask;
+
+static FATFS fatFS;
+static int32_t transpose=0;
+static int8_t presetModified=0;
+
+////////////////////////////////////////////////////////////////////////////////
+// Interrupt masking
+////////////////////////////////////////////////////////////////////////////////
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+void host_setBasepri(uint32_t value)
+{
+	struct host_w25qStats_s fs;
+	double us;
+
+	if(!host_basepri && value)
+	{
+		mask.start=now();
+		host_w25q_getStats(&mask.flashStart);
+	}
+	else if(host_basepri && !value)
+	{
+		us=(now()-mask.start)*1e6;
+		host_w25q_getStats(&fs);
+		++mask.stats.count;
+		mask.stats.totalUs+=us;
+
+		if(fs.fastReads!=mask.flashStart.fastReads || fs.pageProgs!=mask.flashStart.pageProgs)
+			++mask.stats.flashCount;
+
+		if(us>mask.stats.longestUs)
+		{
+			mask.stats.longestUs=us;
+			mask.stats.longestReadBytes=fs.readBytes-mask.flashStart.readBytes;
+			mask.stats.longestFastReads=fs.fastReads-mask.flashStart.fastReads;
+			mask.stats.longestPageProgs=fs.pageProgs-mask.flashStart.pageProgs;
+		}
+	}
+
+	host_basepri=value;
+}
+
+void host_getMaskStats(struct host_maskStats_s * stats)
+{
+	*stats=mask.stats;
+}
+
+void host_resetMaskStats(void)
+{
+	memset(&mask.stats,0,sizeof(mask.stats));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// LPC drivers / main.c
+////////////////////////////////////////////////////////////////////////////////
+
+void GPIO_SetDir(uint8_t portNum, uint32_t bitValue, uint8_t dir)
+{
+}
+
+uint32_t GPIO_ReadValue(uint8_t portNum)
+{
+	return 0;
+}
+
+PINSEL_RET_CODE PINSEL_SetPinMode(uint8_t portnum, uint8_t pinnum, PinSel_BasicMode modenum)
+{
+	return PINSEL_RET_OK;
+}
+
+PINSEL_RET_CODE PINSEL_SetOpenDrainMode(uint8_t portnum, uint8_t pinnum, FunctionalState NewState)
+{
+	return PINSEL_RET_OK;
+}
+
+void delay_us(uint32_t count)
+{
+}
+
+void delay_ms(uint32_t count)
+{
+}
+
+void usb_setMode(usbMode_t mode, usb_MSC_continue_callback_t usbMSCContinue)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// LPCUSB: bulk OUT fed by host_usb_receive(), bulk IN drained by host_usb_transmit()
+////////////////////////////////////////////////////////////////////////////////
+
+static TFnEPIntHandler * usbEPHandlers[2]={NULL,NULL}; // OUT, IN
+static const uint8_t * usbPacket=NULL;
+static int usbPacketLen=0;
+static uint8_t usbSent[4096];
+static int usbSentLen=0;
+static int8_t usbInFlight=0;
+
+BOOL USBInit(void)
+{
+	return TRUE;
+}
+
+void USBRegisterDescriptors(const U8 *pabDescriptors)
+{
+}
+
+void USBHwRegisterEPIntHandler(U8 bEP, TFnEPIntHandler *pfnHandler)
+{
+	usbEPHandlers[bEP>>7]=pfnHandler;
+}
+
+void USBHwConnect(BOOL fConnect)
+{
+}
+
+int USBHwEPRead(U8 bEP, U8 *pbBuf, int iMaxLen)
+{
+	int len=(usbPacketLen<iMaxLen)?usbPacketLen:iMaxLen;
+
+	if(usbPacket)
+		memcpy(pbBuf,usbPacket,len);
+
+	return usbPacket?len:-1;
+}
+
+int USBHwEPWrite(U8 bEP, U8 *pbBuf, int iLen)
+{
+	int len=MIN(iLen,sizeof(usbSent)-usbSentLen);
+
+	memcpy(&usbSent[usbSentLen],pbBuf,len);
+	usbSentLen+=len;
+	usbInFlight=1;
+
+	return iLen;
+}
+
+void host_usb_receive(const uint8_t * packet, int len)
+{
+	usbPacket=packet;
+	usbPacketLen=len;
+
+	if(usbEPHandlers[0])
+		usbEPHandlers[0](0x01,0);
+
+	usbPacket=NULL;
+}
+
+int host_usb_transmit(uint8_t * buf, int maxLen)
+{
+	int len;
+
+	// each packet is picked up right away, its IN interrupt sends the next one
+	while(usbInFlight && usbEPHandlers[1])
+	{
+		usbInFlight=0;
+		usbEPHandlers[1](0x81,0);
+	}
+
+	len=MIN(usbSentLen,maxLen);
+	memcpy(buf,usbSent,len);
+	usbSentLen=0;
+
+	return len;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// scan.c
+////////////////////////////////////////////////////////////////////////////////
+
+uint16_t scan_getPotValue(int8_t pot)
+{
+	return 0;
+}
+
+void scan_resetPotLocking(void)
+{
+}
+
+void scan_setMode(int8_t isSmpMasterMixMode)
+{
+}
+
+void scan_sampleMasterMix(uint16_t sampleCount, uint16_t * buffer)
+{
+	memset(buffer,0,sampleCount*sizeof(uint16_t));
+}
+
+void scan_setScanEventCallback(scan_event_callback_t callback)
+{
+}
+
+int scan_potTo16bits(int x)
+{
+	return ((int)roundf((((float)x)*UINT16_MAX)/SCAN_POT_MAX_VALUE));
+}
+
+int scan_potFrom16bits(int x)
+{
+	return ((int)roundf((((float)x)*SCAN_POT_MAX_VALUE)/UINT16_MAX));
+}
+
+void scan_init(void)
+{
+}
+
+void scan_update(void)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// ui.c / uart_midi.c
+////////////////////////////////////////////////////////////////////////////////
+
+void ui_init(void)
+{
+}
+
+void ui_update(void)
+{
+}
+
+void ui_setPresetModified(int8_t modified)
+{
+	presetModified=modified;
+}
+
+int8_t ui_isPresetModified(void)
+{
+	return presetModified;
+}
+
+int8_t ui_isTransposing(void)
+{
+	return 0;
+}
+
+int32_t ui_getTranspose(void)
+{
+	return transpose;
+}
+
+void ui_setTranspose(int32_t t)
+{
+	transpose=t;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// UART MIDI out, drained at 31250 bauds by host_uart_transmit()
+////////////////////////////////////////////////////////////////////////////////
+
+#define UART_BYTE_US 320 // start + 8 data + stop bits
+
+static uint32_t uartTime;
+
+void uartMidi_init(void)
+{
+}
+
+void uartMidi_startTransmit(void)
+{
+}
+
+int host_uart_transmit(uint8_t * buf, int maxLen, uint32_t elapsedUs)
+{
+	int len,maxBytes;
+
+	uartTime+=elapsedUs;
+	maxBytes=MIN(maxLen,uartTime/UART_BYTE_US);
+	len=midi_getOutput(buf,maxBytes);
+
+	// an idle line doesn't store up bandwidth
+	uartTime=(len<maxBytes)?0:uartTime-len*UART_BYTE_US;
+
+	return len;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Storage
+////////////////////////////////////////////////////////////////////////////////
+
+int8_t host_importTree(const char * hostPath, const char * fatPath)
+{
+	posix_DIR * d;
+	struct dirent * de;
+	char hp[1024],fp[256];
+	int8_t res=0;
+
+	if(!(d=opendir(hostPath)))
+		return 0;
+
+	if(fatPath[0])
+		f_mkdir(fatPath);
+
+	while((de=readdir(d)))
+	{
+		struct stat st;
+
+		if(de->d_name[0]=='.')
+			continue;
+
+		snprintf(hp,sizeof(hp),"%s/%s",hostPath,de->d_name);
+		snprintf(fp,sizeof(fp),"%s/%s",fatPath,de->d_name);
+
+		if(stat(hp,&st))
+			continue;
+
+		if(S_ISDIR(st.st_mode))
+		{
+			res|=host_importTree(hp,fp);
+		}
+		else if(S_ISREG(st.st_mode))
+		{
+			FILE * hf;
+			FIL f;
+			UINT bw;
+			uint8_t buf[W25Q_SECTOR_SIZE];
+			size_t len;
+
+			if(!(hf=fopen(hp,"rb")))
+				continue;
+
+			if(!f_open(&f,fp,FA_WRITE|FA_CREATE_ALWAYS))
+			{
+				while((len=fread(buf,1,sizeof(buf),hf))>0)
+					f_write(&f,buf,len,&bw);
+				f_close(&f);
+				res=1;
+			}
+
+			fclose(hf);
+		}
+	}
+
+	closedir(d);
+
+	return res;
+}
+
+static int putc_stderr(int c)
+{
+	return fputc(c,stderr);
+}
+
+void host_init(void)
+{
+	FRESULT res;
+
+	rprintf_devopen(0,putc_stderr);
+	rprintf_devopen(1,putc_stderr);
+
+	if(disk_initialize(0) || f_mount(0,&fatFS))
+	{
+		fprintf(stderr,"host: storage init failed\n");
+		exit(1);
+	}
+
+	if((res=f_mkfs(0,0,0)))
+	{
+		fprintf(stderr,"host: f_mkfs res=%d\n",res);
+		exit(1);
+	}
+
+	f_mkdir(SYNTH_WAVEDATA_PATH);
+}
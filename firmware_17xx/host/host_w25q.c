@@ -0,0 +1,317 @@
+///////////////////////////////////////////////////////////////////////////////
+// Host W25Q NOR flash device model, behind the SSP1 / GPDMA bus of w25q.c
+///////////////////////////////////////////////////////////////////////////////
+
+// Decodes the SPI command set the driver uses (4 byte addressing, write
+// enable latch, busy status after erase / program, erase suspend / resume,
+// NOR bit clearing) over a RAM array; protocol slips are counted so tests can
+// check the driver. Time is counted in status polls.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "w25q.h"
+#include "host.h"
+
+#define CMD_WRITE_ENABLE 0x06
+#define CMD_ENTER_4BA_MODE 0xB7
+#define CMD_READ_ID 0x9F
+#define CMD_READ_STATUS 0x05
+#define CMD_FAST_READ 0x0B
+#define CMD_SECTOR_ERASE 0x20
+#define CMD_PAGE_PROGRAM 0x02
+#define CMD_ERASE_SUSPEND 0x75
+#define CMD_ERASE_RESUME 0x7A
+#define CMD_ENABLE_RESET 0x66
+#define CMD_RESET 0x99
+
+#define FLASH_SIZE ((size_t)W25Q_SECTOR_COUNT*W25Q_SECTOR_SIZE)
+
+#define BUSY_POLLS 2 // status reads that still see busy after a program
+#define ERASE_BUSY_POLLS 32 // ~45ms vs ~0.7ms
+
+static uint8_t * flash=NULL;
+static uint16_t eraseCounts[W25Q_SECTOR_COUNT];
+static struct host_w25qStats_s stats;
+static int32_t programBudget=-1;
+
+static struct
+{
+	int8_t selected;
+	int8_t addr4;
+	int8_t wel;
+	int8_t resetEnabled;
+	uint8_t cmd;
+	uint32_t pos; // bytes since CS went low
+	uint32_t addr;
+	uint32_t busyPolls;
+	int8_t erasing; // busyPolls are an erase
+	int8_t suspended;
+	uint32_t suspendedPolls;
+	uint32_t eraseSector;
+	int8_t erasePolled; // last command was a status read that saw the erase
+	uint32_t readBytes;
+} dev;
+
+static struct
+{
+	uint8_t * buffer;
+	uint32_t size;
+} dma;
+
+void host_w25q_getStats(struct host_w25qStats_s * s)
+{
+	*s=stats;
+	s->sectorReads=dev.readBytes>>W25Q_SECTOR_BITS;
+	s->readBytes=dev.readBytes;
+}
+
+void host_w25q_resetStats(void)
+{
+	memset(&stats,0,sizeof(stats));
+	dev.readBytes=0;
+	dev.erasePolled=0;
+}
+
+uint32_t host_w25q_getEraseCount(uint32_t sector)
+{
+	return eraseCounts[sector%W25Q_SECTOR_COUNT];
+}
+
+void host_w25q_powerCut(int32_t programBytes)
+{
+	programBudget=programBytes;
+}
+
+// the sector of a suspended erase is neither blank nor programmed yet
+static void checkSuspendedSector(uint32_t addr)
+{
+	if(dev.suspended && (addr%FLASH_SIZE)>>W25Q_SECTOR_BITS==dev.eraseSector)
+		++stats.protocolErrors;
+}
+
+static void endCommand(void)
+{
+	uint32_t addrLen=dev.addr4?4:3;
+
+	if(dev.pos<1+addrLen)
+		return;
+
+	switch(dev.cmd)
+	{
+	case CMD_SECTOR_ERASE:
+		if(!dev.wel)
+		{
+			++stats.protocolErrors;
+			break;
+		}
+		if(dev.suspended)
+		{
+			++stats.protocolErrors;
+			break;
+		}
+		++stats.sectorErases;
+		dev.wel=0;
+		if(!programBudget) // power is gone
+			break;
+		dev.eraseSector=(dev.addr%FLASH_SIZE)>>W25Q_SECTOR_BITS;
+		++eraseCounts[dev.eraseSector];
+		memset(&flash[dev.eraseSector<<W25Q_SECTOR_BITS],0xff,W25Q_SECTOR_SIZE);
+		dev.busyPolls=ERASE_BUSY_POLLS;
+		dev.erasing=1;
+		break;
+	case CMD_PAGE_PROGRAM:
+		if(dev.wel)
+		{
+			++stats.pageProgs;
+			dev.wel=0;
+			dev.busyPolls=BUSY_POLLS;
+		}
+		break;
+	}
+}
+
+void host_w25q_select(int8_t selected)
+{
+	if(dev.selected && !selected)
+		endCommand();
+
+	dev.selected=selected;
+	dev.pos=0;
+}
+
+uint8_t host_w25q_transfer(uint8_t value)
+{
+	uint32_t pos=dev.pos++;
+	uint32_t addrLen=dev.addr4?4:3;
+
+	if(!dev.selected)
+	{
+		++stats.protocolErrors;
+		return 0xff;
+	}
+
+	if(!pos)
+	{
+		dev.cmd=value;
+		dev.addr=0;
+
+		// only status reads while an erase / program runs
+		if(dev.busyPolls && value!=CMD_READ_STATUS && !(dev.erasing && value==CMD_ERASE_SUSPEND))
+			++stats.protocolErrors;
+
+		if(value!=CMD_READ_STATUS)
+			dev.erasePolled=0;
+
+		switch(value)
+		{
+		case CMD_WRITE_ENABLE:
+			dev.wel=1;
+			break;
+		case CMD_ENTER_4BA_MODE:
+			dev.addr4=1;
+			break;
+		case CMD_ENABLE_RESET:
+			dev.resetEnabled=1;
+			return 0xff;
+		case CMD_RESET:
+			if(dev.resetEnabled)
+			{
+				dev.addr4=0;
+				dev.wel=0;
+			}
+			break;
+		case CMD_FAST_READ:
+			++stats.fastReads;
+			break;
+		case CMD_ERASE_SUSPEND:
+			if(dev.erasing && dev.busyPolls)
+			{
+				++stats.eraseSuspends;
+				dev.suspendedPolls=dev.busyPolls;
+				dev.busyPolls=1; // tSUS
+				dev.erasing=0;
+				dev.suspended=1;
+			}
+			break;
+		case CMD_ERASE_RESUME:
+			if(dev.suspended)
+			{
+				dev.busyPolls=dev.suspendedPolls;
+				dev.erasing=1;
+				dev.suspended=0;
+			}
+			break;
+		}
+
+		dev.resetEnabled=0;
+		return 0xff;
+	}
+
+	switch(dev.cmd)
+	{
+	case CMD_READ_ID:
+		return (pos==1)?0xef:((pos==2)?0x40:0x20);
+	case CMD_READ_STATUS:
+		if(dev.busyPolls)
+		{
+			--dev.busyPolls;
+			if(dev.erasing)
+			{
+				// polling in a row, a wait loop
+				stats.eraseWaits+=dev.erasePolled;
+				dev.erasePolled=1;
+			}
+			return 1|(dev.wel<<1);
+		}
+		dev.erasing=0;
+		return dev.wel<<1;
+	case CMD_FAST_READ:
+	case CMD_SECTOR_ERASE:
+	case CMD_PAGE_PROGRAM:
+		if(pos<=addrLen)
+		{
+			dev.addr=(dev.addr<<8)|value;
+			return 0xff;
+		}
+		break;
+	default:
+		return 0xff;
+	}
+
+	if(dev.cmd==CMD_FAST_READ)
+	{
+		if(pos==addrLen+1) // dummy byte
+		{
+			checkSuspendedSector(dev.addr);
+			return 0xff;
+		}
+
+		++dev.readBytes;
+		return flash[dev.addr++%FLASH_SIZE];
+	}
+
+	if(dev.cmd==CMD_PAGE_PROGRAM)
+	{
+		// wraps within the page, NOR can only clear bits
+		uint32_t a=(dev.addr&~W25Q_PAGE_MASK)|((dev.addr+pos-addrLen-1)&W25Q_PAGE_MASK);
+
+		if(pos==addrLen+1)
+		{
+			if(!dev.wel)
+				++stats.protocolErrors;
+			checkSuspendedSector(a);
+		}
+
+		if(dev.wel && programBudget)
+		{
+			flash[a%FLASH_SIZE]&=value;
+			if(programBudget>0)
+				--programBudget;
+		}
+	}
+
+	return 0xff;
+}
+
+void host_w25q_startDMA(uint8_t * buffer, uint32_t size)
+{
+	if(dma.size || !dev.selected)
+		++stats.protocolErrors;
+
+	dma.buffer=buffer;
+	dma.size=size;
+}
+
+void host_w25q_runDMA(uint32_t maxBytes)
+{
+	if(!dma.size)
+		return;
+
+	while(dma.size && maxBytes--)
+	{
+		*dma.buffer++=host_w25q_transfer(0x00);
+		--dma.size;
+		++stats.dmaBytes;
+	}
+
+	// terminal count interrupt
+	if(!dma.size)
+		W25Q_dmaInterrupt();
+}
+
+void host_w25q_init(void)
+{
+	if(!flash)
+	{
+		flash=malloc(FLASH_SIZE);
+		if(!flash)
+			abort();
+		memset(flash,0xff,FLASH_SIZE);
+	}
+
+	memset(&dev,0,sizeof(dev));
+	memset(&dma,0,sizeof(dma));
+
+	host_w25q_resetStats();
+}
@@ -0,0 +1,38 @@
+////////////////////////////////////////////////////////////////////////////////
+// Host (x86-64 Linux) replacement for the CMSIS Cortex-M3 core header
+////////////////////////////////////////////////////////////////////////////////
+
+// LPC177x_8x.h includes "core_cm3.h" from the drivers directory, which has no
+// copy of it, so the include path makes it land here instead of system/.
+// Only what the portable synth code uses is provided, with plain C semantics
+// matching the Cortex-M3 instructions.
+
+#ifndef __CORE_CM3_H_GENERIC
+#define __CORE_CM3_H_GENERIC
+#define __CORE_CM3_H_DEPENDANT
+
+#include <stdint.h>
+
+#define __CM3_CMSIS_VERSION_MAIN  (0x02)
+#define __CM3_CMSIS_VERSION_SUB   (0x10)
+#define __CORTEX_M                (0x03)
+
+#define __ASM            __asm
+#define __INLINE         inline
+#define __STATIC_INLINE  static inline
+
+#define __I     volatile const
+#define __O     volatile
+#define __IO    volatile
+
+#define __FPU_USED       0
+
+#include "core_cmInstr.h"
+#include "core_cmFunc.h"
+
+static inline void NVIC_EnableIRQ(IRQn_Type IRQn) { (void)IRQn; }
+static inline void NVIC_DisableIRQ(IRQn_Type IRQn) { (void)IRQn; }
+static inline void NVIC_SetPriority(IRQn_Type IRQn, uint32_t priority) { (void)IRQn; (void)priority; }
+static inline void NVIC_SystemReset(void) { for(;;); }
+
+#endif /* __CORE_CM3_H_GENERIC */
@@ -0,0 +1,27 @@
+////////////////////////////////////////////////////////////////////////////////
+// Host (x86-64 Linux) replacement for the CMSIS core register access functions
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __CORE_CMFUNC_H
+#define __CORE_CMFUNC_H
+
+#include <stdint.h>
+
+// there are no interrupts on the host, the engine is driven synchronously,
+// so masking registers are just kept around for code that reads them back
+
+extern uint32_t host_basepri;
+extern uint32_t host_primask;
+
+void host_setBasepri(uint32_t value); // times BLOCK_INT, see host.h
+
+static inline void __enable_irq(void) { host_primask=0; }
+static inline void __disable_irq(void) { host_primask=1; }
+
+static inline uint32_t __get_PRIMASK(void) { return host_primask; }
+static inline void __set_PRIMASK(uint32_t priMask) { host_primask=priMask; }
+
+static inline uint32_t __get_BASEPRI(void) { return host_basepri; }
+static inline void __set_BASEPRI(uint32_t value) { host_setBasepri(value); }
+
+#endif /* __CORE_CMFUNC_H */
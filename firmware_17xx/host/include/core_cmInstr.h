@@ -0,0 +1,42 @@
+////////////////////////////////////////////////////////////////////////////////
+// Host (x86-64 Linux) replacement for the CMSIS core instruction intrinsics
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __CORE_CMINSTR_H
+#define __CORE_CMINSTR_H
+
+#include <stdint.h>
+
+#define __NOP()
+#define __WFI()
+#define __WFE()
+#define __SEV()
+#define __ISB() __sync_synchronize()
+#define __DSB() __sync_synchronize()
+#define __DMB() __sync_synchronize()
+
+static inline int32_t __host_ssat(int32_t val, uint32_t sat)
+{
+	const int32_t max=(1<<(sat-1))-1;
+	const int32_t min=-max-1;
+
+	return val>max?max:(val<min?min:val);
+}
+
+static inline uint32_t __host_usat(int32_t val, uint32_t sat)
+{
+	const int32_t max=(sat>=32)?INT32_MAX:(int32_t)((1U<<sat)-1);
+
+	return val>max?(uint32_t)max:(val<0?0:(uint32_t)val);
+}
+
+#define __SSAT(val,sat) __host_ssat((int32_t)(val),(sat))
+#define __USAT(val,sat) __host_usat((int32_t)(val),(sat))
+
+static inline uint32_t __REV(uint32_t value) { return __builtin_bswap32(value); }
+static inline uint32_t __REV16(uint32_t value) { return ((value&0xff00ff00)>>8)|((value&0x00ff00ff)<<8); }
+static inline int32_t __REVSH(int32_t value) { return (int16_t)__builtin_bswap16(value); }
+static inline uint32_t __RBIT(uint32_t value) { uint32_t r=0; for(int i=0;i<32;++i,value>>=1) r=(r<<1)|(value&1); return r; }
+static inline uint8_t __CLZ(uint32_t value) { return value?__builtin_clz(value):32; }
+
+#endif /* __CORE_CMINSTR_H */
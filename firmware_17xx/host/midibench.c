@@ -0,0 +1,159 @@
+///////////////////////////////////////////////////////////////////////////////
+// MIDI input throughput benchmark: dense streams through the whole input path
+///////////////////////////////////////////////////////////////////////////////
+
+// Each stream is received in USB sized bulk chunks (midi_newDataBulk) and
+// parsed / dispatched by midi_processInput, as fast as this machine can.
+// Messages that end up changing the preset also pay for the state refresh,
+// at most once per chunk as parameter changes are coalesced by CV tick.
+
+#include <stdio.h>
+#include <time.h>
+
+#include "host.h"
+#include "synth/midi.h"
+#include "synth/storage.h"
+#include "synth/dacspi.h"
+
+#define STREAM_SIZE 60000
+#define CHUNK_SIZE 48
+#define MIN_DURATION 0.5
+
+static uint8_t stream[STREAM_SIZE];
+static int streamLen,streamMessages;
+
+static void add(uint8_t b)
+{
+	stream[streamLen++]=b;
+}
+
+static void buildNotes(void)
+{
+	// note on / off pairs with running status, like a sequencer dump
+	add(0x90);
+	for(int i=0;streamLen<STREAM_SIZE-4;++i,streamMessages+=2)
+	{
+		add(36+i%48);
+		add(100);
+		add(36+i%48);
+		add(0);
+	}
+}
+
+static void buildCCs(int8_t changing)
+{
+	// cutoff & resonance, sweeping or resent at the same value
+	for(int i=0;streamLen<STREAM_SIZE-6;++i,streamMessages+=2)
+	{
+		add(0xb0);
+		add(19);
+		add(changing?i&0x7f:64);
+		add(0xb0);
+		add(20);
+		add(changing?(i*3)&0x7f:64);
+	}
+}
+
+static void buildAutomation(void)
+{
+	// 8 knobs recorded moving together (filter, envelopes, LFO, osc), running status
+	static const uint8_t ccs[8]={19,20,21,22,24,31,44,12};
+	
+	add(0xb0);
+	for(int i=0;streamLen<STREAM_SIZE-2;++i,++streamMessages)
+	{
+		int k=i&7,t=i>>3;
+		
+		add(ccs[k]);
+		add(((t+k*16)>>1)&0x7f);
+	}
+}
+
+static void buildPitchBend(void)
+{
+	add(0xe0);
+	for(int i=0;streamLen<STREAM_SIZE-2;++i,++streamMessages)
+	{
+		add(i&0x7f);
+		add((i>>7)&0x7f);
+	}
+}
+
+static void buildOtherChannel(void)
+{
+	// notes & CCs on a channel the synth doesn't listen to
+	for(int i=0;streamLen<STREAM_SIZE-6;++i,streamMessages+=2)
+	{
+		add(0x95);
+		add(60);
+		add(i&0x7f);
+		add(0xb5);
+		add(19);
+		add(i&0x7f);
+	}
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+static void run(const char * name, void (*build)(void))
+{
+	double start,elapsed;
+	long messages=0;
+
+	streamLen=0;
+	streamMessages=0;
+	build();
+
+	start=now();
+	do
+	{
+		for(int pos=0;pos<streamLen;pos+=CHUNK_SIZE)
+		{
+			midi_newDataBulk(mpUSB,&stream[pos],MIN(CHUNK_SIZE,streamLen-pos));
+			midi_processInput(dacspi_getTimestamp()+1);
+		}
+		messages+=streamMessages;
+		elapsed=now()-start;
+	}
+	while(elapsed<MIN_DURATION);
+
+	assigner_allKeysOff(0);
+
+	printf("| %s | %.2f |\n",name,messages/elapsed*1e-6);
+}
+
+static void buildCCsSame(void)
+{
+	buildCCs(0);
+}
+
+static void buildCCsChanging(void)
+{
+	buildCCs(1);
+}
+
+int main(int argc, char * argv[])
+{
+	host_init();
+	synth_init();
+
+	settings.midiReceiveChannel=0;
+	settings.midiThru=0;
+
+	printf("| stream | Mmsg/s |\n");
+	printf("|--------|--------|\n");
+
+	run("notes",buildNotes);
+	run("CCs, same value",buildCCsSame);
+	run("CCs, changing (full state refresh)",buildCCsChanging);
+	run("CC automation, 8 knobs",buildAutomation);
+	run("pitch bend",buildPitchBend);
+	run("other channel",buildOtherChannel);
+
+	return 0;
+}
@@ -0,0 +1,177 @@
+///////////////////////////////////////////////////////////////////////////////
+// Preset formats benchmark: text files vs binary log store records
+///////////////////////////////////////////////////////////////////////////////
+
+// The disk presets are loaded from their text files, saved (which moves them
+// to the log store as binary records) and loaded again. Each format gets one
+// pass over all presets counting flash traffic, then repeated passes for the
+// host CPU time. Both loads must give the same preset, bit for bit.
+
+// Then the presets are stepped through by program changes, once from cold
+// caches and once with the main loop prefetching the neighbours in between,
+// timing the longest stretch spent with interrupts blocked.
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "host.h"
+#include "ff.h"
+#include "synth/storage.h"
+#include "synth/logstore.h"
+#include "synth/synth.h"
+#include "synth/midi.h"
+
+#define MAX_PRESETS 1000
+#define MIN_DURATION 0.5
+#define SPI_CLOCK 15e6
+#define READ_COMMAND_BYTES 5 // FAST_READ, address, dummy
+
+#define STORE_PRESET(number) LOGSTORE_KEY(2,number) // as storage.c
+
+static uint16_t numbers[MAX_PRESETS];
+static int presetCount;
+static struct preset_s textPresets[MAX_PRESETS];
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+static void run(const char * name, double bytes)
+{
+	struct host_w25qStats_s s;
+	struct preset_s p;
+	double start,elapsed,flashBytes;
+	long loads=0;
+
+	host_w25q_resetStats();
+	for(int i=0;i<presetCount;++i)
+		preset_load(&p,numbers[i]);
+	host_w25q_getStats(&s);
+
+	start=now();
+	do
+	{
+		for(int i=0;i<presetCount;++i)
+			preset_load(&p,numbers[i]);
+		loads+=presetCount;
+		elapsed=now()-start;
+	}
+	while(elapsed<MIN_DURATION);
+
+	flashBytes=(s.readBytes+READ_COMMAND_BYTES*(double)s.fastReads)/presetCount;
+
+	printf("| %s | %.0f | %.1f | %.0f | %.2f | %.2f |\n",name,bytes,
+			(double)s.fastReads/presetCount,flashBytes,flashBytes*8/SPI_CLOCK*1e3,
+			elapsed/loads*1e6);
+}
+
+static void programChanges(const char * name, int8_t prefetch)
+{
+	struct host_maskStats_s m;
+	struct host_w25qStats_s s;
+	double start,elapsed=0,flashBytes;
+
+	host_resetMaskStats();
+	host_w25q_resetStats();
+
+	for(int i=0;i<presetCount;++i)
+	{
+		if(prefetch)
+		{
+			while(synth_prefetchNeighbours())
+				;
+		}
+		else
+		{
+			storage_importText();
+			synth_refreshBankNames(1,1);
+		}
+
+		start=now();
+		settings.presetNumber=numbers[i];
+		midi_reloadPreset();
+		++currentTick;
+		midi_update();
+		elapsed+=now()-start;
+	}
+
+	host_getMaskStats(&m);
+	host_w25q_getStats(&s);
+
+	flashBytes=m.longestReadBytes+READ_COMMAND_BYTES*(double)m.longestFastReads;
+
+	printf("| %s | %u/%u | %.0f | %.0f | %.2f | %.2f | %.0f |\n",name,
+			m.flashCount,m.count,m.totalUs/m.count,m.longestUs,flashBytes*8/SPI_CLOCK*1e3,
+			elapsed/presetCount*1e6,(double)s.readBytes/presetCount);
+}
+
+int main(int argc, char * argv[])
+{
+	const char * diskDir=(argc>1)?argv[1]:"../../disk";
+	struct preset_s p;
+	double textBytes=0,storeBytes=0;
+	int same=0;
+	char fn[64];
+	FIL f;
+
+	host_init();
+	if(!host_importTree(diskDir,""))
+	{
+		fprintf(stderr,"nothing imported from %s\n",diskDir);
+		return 1;
+	}
+	synth_init();
+
+	for(int n=0;n<MAX_PRESETS;++n)
+	{
+		sprintf(fn,SYNTH_PRESETS_PATH "/preset_%04d.conf",n);
+		if(f_open(&f,fn,FA_READ|FA_OPEN_EXISTING))
+			continue;
+
+		textBytes+=f_size(&f);
+		f_close(&f);
+
+		preset_load(&textPresets[presetCount],n);
+		numbers[presetCount++]=n;
+	}
+
+	if(!presetCount)
+	{
+		fprintf(stderr,"no presets in %s\n",diskDir);
+		return 1;
+	}
+
+	printf("%d presets\n\n",presetCount);
+	printf("| format | bytes | flash reads | flash bytes | flash ms | host us |\n");
+	printf("|--------|-------|-------------|-------------|----------|---------|\n");
+
+	run("text",textBytes/presetCount);
+
+	for(int i=0;i<presetCount;++i)
+	{
+		currentPreset=textPresets[i];
+		preset_saveCurrent(numbers[i]);
+		logstore_update();
+
+		storeBytes+=logstore_getSize(STORE_PRESET(numbers[i]));
+
+		preset_load(&p,numbers[i]);
+		same+=!memcmp(&p,&textPresets[i],sizeof(p));
+	}
+
+	run("binary",storeBytes/presetCount);
+
+	printf("\n%d/%d presets identical through the binary format\n",same,presetCount);
+
+	printf("\n| program change | blocked with flash | blocked host us | longest host us | longest flash ms | switch host us | flash bytes/switch |\n");
+	printf("|----------------|--------------------|-----------------|-----------------|------------------|----------------|--------------------|\n");
+
+	programChanges("cold",0);
+	programChanges("prefetched",1);
+
+	return same==presetCount?0:1;
+}
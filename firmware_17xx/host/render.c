@@ -0,0 +1,325 @@
+///////////////////////////////////////////////////////////////////////////////
+// Offline renderer: plays a MIDI event script through the synth engine and
+// writes oscillator / CV DAC channels to WAV & CSV files
+///////////////////////////////////////////////////////////////////////////////
+
+// MIDI event script format, one event per line, '#' starts a comment:
+//   <time in ms> <hex byte> [<hex byte> ...]
+// eg. "250 90 3c 7f" plays a middle C at 250ms on channel 1.
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "host.h"
+#include "synth/dacspi.h"
+#include "synth/storage.h"
+#include "synth/midi.h"
+
+#define MAX_EVENTS 65536
+#define MAX_EVENT_BYTES 16
+
+#define OSC_CHANNEL_COUNT (SYNTH_VOICE_COUNT*2)
+#define SAMPLE_RATE dacspi_getSampleRate() // of the preset DAC profile
+#define BLOCK_SIZE dacspi_getBlockSize()
+#define TAIL_MS 2000
+
+struct event_s
+{
+	uint32_t time; // ms
+	uint8_t count;
+	uint8_t data[MAX_EVENT_BYTES];
+};
+
+static struct event_s events[MAX_EVENTS];
+static int eventCount;
+
+static const char demoScript[]=
+	"0 90 3c 64\n"
+	"0 90 40 64\n"
+	"0 90 43 64\n"
+	"1000 80 3c 00\n"
+	"1000 80 40 00\n"
+	"1000 80 43 00\n";
+
+static void parseScript(FILE * f)
+{
+	char line[256];
+
+	while(fgets(line,sizeof(line),f) && eventCount<MAX_EVENTS)
+	{
+		struct event_s * e=&events[eventCount];
+		char * p, * end;
+		unsigned long v;
+
+		if((p=strchr(line,'#')))
+			*p=0;
+
+		v=strtoul(line,&end,10);
+		if(end==line)
+			continue;
+
+		e->time=v;
+		e->count=0;
+
+		for(p=end;e->count<MAX_EVENT_BYTES;p=end)
+		{
+			v=strtoul(p,&end,16);
+			if(end==p)
+				break;
+			e->data[e->count++]=v;
+		}
+
+		if(e->count)
+			++eventCount;
+	}
+}
+
+static void writeWavHeader(FILE * f, int channels, int rate, uint32_t frames)
+{
+	uint32_t dataSize=frames*channels*2;
+	uint8_t h[44];
+
+	auto void le16(int pos, uint16_t v)
+	{
+		h[pos]=v;h[pos+1]=v>>8;
+	}
+
+	auto void le32(int pos, uint32_t v)
+	{
+		le16(pos,v);le16(pos+2,v>>16);
+	}
+
+	memcpy(&h[0],"RIFF",4);
+	le32(4,36+dataSize);
+	memcpy(&h[8],"WAVEfmt ",8);
+	le32(16,16);
+	le16(20,1); // PCM
+	le16(22,channels);
+	le32(24,rate);
+	le32(28,rate*channels*2);
+	le16(32,channels*2);
+	le16(34,16);
+	memcpy(&h[36],"data",4);
+	le32(40,dataSize);
+
+	fseek(f,0,SEEK_SET);
+	fwrite(h,1,sizeof(h),f);
+}
+
+static void writeSample(FILE * f, uint16_t dacValue)
+{
+	int16_t s=dacValue+INT16_MIN;
+	uint8_t b[2]={s,s>>8};
+
+	fwrite(b,1,2,f);
+}
+
+static void usage(const char * name)
+{
+	fprintf(stderr,
+		"usage: %s [-d disk_dir] [-p preset] [-m midi_script] [-t seconds] [-o out_prefix] [-r profile] [-c]\n"
+		"  -d  directory imported as the flash disk (default ../../disk)\n"
+		"  -p  preset number to load (default: from settings, ie. 0)\n"
+		"  -m  MIDI event script (default: built-in C major chord)\n"
+		"  -t  render length (default: last event + %dms)\n"
+		"  -o  output files prefix (default render): <prefix>_osc.wav, <prefix>_cv.wav\n"
+		"  -r  DAC profile, overriding the preset one (0: standard, 1: low latency, 2: high rate, 3: power save)\n"
+		"  -c  also write <prefix>_osc.csv & <prefix>_cv.csv\n",
+		name,TAIL_MS);
+	exit(1);
+}
+
+int main(int argc, char * argv[])
+{
+	const char * diskDir="../../disk", * script=NULL, * prefix="render";
+	int preset=-1, profile=-1, csv=0, opt, ev=0;
+	double seconds=-1.0;
+	char fn[1024];
+	FILE * oscWav, * cvWav, * oscCsv=NULL, * cvCsv=NULL;
+	uint32_t frames=0, cvFrames=0, ticks;
+
+	while((opt=getopt(argc,argv,"d:p:m:t:o:r:c"))!=-1)
+	{
+		switch(opt)
+		{
+			case 'd': diskDir=optarg; break;
+			case 'p': preset=atoi(optarg); break;
+			case 'm': script=optarg; break;
+			case 't': seconds=atof(optarg); break;
+			case 'o': prefix=optarg; break;
+			case 'r': profile=atoi(optarg); break;
+			case 'c': csv=1; break;
+			default: usage(argv[0]);
+		}
+	}
+
+	// events
+
+	if(script)
+	{
+		FILE * f=fopen(script,"r");
+		if(!f)
+		{
+			perror(script);
+			return 1;
+		}
+		parseScript(f);
+		fclose(f);
+	}
+	else
+	{
+		FILE * f=fmemopen((void *)demoScript,sizeof(demoScript)-1,"r");
+		parseScript(f);
+		fclose(f);
+	}
+
+	if(seconds<0.0)
+		seconds=((eventCount?events[eventCount-1].time:0)+TAIL_MS)/1000.0;
+
+	// storage & synth
+
+	host_init();
+
+	if(!host_importTree(diskDir,""))
+		fprintf(stderr,"warning: nothing imported from %s, using default waveforms\n",diskDir);
+
+	synth_init();
+
+	if(preset>=0)
+	{
+		settings.presetNumber=preset;
+		preset_loadCurrent(preset);
+		synth_refreshFullState(1);
+	}
+
+	if(profile>=0)
+	{
+		currentPreset.steppedParameters[spDacProfile]=MIN(profile,dpCount-1);
+		synth_refreshFullState(0);
+	}
+
+	// outputs
+
+	snprintf(fn,sizeof(fn),"%s_osc.wav",prefix);
+	oscWav=fopen(fn,"wb");
+	snprintf(fn,sizeof(fn),"%s_cv.wav",prefix);
+	cvWav=fopen(fn,"wb");
+	if(csv)
+	{
+		snprintf(fn,sizeof(fn),"%s_osc.csv",prefix);
+		oscCsv=fopen(fn,"w");
+		snprintf(fn,sizeof(fn),"%s_cv.csv",prefix);
+		cvCsv=fopen(fn,"w");
+	}
+
+	if(!oscWav || !cvWav || (csv && (!oscCsv || !cvCsv)))
+	{
+		perror(prefix);
+		return 1;
+	}
+
+	writeWavHeader(oscWav,OSC_CHANNEL_COUNT,SAMPLE_RATE,0);
+	writeWavHeader(cvWav,DACSPI_CV_COUNT,dacspi_getUpdateHz(),0);
+
+	if(oscCsv)
+	{
+		// channel pairs are the A & B oscillators of a voice
+		fprintf(oscCsv,"time");
+		for(int c=0;c<OSC_CHANNEL_COUNT;++c)
+			fprintf(oscCsv,",v%d%c",c>>1,(c&1)?'b':'a');
+		fprintf(oscCsv,"\n");
+	}
+
+	if(cvCsv)
+	{
+		fprintf(cvCsv,"time");
+		for(int c=0;c<DACSPI_CV_COUNT;++c)
+			fprintf(cvCsv,",cv%d",c);
+		fprintf(cvCsv,"\n");
+	}
+
+	// render, one DMA interrupt (half a DAC ring) at a time
+
+	ticks=seconds*SAMPLE_RATE/BLOCK_SIZE;
+
+	for(uint32_t t=0;t<ticks;++t)
+	{
+		uint64_t blockStart=(uint64_t)t*BLOCK_SIZE; // samples, block playing until this tick
+		int32_t set;
+
+		// events are received at their position in the block being played
+		while(ev<eventCount)
+		{
+			uint64_t sample=((uint64_t)events[ev].time*SAMPLE_RATE)/1000;
+
+			if(sample>=blockStart+BLOCK_SIZE)
+				break;
+
+			host_dacspi_setPlayPosition((sample>blockStart)?sample-blockStart:0);
+
+			for(int i=0;i<events[ev].count;++i)
+				synth_uartMIDIEvent(events[ev].data[i]);
+			++ev;
+		}
+
+		host_dacspi_tick();
+
+		// main loop work
+
+		midi_update();
+
+		// outputs
+
+		set=host_dacspi_getLastSet();
+
+		for(int32_t buf=set;buf<set+BLOCK_SIZE;++buf)
+		{
+			if(oscCsv)
+				fprintf(oscCsv,"%.6f",(double)frames/SAMPLE_RATE);
+
+			for(int c=0;c<OSC_CHANNEL_COUNT;++c)
+			{
+				writeSample(oscWav,host_dacspi_getOscValue(buf,c));
+				if(oscCsv)
+					fprintf(oscCsv,",%d",host_dacspi_getOscValue(buf,c));
+			}
+
+			if(oscCsv)
+				fprintf(oscCsv,"\n");
+
+			++frames;
+		}
+
+		for(int32_t cvSet=set;cvSet<set+BLOCK_SIZE;cvSet+=DACSPI_CV_COUNT)
+		{
+			if(cvCsv)
+				fprintf(cvCsv,"%.6f",(double)cvFrames/dacspi_getUpdateHz());
+
+			for(int c=0;c<DACSPI_CV_COUNT;++c)
+			{
+				writeSample(cvWav,host_dacspi_getCVValue(cvSet+c));
+				if(cvCsv)
+					fprintf(cvCsv,",%d",host_dacspi_getCVValue(cvSet+c));
+			}
+
+			if(cvCsv)
+				fprintf(cvCsv,"\n");
+
+			++cvFrames;
+		}
+	}
+
+	writeWavHeader(oscWav,OSC_CHANNEL_COUNT,SAMPLE_RATE,frames);
+	writeWavHeader(cvWav,DACSPI_CV_COUNT,dacspi_getUpdateHz(),cvFrames);
+
+	fclose(oscWav);
+	fclose(cvWav);
+	if(oscCsv)
+		fclose(oscCsv);
+	if(cvCsv)
+		fclose(cvCsv);
+
+	fprintf(stderr,"rendered %u frames at %d Hz, %u CV frames at %d Hz\n",frames,SAMPLE_RATE,cvFrames,dacspi_getUpdateHz());
+
+	return 0;
+}
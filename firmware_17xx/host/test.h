@@ -0,0 +1,26 @@
+#ifndef TEST_H
+#define TEST_H
+
+////////////////////////////////////////////////////////////////////////////////
+// Host test scaffold: one line per check, the failure count ends the run
+////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+
+static int failures=0;
+
+static void check(int ok, const char * what)
+{
+	printf("%-40s %s\n",what,ok?"ok":"FAIL");
+	failures+=!ok;
+}
+
+// prints the count, returns main()'s exit status
+static int test_summary(void)
+{
+	printf("%d failures\n",failures);
+
+	return failures?1:0;
+}
+
+#endif
@@ -0,0 +1,303 @@
+///////////////////////////////////////////////////////////////////////////////
+// Log store test: remounts, garbage collection, wear, torn writes, erases
+///////////////////////////////////////////////////////////////////////////////
+
+// A set of records is churned through many laps of the region while a RAM
+// model tracks what must be read back, including after remounts and power
+// cuts at random points of a write. Saves & loads must never wait on an
+// erase once the erase ahead was started, and erases must spread evenly.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host.h"
+#include "test.h"
+#include "w25q.h"
+#include "ff.h"
+#include "synth/storage.h"
+#include "synth/logstore.h"
+
+#define TEST_KEY(i) LOGSTORE_KEY(15,i)
+#define KEY_COUNT 40
+#define MAX_RECORD 600 // about a preset
+#define CHURN_WRITES 20000
+#define CUT_ROUNDS 300
+#define SAVE_ROUNDS 100
+
+static uint8_t model[KEY_COUNT][MAX_RECORD];
+static uint16_t modelSize[KEY_COUNT];
+
+static struct host_w25qStats_s getStats(void)
+{
+	struct host_w25qStats_s s;
+	host_w25q_getStats(&s);
+	return s;
+}
+
+static void update(int count)
+{
+	while(count--)
+		logstore_update();
+}
+
+// status polls spent waiting on an erase, logstore_update() calls aside
+static uint32_t write(int k)
+{
+	uint32_t polls=getStats().eraseWaits;
+
+	if(!logstore_write(TEST_KEY(k),model[k],modelSize[k]))
+		return UINT32_MAX;
+
+	return getStats().eraseWaits-polls;
+}
+
+static void fill(uint8_t * data, uint16_t size, uint32_t seed)
+{
+	for(int i=0;i<size;++i)
+		data[i]=(seed*2654435761u+i*97)>>13;
+}
+
+static int modelMatches(void)
+{
+	uint8_t buf[MAX_RECORD];
+
+	for(int k=0;k<KEY_COUNT;++k)
+		if(!modelSize[k])
+		{
+			if(logstore_getSize(TEST_KEY(k))>=0)
+				return 0;
+		}
+		else if(logstore_getSize(TEST_KEY(k))!=modelSize[k] ||
+				!logstore_read(TEST_KEY(k),buf,modelSize[k]) ||
+				memcmp(buf,model[k],modelSize[k]))
+			return 0;
+
+	return 1;
+}
+
+static void testChurn(void)
+{
+	struct host_w25qStats_s s;
+	uint32_t maxErases=0,totalErases,waits=0;
+	int ok=1;
+
+	host_w25q_resetStats();
+
+	for(int k=0;k<KEY_COUNT;++k)
+	{
+		modelSize[k]=100+(k*37)%(MAX_RECORD-100);
+		fill(model[k],modelSize[k],k);
+		ok&=logstore_write(TEST_KEY(k),model[k],modelSize[k]);
+		update(40);
+	}
+
+	check(ok && modelMatches(),"first writes read back");
+
+	for(int i=0;i<CHURN_WRITES && ok;++i)
+	{
+		int k=random()%KEY_COUNT;
+
+		fill(model[k],modelSize[k],i+KEY_COUNT);
+		waits+=write(k);
+		ok&=waits!=UINT32_MAX;
+		update(40);
+	}
+
+	s=getStats();
+	check(ok,"writes never fail");
+	check(modelMatches(),"churned records read back");
+
+	// wear: every sector of the region goes round at the same pace
+
+	totalErases=s.sectorErases;
+	for(uint32_t sector=0;sector<W25Q_SECTOR_COUNT;++sector)
+		if(host_w25q_getEraseCount(sector)>maxErases)
+			maxErases=host_w25q_getEraseCount(sector);
+
+	printf("%d writes: %u erases, %u page programs, hottest sector erased %u times (%u per sector on average)\n",
+			CHURN_WRITES,s.sectorErases,s.pageProgs,maxErases,totalErases/LOGSTORE_SECTOR_COUNT);
+	check(maxErases<=totalErases/LOGSTORE_SECTOR_COUNT+2,"erases spread over the region");
+	check(!waits,"writes never wait on erases");
+	check(!s.protocolErrors,"flash protocol");
+}
+
+static void testRemount(void)
+{
+	struct host_w25qStats_s s;
+
+	host_w25q_resetStats();
+	check(logstore_init(),"remount");
+	s=getStats();
+
+	// binary search on headers, then a single sector replay
+	printf("mount: %u reads\n",s.fastReads);
+	check(s.fastReads<LOGSTORE_SECTOR_COUNT/2,"mount reads");
+	check(modelMatches(),"records survive a remount");
+
+	logstore_remove(TEST_KEY(0));
+	modelSize[0]=0;
+	logstore_init();
+	check(modelMatches(),"removal survives a remount");
+}
+
+static void testPowerCuts(void)
+{
+	uint8_t buf[MAX_RECORD],prev[MAX_RECORD];
+	int ok=1,mounts=1;
+
+	for(int i=0;i<CUT_ROUNDS && ok;++i)
+	{
+		int k=1+random()%(KEY_COUNT-1);
+
+		memcpy(prev,model[k],modelSize[k]);
+		fill(model[k],modelSize[k],CHURN_WRITES+i);
+
+		update(random()%4);
+
+		// a write, or a few, stopping at any byte
+		host_w25q_powerCut(random()%(2*MAX_RECORD));
+		logstore_write(TEST_KEY(k),model[k],modelSize[k]);
+		host_w25q_powerCut(-1);
+
+		mounts&=logstore_init();
+
+		// either version, the model follows
+		if(logstore_read(TEST_KEY(k),buf,modelSize[k]) && (!memcmp(buf,model[k],modelSize[k]) || !memcmp(buf,prev,modelSize[k])))
+			memcpy(model[k],buf,modelSize[k]);
+		else
+			ok=0;
+
+		ok&=modelMatches();
+	}
+
+	check(mounts,"mounts after power cuts");
+	check(ok,"torn writes roll back");
+
+	for(int k=1;k<KEY_COUNT;++k)
+	{
+		fill(model[k],modelSize[k],k*3);
+		ok&=logstore_write(TEST_KEY(k),model[k],modelSize[k]);
+		update(40);
+	}
+
+	logstore_init();
+	check(ok && modelMatches(),"writes after power cuts");
+}
+
+static void testProgramChange(void)
+{
+	struct host_w25qStats_s s;
+	uint32_t erases;
+
+	preset_saveCurrent(8);
+	update(1);
+	W25Q_wait();
+
+	// saves until one opens a sector, the erase ahead of the next one then starts
+	for(int i=0;i<32;++i)
+	{
+		erases=getStats().sectorErases;
+		currentPreset.presetName[0]='a'+i;
+		preset_saveCurrent(7);
+		update(1);
+		if(getStats().sectorErases!=erases)
+			break;
+	}
+
+	check(W25Q_isBusy(),"erase ahead");
+
+	host_w25q_resetStats();
+	settings.presetNumber=8;
+	settings_save();
+	preset_loadCurrent(8);
+
+	settings.presetNumber=7;
+	settings_save();
+	preset_loadCurrent(7);
+
+	s=getStats();
+	printf("program change: %u suspends, %u erase waits\n",s.eraseSuspends,s.eraseWaits);
+	check(!s.eraseWaits,"program change doesn't wait on erases");
+	check(!s.protocolErrors,"flash protocol");
+
+	W25Q_wait();
+}
+
+static void testSaveCosts(void)
+{
+	struct host_w25qStats_s s;
+
+	for(int kind=0;kind<2;++kind)
+	{
+		host_w25q_resetStats();
+
+		for(int i=0;i<SAVE_ROUNDS;++i)
+		{
+			if(kind)
+			{
+				currentPreset.continuousParameters[cpCutoff]=i;
+				preset_saveCurrent(10);
+			}
+			else
+			{
+				settings.presetNumber=i;
+				settings_save();
+			}
+			update(40);
+		}
+
+		s=getStats();
+		printf("%s: %.2f erases, %.1f page programs per save\n",kind?"preset":"settings",
+				(double)s.sectorErases/SAVE_ROUNDS,(double)s.pageProgs/SAVE_ROUNDS);
+		check(!s.protocolErrors,"flash protocol");
+	}
+}
+
+static void testText(void)
+{
+	FIL f;
+
+	strcpy(currentPreset.presetName,"stored");
+	preset_saveCurrent(9);
+
+	// text file imported over the stored preset, like from the USB disk
+	f_mkdir(SYNTH_PRESETS_PATH);
+	f_open(&f,SYNTH_PRESETS_PATH "/preset_0009.conf",FA_WRITE|FA_CREATE_ALWAYS);
+	f_printf(&f,"presetName = imported\n");
+	f_close(&f);
+
+	preset_loadCurrent(9);
+	check(!strcmp(currentPreset.presetName,"stored"),"store first");
+
+	storage_importText();
+	preset_loadCurrent(9);
+	check(!strcmp(currentPreset.presetName,"imported"),"text file wins");
+
+	// saving it moves it to the store
+	preset_saveCurrent(9);
+	check(f_open(&f,SYNTH_PRESETS_PATH "/preset_0009.conf",FA_READ|FA_OPEN_EXISTING)==FR_NO_FILE,"save removes the text file");
+	check(preset_fileExists(9),"stored preset exists");
+
+	strcpy(currentPreset.presetName,"other");
+	preset_exportText(9);
+	preset_loadCurrent(9);
+	check(!strcmp(currentPreset.presetName,"imported"),"text export");
+}
+
+int main(int argc, char * argv[])
+{
+	host_init();
+	synth_init();
+
+	srandom(1234);
+
+	testChurn();
+	testRemount();
+	testPowerCuts();
+	testProgramChange();
+	testSaveCosts();
+	testText();
+
+	return test_summary();
+}
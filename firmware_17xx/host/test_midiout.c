@@ -0,0 +1,174 @@
+///////////////////////////////////////////////////////////////////////////////
+// MIDI out test: soft thru / notes / echoes merging and UART throughput
+///////////////////////////////////////////////////////////////////////////////
+
+// Every source of MIDI out is fed in turn, the resulting UART byte stream
+// must keep their order, never split a message and apply running status.
+// Bursts must leave at 31250 bauds without loss until the queue is full,
+// then whole messages get dropped instead of blocking the caller.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "host.h"
+#include "test.h"
+#include "synth/midi.h"
+#include "synth/storage.h"
+#include "synth/dacspi.h"
+#include "usb/usb_midi.h"
+
+#define MAX_OUTPUT 4096
+#define UART_BYTE_US 320
+
+static uint8_t output[MAX_OUTPUT];
+static int outputLen;
+
+static void process(void)
+{
+	midi_processInput(dacspi_getTimestamp()+1);
+}
+
+static void uartInput(const uint8_t * data, int len)
+{
+	for(int i=0;i<len;++i)
+		synth_uartMIDIEvent(data[i]);
+	process();
+}
+
+static void usbInput(const uint8_t * packet, int len)
+{
+	host_usb_receive(packet,len);
+	process();
+}
+
+// lets the UART run until the line is idle, returns how long it took
+static uint32_t drain(void)
+{
+	uint32_t us=0;
+	int len;
+
+	outputLen=0;
+
+	do
+	{
+		len=host_uart_transmit(&output[outputLen],MAX_OUTPUT-outputLen,1000);
+		outputLen+=len;
+		us+=1000;
+	}
+	while(len);
+
+	return us-1000;
+}
+
+static int expect(const uint8_t * data, int len, const char * what)
+{
+	drain();
+
+	if(outputLen!=len || memcmp(output,data,len))
+	{
+		printf("%s: got",what);
+		for(int i=0;i<outputLen;++i)
+			printf(" %02x",output[i]);
+		printf("\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+static void testMerge(void)
+{
+	static const uint8_t uartNote[]={0x90,0x3c,0x64};
+	static const uint8_t uartClock[]={0xf8};
+	static const uint8_t usbCC[]={0x0b,0xb0,0x07,0x64};
+	static const uint8_t usbNote[]={0x09,0x90,0x40,0x50};
+	static const uint8_t foreignSysex[]={0xf0,0x41,0x10,0x42,0xf7};
+	static const uint8_t reply[]={0xf0,0x7d,0x4f,0x7e,0x01,0x00,0x00,0x00,0xf7};
+	static const uint8_t expected[]=
+	{
+		0x90,0x3c,0x64,			// UART thru
+		0x48,0x40,				// sequencer note, running status
+		0xf8,					// realtime keeps running status
+		0x48,0x00,				// sequencer note off
+		0xb0,0x07,0x64,			// USB thru
+		0x13,0x40,				// cutoff pot echo
+		0x63,0x00,0x62,0x24,0x06,0x10,0x26,0x00,	// NRPN echo, no CC for that one
+		0x54,0x13,				// stepped echo (LFO shape 1 of 7)
+		0xf0,0x7d,0x4f,0x7e,0x01,0x00,0x00,0x00,0xf7,	// SysEx reply
+		0x90,0x40,0x50,			// running status was cancelled
+	};
+	uint8_t n=0x3c; // synth notes are an octave below MIDI notes
+
+	uartInput(uartNote,sizeof(uartNote));
+	midi_sendNote(n,1,HALF_RANGE);
+	uartInput(uartClock,sizeof(uartClock));
+	midi_sendNote(n,0,0);
+	usbInput(usbCC,sizeof(usbCC));
+
+	currentPreset.continuousParameters[cpCutoff]=0x8000;
+	midi_echoParameter(0,cpCutoff);
+	midi_echoParameter(0,cpCutoff); // unchanged, not sent again
+
+	currentPreset.continuousParameters[cpSeqArpClock_Legacy]=0x2000;
+	midi_echoParameter(0,cpSeqArpClock_Legacy);
+
+	currentPreset.steppedParameters[spLFOShape]=1;
+	midi_echoParameter(1,spLFOShape);
+
+	uartInput(foreignSysex,sizeof(foreignSysex)); // not forwarded
+	midi_sendSysex(mpUART,(uint8_t*)reply,sizeof(reply));
+	usbInput(usbNote,sizeof(usbNote));
+
+	check(expect(expected,sizeof(expected),"merge"),"merge order & running status");
+
+	settings.midiThru=0;
+	uartInput(uartNote,sizeof(uartNote));
+	usbInput(usbCC,sizeof(usbCC));
+	check(expect(NULL,0,"thru off"),"thru off");
+	settings.midiThru=1;
+
+	assigner_allKeysOff(0);
+}
+
+static void testThroughput(void)
+{
+	uint32_t drops=midi_getOutputDrops(),us;
+	int8_t ok=1;
+
+	// 64 note ons, running status is still note on from the merge test
+
+	for(int i=0;i<64;++i)
+		midi_sendNote(24+i,1,UINT16_MAX);
+
+	us=drain();
+	check(outputLen==64*2 && midi_getOutputDrops()==drops,"burst, no drop");
+	check(us+1000>=outputLen*UART_BYTE_US && us<=outputLen*UART_BYTE_US+1000,"burst at 31250 bauds");
+	printf("%d bytes in %u us\n",outputLen,us);
+
+	// queue overflow: later notes are dropped whole, the caller never waits
+
+	for(int i=0;i<200;++i)
+		midi_sendNote(24+(i&63),0,0);
+
+	drain();
+
+	for(int i=0;i<outputLen;i+=2)
+		ok&=output[i]==24+12+((i/2)&63) && output[i+1]==0;
+
+	check(ok && outputLen>0 && midi_getOutputDrops()-drops==200-outputLen/2,"overflow drops whole messages");
+	printf("%d notes sent, %u dropped\n",outputLen/2,midi_getOutputDrops()-drops);
+}
+
+int main(int argc, char * argv[])
+{
+	host_init();
+	synth_init();
+	usb_midi_start();
+
+	drain();
+
+	testMerge();
+	testThroughput();
+
+	return test_summary();
+}
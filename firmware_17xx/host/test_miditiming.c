@@ -0,0 +1,136 @@
+///////////////////////////////////////////////////////////////////////////////
+// MIDI note timing test: latency & jitter from reception to amp CV change
+///////////////////////////////////////////////////////////////////////////////
+
+// Note ons are received at pseudo random positions of the block being played,
+// the amp CVs rendered afterwards are scanned for the first CV tick that moved.
+// With an instant amp envelope, latency should be constant, give or take the
+// CV tick granularity (DACSPI_CV_COUNT samples).
+
+#include <stdio.h>
+#include <string.h>
+
+#include "host.h"
+#include "synth/dacspi.h"
+#include "synth/storage.h"
+
+#define TRIALS 256
+#define MAX_WAIT_TICKS 64
+#define SETTLE_TICKS 8
+
+static uint32_t tickCount;
+static uint32_t rng=12345;
+
+static uint32_t nextRandom(void)
+{
+	rng=rng*1103515245u+12345u;
+	return rng>>16;
+}
+
+static void tick(void)
+{
+	host_dacspi_tick();
+	++tickCount;
+}
+
+static int8_t ampMoved(int32_t buffer, const uint16_t * idle)
+{
+	for(int8_t v=0;v<SYNTH_VOICE_COUNT;++v)
+		if(host_dacspi_getCVValue(buffer+dacspiBoard.ampCV[v])!=idle[v])
+			return 1;
+	return 0;
+}
+
+static int measureProfile(dacspiProfile_t profile)
+{
+	uint16_t idle[SYNTH_VOICE_COUNT];
+	int32_t minLat=INT32_MAX,maxLat=INT32_MIN;
+	int64_t sumLat=0;
+	int32_t blockSize;
+	int8_t note=48;
+
+	currentPreset.steppedParameters[spDacProfile]=profile;
+	currentPreset.continuousParameters[cpAmpAtt]=0;
+	currentPreset.continuousParameters[cpAmpDec]=0;
+	currentPreset.continuousParameters[cpAmpSus]=UINT16_MAX;
+	currentPreset.continuousParameters[cpAmpRel]=0;
+	synth_refreshFullState(0);
+
+	blockSize=dacspi_getBlockSize();
+
+	for(int i=0;i<SETTLE_TICKS;++i)
+		tick();
+	for(int8_t v=0;v<SYNTH_VOICE_COUNT;++v)
+		idle[v]=host_dacspi_getCVValue(host_dacspi_getLastSet()+dacspiBoard.ampCV[v]);
+
+	for(int trial=0;trial<TRIALS;++trial)
+	{
+		int32_t pos=nextRandom()%blockSize;
+		uint32_t received,onset=0;
+
+		// the block playing after tick n starts at sample n*blockSize, the
+		// one it rendered plays after tick n+1
+
+		for(int i=nextRandom()%4;i>0;--i)
+			tick();
+
+		host_dacspi_setPlayPosition(pos);
+		received=tickCount*blockSize+pos;
+
+		synth_uartMIDIEvent(0x90);
+		synth_uartMIDIEvent(note);
+		synth_uartMIDIEvent(0x7f);
+
+		for(int i=0;i<MAX_WAIT_TICKS && !onset;++i)
+		{
+			tick();
+
+			for(int32_t set=0;set<blockSize && !onset;set+=DACSPI_CV_COUNT)
+				if(ampMoved(host_dacspi_getLastSet()+set,idle))
+					onset=(tickCount+1)*blockSize+set;
+		}
+
+		if(!onset)
+		{
+			printf("profile %d: no amp CV change after note on\n",profile);
+			return 0;
+		}
+
+		minLat=MIN(minLat,(int32_t)(onset-received));
+		maxLat=MAX(maxLat,(int32_t)(onset-received));
+		sumLat+=onset-received;
+
+		synth_uartMIDIEvent(0x80);
+		synth_uartMIDIEvent(note);
+		synth_uartMIDIEvent(0x00);
+
+		for(int i=0;i<SETTLE_TICKS;++i)
+			tick();
+
+		note=48+(note-47)%24;
+	}
+
+	printf("profile %d: latency %4.0fus avg, %4.0fus to %4.0fus, jitter %4.0fus (%d samples)\n",profile,
+			(double)sumLat*1e6/TRIALS/dacspi_getSampleRate(),
+			(double)minLat*1e6/dacspi_getSampleRate(),
+			(double)maxLat*1e6/dacspi_getSampleRate(),
+			(double)(maxLat-minLat)*1e6/dacspi_getSampleRate(),
+			maxLat-minLat);
+
+	return maxLat-minLat<DACSPI_CV_COUNT;
+}
+
+int main(int argc, char * argv[])
+{
+	int failures=0;
+
+	host_init();
+	synth_init();
+
+	failures+=!measureProfile(dpStandard);
+	failures+=!measureProfile(dpLowLatency);
+
+	printf("%d failures\n",failures);
+
+	return failures?1:0;
+}
@@ -0,0 +1,157 @@
+///////////////////////////////////////////////////////////////////////////////
+// NOR disk sector cache test: erases per save, read-compare-skip, coherency
+///////////////////////////////////////////////////////////////////////////////
+
+// Raw sector writes go through nor.c like FatFs ones, then the usual storage
+// saves are counted on the flash device model: repeated writes to a sector
+// must coalesce until CTRL_SYNC, unchanged sectors must not be erased again
+// and reads must always see the latest data. The log store is kept off, so
+// that saves go to text files.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "host.h"
+#include "test.h"
+#include "w25q.h"
+#include "nor.h"
+#include "ff.h"
+#include "synth/storage.h"
+#include "synth/logstore.h"
+
+#define TEST_SECTOR (W25Q_SECTOR_COUNT-8) // past what the tests put on the volume
+#define SEQ_SIZE 10
+
+static uint8_t buf[W25Q_SECTOR_SIZE];
+static uint8_t chk[W25Q_SECTOR_SIZE];
+
+static struct host_w25qStats_s getStats(void)
+{
+	struct host_w25qStats_s s;
+	host_w25q_getStats(&s);
+	return s;
+}
+
+static void sync(void)
+{
+	nor_disk_ioctl(CTRL_SYNC,NULL);
+}
+
+static void testSectorCache(void)
+{
+	struct host_w25qStats_s s;
+
+	for(int i=0;i<W25Q_SECTOR_SIZE;++i)
+		buf[i]=i*7+(i>>9);
+
+	// erased flash: only bits to clear
+
+	host_w25q_resetStats();
+	for(int i=0;i<3;++i)
+	{
+		buf[0]=i;
+		nor_disk_write(buf,TEST_SECTOR,1);
+	}
+	nor_disk_read(chk,TEST_SECTOR,1);
+	s=getStats();
+	check(!s.pageProgs && !memcmp(buf,chk,W25Q_SECTOR_SIZE),"writes coalesce until sync");
+
+	sync();
+	W25Q_readSector(TEST_SECTOR,chk);
+	s=getStats();
+	check(!memcmp(buf,chk,W25Q_SECTOR_SIZE),"sync writes back");
+	check(!s.sectorErases && s.pageProgs==W25Q_SECTOR_SIZE/W25Q_PAGE_SIZE,"blank sector needs no erase");
+
+	// unchanged
+
+	host_w25q_resetStats();
+	nor_disk_write(buf,TEST_SECTOR,1);
+	sync();
+	s=getStats();
+	check(!s.sectorErases && !s.pageProgs,"unchanged sector skipped");
+
+	// bits cleared in one page
+
+	host_w25q_resetStats();
+	buf[W25Q_PAGE_SIZE*3]&=0xf0;
+	nor_disk_write(buf,TEST_SECTOR,1);
+	sync();
+	s=getStats();
+	check(!s.sectorErases && s.pageProgs==1,"cleared bits only program their page");
+
+	// bits set: erase, pages that stay blank are not programmed
+
+	host_w25q_resetStats();
+	memset(buf,0xff,sizeof(buf));
+	buf[5]=0x42;
+	nor_disk_write(buf,TEST_SECTOR,1);
+	sync();
+	W25Q_readSector(TEST_SECTOR,chk);
+	s=getStats();
+	check(s.sectorErases==1 && s.pageProgs==1 && !memcmp(buf,chk,W25Q_SECTOR_SIZE),"set bits erase once");
+	check(!s.protocolErrors,"flash protocol");
+}
+
+static void testSaves(void)
+{
+	static const char * names[]={"settings","preset","sequence"};
+	uint8_t seq[SEQ_SIZE],seqLoaded[SEQ_SIZE];
+	struct host_w25qStats_s s;
+	uint32_t erases[3][2];
+
+	for(int i=0;i<SEQ_SIZE;++i)
+		seq[i]=i*3;
+
+	// first save creates the files, the second one rewrites them
+	for(int pass=0;pass<2;++pass)
+	{
+		for(int kind=0;kind<3;++kind)
+		{
+			host_w25q_resetStats();
+
+			switch(kind)
+			{
+			case 0:
+				settings_save();
+				break;
+			case 1:
+				preset_saveCurrent(42);
+				break;
+			case 2:
+				storage_saveSequencer(0,seq,SEQ_SIZE);
+				break;
+			}
+
+			s=getStats();
+			erases[kind][pass]=s.sectorErases;
+			printf("%s save %d: %u erases, %u page programs\n",names[kind],pass+1,s.sectorErases,s.pageProgs);
+		}
+	}
+
+	for(int kind=0;kind<3;++kind)
+		check(erases[kind][1]<=2,"erases per resave");
+
+	memset(seqLoaded,0,sizeof(seqLoaded));
+	check(storage_loadSequencer(0,seqLoaded,SEQ_SIZE) && !memcmp(seq,seqLoaded,SEQ_SIZE),"sequence reloads");
+	check(settings_load() && preset_fileExists(42),"settings & preset reload");
+	check(!getStats().protocolErrors,"flash protocol");
+}
+
+int main(int argc, char * argv[])
+{
+	FIL f;
+
+	host_init();
+
+	// not the store size, it won't mount
+	f_open(&f,LOGSTORE_PATH,FA_WRITE|FA_CREATE_ALWAYS);
+	f_putc('\n',&f);
+	f_close(&f);
+
+	synth_init();
+
+	testSectorCache();
+	testSaves();
+
+	return test_summary();
+}
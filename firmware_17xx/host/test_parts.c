@@ -0,0 +1,123 @@
+///////////////////////////////////////////////////////////////////////////////
+// Multi-timbral parts test: voice split, per part CCs and program changes
+///////////////////////////////////////////////////////////////////////////////
+
+// A layer on MIDI channel 2 takes the top 2 voices, the main part on
+// channel 1 keeps the others. Notes, CCs and program changes on each
+// channel must only ever reach their own part.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "host.h"
+#include "test.h"
+#include "synth/midi.h"
+#include "synth/storage.h"
+#include "synth/assigner.h"
+#include "synth/dacspi.h"
+
+#define LAYER_PRESET 7
+#define LAYER_MASK 0x30
+
+static void uartInput(const uint8_t * data, int len)
+{
+	for(int i=0;i<len;++i)
+		synth_uartMIDIEvent(data[i]);
+	midi_processInput(dacspi_getTimestamp()+1);
+}
+
+// voices playing notes of the given channel
+static uint8_t getPlaying(const uint8_t * notes, int count)
+{
+	uint8_t note,mask=0;
+
+	for(int8_t v=0;v<SYNTH_VOICE_COUNT;++v)
+		if(assigner_getAssignment(v,&note))
+			for(int i=0;i<count;++i)
+				if(note==notes[i]-12) // synth notes are an octave below MIDI notes
+					mask|=1<<v;
+
+	return mask;
+}
+
+static void testVoices(void)
+{
+	static const uint8_t mainNotes[]={48,50,52,53,55,57,59};
+	static const uint8_t layerNotes[]={72,76};
+	uint8_t data[3];
+
+	check(assigner_getVoiceMask(1)==LAYER_MASK && !(assigner_getVoiceMask(0)&LAYER_MASK),"disjoint voice masks");
+
+	for(int i=0;i<sizeof(layerNotes);++i)
+	{
+		data[0]=0x91; data[1]=layerNotes[i]; data[2]=100;
+		uartInput(data,3);
+	}
+
+	// more notes than it has voices, the main part must steal its own
+	for(int i=0;i<sizeof(mainNotes);++i)
+	{
+		data[0]=0x90; data[1]=mainNotes[i]; data[2]=100;
+		uartInput(data,3);
+	}
+
+	check(getPlaying(layerNotes,sizeof(layerNotes))==LAYER_MASK,"layer keeps its voices");
+	check(getPlaying(mainNotes,sizeof(mainNotes))==(~LAYER_MASK&((1<<SYNTH_VOICE_COUNT)-1)),"main part on the others");
+
+	data[0]=0xb1; data[1]=123; data[2]=0; // all notes off, layer only
+	uartInput(data,3);
+	check(!assigner_getAnyPressed(1) && assigner_getAnyPressed(0),"all notes off per part");
+
+	assigner_allKeysOff(0);
+}
+
+static void testCCs(void)
+{
+	static const uint8_t cutoff[]={0xb1,19,10};
+	uint16_t mainCutoff=currentPreset.continuousParameters[cpCutoff];
+
+	uartInput(cutoff,sizeof(cutoff));
+	check((synth_getPartPreset(1)->continuousParameters[cpCutoff]>>9)==10,"CC reaches the layer");
+	check(currentPreset.continuousParameters[cpCutoff]==mainCutoff,"CC leaves the main part alone");
+}
+
+static void testProgramChange(void)
+{
+	static const uint8_t progChange[]={0xc1,LAYER_PRESET};
+	struct preset_s saved=currentPreset;
+
+	strcpy(currentPreset.presetName,"layer");
+	currentPreset.continuousParameters[cpResonance]=0x1234;
+	preset_saveCurrent(LAYER_PRESET);
+	currentPreset=saved;
+
+	uartInput(progChange,sizeof(progChange));
+	check(settings.parts[1].presetNumber==LAYER_PRESET && settings.presetNumber!=LAYER_PRESET,"program change on the layer");
+
+	for(int t=0;t<TICKER_HZ;++t)
+	{
+		midi_update();
+		++currentTick;
+	}
+
+	check(!strcmp(synth_getPartPreset(1)->presetName,"layer"),"layer preset loaded");
+	check(!strcmp(currentPreset.presetName,saved.presetName) && currentPreset.continuousParameters[cpResonance]==saved.continuousParameters[cpResonance],"main preset untouched");
+	check(assigner_getVoiceMask(1)==LAYER_MASK,"layer still has its voices");
+}
+
+int main(int argc, char * argv[])
+{
+	host_init();
+	synth_init();
+
+	settings.midiReceiveChannel=0;
+	settings.parts[1].midiChannel=1;
+	settings.parts[1].voiceCount=1;
+	synth_refreshParts();
+
+	testVoices();
+	testCCs();
+	testProgramChange();
+
+	return test_summary();
+}
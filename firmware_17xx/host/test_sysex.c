@@ -0,0 +1,368 @@
+///////////////////////////////////////////////////////////////////////////////
+// SysEx bulk transfer test, the host plays the librarian over USB-MIDI
+///////////////////////////////////////////////////////////////////////////////
+
+// Objects are loaded chunk by chunk, waiting for each ack like a librarian
+// would, then checked on flash and dumped back. Corrupted and repeated chunks
+// must be nacked / acked without altering what gets written.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "host.h"
+#include "test.h"
+#include "usb/usb_midi.h"
+#include "synth/midi.h"
+#include "synth/sysex.h"
+#include "synth/storage.h"
+#include "synth/dacspi.h"
+#include "synth/wave_reader.h"
+#include "synth/wtosc.h"
+#include "xnormidi/sysex_tools.h"
+
+#define PRESET_FILE "../../disk/PRESETS/preset_0001.conf"
+#define WAVE_NAME "TEST/ramp.wav"
+#define MAX_OBJECT_SIZE 8192
+#define MAX_MESSAGE_SIZE 256
+
+static uint8_t reply[MAX_MESSAGE_SIZE];
+static int replyLen;
+
+// one synth main loop iteration
+static void run(void)
+{
+	midi_processInput(dacspi_getTimestamp()+1);
+	midi_update();
+	++currentTick;
+}
+
+static void sendMessage(const uint8_t * msg, int len)
+{
+	uint8_t packet[64];
+	int p=0;
+
+	for(int i=0;i<len;i+=3)
+	{
+		int n=MIN(3,len-i);
+
+		if(p==sizeof(packet))
+		{
+			host_usb_receive(packet,p);
+			p=0;
+		}
+
+		// SysEx start / continue, or end with 1-3 bytes
+		packet[p++]=(msg[i+n-1]==0xf7)?4+n:4;
+		packet[p++]=msg[i];
+		packet[p++]=(n>1)?msg[i+1]:0;
+		packet[p++]=(n>2)?msg[i+2]:0;
+	}
+
+	host_usb_receive(packet,p);
+	run();
+}
+
+// gathers a whole SysEx message from the bulk IN endpoint
+static int receiveMessage(void)
+{
+	static uint8_t events[4096];
+	static int eventsLen=0,eventsPos=0;
+
+	replyLen=0;
+
+	for(int tries=0;tries<4;++tries)
+	{
+		if(eventsPos>=eventsLen)
+		{
+			eventsLen=host_usb_transmit(events,sizeof(events));
+			eventsPos=0;
+		}
+
+		while(eventsPos<eventsLen)
+		{
+			static const int8_t sizes[16]={0,0,2,3,3,1,2,3,3,3,3,3,3,2,3,1};
+			uint8_t * e=&events[eventsPos];
+
+			eventsPos+=4;
+
+			for(int i=0;i<sizes[e[0]&0xf] && replyLen<MAX_MESSAGE_SIZE;++i)
+			{
+				reply[replyLen++]=e[1+i];
+				if(e[1+i]==0xf7)
+					return replyLen;
+			}
+		}
+
+		run();
+	}
+
+	return 0;
+}
+
+static int beginMessage(uint8_t * msg, sysexCommand_t command)
+{
+	msg[0]=0xf0;
+	msg[1]=SYSEX_ID_MANUFACTURER;
+	msg[2]=SYSEX_ID_DEVICE;
+	msg[3]=command;
+	return 4;
+}
+
+static sysexStatus_t expectAck(sysexCommand_t command, uint16_t seq)
+{
+	if(!receiveMessage() || replyLen!=9 || reply[3]!=scAck || reply[4]!=command || (reply[5]|(reply[6]<<7))!=seq)
+		return -1;
+
+	return reply[7];
+}
+
+static void sendAck(sysexCommand_t command, uint16_t seq, sysexStatus_t status)
+{
+	uint8_t msg[16];
+	int len=beginMessage(msg,scAck);
+
+	msg[len++]=command;
+	msg[len++]=seq&0x7f;
+	msg[len++]=seq>>7;
+	msg[len++]=status;
+	msg[len++]=0xf7;
+
+	sendMessage(msg,len);
+}
+
+static int dataMessage(uint8_t * msg, uint16_t seq, const uint8_t * data, int size, int8_t corrupt)
+{
+	int len=beginMessage(msg,scWriteData);
+	uint8_t chk=0;
+
+	msg[len++]=seq&0x7f;
+	msg[len++]=seq>>7;
+	len+=sysex_encode(&msg[len],data,size);
+
+	for(int i=4;i<len;++i)
+		chk^=msg[i];
+
+	msg[len++]=(chk^corrupt)&0x7f;
+	msg[len++]=0xf7;
+
+	return len;
+}
+
+static int load(sysexObject_t object, uint16_t index, const char * name, const uint8_t * data, int size, int8_t faults)
+{
+	uint8_t msg[MAX_MESSAGE_SIZE];
+	int len=beginMessage(msg,scWriteBegin);
+	uint16_t seq=0;
+	int ok=1;
+
+	msg[len++]=object;
+	msg[len++]=index&0x7f;
+	msg[len++]=index>>7;
+	msg[len++]=size&0x7f;
+	msg[len++]=(size>>7)&0x7f;
+	msg[len++]=(size>>14)&0x7f;
+	len+=sprintf((char*)&msg[len],"%s",name);
+	msg[len++]=0xf7;
+
+	sendMessage(msg,len);
+	if(expectAck(scWriteBegin,0)!=ssOk)
+		return 0;
+
+	for(int pos=0;pos<size;pos+=SYSEX_CHUNK_SIZE,++seq)
+	{
+		int n=MIN(SYSEX_CHUNK_SIZE,size-pos);
+
+		if(faults && seq==1)
+		{
+			// corrupted chunk, then a sequence gap
+			sendMessage(msg,dataMessage(msg,seq,&data[pos],n,0x55));
+			ok&=expectAck(scWriteData,seq)==ssChecksum;
+			sendMessage(msg,dataMessage(msg,seq+1,&data[pos],n,0));
+			ok&=expectAck(scWriteData,seq+1)==ssSequence;
+		}
+
+		sendMessage(msg,dataMessage(msg,seq,&data[pos],n,0));
+		ok&=expectAck(scWriteData,seq)==ssOk;
+
+		if(faults && seq==2)
+		{
+			// lost ack, repeated chunk
+			sendMessage(msg,dataMessage(msg,seq,&data[pos],n,0));
+			ok&=expectAck(scWriteData,seq)==ssOk;
+		}
+	}
+
+	len=beginMessage(msg,scWriteEnd);
+	msg[len++]=0xf7;
+	sendMessage(msg,len);
+	ok&=expectAck(scWriteEnd,seq)==ssOk;
+
+	return ok;
+}
+
+static int dump(sysexObject_t object, uint16_t index, const char * name, uint8_t * data, int8_t faults)
+{
+	uint8_t msg[MAX_MESSAGE_SIZE];
+	int len=beginMessage(msg,scReadRequest);
+	int size,pos=0;
+	uint16_t seq=0;
+
+	msg[len++]=object;
+	msg[len++]=index&0x7f;
+	msg[len++]=index>>7;
+	len+=sprintf((char*)&msg[len],"%s",name);
+	msg[len++]=0xf7;
+	sendMessage(msg,len);
+
+	if(!receiveMessage() || reply[3]!=scWriteBegin || reply[4]!=object)
+		return -1;
+
+	size=reply[7]|(reply[8]<<7)|(reply[9]<<14);
+	sendAck(scWriteBegin,0,ssOk);
+
+	for(;;)
+	{
+		uint8_t chk=0;
+		int encLen;
+
+		if(!receiveMessage())
+			return -1;
+
+		if(reply[3]==scWriteEnd)
+			break;
+
+		if(reply[3]!=scWriteData || (reply[4]|(reply[5]<<7))!=seq)
+			return -1;
+
+		encLen=replyLen-8;
+		for(int i=4;i<replyLen-2;++i)
+			chk^=reply[i];
+
+		if(chk!=reply[replyLen-2])
+			return -1;
+
+		// ask for a resend once
+		if(faults && seq==1)
+		{
+			faults=0;
+			sendAck(scWriteData,seq,ssChecksum);
+			continue;
+		}
+
+		pos+=sysex_decode(&data[pos],&reply[6],encLen);
+		sendAck(scWriteData,seq++,ssOk);
+	}
+
+	sendAck(scWriteEnd,0,ssOk);
+
+	return pos==size?size:-1;
+}
+
+static int readFile(const char * fn, uint8_t * data, int maxLen)
+{
+	FIL f;
+	UINT br=0;
+
+	if(f_open(&f,fn,FA_READ|FA_OPEN_EXISTING))
+		return -1;
+	f_read(&f,data,maxLen,&br);
+	f_close(&f);
+
+	return br;
+}
+
+static void testPreset(void)
+{
+	static uint8_t preset[MAX_OBJECT_SIZE],flash[MAX_OBJECT_SIZE],dumped[MAX_OBJECT_SIZE];
+	FILE * f;
+	int size,len;
+
+	f=fopen(PRESET_FILE,"rb");
+	if(!f)
+	{
+		check(0,"open " PRESET_FILE);
+		return;
+	}
+	size=fread(preset,1,sizeof(preset),f);
+	fclose(f);
+
+	check(load(soPreset,42,"",preset,size,1),"preset load, with faults");
+
+	len=readFile(SYNTH_PRESETS_PATH "/preset_0042.conf",flash,sizeof(flash));
+	check(len==size && !memcmp(flash,preset,size),"preset on flash");
+	check(readFile(SYNTH_PRESETS_PATH "/SYSEX.TMP",flash,sizeof(flash))<0,"preset temp file removed");
+
+	check(preset_loadCurrent(42) && currentPreset.presetName[0],"preset parses");
+
+	len=dump(soPreset,42,"",dumped,1);
+	check(len==size && !memcmp(dumped,preset,size),"preset dump, with a resend");
+
+	// the current preset is reloaded when replaced
+
+	settings.presetNumber=43;
+	preset_loadDefault(1);
+	check(load(soPreset,43,"",preset,size,0),"current preset load");
+	for(int i=0;i<8;++i)
+		run();
+	check(currentPreset.loadedPresetNumber==43 && currentPreset.presetName[0],"current preset reloaded");
+}
+
+static void testWave(void)
+{
+	static int16_t samples[WTOSC_SAMPLE_COUNT],read[WTOSC_SAMPLE_COUNT],dumped[WTOSC_SAMPLE_COUNT];
+	wave_reader wr;
+	int ok=0;
+
+	for(int i=0;i<WTOSC_SAMPLE_COUNT;++i)
+		samples[i]=i*27-INT16_MAX;
+
+	check(load(soWave,0,WAVE_NAME,(uint8_t*)samples,sizeof(samples),1),"wave load, with faults");
+
+	if(wave_reader_open(SYNTH_WAVEDATA_PATH "/" WAVE_NAME,&wr)==WR_NO_ERROR)
+	{
+		ok=wave_reader_get_format(&wr)==1 && wave_reader_get_sample_bits(&wr)==16 && wave_reader_get_num_channels(&wr)==1 &&
+				wave_reader_get_num_samples(&wr)==WTOSC_SAMPLE_COUNT &&
+				!wave_reader_get_samples(&wr,WTOSC_SAMPLE_COUNT,read) &&
+				!memcmp(read,samples,sizeof(samples));
+		wave_reader_close(&wr);
+	}
+	check(ok,"wave readable");
+
+	check(dump(soWave,0,WAVE_NAME,(uint8_t*)dumped,0)==sizeof(samples) && !memcmp(dumped,samples,sizeof(samples)),"wave dump");
+}
+
+static void testErrors(void)
+{
+	static const uint8_t data[4]={'a',' ','=',' '};
+	uint8_t msg[MAX_MESSAGE_SIZE];
+	int len;
+
+	check(!load(soWave,0,"../escape.wav",data,sizeof(data),0),"wave name outside of bank refused");
+	check(!load(soPreset,1000,"",data,sizeof(data),0),"preset index range");
+
+	// data without a transfer
+	sendMessage(msg,dataMessage(msg,0,data,sizeof(data),0));
+	check(expectAck(scWriteData,0)==ssBadRequest,"data outside of a transfer");
+
+	// preset 484 was never written
+	len=beginMessage(msg,scReadRequest);
+	msg[len++]=soPreset;
+	msg[len++]=100;
+	msg[len++]=3;
+	msg[len++]=0xf7;
+	sendMessage(msg,len);
+	check(expectAck(scReadRequest,0)==ssIO,"missing object dump");
+}
+
+int main(int argc, char * argv[])
+{
+	host_init();
+	synth_init();
+	usb_midi_start();
+
+	testPreset();
+	testWave();
+	testErrors();
+
+	return test_summary();
+}
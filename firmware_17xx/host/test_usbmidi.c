@@ -0,0 +1,185 @@
+///////////////////////////////////////////////////////////////////////////////
+// USB-MIDI bulk OUT decoding test, on recorded packets
+///////////////////////////////////////////////////////////////////////////////
+
+// Packets as captured from DAWs / class drivers are decoded and compared with
+// the expected MIDI byte stream, then fed through the endpoint handler to
+// check they reach the synth and that queue overflows are accounted for.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "host.h"
+#include "test.h"
+#include "usb/usb_midi.h"
+#include "synth/midi.h"
+#include "synth/assigner.h"
+#include "synth/dacspi.h"
+
+struct capture_s
+{
+	const char * name;
+	int len;
+	uint8_t packet[64];
+	int midiLen;
+	uint8_t midi[48];
+	uint32_t events;
+	uint32_t drops;
+};
+
+static const struct capture_s captures[]=
+{
+	{
+		"chord",
+		12,{0x09,0x90,0x3c,0x64, 0x09,0x90,0x40,0x64, 0x09,0x90,0x43,0x64},
+		9,{0x90,0x3c,0x64, 0x90,0x40,0x64, 0x90,0x43,0x64},
+		3,0,
+	},
+	{
+		"cc burst",
+		64,{
+			0x0b,0xb0,0x01,0x00, 0x0b,0xb0,0x01,0x08, 0x0b,0xb0,0x01,0x10, 0x0b,0xb0,0x01,0x18,
+			0x0b,0xb0,0x01,0x20, 0x0b,0xb0,0x01,0x28, 0x0b,0xb0,0x01,0x30, 0x0b,0xb0,0x01,0x38,
+			0x0b,0xb0,0x01,0x40, 0x0b,0xb0,0x01,0x48, 0x0b,0xb0,0x01,0x50, 0x0b,0xb0,0x01,0x58,
+			0x0b,0xb0,0x01,0x60, 0x0b,0xb0,0x01,0x68, 0x0b,0xb0,0x01,0x70, 0x0b,0xb0,0x01,0x78,
+		},
+		48,{
+			0xb0,0x01,0x00, 0xb0,0x01,0x08, 0xb0,0x01,0x10, 0xb0,0x01,0x18,
+			0xb0,0x01,0x20, 0xb0,0x01,0x28, 0xb0,0x01,0x30, 0xb0,0x01,0x38,
+			0xb0,0x01,0x40, 0xb0,0x01,0x48, 0xb0,0x01,0x50, 0xb0,0x01,0x58,
+			0xb0,0x01,0x60, 0xb0,0x01,0x68, 0xb0,0x01,0x70, 0xb0,0x01,0x78,
+		},
+		16,0,
+	},
+	{
+		"sysex end 2",
+		12,{0x04,0xf0,0x7d,0x01, 0x04,0x02,0x03,0x04, 0x06,0x05,0xf7,0x00},
+		8,{0xf0,0x7d,0x01,0x02,0x03,0x04,0x05,0xf7},
+		3,0,
+	},
+	{
+		"sysex end 1 / 3",
+		16,{0x04,0xf0,0x7d,0x01, 0x05,0xf7,0x00,0x00, 0x04,0xf0,0x7d,0x02, 0x07,0x03,0x04,0xf7},
+		10,{0xf0,0x7d,0x01,0xf7, 0xf0,0x7d,0x02,0x03,0x04,0xf7},
+		4,0,
+	},
+	{
+		"realtime",
+		12,{0x0f,0xf8,0x00,0x00, 0x0f,0xfa,0x00,0x00, 0x0f,0xf8,0x00,0x00},
+		3,{0xf8,0xfa,0xf8},
+		3,0,
+	},
+	{
+		"2 bytes messages",
+		8,{0x0c,0xc0,0x05,0x00, 0x0d,0xd0,0x40,0x00},
+		4,{0xc0,0x05, 0xd0,0x40},
+		2,0,
+	},
+	{
+		"zero padded",
+		16,{0x08,0x80,0x3c,0x00, 0x00,0x00,0x00,0x00, 0x00,0x00,0x00,0x00, 0x00,0x00,0x00,0x00},
+		3,{0x80,0x3c,0x00},
+		1,0,
+	},
+	{
+		"reserved CIN",
+		12,{0x01,0x12,0x34,0x56, 0x0e,0xe0,0x00,0x40, 0x00,0x7f,0x00,0x00},
+		3,{0xe0,0x00,0x40},
+		1,2,
+	},
+	{
+		"truncated",
+		6,{0x09,0x90,0x3c,0x64, 0x09,0x90},
+		3,{0x90,0x3c,0x64},
+		1,1,
+	},
+	{
+		"cable 1",
+		4,{0x19,0x90,0x3c,0x64},
+		3,{0x90,0x3c,0x64},
+		1,0,
+	},
+};
+
+#define CAPTURE_COUNT (sizeof(captures)/sizeof(captures[0]))
+
+static void testDecode(void)
+{
+	for(int c=0;c<CAPTURE_COUNT;++c)
+	{
+		const struct capture_s * cap=&captures[c];
+		struct usbMidiStats_s s;
+		uint8_t midi[48];
+		int len;
+		char what[64];
+
+		usb_midi_resetStats();
+		len=usb_midi_decode(cap->packet,cap->len,midi);
+		usb_midi_getStats(&s);
+
+		snprintf(what,sizeof(what),"decode %s",cap->name);
+		check(len==cap->midiLen && !memcmp(midi,cap->midi,len) && s.events==cap->events && s.drops==cap->drops,what);
+	}
+}
+
+static void testEndpoint(void)
+{
+	static const uint8_t chordOff[12]={0x08,0x80,0x3c,0x00, 0x08,0x80,0x40,0x00, 0x08,0x80,0x43,0x00};
+	struct usbMidiStats_s s;
+	uint8_t note,lo=UINT8_MAX,hi=0;
+	int assigned=0;
+
+	usb_midi_start();
+	usb_midi_resetStats();
+
+	// all the events of a packet reach the synth
+
+	host_usb_receive(captures[0].packet,captures[0].len);
+	midi_processInput(dacspi_getTimestamp()+1);
+
+	for(int8_t v=0;v<SYNTH_VOICE_COUNT;++v)
+		if(assigner_getAssignment(v,&note))
+		{
+			lo=MIN(lo,note);
+			hi=MAX(hi,note);
+			++assigned;
+		}
+
+	// MIDI notes are transposed, only check the chord span
+	check(assigned==3 && hi-lo==0x43-0x3c,"endpoint chord on");
+
+	host_usb_receive(chordOff,sizeof(chordOff));
+	midi_processInput(dacspi_getTimestamp()+1);
+
+	check(!assigner_getAnyPressed(0),"endpoint chord off");
+
+	// 8 full CC bursts without processing: 5 fit the 256 bytes queue, the
+	// remaining packets are dropped whole
+
+	usb_midi_resetStats();
+
+	for(int p=0;p<8;++p)
+		host_usb_receive(captures[1].packet,captures[1].len);
+
+	usb_midi_getStats(&s);
+	check(s.packets==8 && s.events==8*16 && s.drops==3*16,"endpoint queue overflow");
+
+	midi_processInput(dacspi_getTimestamp()+1);
+	host_usb_receive(captures[0].packet,captures[0].len);
+	usb_midi_getStats(&s);
+	check(s.packets==9 && s.drops==3*16,"endpoint after overflow");
+
+	midi_processInput(dacspi_getTimestamp()+1);
+	assigner_allKeysOff(0);
+}
+
+int main(int argc, char * argv[])
+{
+	host_init();
+	synth_init();
+
+	testDecode();
+	testEndpoint();
+
+	return test_summary();
+}
@@ -0,0 +1,117 @@
+///////////////////////////////////////////////////////////////////////////////
+// W25Q driver test: DMA sector reads against the flash device model
+///////////////////////////////////////////////////////////////////////////////
+
+// Sectors written through the driver must read back the same, whole runs
+// under a single FAST_READ; async reads only progress as the simulated DMA
+// moves and complete once, through the callback.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "host.h"
+#include "test.h"
+#include "w25q.h"
+#include "nor.h"
+
+#define BASE_SECTOR 1000
+#define RUN_SECTORS 9 // several DMA batches
+
+static int callbacks=0;
+
+static uint8_t pattern[RUN_SECTORS][W25Q_SECTOR_SIZE];
+static uint8_t buf[RUN_SECTORS][W25Q_SECTOR_SIZE];
+
+static void readDone(void)
+{
+	++callbacks;
+}
+
+static struct host_w25qStats_s getStats(void)
+{
+	struct host_w25qStats_s s;
+	host_w25q_getStats(&s);
+	return s;
+}
+
+static void testWrite(void)
+{
+	struct host_w25qStats_s s;
+
+	for(int i=0;i<RUN_SECTORS;++i)
+		for(int j=0;j<W25Q_SECTOR_SIZE;++j)
+			pattern[i][j]=(i*131+j*7+(j>>8))&0xff;
+
+	host_w25q_resetStats();
+
+	for(int i=0;i<RUN_SECTORS;++i)
+		W25Q_writeSector(BASE_SECTOR+i,pattern[i]);
+
+	s=getStats();
+	check(s.sectorErases==RUN_SECTORS && s.pageProgs==RUN_SECTORS*W25Q_SECTOR_SIZE/W25Q_PAGE_SIZE,"erase & program counts");
+	check(!s.protocolErrors,"write protocol");
+}
+
+static void testBlockingRead(void)
+{
+	struct host_w25qStats_s s;
+
+	memset(buf,0,sizeof(buf));
+	host_w25q_resetStats();
+
+	W25Q_readSectors(BASE_SECTOR,buf[0],RUN_SECTORS);
+
+	s=getStats();
+	check(!memcmp(buf,pattern,sizeof(buf)),"multi sector read data");
+	check(s.fastReads==1 && s.sectorReads==RUN_SECTORS,"single FAST_READ per run");
+	check(s.dmaBytes==sizeof(buf),"all data moved by DMA");
+	check(!W25Q_isBusy() && !s.protocolErrors,"read protocol");
+}
+
+static void testAsyncRead(void)
+{
+	memset(buf,0,sizeof(buf));
+	callbacks=0;
+
+	W25Q_readSectorsAsync(BASE_SECTOR+1,buf[0],RUN_SECTORS-1,readDone);
+	check(W25Q_isBusy() && !buf[0][0] && !callbacks,"async read returns at once");
+
+	host_w25q_runDMA(W25Q_SECTOR_SIZE+W25Q_SECTOR_SIZE/2);
+	check(W25Q_isBusy() && !memcmp(buf,pattern[1],W25Q_SECTOR_SIZE) && !buf[1][W25Q_SECTOR_SIZE/2],"progresses with the DMA");
+
+	W25Q_wait();
+	check(!W25Q_isBusy() && callbacks==1,"completion callback");
+	check(!memcmp(buf,pattern[1],(RUN_SECTORS-1)*W25Q_SECTOR_SIZE),"async read data");
+
+	// a new command waits for the pending read
+	W25Q_readSectorsAsync(BASE_SECTOR,buf[0],RUN_SECTORS,readDone);
+	W25Q_writeSector(BASE_SECTOR+RUN_SECTORS,pattern[0]);
+	check(callbacks==2 && !memcmp(buf,pattern,sizeof(buf)),"writes wait for reads");
+	check(!getStats().protocolErrors,"async protocol");
+}
+
+static void testDisk(void)
+{
+	struct host_w25qStats_s s;
+
+	memset(buf,0,sizeof(buf));
+	host_w25q_resetStats();
+
+	nor_disk_read(buf[0],BASE_SECTOR,RUN_SECTORS);
+
+	s=getStats();
+	check(s.fastReads==1 && !memcmp(buf,pattern,sizeof(buf)),"disk reads are one run");
+}
+
+int main(int argc, char * argv[])
+{
+	host_init();
+
+	check(!getStats().protocolErrors,"init & format protocol");
+	testWrite();
+	testBlockingRead();
+	testAsyncRead();
+	testDisk();
+
+	return test_summary();
+}
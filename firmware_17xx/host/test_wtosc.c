@@ -0,0 +1,139 @@
+///////////////////////////////////////////////////////////////////////////////
+// Bit exactness test of the wtosc_update() dispatch table variants
+///////////////////////////////////////////////////////////////////////////////
+
+// Every (wave mod, sync role, data present) variant renders a fixed sweep of
+// pitches & amounts, its DAC output (and sync positions for masters) is
+// hashed and compared with the reference hashes below.
+// "./test_wtosc -g" prints a new reference table, only to be pasted here
+// when a change of the oscillator output is intended.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "host.h"
+#include "synth/wtosc.h"
+#include "synth/dacspi.h"
+
+#define TEST_SAMPLES_PER_UPDATE (DACSPI_BUFFER_COUNT/4)
+#define TEST_UPDATES 48
+
+#define VARIANT_COUNT (wmCount*2*2)
+
+static const uint16_t testNotes[]={12,36,60,84,108,WTOSC_HIGHEST_NOTE};
+static const uint16_t testAmounts[]={0x0000,0x2000,0x7000,0x8000,0xb000,0xffff};
+
+static const char * wmNames[wmCount]={"off","aliasing","width","frequency","crossover","folder","bitcrush"};
+
+static const uint32_t referenceHashes[VARIANT_COUNT]=
+{
+	0x5745ee3b, 0xc2fb1319, 0x1aa07dc5, 0x86368e2d,
+	0xf6d6acc5, 0xe67b945d, 0x1aa07dc5, 0x89556e0f,
+	0x7b381664, 0x96d1f057, 0x1aa07dc5, 0xe22fe320,
+	0x5745ee3b, 0xc2fb1319, 0x1aa07dc5, 0x86368e2d,
+	0x5745ee3b, 0xbd9c5a93, 0x1aa07dc5, 0x69258239,
+	0x5745ee3b, 0x410ed954, 0x1aa07dc5, 0x8f6da606,
+	0x5745ee3b, 0xa6135bc4, 0x1aa07dc5, 0x22efc4a6,
+};
+
+static uint16_t mainData[WTOSC_SAMPLE_COUNT];
+static uint16_t xovrData[WTOSC_SAMPLE_COUNT];
+
+static uint32_t hash(uint32_t h, uint32_t v)
+{
+	// FNV-1a on 16 bits values
+	h=(h^(v&0xff))*16777619u;
+	h=(h^((v>>8)&0xff))*16777619u;
+	return h;
+}
+
+static void buildWaveforms(void)
+{
+	const int32_t range=UINT16_MAX-2*WTOSC_SAMPLES_GUARD_BAND;
+
+	for(int32_t i=0;i<WTOSC_SAMPLE_COUNT;++i)
+	{
+		int32_t tri=(i<WTOSC_SAMPLE_COUNT/2)?i:WTOSC_SAMPLE_COUNT-i;
+
+		// saw with a small step, triangle
+		mainData[i]=WTOSC_SAMPLES_GUARD_BAND+((int64_t)range*i)/WTOSC_SAMPLE_COUNT/((i<WTOSC_SAMPLE_COUNT/3)?2:1);
+		xovrData[i]=WTOSC_SAMPLES_GUARD_BAND+((int64_t)range*tri*2)/WTOSC_SAMPLE_COUNT;
+	}
+
+	wtosc_buildMipmaps(mainData);
+	wtosc_buildMipmaps(xovrData);
+}
+
+static uint32_t renderVariant(int8_t entry)
+{
+	static int16_t syncPositions[TEST_SAMPLES_PER_UPDATE];
+	struct wtosc_s o;
+	oscWModTarget_t wm=entry>>2;
+	int8_t slave=(entry>>1)&1;
+	int8_t data=entry&1;
+	uint32_t h=2166136261u;
+	int32_t u=0;
+
+	wtosc_init(&o,0);
+	wtosc_setSampleData(&o,data?mainData:NULL,xovrData);
+
+	for(int i=0;i<TEST_SAMPLES_PER_UPDATE;++i)
+		syncPositions[i]=INT16_MIN;
+
+	for(int n=0;n<sizeof(testNotes)/sizeof(testNotes[0]);++n)
+		for(int a=0;a<sizeof(testAmounts)/sizeof(testAmounts[0]);++a)
+		{
+			wtosc_setParameters(&o,testNotes[n]*WTOSC_CV_SEMITONE+a*37,wm,testAmounts[a]);
+
+			for(int i=0;i<TEST_UPDATES;++i,++u)
+			{
+				if(slave && (u%3)!=2)
+					syncPositions[(u*5)%TEST_SAMPLES_PER_UPDATE]=(u*1237)&0x3ff;
+
+				wtosc_update(&o,0,TEST_SAMPLES_PER_UPDATE-1,slave?osmSlave:osmMaster,syncPositions);
+
+				for(int b=0;b<TEST_SAMPLES_PER_UPDATE;++b)
+					h=hash(h,host_dacspi_getOscValue(b,0));
+
+				// a master publishes sync positions, the slave consumes them
+				for(int b=0;b<TEST_SAMPLES_PER_UPDATE;++b)
+				{
+					if(!slave)
+						h=hash(h,syncPositions[b]);
+					syncPositions[b]=INT16_MIN;
+				}
+			}
+		}
+
+	return h;
+}
+
+int main(int argc, char * argv[])
+{
+	int8_t generate=argc>1 && !strcmp(argv[1],"-g");
+	int failures=0;
+
+	buildWaveforms();
+
+	for(int8_t entry=0;entry<VARIANT_COUNT;++entry)
+	{
+		uint32_t h=renderVariant(entry);
+
+		if(generate)
+		{
+			printf("%s0x%08x,%s",(entry&3)?"":"\t",h,(entry&3)==3?"\n":" ");
+		}
+		else
+		{
+			int8_t ok=h==referenceHashes[entry];
+
+			printf("%-9s %-6s %-7s %s\n",wmNames[entry>>2],(entry&2)?"slave":"master",(entry&1)?"data":"noData",ok?"ok":"FAIL");
+			failures+=!ok;
+		}
+	}
+
+	if(!generate)
+		printf("%d/%d variants bit exact\n",VARIANT_COUNT-failures,VARIANT_COUNT);
+
+	return failures?1:0;
+}
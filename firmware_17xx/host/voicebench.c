@@ -0,0 +1,40 @@
+///////////////////////////////////////////////////////////////////////////////
+// Host runner for the voice count scaling benchmark (synth/bench.c)
+///////////////////////////////////////////////////////////////////////////////
+
+// Built once per voice count by "make voicescale", each build prints its
+// table row; pass "header" to print the table header first.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "host.h"
+#include "synth/bench.h"
+#include "synth/dacspi.h"
+
+int main(int argc, char * argv[])
+{
+	const char * diskDir=(argc>1)?argv[1]:"../../disk";
+	int8_t header=argc>2 && !strcmp(argv[2],"header");
+
+	host_init();
+
+	if(!host_importTree(diskDir,""))
+		fprintf(stderr,"warning: nothing imported from %s, using default waveforms\n",diskDir);
+
+	synth_init();
+
+	// table goes to stdout
+	rprintf_devopen(0,putchar);
+
+	bench_runVoiceScaling(header);
+
+	// the DAC buffers are otherwise never read on the host, LTO would drop the stores
+	uint32_t checksum=0;
+	for(int32_t b=0;b<DACSPI_BUFFER_COUNT;++b)
+		for(int c=0;c<SYNTH_VOICE_COUNT*2;++c)
+			checksum+=host_dacspi_getOscValue(b,c);
+	fprintf(stderr,"DAC buffers checksum %08x\n",checksum);
+
+	return 0;
+}
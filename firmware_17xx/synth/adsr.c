@@ -37,6 +37,9 @@
 
 #include "adsr.h"
 #include "adsr_lookups.h"
+#include "dacspi.h"
+
+#define ADSR_NOMINAL_UPDATE_HZ 4000
 
 static uint32_t getPhaseInc(uint8_t v)
 {
@@ -88,6 +91,15 @@ static LOWERCODESIZE void updateIncrements(struct adsr_s * adsr)
 	dInc=getPhaseInc(adsr->decayCV>>8)>>adsr->speedShift;
 	rInc=getPhaseInc(adsr->releaseCV>>8)>>adsr->speedShift;
 	
+	// phase increments are for a 4Khz update rate, keep times whatever the DAC profile
+	
+	if(dacspi_getUpdateHz()!=ADSR_NOMINAL_UPDATE_HZ)
+	{
+		aInc=((uint64_t)aInc*ADSR_NOMINAL_UPDATE_HZ)/dacspi_getUpdateHz();
+		dInc=((uint64_t)dInc*ADSR_NOMINAL_UPDATE_HZ)/dacspi_getUpdateHz();
+		rInc=((uint64_t)rInc*ADSR_NOMINAL_UPDATE_HZ)/dacspi_getUpdateHz();
+	}
+	
 	adsr->attackIncrement=aInc<<4; // phase is 20 bits, from bit 4 to bit 23
 	adsr->decayIncrement=dInc<<4;
 	adsr->releaseIncrement=rInc<<4;
@@ -181,7 +193,7 @@ void adsr_setCVs(struct adsr_s * adsr, uint16_t atk, uint16_t dec, uint16_t sus,
 void adsr_setGate(struct adsr_s * a, int8_t gate)
 {
 	a->phase=0;
-	a->stageLevel=((uint32_t)a->output<<16)/a->levelCV;
+	a->stageLevel=a->levelCV?((uint32_t)a->output<<16)/a->levelCV:0; // Cortex-M3 UDIV by 0 yields 0
 
 	if(gate)
 	{
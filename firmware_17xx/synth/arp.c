@@ -47,7 +47,8 @@ static void finishPreviousNote(void)
 	{
 		uint8_t n=arp.previousNote&~ARP_NOTE_HELD_FLAG; // remove the HELD bit
 		
-		assigner_assignNote(n+SCANNER_BASE_NOTE+arp.previousTranspose,0,0,0);
+		assigner_assignNote(0,n+SCANNER_BASE_NOTE+arp.previousTranspose,0,0,0);
+		midi_sendNote(n+SCANNER_BASE_NOTE+arp.previousTranspose,0,0);
 	}
 }
 
@@ -60,7 +61,7 @@ static void killAllNotes(void)
 	arp.previousNote=ASSIGNER_NO_NOTE;
 
 	memset(arp.notes,ASSIGNER_NO_NOTE,ARP_NOTE_MEMORY);
-	assigner_allKeysOff();
+	assigner_allKeysOff(0);
 }
 
 static void killHeldNotes(void)
@@ -287,7 +288,8 @@ void arp_update(void)
 	
 	// send note to assigner, velocity at half (MIDI value 64)
 	
-	assigner_assignNote(n+SCANNER_BASE_NOTE+arp.transpose,1,HALF_RANGE,0);
+	assigner_assignNote(0,n+SCANNER_BASE_NOTE+arp.transpose,1,HALF_RANGE,0);
+	midi_sendNote(n+SCANNER_BASE_NOTE+arp.transpose,1,HALF_RANGE);
 	
 	arp.previousNote=arp.notes[arp.noteIndex];
 	arp.previousTranspose=arp.transpose;
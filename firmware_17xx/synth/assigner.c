@@ -4,117 +4,155 @@
 
 #include "assigner.h"
 
+#define HELD_WORDS (ASSIGNER_NOTE_COUNT/32)
+
 struct allocation_s
 {
 	uint32_t timestamp;
 	uint16_t velocity;
 	uint8_t rootNote;
 	uint8_t note;
-	int8_t allocated;
-	int8_t gated;
-	int8_t keyPressed;
 	int8_t fromKeyboard;
 };
 
-static struct
+// each part plays its own notes on its own voices, voice masks never overlap
+struct assignerPart_s
 {
-	uint32_t noteTimestamps[ASSIGNER_NOTE_COUNT]; // UINT32_MAX if not gated
+	uint32_t noteTimestamps[ASSIGNER_NOTE_COUNT]; // valid when held
 	uint16_t noteVelocities[ASSIGNER_NOTE_COUNT];
-	struct allocation_s allocation[SYNTH_VOICE_COUNT];
+	uint32_t heldNotes[HELD_WORDS]; // gated keys
 	uint8_t patternOffsets[SYNTH_VOICE_COUNT];
 	assignerPriority_t priority;
-	uint8_t voiceMask;
+	voiceMask_t voiceMask;
 	int8_t mono;
 	int8_t hold;
+};
+
+// voice sets are bitmasks, one bit per voice, so that picking a voice is a
+// CTZ / CLZ over a few words instead of a scan with a branch per voice
+static struct
+{
+	struct allocation_s allocation[SYNTH_VOICE_COUNT];
+	struct assignerPart_s part[SYNTH_PART_COUNT];
+
+	voiceMask_t allocated;
+	voiceMask_t gated;
+	voiceMask_t keyPressed;
+
+	// allocated voices by root / played note, parts are told apart by their voice masks
+	voiceMask_t rootVoices[ASSIGNER_NOTE_COUNT];
+	voiceMask_t noteVoices[ASSIGNER_NOTE_COUNT];
 } assigner;
 
-static const uint8_t polyPattern[SYNTH_VOICE_COUNT]={0,ASSIGNER_NO_NOTE,ASSIGNER_NO_NOTE,ASSIGNER_NO_NOTE,ASSIGNER_NO_NOTE,ASSIGNER_NO_NOTE};	
+static FORCEINLINE int8_t lowestVoice(voiceMask_t set)
+{
+	return __builtin_ctz(set);
+}
 
-static inline void setNoteState(uint8_t note, int8_t gate, uint16_t velocity, uint32_t timestamp)
+static inline void setNoteState(struct assignerPart_s * p, uint8_t note, int8_t gate, uint16_t velocity, uint32_t timestamp)
 {
-	assigner.noteVelocities[note]=velocity;
+	p->noteVelocities[note]=velocity;
 	if(gate)
-		assigner.noteTimestamps[note]=timestamp;
+	{
+		p->noteTimestamps[note]=timestamp;
+		p->heldNotes[note>>5]|=1u<<(note&31);
+	}
 	else
-		assigner.noteTimestamps[note]=UINT32_MAX;
+	{
+		p->heldNotes[note>>5]&=~(1u<<(note&31));
+	}
 }
 
-static inline int8_t getNoteState(uint8_t note, uint16_t *velocity, uint32_t *timestamp)
+static inline int8_t getNoteState(struct assignerPart_s * p, uint8_t note, uint16_t *velocity, uint32_t *timestamp)
 {
-	int8_t gate=assigner.noteTimestamps[note]!=UINT32_MAX;
+	int8_t gate=(p->heldNotes[note>>5]>>(note&31))&1;
 	if(gate && timestamp)
-		*timestamp=assigner.noteTimestamps[note];
+		*timestamp=p->noteTimestamps[note];
 	if(gate && velocity)
-		*velocity=assigner.noteVelocities[note];
+		*velocity=p->noteVelocities[note];
 	return gate;
 }
 
-static inline int8_t isVoiceDisabled(int8_t voice)
+static inline void releaseNotes(struct assignerPart_s * p)
 {
-	return !(assigner.voiceMask&(1<<voice));
+	memset(p->heldNotes,0,sizeof(p->heldNotes));
 }
 
-static inline int8_t getNoteAllocation(uint8_t note)
+// lowest / highest held note, ASSIGNER_NO_NOTE if none
+static inline uint8_t getLowestHeld(const uint32_t * held)
 {
-	int8_t vi,v=-1;
+	for(int8_t w=0;w<HELD_WORDS;++w)
+		if(held[w])
+			return (w<<5)+__builtin_ctz(held[w]);
+	return ASSIGNER_NO_NOTE;
+}
 
-	for(vi=0;vi<SYNTH_VOICE_COUNT;++vi)
-	{
-		if(isVoiceDisabled(vi))
-			continue;
+static inline uint8_t getHighestHeld(const uint32_t * held)
+{
+	for(int8_t w=HELD_WORDS-1;w>=0;--w)
+		if(held[w])
+			return (w<<5)+31-__CLZ(held[w]);
+	return ASSIGNER_NO_NOTE;
+}
 
-		if(assigner.allocation[vi].allocated && assigner.allocation[vi].rootNote==note)
-		{
-			v=vi;
-			break;
-		}
+static inline int8_t getNoteAllocation(struct assignerPart_s * p, uint8_t note)
+{
+	voiceMask_t set=assigner.rootVoices[note]&p->voiceMask;
+
+	return set?lowestVoice(set):-1;
+}
+
+static inline void setAllocation(int8_t v, uint8_t rootNote, uint8_t note)
+{
+	voiceMask_t bit=(voiceMask_t)1<<v;
+
+	if(assigner.allocated&bit)
+	{
+		assigner.rootVoices[assigner.allocation[v].rootNote]&=~bit;
+		assigner.noteVoices[assigner.allocation[v].note]&=~bit;
 	}
 
-	return v;
+	assigner.allocation[v].rootNote=rootNote;
+	assigner.allocation[v].note=note;
+	assigner.rootVoices[rootNote]|=bit;
+	assigner.noteVoices[note]|=bit;
+	assigner.allocated|=bit;
 }
 
-static inline int8_t getAvailableVoice(uint8_t note, uint32_t timestamp)
+static inline int8_t getAvailableVoice(struct assignerPart_s * p, uint8_t note, uint32_t timestamp)
 {
-	int8_t v,oldestVoice=-1,sameNote=-1;
+	voiceMask_t set;
+	int8_t v,oldestVoice=-1;
 	uint32_t oldestTimestamp=UINT32_MAX;
 
-	for(v=0;v<SYNTH_VOICE_COUNT;++v)
+	// triggering a note that is still allocated to a voice should use this voice
+
+	for(set=assigner.noteVoices[note]&p->voiceMask;set;set&=set-1)
 	{
-		// never assign a disabled voice
-		
-		if(isVoiceDisabled(v))
-			continue;
+		v=lowestVoice(set);
+		if(assigner.allocation[v].timestamp<timestamp)
+			return v;
+	}
 		
-		if(assigner.allocation[v].allocated)
-		{
-			// triggering a note that is still allocated to a voice should use this voice
+	// else use oldest free voice, if there is one
 		
-			if(assigner.allocation[v].timestamp<timestamp && assigner.allocation[v].note==note)
-			{
-				sameNote=v;
-				break;
-			}
-		}
-		else
+	for(set=~assigner.allocated&p->voiceMask;set;set&=set-1)
+	{
+		v=lowestVoice(set);
+		if(assigner.allocation[v].timestamp<oldestTimestamp)
 		{
-			// else use oldest voice, if there is one
-
-			if (assigner.allocation[v].timestamp<oldestTimestamp)
-			{
-				oldestTimestamp=assigner.allocation[v].timestamp;
-				oldestVoice=v;
-			}
+			oldestTimestamp=assigner.allocation[v].timestamp;
+			oldestVoice=v;
 		}
 	}
 	
-	if(sameNote>=0)
-		return sameNote;
-	else
-		return oldestVoice;
+	return oldestVoice;
 }
 
-static inline int8_t getDispensableVoice(uint8_t note)
+// only called when all the part voices are allocated
+static inline int8_t getDispensableVoice(struct assignerPart_s * p, uint8_t note)
 {
+	voiceMask_t set;
 	int8_t v,res=-1;
 	uint32_t ts;
 
@@ -122,12 +160,10 @@ static inline int8_t getDispensableVoice(uint8_t note)
 	
 	ts=UINT32_MAX;
 		
-	for(v=0;v<SYNTH_VOICE_COUNT;++v)
+	for(set=p->voiceMask;set;set&=set-1)
 	{
-		if(isVoiceDisabled(v))
-			continue;
-		
-		if(!getNoteState(assigner.allocation[v].rootNote,NULL,NULL) && assigner.allocation[v].timestamp<ts)
+		v=lowestVoice(set);
+		if(!getNoteState(p,assigner.allocation[v].rootNote,NULL,NULL) && assigner.allocation[v].timestamp<ts)
 		{
 			ts=assigner.allocation[v].timestamp;
 			res=v;
@@ -141,12 +177,11 @@ static inline int8_t getDispensableVoice(uint8_t note)
 	
 	ts=UINT32_MAX;
 		
-	for(v=0;v<SYNTH_VOICE_COUNT;++v)
+	for(set=p->voiceMask;set;set&=set-1)
 	{
-		if(isVoiceDisabled(v))
-			continue;
+		v=lowestVoice(set);
 		
-		switch(assigner.priority)
+		switch(p->priority)
 		{
 		case apLast:
 			if(assigner.allocation[v].timestamp<ts)
@@ -175,88 +210,166 @@ static inline int8_t getDispensableVoice(uint8_t note)
 	return res;
 }
 	
+// still held notes that lost their voice, by priority
+static inline uint8_t getRestoredNote(struct assignerPart_s * p)
+{
+	uint32_t held[HELD_WORDS];
+	uint32_t ts,restoredTimestamp;
+	uint8_t n,restoredNote=ASSIGNER_NO_NOTE;
+
+	memcpy(held,p->heldNotes,sizeof(held));
+
+	if(p->priority==apLast)
+	{
+		restoredTimestamp=0;
+		for(int8_t w=0;w<HELD_WORDS;++w)
+			for(uint32_t bits=held[w];bits;bits&=bits-1)
+			{
+				n=(w<<5)+__builtin_ctz(bits);
+				ts=p->noteTimestamps[n];
+				if(ts>restoredTimestamp && getNoteAllocation(p,n)<0)
+				{
+					restoredNote=n;
+					restoredTimestamp=ts;
+				}
+			}
+	}
+	else
+	{
+		for(;;)
+		{
+			n=(p->priority==apHigh)?getHighestHeld(held):getLowestHeld(held);
+
+			if(n==ASSIGNER_NO_NOTE || getNoteAllocation(p,n)<0)
+				break;
+
+			held[n>>5]&=~(1u<<(n&31));
+		}
+
+		restoredNote=n;
+	}
+
+	return restoredNote;
+}
+
 void assigner_voiceDone(int8_t voice)
 {
-	if (voice<0||voice>SYNTH_VOICE_COUNT)
+	voiceMask_t bit=(voiceMask_t)1<<voice;
+
+	if (voice<0||voice>=SYNTH_VOICE_COUNT)
 		return;
 
-	assigner.allocation[voice].allocated=0;
-	assigner.allocation[voice].keyPressed=0;
+	if(assigner.allocated&bit)
+	{
+		assigner.rootVoices[assigner.allocation[voice].rootNote]&=~bit;
+		assigner.noteVoices[assigner.allocation[voice].note]&=~bit;
+	}
+
+	assigner.allocated&=~bit;
+	assigner.keyPressed&=~bit;
 	assigner.allocation[voice].note=ASSIGNER_NO_NOTE;
 	assigner.allocation[voice].rootNote=ASSIGNER_NO_NOTE;
 }
 
-LOWERCODESIZE static void voicesDone(void)
+LOWERCODESIZE static void voicesDone(struct assignerPart_s * p)
 {
 	int8_t v;
-	for(v=0;v<SYNTH_VOICE_COUNT;++v)
+	for(voiceMask_t set=p->voiceMask;set;set&=set-1)
 	{
-		if(isVoiceDisabled(v))
-			continue;
-		
+		v=lowestVoice(set);
 		assigner_voiceDone(v);
 		assigner.allocation[v].timestamp=0; // reset to voice 0 in case all voices stopped at once
 	}
 	// Release all keys and future holds too. This avoids potential
 	// problems with notes seemingly popping up from nowhere due to
 	// reassignment when future keys are released.
-    memset(assigner.noteTimestamps,UINT32_MAX,sizeof(assigner.noteTimestamps));
+	releaseNotes(p);
 }
 
 // This is different from voicesDone() in that it does not silence
 // the voice immediately but lets it go through its release phase as usual.
 // Also, only voices corresponding to keys that are down on the keyboard
 // are released.
-void assigner_allKeysOff(void)
+void assigner_allKeysOff(int8_t part)
 {
+	struct assignerPart_s * p=&assigner.part[part];
 	int8_t v;
-	for(v=0;v<SYNTH_VOICE_COUNT;++v)
+	for(voiceMask_t set=p->voiceMask&assigner.gated;set;set&=set-1)
 	{
-		if (!isVoiceDisabled(v) && assigner.allocation[v].gated &&
-		    assigner.allocation[v].fromKeyboard)
+		v=lowestVoice(set);
+		if (assigner.allocation[v].fromKeyboard)
 		{
 			synth_assignerEvent(assigner.allocation[v].note,0,v,assigner.allocation[v].velocity,0);
-		    	assigner.allocation[v].gated=0;
-		    	assigner.allocation[v].keyPressed=0;
+			assigner.gated&=~((voiceMask_t)1<<v);
+			assigner.keyPressed&=~((voiceMask_t)1<<v);
 		}
 	}
-    memset(assigner.noteTimestamps,UINT32_MAX,sizeof(assigner.noteTimestamps));
-	assigner.hold=0;
+	releaseNotes(p);
+	p->hold=0;
 }
 
+// all parts, they keep their voices, priority & pattern
 void assigner_panicOff(void)
 {
-    voicesDone();
-    assigner_init();
+	for(int8_t part=0;part<SYNTH_PART_COUNT;++part)
+	{
+		voicesDone(&assigner.part[part]);
+		assigner.part[part].hold=0;
+	}
+	
+	// voices outside any part too
+	memset(assigner.allocation,0,sizeof(assigner.allocation));
+	memset(assigner.rootVoices,0,sizeof(assigner.rootVoices));
+	memset(assigner.noteVoices,0,sizeof(assigner.noteVoices));
+	assigner.allocated=0;
+	assigner.gated=0;
+	assigner.keyPressed=0;
 }
 
-void assigner_setPriority(assignerPriority_t prio)
+void assigner_setPriority(int8_t part, assignerPriority_t prio)
 {
-	if(prio==assigner.priority)
+	struct assignerPart_s * p=&assigner.part[part];
+
+	if(prio==p->priority)
 		return;
 	
-	voicesDone();
+	voicesDone(p);
 	
 	if(prio>2)
 		prio=0;
 	
-	assigner.priority=prio;
+	p->priority=prio;
 }
 
-void assigner_setVoiceMask(uint8_t mask)
+void assigner_setVoiceMask(int8_t part, voiceMask_t mask)
 {
-	if(mask==assigner.voiceMask)
+	struct assignerPart_s * p=&assigner.part[part];
+
+	if(mask==p->voiceMask)
 		return;
 	
-	voicesDone();
-	assigner.voiceMask=mask;
+	// voices taken from other parts are released there first
+	for(int8_t op=0;op<SYNTH_PART_COUNT;++op)
+		if(op!=part && (assigner.part[op].voiceMask&mask))
+		{
+			voicesDone(&assigner.part[op]);
+			assigner.part[op].voiceMask&=~mask;
+		}
+
+	voicesDone(p);
+	p->voiceMask=mask;
+}
+
+voiceMask_t assigner_getVoiceMask(int8_t part)
+{
+	return assigner.part[part].voiceMask;
 }
 
 FORCEINLINE int8_t assigner_getAssignment(int8_t voice, uint8_t * note)
 {
 	int8_t a;
 	
-	a=assigner.allocation[voice].allocated;
+	a=(assigner.allocated>>voice)&1;
 	
 	if(a && note)
 		*note=assigner.allocation[voice].note;
@@ -264,74 +377,73 @@ FORCEINLINE int8_t assigner_getAssignment(int8_t voice, uint8_t * note)
 	return a;
 }
 
-int8_t assigner_getAnyPressed(void)
+int8_t assigner_getAnyPressed(int8_t part)
 {
-	for(uint8_t n=0;n<ASSIGNER_NOTE_COUNT;++n)
-		if(getNoteState(n,NULL,NULL))
-			return 1;
-	
-	return 0;
+	return getLowestHeld(assigner.part[part].heldNotes)!=ASSIGNER_NO_NOTE;
 }
 
-int8_t assigner_getAnyAssigned(void)
+int8_t assigner_getAnyAssigned(int8_t part)
 {
-	int8_t v;
-	int8_t f=0;
-	
-	for(v=0;v<SYNTH_VOICE_COUNT;++v)
-		if(!isVoiceDisabled(v))
-			f|=assigner.allocation[v].allocated;
-	
-	return f!=0;
+	return (assigner.allocated&assigner.part[part].voiceMask)!=0;
 }
 
-int8_t FORCEINLINE assigner_getMono(void)
+int8_t FORCEINLINE assigner_getMono(int8_t part)
 {
-	return assigner.mono;
+	return assigner.part[part].mono;
 }
 
-void assigner_assignNote(uint8_t note, int8_t gate, uint16_t velocity, int8_t fromKeyboard)
+void assigner_assignNote(int8_t part, uint8_t note, int8_t gate, uint16_t velocity, int8_t fromKeyboard)
 {
-	uint32_t timestamp,restoredTimestamp,ts;
-	uint16_t restoredVelocity,vel;
+	struct assignerPart_s * p=&assigner.part[part];
+	uint32_t timestamp;
+	uint32_t others[HELD_WORDS];
 	uint8_t restoredNote;
-	uint8_t ni,n,flags=0;
+	uint8_t n,flags=0;
 	int8_t v,vi;
+	voiceMask_t set,bit;
+
+	// a part without voices
+	if(!p->voiceMask)
+		return;
 
 	timestamp=currentTick;
 
-	setNoteState(note,gate,velocity,timestamp);
+	setNoteState(p,note,gate,velocity,timestamp);
 
 reassign:
 
 	if(gate)
 	{
-		if(assigner.mono)
+		if(p->mono)
 		{
-			// just handle legato & priority
+			// just handle legato & priority, from the part first voice
 			
-			v=0;
-
-			if(assigner.priority!=apLast)
-				for(n=0;n<ASSIGNER_NOTE_COUNT;++n)
-					if(n!=note && getNoteState(n,NULL,NULL))
-					{
-						if (note>n && assigner.priority==apLow)
-							return;
-						if (note<n && assigner.priority==apHigh)
-							return;
+			v=lowestVoice(p->voiceMask);
+
+			if(p->priority!=apLast)
+			{
+				memcpy(others,p->heldNotes,sizeof(others));
+				others[note>>5]&=~(1u<<(note&31));
 						
-						flags=ASSIGNER_EVENT_FLAG_LEGATO;
-					}
+				if((n=getLowestHeld(others))!=ASSIGNER_NO_NOTE)
+				{
+					if (n<note && p->priority==apLow)
+						return;
+					if (getHighestHeld(others)>note && p->priority==apHigh)
+						return;
+
+					flags=ASSIGNER_EVENT_FLAG_LEGATO;
+				}
+			}
 		}
 		else
 		{
 			// first, try to get a free voice
-			v=getAvailableVoice(note,timestamp);
+			v=getAvailableVoice(p,note,timestamp);
 
 			// no free voice, try to steal one
 			if(v<0)
-				v=getDispensableVoice(note);
+				v=getDispensableVoice(p,note);
 
 			// we might still have no voice
 			if(v<0)
@@ -342,81 +454,46 @@ reassign:
 
 		for(vi=0;vi<SYNTH_VOICE_COUNT;++vi)
 		{
-			if(assigner.patternOffsets[vi]==ASSIGNER_NO_NOTE)
+			if(p->patternOffsets[vi]==ASSIGNER_NO_NOTE)
 				break;
 
-			n=note+assigner.patternOffsets[vi];
+			n=note+p->patternOffsets[vi];
+			bit=(voiceMask_t)1<<v;
 
-			assigner.allocation[v].allocated=1;
-			assigner.allocation[v].gated=1;
-			assigner.allocation[v].keyPressed=1;
+			setAllocation(v,note,n);
+			assigner.gated|=bit;
+			assigner.keyPressed|=bit;
 			assigner.allocation[v].velocity=velocity;
-			assigner.allocation[v].rootNote=note;
-			assigner.allocation[v].note=n;
 			assigner.allocation[v].timestamp=timestamp;
 			assigner.allocation[v].fromKeyboard=fromKeyboard;
 
 			synth_assignerEvent(n,1,v,velocity,flags);
 
-			do
-				v=(v+1)%SYNTH_VOICE_COUNT;
-			while(isVoiceDisabled(v));
+			// next voice of the part, wrapping around
+			set=p->voiceMask&((~(voiceMask_t)0<<v)<<1);
+			v=lowestVoice(set?set:p->voiceMask);
 		}
 	}
-	else if(getNoteAllocation(note)>=0) // note not allocated -> nothing to do
+	else if(getNoteAllocation(p,note)>=0) // note not allocated -> nothing to do
 	{
-		restoredNote=ASSIGNER_NO_NOTE;
-
 		// some still triggered notes might have been stolen, find them
 
-		if(assigner.priority==apLast)
-		{
-			restoredTimestamp=0;
-			for(n=0;n<ASSIGNER_NOTE_COUNT;++n)
-			{
-				if(getNoteState(n,&vel,&ts) && ts>restoredTimestamp && getNoteAllocation(n)<0)
-				{
-					restoredNote=n;
-					restoredVelocity=vel;
-					restoredTimestamp=ts;
-				}
-			}
-		}
-		else
-		{
-			for(ni=0;ni<ASSIGNER_NOTE_COUNT;++ni)
-			{
-				if(assigner.priority==apHigh)
-					n=127-ni;
-				else // apLow
-					n=ni;
-
-				if(getNoteState(n,&vel,NULL) && getNoteAllocation(n)<0)
-				{
-					restoredNote=n;
-					restoredVelocity=vel;
-					break;
-				}
-			}
-		}
+		restoredNote=getRestoredNote(p);
 		
 		if(restoredNote==ASSIGNER_NO_NOTE)
 		{
 			// no note to restore, gate off all voices with rootNote=note
 			
-			for(v=0;v<SYNTH_VOICE_COUNT;++v)
+			for(set=assigner.rootVoices[note]&p->voiceMask;set;set&=set-1)
 			{
-				if(isVoiceDisabled(v))
-					continue;
+				v=lowestVoice(set);
+				bit=(voiceMask_t)1<<v;
 				
-				if(assigner.allocation[v].allocated && assigner.allocation[v].rootNote==note)
+				assigner.keyPressed&=~bit;
+				if(!p->hold)
 				{
-					assigner.allocation[v].keyPressed=0;
-					if(!assigner.hold)
-					{
-						assigner.allocation[v].gated=0;
-						synth_assignerEvent(assigner.allocation[v].note,0,v,velocity,0);
-					}
+					assigner.gated&=~bit;
+					synth_assignerEvent(assigner.allocation[v].note,0,v,velocity,0);
 				}
 			}
 		}
@@ -425,7 +502,7 @@ reassign:
 			// restored notes can be assigned again
 			
 			note=restoredNote;
-			velocity=restoredVelocity;
+			velocity=p->noteVelocities[restoredNote];
 			gate=1;
 			flags=ASSIGNER_EVENT_FLAG_LEGATO;
 			
@@ -434,48 +511,50 @@ reassign:
 	}
 }
 
-LOWERCODESIZE void assigner_setPattern(const uint8_t * pattern, int8_t mono)
+LOWERCODESIZE void assigner_setPattern(int8_t part, const uint8_t * pattern, int8_t mono)
 {
+	struct assignerPart_s * p=&assigner.part[part];
 	int8_t i,count=0;
 	
-	if(mono==assigner.mono && !memcmp(pattern,&assigner.patternOffsets[0],SYNTH_VOICE_COUNT))
+	if(mono==p->mono && !memcmp(pattern,&p->patternOffsets[0],SYNTH_VOICE_COUNT))
 		return;
 
-        assigner_allKeysOff();
+        assigner_allKeysOff(part);
 	
-	assigner.mono=mono;
-	memset(&assigner.patternOffsets[0],ASSIGNER_NO_NOTE,SYNTH_VOICE_COUNT);
+	p->mono=mono;
+	memset(&p->patternOffsets[0],ASSIGNER_NO_NOTE,SYNTH_VOICE_COUNT);
 
 	for(i=0;i<SYNTH_VOICE_COUNT;++i)
 	{
 		if(pattern[i]==ASSIGNER_NO_NOTE)
 			break;
 		
-		assigner.patternOffsets[i]=pattern[i];
+		p->patternOffsets[i]=pattern[i];
 		++count;
 	}
 
 	if(count>0)
 	{
-		assigner.patternOffsets[0]=0; // root note always has offset 0
+		p->patternOffsets[0]=0; // root note always has offset 0
 	}
 	else
 	{
 		// empty pattern means unison
-		memset(&assigner.patternOffsets[0],0,SYNTH_VOICE_COUNT);
+		memset(&p->patternOffsets[0],0,SYNTH_VOICE_COUNT);
 	}
 }
 
-void assigner_getPattern(uint8_t * pattern, int8_t * mono)
+void assigner_getPattern(int8_t part, uint8_t * pattern, int8_t * mono)
 {
-	memcpy(pattern,assigner.patternOffsets,SYNTH_VOICE_COUNT);
+	memcpy(pattern,assigner.part[part].patternOffsets,SYNTH_VOICE_COUNT);
 	
 	if(mono!=NULL)
-		*mono=assigner.mono;
+		*mono=assigner.part[part].mono;
 }
 
-LOWERCODESIZE void assigner_latchPattern(void)
+LOWERCODESIZE void assigner_latchPattern(int8_t part)
 {
+	struct assignerPart_s * p=&assigner.part[part];
 	uint8_t n;
 	int8_t count;
 	uint8_t pattern[SYNTH_VOICE_COUNT];	
@@ -484,7 +563,7 @@ LOWERCODESIZE void assigner_latchPattern(void)
 	memset(pattern,ASSIGNER_NO_NOTE,SYNTH_VOICE_COUNT);
 	
 	for(n=0;n<ASSIGNER_NOTE_COUNT;++n)
-		if(getNoteState(n,NULL,NULL))
+		if(getNoteState(p,n,NULL,NULL))
 		{
 			pattern[count]=n;
 			
@@ -497,42 +576,50 @@ LOWERCODESIZE void assigner_latchPattern(void)
 				break;
 		}
 
-	assigner_setPattern(pattern,1);
+	assigner_setPattern(part,pattern,1);
 }
 
-LOWERCODESIZE void assigner_setPoly(void)
+LOWERCODESIZE void assigner_setPoly(int8_t part)
 {
-	assigner_setPattern(polyPattern,0);
+	uint8_t pattern[SYNTH_VOICE_COUNT];
+	
+	memset(pattern,ASSIGNER_NO_NOTE,SYNTH_VOICE_COUNT);
+	pattern[0]=0;
+	
+	assigner_setPattern(part,pattern,0);
 }
 
-void assigner_holdEvent(int8_t hold)
+void assigner_holdEvent(int8_t part, int8_t hold)
 {
+	struct assignerPart_s * p=&assigner.part[part];
 	int8_t v;
 
 	if (hold) {
-		assigner.hold=1;
+		p->hold=1;
 		return;
 	}
 
-	assigner.hold=0;
+	p->hold=0;
 	// Send gate off to all voices whose corresponding key is up
-	for(v=0;v<SYNTH_VOICE_COUNT;++v) {
-		if (!isVoiceDisabled(v) && 
-		    assigner.allocation[v].gated &&
-		    !assigner.allocation[v].keyPressed) {
-			synth_assignerEvent(assigner.allocation[v].note,0,v,assigner.allocation[v].velocity,0);
-		    	assigner.allocation[v].gated=0;
-		}
+	for(voiceMask_t set=p->voiceMask&assigner.gated&~assigner.keyPressed;set;set&=set-1) {
+		v=lowestVoice(set);
+		synth_assignerEvent(assigner.allocation[v].note,0,v,assigner.allocation[v].velocity,0);
+		assigner.gated&=~((voiceMask_t)1<<v);
 	}
 }
 
 void assigner_init(void)
 {
 	memset(&assigner,0,sizeof(assigner));
-    memset(assigner.noteTimestamps,UINT32_MAX,sizeof(assigner.noteTimestamps));
 
-	assigner.voiceMask=(1<<SYNTH_VOICE_COUNT)-1;
-	memset(&assigner.patternOffsets[0],ASSIGNER_NO_NOTE,SYNTH_VOICE_COUNT);
-	assigner.patternOffsets[0]=0;
-}
+	for(int8_t part=0;part<SYNTH_PART_COUNT;++part)
+	{
+		struct assignerPart_s * p=&assigner.part[part];
+		
+		memset(&p->patternOffsets[0],ASSIGNER_NO_NOTE,SYNTH_VOICE_COUNT);
+		p->patternOffsets[0]=0;
+	}
 
+	// every voice to the main part until others get some
+	assigner.part[0].voiceMask=SYNTH_ALL_VOICES;
+}
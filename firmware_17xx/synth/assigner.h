@@ -13,24 +13,27 @@ typedef enum
 	apLast=0,apLow=1,apHigh=2
 } assignerPriority_t;
 
-void assigner_setPriority(assignerPriority_t prio);
-void assigner_setVoiceMask(uint8_t mask);
+// part: multi-timbral part, 0 is the main one
+
+void assigner_setPriority(int8_t part, assignerPriority_t prio);
+void assigner_setVoiceMask(int8_t part, voiceMask_t mask); // taken from other parts if needed
+voiceMask_t assigner_getVoiceMask(int8_t part);
 
 int8_t assigner_getAssignment(int8_t voice, uint8_t * note);
-int8_t assigner_getAnyPressed(void);
-int8_t assigner_getAnyAssigned(void);
-int8_t assigner_getMono(void);
+int8_t assigner_getAnyPressed(int8_t part);
+int8_t assigner_getAnyAssigned(int8_t part);
+int8_t assigner_getMono(int8_t part);
 
-void assigner_assignNote(uint8_t note, int8_t gate, uint16_t velocity, int8_t fromKeyboard);
+void assigner_assignNote(int8_t part, uint8_t note, int8_t gate, uint16_t velocity, int8_t fromKeyboard);
 void assigner_voiceDone(int8_t voice);
-void assigner_allKeysOff(void);
+void assigner_allKeysOff(int8_t part);
 void assigner_panicOff(void);
 
-void assigner_setPattern(const uint8_t * pattern, int8_t mono);
-void assigner_getPattern(uint8_t * pattern, int8_t * mono);
-void assigner_setPoly(void);
-void assigner_latchPattern(void);
-void assigner_holdEvent(int8_t hold);
+void assigner_setPattern(int8_t part, const uint8_t * pattern, int8_t mono);
+void assigner_getPattern(int8_t part, uint8_t * pattern, int8_t * mono);
+void assigner_setPoly(int8_t part);
+void assigner_latchPattern(int8_t part);
+void assigner_holdEvent(int8_t part, int8_t hold);
 
 void assigner_init(void);
 
@@ -0,0 +1,364 @@
+////////////////////////////////////////////////////////////////////////////////
+// Cycle budget benchmark of the DMA_IRQHandler / PendSV_Handler audio path
+////////////////////////////////////////////////////////////////////////////////
+
+// One DMA interrupt renders half the DAC ring (dacspi_getBlockSize() samples),
+// then pends the control rate task that prepares the next one. Both must be
+// done before the DMA wraps around, ie. the budget is dacspi_getTickRate()
+// cycles per sample, minus whatever the main loop needs.
+
+#include "bench.h"
+
+#include "dacspi.h"
+#include "storage.h"
+#include "assigner.h"
+#include "wtosc.h"
+
+#ifdef HOST_BUILD
+#include <time.h>
+#else
+#define DWT_CTRL (*(volatile uint32_t *)0xE0001000)
+#define DWT_CYCCNT (*(volatile uint32_t *)0xE0001004)
+#define DWT_CTRL_CYCCNTENA 1
+#endif
+
+#define BENCH_SAMPLES_PER_IRQ dacspi_getBlockSize()
+#define BENCH_WMOD_AMOUNT 0xc000
+
+#define BENCH_OSC_SAMPLES_PER_UPDATE (DACSPI_BUFFER_COUNT/4)
+#define BENCH_OSC_LOW_NOTE 24
+#define BENCH_OSC_NOTES 72
+#define BENCH_OSC_UPDATES 16
+#define BENCH_OSC_PASSES 8
+
+static const char * wmNames[wmCount]={"off","aliasing","width","frequency","crossover","folder","bitcrush"};
+static const char * profileNames[dpCount]={"standard","low latency","high rate","power save"};
+static const uint8_t benchNotes[32]= // chained boards play the lower / upper octaves
+{
+	48,55,60,64,67,72,
+	36,43,52,58,62,70,
+	76,79,84,88,91,96,
+	24,31,40,46,50,57,
+	65,69,74,77,81,86,
+	98,100,
+};
+
+// also the interrupt vectors, called directly here
+void DMA_IRQHandler(void);
+void PendSV_Handler(void);
+
+static void benchCycleCounterInit(void)
+{
+#ifndef HOST_BUILD
+	CoreDebug->DEMCR|=CoreDebug_DEMCR_TRCENA_Msk;
+	DWT_CYCCNT=0;
+	DWT_CTRL|=DWT_CTRL_CYCCNTENA;
+#endif
+}
+
+uint32_t bench_getCycles(void)
+{
+#ifdef HOST_BUILD
+	// wall time expressed in target clock cycles, so that the budget is a real time deadline
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ((uint64_t)ts.tv_sec*SYNTH_MASTER_CLOCK)+((uint64_t)ts.tv_nsec*SYNTH_MASTER_CLOCK)/1000000000ULL;
+#else
+	return DWT_CYCCNT;
+#endif
+}
+
+static void benchSetup(dacspiProfile_t profile, oscWModTarget_t wm, int8_t sync, int8_t voiceCount, int8_t unison)
+{
+	assigner_panicOff();
+
+	currentPreset.steppedParameters[spDacProfile]=profile;
+	currentPreset.steppedParameters[spAWModType]=wm;
+	currentPreset.steppedParameters[spBWModType]=wm;
+	currentPreset.steppedParameters[spOscSync]=sync;
+	currentPreset.steppedParameters[spVoiceCount]=voiceCount-1;
+	currentPreset.steppedParameters[spUnison]=unison;
+	currentPreset.continuousParameters[cpABaseWMod]=BENCH_WMOD_AMOUNT;
+	currentPreset.continuousParameters[cpBBaseWMod]=BENCH_WMOD_AMOUNT;
+	currentPreset.continuousParameters[cpAmpSus]=UINT16_MAX;
+
+	synth_refreshFullState(0);
+
+	for(int8_t v=0;v<voiceCount;++v)
+		assigner_assignNote(0,benchNotes[v],1,UINT16_MAX,0);
+}
+
+static void benchPrintRatio(uint32_t num, uint32_t den)
+{
+	uint32_t permil=((uint64_t)num*1000)/den;
+	rprintf(0,"%d.%d%%",permil/10,permil%10);
+}
+
+// a single oscillator through each of the wtosc_update() dispatch table
+// entries, across the keyboard; best of BENCH_OSC_PASSES to reject the noise
+static void benchOscillators(void)
+{
+	static int16_t syncPositions[BENCH_OSC_SAMPLES_PER_UPDATE];
+	struct wtosc_s o;
+	uint32_t start,cycles,best;
+
+	rprintf(0,"\nwtosc_update benchmark, notes %d to %d\n\n",BENCH_OSC_LOW_NOTE,BENCH_OSC_LOW_NOTE+BENCH_OSC_NOTES-1);
+	rprintf(0,"| entry | wmod | sync | data | cyc/smp |\n");
+	rprintf(0,"|-------|------|------|------|---------|\n");
+
+	for(int8_t entry=0;entry<wmCount*2*2;++entry)
+	{
+		oscWModTarget_t wm=entry>>2;
+		int8_t slave=(entry>>1)&1;
+		int8_t data=entry&1;
+
+		best=UINT32_MAX;
+
+		for(int pass=0;pass<BENCH_OSC_PASSES;++pass)
+		{
+			wtosc_init(&o,0);
+			wtosc_setSampleData(&o,data?synth_getWaveformData(abxAMain):NULL,synth_getWaveformData(abxACrossover));
+
+			for(int i=0;i<BENCH_OSC_SAMPLES_PER_UPDATE;++i)
+				syncPositions[i]=INT16_MIN;
+
+			cycles=0;
+
+			for(int note=0;note<BENCH_OSC_NOTES;++note)
+			{
+				wtosc_setParameters(&o,(BENCH_OSC_LOW_NOTE+note)*WTOSC_CV_SEMITONE,wm,BENCH_WMOD_AMOUNT);
+
+				start=bench_getCycles();
+				for(int i=0;i<BENCH_OSC_UPDATES;++i)
+				{
+					if(slave)
+						syncPositions[i]=0; // one sync per update
+
+					wtosc_update(&o,0,BENCH_OSC_SAMPLES_PER_UPDATE-1,slave?osmSlave:osmMaster,syncPositions);
+				}
+				cycles+=bench_getCycles()-start;
+			}
+
+			best=MIN(best,cycles);
+		}
+
+		best=(best*100)/(BENCH_OSC_NOTES*BENCH_OSC_UPDATES*BENCH_OSC_SAMPLES_PER_UPDATE);
+
+		rprintf(0,"| %d | %s | %s | %s | %d.%02d |\n",entry,wmNames[wm],slave?"slave":"master",data?"yes":"no",best/100,best%100);
+	}
+}
+
+// CPU stores to the DAC command buffers while the GPDMA plays the ring (the DMA
+// interrupt is masked, not the channel), against the same stores to local
+// SRAM, in the order oscillators write them; best of BENCH_OSC_PASSES
+static volatile uint16_t localCommands[SYNTH_VOICE_COUNT*2][DACSPI_BUFFER_COUNT];
+
+static void benchBusContention(void)
+{
+	uint32_t start,cycles,dacBest=UINT32_MAX,localBest=UINT32_MAX;
+	const int32_t stores=SYNTH_VOICE_COUNT*2*DACSPI_BUFFER_COUNT;
+
+	for(int pass=0;pass<BENCH_OSC_PASSES;++pass)
+	{
+		start=bench_getCycles();
+		for(int c=0;c<SYNTH_VOICE_COUNT*2;++c)
+			for(int32_t b=0;b<DACSPI_BUFFER_COUNT;++b)
+				dacspi_setOscValue(b,c,HALF_RANGE);
+		cycles=bench_getCycles()-start;
+		dacBest=MIN(dacBest,cycles);
+
+		start=bench_getCycles();
+		for(int c=0;c<SYNTH_VOICE_COUNT*2;++c)
+			for(int32_t b=0;b<DACSPI_BUFFER_COUNT;++b)
+				localCommands[c][b]=(HALF_RANGE>>4)|((c&1)?0xf000:0x7000);
+		cycles=bench_getCycles()-start;
+		localBest=MIN(localBest,cycles);
+	}
+
+	dacBest=(dacBest*100)/stores;
+	localBest=(localBest*100)/stores;
+
+	rprintf(0,"\nCPU stores under DMA load, %d per pass\n\n",stores);
+	rprintf(0,"| target | cyc/store |\n");
+	rprintf(0,"|--------|-----------|\n");
+	rprintf(0,"| local SRAM | %d.%02d |\n",localBest/100,localBest%100);
+	rprintf(0,"| DAC commands, peripheral SRAM | %d.%02d |\n",dacBest/100,dacBest%100);
+}
+
+// one DMA interrupt and the control rate task it pends, returns cycles
+// spent in the interrupt alone through irqCycles
+static uint32_t benchBlock(uint32_t * irqCycles)
+{
+	uint32_t start,mid;
+	
+	start=bench_getCycles();
+	DMA_IRQHandler();
+	mid=bench_getCycles();
+#ifndef HOST_BUILD
+	SCB->ICSR=SCB_ICSR_PENDSVCLR_Msk; // run here instead
+#endif
+	PendSV_Handler();
+	
+	*irqCycles=mid-start;
+	return bench_getCycles()-start;
+}
+
+// prints the "avg cyc/IRQ" to "max load" columns
+static void benchMeasure(void)
+{
+	uint32_t cycles,irqCycles,total,peak,irqTotal,irqPeak;
+
+	for(int i=0;i<BENCH_WARMUP_IRQS;++i)
+		benchBlock(&irqCycles);
+
+	total=0;
+	peak=0;
+	irqTotal=0;
+	irqPeak=0;
+
+	for(int i=0;i<BENCH_MEASURED_IRQS;++i)
+	{
+		cycles=benchBlock(&irqCycles);
+
+		total+=cycles;
+		peak=MAX(peak,cycles);
+		irqTotal+=irqCycles;
+		irqPeak=MAX(irqPeak,irqCycles);
+	}
+
+	rprintf(0,"%d | %d | %d | %d | %d | ",irqTotal/BENCH_MEASURED_IRQS,irqPeak,total/BENCH_MEASURED_IRQS,peak,total/(BENCH_MEASURED_IRQS*BENCH_SAMPLES_PER_IRQ));
+	benchPrintRatio(total,BENCH_MEASURED_IRQS*BENCH_SAMPLES_PER_IRQ*dacspi_getTickRate());
+	rprintf(0," | ");
+	benchPrintRatio(peak,BENCH_SAMPLES_PER_IRQ*dacspi_getTickRate());
+	rprintf(0," |\n");
+}
+
+// heaviest voice setup through each DAC profile
+static void benchProfiles(void)
+{
+	rprintf(0,"\nDAC profiles, %d voices, sync on, wmod folder\n\n",SYNTH_VOICE_COUNT);
+	rprintf(0,"| profile | rate Hz | smp/IRQ | avg cyc/IRQ | max cyc/IRQ | avg cyc/block | max cyc/block | avg cyc/smp | avg load | max load |\n");
+	rprintf(0,"|---------|---------|---------|-------------|-------------|---------------|---------------|-------------|----------|----------|\n");
+
+	for(dacspiProfile_t profile=0;profile<dpCount;++profile)
+	{
+		benchSetup(profile,wmFolder,1,SYNTH_VOICE_COUNT,0);
+
+		rprintf(0,"| %s | %d | %d | ",profileNames[profile],dacspi_getSampleRate(),BENCH_SAMPLES_PER_IRQ);
+		benchMeasure();
+	}
+}
+
+// the same voices split among multi-timbral parts, each part adds its LFOs
+// and CV terms computations; layers play the main preset too
+static void benchParts(void)
+{
+	static struct preset_s savedLayers[SYNTH_PART_COUNT];
+	uint8_t savedParts[sizeof(settings.parts)];
+	int8_t parts,part,perPart;
+	
+	rprintf(0,"\nMulti-timbral parts, %d voices, sync on, wmod folder\n\n",SYNTH_VOICE_COUNT);
+	rprintf(0,"| parts | voices/part | avg cyc/IRQ | max cyc/IRQ | avg cyc/block | max cyc/block | avg cyc/smp | avg load | max load |\n");
+	rprintf(0,"|-------|-------------|-------------|-------------|---------------|---------------|-------------|----------|----------|\n");
+
+	memcpy(savedParts,settings.parts,sizeof(settings.parts));
+	for(part=1;part<SYNTH_PART_COUNT;++part)
+		savedLayers[part]=*synth_getPartPreset(part);
+
+	for(parts=1;parts<=SYNTH_PART_COUNT;++parts)
+	{
+		perPart=SYNTH_VOICE_COUNT/parts;
+		
+		for(part=1;part<SYNTH_PART_COUNT;++part)
+		{
+			settings.parts[part].midiChannel=(part<parts)?part:-1;
+			settings.parts[part].voiceCount=perPart-1;
+		}
+		
+		benchSetup(dpStandard,wmFolder,1,perPart,0);
+
+		for(part=1;part<parts;++part)
+		{
+			*synth_getPartPreset(part)=currentPreset;
+			synth_refreshParts();
+			
+			for(int8_t v=0;v<perPart;++v)
+				assigner_assignNote(part,benchNotes[v],1,UINT16_MAX,0);
+		}
+
+		rprintf(0,"| %d | %d | ",parts,perPart);
+		benchMeasure();
+	}
+
+	memcpy(settings.parts,savedParts,sizeof(settings.parts));
+	for(part=1;part<SYNTH_PART_COUNT;++part)
+		*synth_getPartPreset(part)=savedLayers[part];
+}
+
+// every voice of this build through the heaviest setup, one table row; the
+// host builds the engine for several SYNTH_VOICE_COUNT (make voicescale)
+void bench_runVoiceScaling(int8_t header)
+{
+	static struct preset_s savedPreset;
+
+	savedPreset=currentPreset;
+
+	NVIC_DisableIRQ(DMA_IRQn);
+	benchCycleCounterInit();
+
+	if(header)
+	{
+		rprintf(0,"\nVoice count scaling, standard profile, sync on, wmod folder\n\n");
+		rprintf(0,"| voices | boards | avg cyc/IRQ | max cyc/IRQ | avg cyc/block | max cyc/block | avg cyc/smp | avg load | max load |\n");
+		rprintf(0,"|--------|--------|-------------|-------------|---------------|---------------|-------------|----------|----------|\n");
+	}
+
+	benchSetup(dpStandard,wmFolder,1,SYNTH_VOICE_COUNT,0);
+
+	rprintf(0,"| %d | %d | ",SYNTH_VOICE_COUNT,DACSPI_BOARD_COUNT);
+	benchMeasure();
+
+	assigner_panicOff();
+	currentPreset=savedPreset;
+	synth_refreshFullState(0);
+
+	NVIC_EnableIRQ(DMA_IRQn);
+}
+
+void bench_run(void)
+{
+	static struct preset_s savedPreset;
+
+	savedPreset=currentPreset;
+
+	NVIC_DisableIRQ(DMA_IRQn);
+	benchCycleCounterInit();
+
+	benchSetup(dpStandard,wmOff,0,1,0);
+
+	rprintf(0,"\nDMA_IRQHandler + PendSV_Handler benchmark, %d samples per IRQ, budget %d cycles per sample\n\n",BENCH_SAMPLES_PER_IRQ,dacspi_getTickRate());
+	rprintf(0,"| wmod | sync | voices | unison | avg cyc/IRQ | max cyc/IRQ | avg cyc/block | max cyc/block | avg cyc/smp | avg load | max load |\n");
+	rprintf(0,"|------|------|--------|--------|-------------|-------------|---------------|---------------|-------------|----------|----------|\n");
+
+	for(oscWModTarget_t wm=wmOff;wm<wmCount;++wm)
+		for(int8_t sync=0;sync<2;++sync)
+			for(int8_t vc=1;vc<=SYNTH_VOICE_COUNT;++vc)
+				for(int8_t unison=0;unison<2;++unison)
+				{
+					benchSetup(dpStandard,wm,sync,vc,unison);
+
+					rprintf(0,"| %s | %s | %d | %s | ",wmNames[wm],sync?"on":"off",vc,unison?"on":"off");
+					benchMeasure();
+				}
+
+	benchProfiles();
+	benchParts();
+	benchBusContention();
+	benchOscillators();
+
+	assigner_panicOff();
+	currentPreset=savedPreset;
+	synth_refreshFullState(0);
+
+	NVIC_EnableIRQ(DMA_IRQn);
+}
@@ -0,0 +1,23 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "synth.h"
+
+// Cycle budget benchmark of the DMA_IRQHandler / PendSV_Handler audio path,
+// for every combination of wave mod type, oscillator sync, voice count and
+// unison.
+// Results are printed as a markdown table (see BENCHMARKS.md).
+
+#define BENCH_WARMUP_IRQS 16
+
+#ifdef HOST_BUILD
+#define BENCH_MEASURED_IRQS 512 // host timer is noisy, average more
+#else
+#define BENCH_MEASURED_IRQS 64
+#endif
+
+uint32_t bench_getCycles(void); // free running, SYNTH_MASTER_CLOCK based
+void bench_run(void);
+void bench_runVoiceScaling(int8_t header); // all voices, for this SYNTH_VOICE_COUNT
+
+#endif /* BENCH_H */
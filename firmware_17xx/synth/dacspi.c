@@ -3,6 +3,7 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "dacspi.h"
+#include "w25q.h"
 
 #include "LPC177x_8x.h"
 #include "lpc177x_8x_gpdma.h"
@@ -17,99 +18,182 @@
 #define SPIMUX_PIN_C 16
 
 #define SPIMUX_VAL(c,b,a) (((a)<<SPIMUX_PIN_A)|((b)<<SPIMUX_PIN_B)|((c)<<SPIMUX_PIN_C))
+#define SPIMUX_ADDR(addr) SPIMUX_VAL(((addr)>>2)&1,((addr)>>1)&1,(addr)&1)
 
 #define DACSPI_CMD_SET_A 0x7000
 #define DACSPI_CMD_SET_B 0xf000
 
+#if DACSPI_BOARD_COUNT>1
+#error "a single voice board on the SPI mux, chained boards need their own mux lines & ring slots"
+#endif
+
 #define DACSPI_DMACONFIG \
 		GPDMA_DMACCxConfig_E | \
 		GPDMA_DMACCxConfig_SrcPeripheral(DMA_CHANNEL_UART2_TX__T3_MAT_0) | \
 		GPDMA_DMACCxConfig_TransferType(2) | \
 		GPDMA_DMACCxConfig_ITC
 
-static EXT_RAM GPDMA_LLI_Type lli[DACSPI_BUFFER_COUNT*DACSPI_CHANNEL_COUNT][3];
-static EXT_RAM GPDMA_LLI_Type cvLli[DACSPI_BUFFER_COUNT][4];
-static EXT_RAM volatile uint8_t marker;
-static EXT_RAM uint8_t markerSource[DACSPI_BUFFER_COUNT];
-
-static const uint32_t spiMuxCommandsConst[DACSPI_CHANNEL_COUNT][3] =
+// standard timing: 9 ticks after osc data (225 cycles, 192 needed by 32 SPI bits)
+// and 5 after CV data (125 cycles); other profiles keep at least as much time
+const struct dacspiProfile_s dacspiProfiles[dpCount] =
 {
-	{SPIMUX_VAL(1,0,1),(uint32_t)&LPC_GPIO1->FIOSET,5},
-	{SPIMUX_VAL(1,0,0),(uint32_t)&LPC_GPIO1->FIOCLR,1},
-	{SPIMUX_VAL(0,1,0),(uint32_t)&LPC_GPIO1->FIOSET,3},
-	{SPIMUX_VAL(0,0,1),(uint32_t)&LPC_GPIO1->FIOCLR,2},
-	{SPIMUX_VAL(1,0,0),(uint32_t)&LPC_GPIO1->FIOSET,6},
-	{SPIMUX_VAL(0,1,0),(uint32_t)&LPC_GPIO1->FIOCLR,4},
-	{SPIMUX_VAL(1,0,0),(uint32_t)&LPC_GPIO1->FIOCLR,0},
+	/* dpStandard   */ {64,24,9,3}, // 64000Hz, 32 samples per interrupt
+	/* dpLowLatency */ {32,24,9,3}, // 64000Hz, 16 samples per interrupt
+	/* dpHighRate   */ {64,15,13,6}, // 73529Hz, 208 cycles after osc data, 128 after CV
+	/* dpPowerSave  */ {64,31,9,3}, // 50000Hz
 };
 
+// each DAC slot is a SPI mux write, a data write & a wait (marker transfers paced by TIM3)
+static EXT_RAM_DMA GPDMA_LLI_Type muxLli[DACSPI_BUFFER_COUNT*DACSPI_CHANNEL_COUNT];
+static EXT_RAM_DMA GPDMA_LLI_Type dataLli[DACSPI_BUFFER_COUNT*DACSPI_CHANNEL_COUNT];
+static EXT_RAM_DMA volatile uint8_t marker;
+static EXT_RAM_DMA uint8_t markerSource[DACSPI_BUFFER_COUNT];
+static EXT_RAM_DMA GPDMA_LLI_Type waitLli[DACSPI_BUFFER_COUNT*DACSPI_CHANNEL_COUNT];
+static EXT_RAM_DMA GPDMA_LLI_Type cvLli[DACSPI_BUFFER_COUNT][4];
 
-static const uint16_t oscChannelCommand[SYNTH_VOICE_COUNT*2] = 
+// Overcycler voice board: mux addresses 1 to 6 are the voices DACs, 0 is the CV DAC
+const struct dacspiBoard_s dacspiBoard =
 {
-	DACSPI_CMD_SET_A,DACSPI_CMD_SET_B,
-	DACSPI_CMD_SET_A,DACSPI_CMD_SET_B,
-	DACSPI_CMD_SET_A,DACSPI_CMD_SET_B,
-	DACSPI_CMD_SET_A,DACSPI_CMD_SET_B,
-	DACSPI_CMD_SET_A,DACSPI_CMD_SET_B,
-	DACSPI_CMD_SET_A,DACSPI_CMD_SET_B,
+	.slots={{5,4},{1,0},{3,2},{2,1},{6,5},{4,3},{0,-1}},
+	.ampCV={0,1,2,3,8,9},
+	.cutoffCV={4,15,14,13,12,11},
+	.globalCV=
+	{
+		[cvAVol]=6,[cvBVol]=7,[cvCutoff]=UINT8_MAX,[cvResonance]=5,[cvAPitch]=UINT8_MAX,
+		[cvBPitch]=UINT8_MAX,[cvWaveMod]=UINT8_MAX,[cvAmp]=UINT8_MAX,[cvNoiseVol]=10,
+	},
 };
 
 static struct
 {
-	uint16_t oscCommands[DACSPI_BUFFER_COUNT][SYNTH_VOICE_COUNT*2];
+	// per voice, so that oscillators write contiguously; A & B stay paired for the 32bit DMA read
+	uint16_t oscCommands[SYNTH_VOICE_COUNT][DACSPI_BUFFER_COUNT][2];
 	uint32_t cvCommands[DACSPI_BUFFER_COUNT];
-	uint32_t spiMuxCommands[DACSPI_CHANNEL_COUNT][3];
+	uint32_t spiMuxCommands[DACSPI_CHANNEL_COUNT][2]; // mux lines, GPIO set or clear register
 	uint16_t cr0Pre, cr0Post, sselPre, sselPost;
-	int curSet;
 } dacspi EXT_RAM;
 
+static struct
+{
+	dacspiProfile_t profile;
+	int32_t bufferCount;
+	int32_t curSet;
+	uint32_t tickRate;
+	uint32_t tickAccumulator; // 2Khz timer phases, wraps at SYNTH_MASTER_CLOCK
+	volatile uint32_t playStart; // sample clock, for MIDI input timestamps
+	volatile int8_t playHalf;
+} ring=
+{
+	// standard profile, valid before dacspi_init() as the oscillators are set up first
+	.profile=dpStandard,
+	.bufferCount=64,
+	.tickRate=(24+1)*DACSPI_TIME_CONSTANT(9,3),
+	.playHalf=1,
+};
+
 __attribute__ ((used)) void DMA_IRQHandler(void)
 {
-	static uint8_t phase=0;
+	uint32_t stat=LPC_GPDMA->IntTCStat;
 	
-	LPC_GPDMA->IntTCClear=LPC_GPDMA->IntTCStat; // acknowledge interrupt
+	LPC_GPDMA->IntTCClear=stat; // acknowledge interrupt
+
+	// flash reads share the GPDMA interrupt, no audio block is due if they were alone
+	
+	if(stat&W25Q_DMA_CHANNEL_MASK)
+	{
+		W25Q_dmaInterrupt();
+		
+		if(!(stat&~W25Q_DMA_CHANNEL_MASK))
+			return;
+	}
+
+	int8_t half=marker>=ring.bufferCount/2;
 
 	// when second half is playing, update first and vice-versa
-	dacspi.curSet=(marker>=DACSPI_BUFFER_COUNT/2)?0:DACSPI_BUFFER_COUNT/2;
+	ring.curSet=half?0:ring.bufferCount/2;
+
+	// a new block started playing
+	ring.playStart+=ring.bufferCount/2;
+	ring.playHalf=half;
 
-	// update CVs and DACs (in 2 sets of 16)
+	// render CVs and DACs (in sets of 16) from the parameters computed during the previous block
 	
-	synth_updateCVsEvent();
-	synth_updateOscsEvent(dacspi.curSet,DACSPI_BUFFER_COUNT/4);
+	for(int32_t set=0;set<ring.bufferCount/2;set+=DACSPI_CV_COUNT)
+	{
+		synth_updateOscsEvent(ring.curSet,DACSPI_CV_COUNT);
+		ring.curSet+=DACSPI_CV_COUNT;
+	}
 
-	dacspi.curSet+=DACSPI_CV_COUNT;
-	synth_updateCVsEvent();
-	synth_updateOscsEvent(dacspi.curSet,DACSPI_BUFFER_COUNT/4);
+	// next block control rate work, below MIDI & USB interrupts
+	
+	SCB->ICSR=SCB_ICSR_PENDSVSET_Msk;
+}
 
-	// update timer @ 500Hz
+__attribute__ ((used)) void PendSV_Handler(void)
+{
+	static uint8_t phase=0;
+	
+	// compute next block parameters (in sets of 16)
+
+	for(int8_t sb=0;sb<ring.bufferCount/(DACSPI_CV_COUNT*2);++sb)
+		synth_updateCVsEvent(sb);
+
+	// update timer @ 500Hz, whatever the block size & sample rate
+
+	ring.tickAccumulator+=(ring.bufferCount/2)*ring.tickRate*TICKER_HZ*4;
+	while(ring.tickAccumulator>=SYNTH_MASTER_CLOCK)
+	{
+		ring.tickAccumulator-=SYNTH_MASTER_CLOCK;
 
-	synth_tickTimerEvent(phase);
+		synth_tickTimerEvent(phase);
 
-	++phase;
-	if(phase>=4)
-		phase=0;
+		++phase;
+		if(phase>=4)
+			phase=0;
+	}
+}
+
+// one GPIO write per slot, from the previous slot mux address
+static void buildMuxCommands(void)
+{
+	for(int i=0;i<DACSPI_CHANNEL_COUNT;++i)
+	{
+		uint8_t prev=dacspiBoard.slots[(i+DACSPI_CHANNEL_COUNT-1)%DACSPI_CHANNEL_COUNT].mux;
+		uint8_t cur=dacspiBoard.slots[i].mux;
+		
+		if(cur&~prev)
+		{
+			dacspi.spiMuxCommands[i][0]=SPIMUX_ADDR(cur&~prev);
+			dacspi.spiMuxCommands[i][1]=(uint32_t)&LPC_GPIO1->FIOSET;
+		}
+		else
+		{
+			dacspi.spiMuxCommands[i][0]=SPIMUX_ADDR(prev&~cur);
+			dacspi.spiMuxCommands[i][1]=(uint32_t)&LPC_GPIO1->FIOCLR;
+		}
+	}
 }
 
 static void buildLLIs(int buffer, int channel)
 {
 	int lliPos=buffer*DACSPI_CHANNEL_COUNT+channel;
 	int muxIndex=lliPos%DACSPI_CHANNEL_COUNT;
-	int muxChannel=dacspi.spiMuxCommands[muxIndex][2];
-	int8_t isCVChannel=muxChannel==0;
+	int voice=dacspiBoard.slots[muxIndex].voice;
+	int8_t isCVChannel=voice<0;
 	
-	lli[lliPos][0].SrcAddr=(uint32_t)&dacspi.spiMuxCommands[muxIndex][0];
-	lli[lliPos][0].DstAddr=dacspi.spiMuxCommands[muxIndex][1];
-	lli[lliPos][0].Control=
+	muxLli[lliPos].SrcAddr=(uint32_t)&dacspi.spiMuxCommands[muxIndex][0];
+	muxLli[lliPos].DstAddr=dacspi.spiMuxCommands[muxIndex][1];
+	muxLli[lliPos].Control=
 		GPDMA_DMACCxControl_TransferSize(1) |
 		GPDMA_DMACCxControl_SWidth(2) |
 		GPDMA_DMACCxControl_DWidth(2);
 
 	if(isCVChannel)
 	{
-		lli[lliPos][0].NextLLI=(uint32_t)&cvLli[buffer][0];
+		muxLli[lliPos].NextLLI=(uint32_t)&cvLli[buffer][0];
 
 		cvLli[buffer][0].NextLLI=(uint32_t)&cvLli[buffer][1];
-		cvLli[buffer][1].NextLLI=(uint32_t)&lli[lliPos][1];
+		cvLli[buffer][1].NextLLI=(uint32_t)&dataLli[lliPos];
 
 		cvLli[buffer][0].SrcAddr=(uint32_t)&dacspi.cr0Pre;
 		cvLli[buffer][1].SrcAddr=(uint32_t)&dacspi.sselPre;
@@ -125,40 +209,38 @@ static void buildLLIs(int buffer, int channel)
 	}
 	else
 	{
-		lli[lliPos][0].NextLLI=(uint32_t)&lli[lliPos][1];
+		muxLli[lliPos].NextLLI=(uint32_t)&dataLli[lliPos];
 	}
 	
-	lli[lliPos][1].DstAddr=(uint32_t)&LPC_SSP2->DR;
-	lli[lliPos][1].NextLLI=(uint32_t)&lli[lliPos][2];
-	lli[lliPos][1].Control=
+	dataLli[lliPos].DstAddr=(uint32_t)&LPC_SSP2->DR;
+	dataLli[lliPos].NextLLI=(uint32_t)&waitLli[lliPos];
+	dataLli[lliPos].Control=
 		GPDMA_DMACCxControl_TransferSize(1) |
 		GPDMA_DMACCxControl_SWidth(2) |
 		GPDMA_DMACCxControl_DWidth(1);
 
 	if(isCVChannel)
 	{
-		lli[lliPos][1].SrcAddr=(uint32_t)&dacspi.cvCommands[buffer];
+		dataLli[lliPos].SrcAddr=(uint32_t)&dacspi.cvCommands[buffer];
 	}
 	else
 	{
-		int voice=muxChannel-1;
-		
-		lli[lliPos][1].SrcAddr=(uint32_t)&dacspi.oscCommands[buffer][voice*2];
+		dataLli[lliPos].SrcAddr=(uint32_t)&dacspi.oscCommands[voice][buffer][0];
 	}
 	
-	lli[lliPos][2].SrcAddr=(uint32_t)&markerSource[buffer];
-	lli[lliPos][2].DstAddr=(uint32_t)&marker;
-	lli[lliPos][2].Control=
-		GPDMA_DMACCxControl_TransferSize(isCVChannel?DACSPI_CV_CHANNEL_WAIT_STATES:DACSPI_OSC_CHANNEL_WAIT_STATES) |
+	waitLli[lliPos].SrcAddr=(uint32_t)&markerSource[buffer];
+	waitLli[lliPos].DstAddr=(uint32_t)&marker;
+	waitLli[lliPos].Control=
+		GPDMA_DMACCxControl_TransferSize(isCVChannel?dacspiProfiles[ring.profile].cvWaitStates:dacspiProfiles[ring.profile].oscWaitStates) |
 		GPDMA_DMACCxControl_SWidth(0) |
 		GPDMA_DMACCxControl_DWidth(0);
 
 	if(isCVChannel)
 	{
-		lli[lliPos][2].NextLLI=(uint32_t)&cvLli[buffer][2];
+		waitLli[lliPos].NextLLI=(uint32_t)&cvLli[buffer][2];
 		
 		cvLli[buffer][2].NextLLI=(uint32_t)&cvLli[buffer][3];
-		cvLli[buffer][3].NextLLI=(uint32_t)&lli[(lliPos+1)%(DACSPI_BUFFER_COUNT*DACSPI_CHANNEL_COUNT)][0];
+		cvLli[buffer][3].NextLLI=(uint32_t)&muxLli[(lliPos+1)%(ring.bufferCount*DACSPI_CHANNEL_COUNT)];
 		
 		cvLli[buffer][2].SrcAddr=(uint32_t)&dacspi.sselPost;
 		cvLli[buffer][3].SrcAddr=(uint32_t)&dacspi.cr0Post;
@@ -174,13 +256,13 @@ static void buildLLIs(int buffer, int channel)
 	}
 	else
 	{
-		lli[lliPos][2].NextLLI=(uint32_t)&lli[(lliPos+1)%(DACSPI_BUFFER_COUNT*DACSPI_CHANNEL_COUNT)][0];
+		waitLli[lliPos].NextLLI=(uint32_t)&muxLli[(lliPos+1)%(ring.bufferCount*DACSPI_CHANNEL_COUNT)];
 	}
 }
 
 FORCEINLINE void dacspi_setOscValue(int32_t buffer, int channel, uint16_t value)
 {
-	dacspi.oscCommands[buffer][channel]=(value>>4)|oscChannelCommand[channel];
+	dacspi.oscCommands[channel>>1][buffer][channel&1]=(value>>4)|((channel&1)?DACSPI_CMD_SET_B:DACSPI_CMD_SET_A);
 }
 
 FORCEINLINE void dacspi_setCVValue(int channel, uint16_t value, int8_t noDblBuf)
@@ -189,19 +271,82 @@ FORCEINLINE void dacspi_setCVValue(int channel, uint16_t value, int8_t noDblBuf)
 	
 	if(noDblBuf)
 	{
-		for(int set=0;set<DACSPI_BUFFER_COUNT;set+=DACSPI_CV_COUNT)
+		for(int set=0;set<ring.bufferCount;set+=DACSPI_CV_COUNT)
 			dacspi.cvCommands[channel+set]=cmd;
 	}
 	else
 	{
-		dacspi.cvCommands[channel+dacspi.curSet]=cmd;
+		dacspi.cvCommands[channel+ring.curSet]=cmd;
 	}
 }
 
-void dacspi_init(void)
+static void startRing(dacspiProfile_t profile, int8_t enableIRQ)
 {
 	int i,j;
+	const struct dacspiProfile_s * p=&dacspiProfiles[profile];
+	
+	// stop
+	
+	NVIC_DisableIRQ(DMA_IRQn);
+	TIM_Cmd(LPC_TIM3,DISABLE);
+	LPC_GPDMACH0->CConfig=0;
+	
+	// CVs of the sets the previous ring didn't have
+
+	for(j=ring.bufferCount;ring.bufferCount && j<p->bufferCount;++j)
+		dacspi.cvCommands[j]=dacspi.cvCommands[j%ring.bufferCount];
+	
+	ring.profile=profile;
+	ring.bufferCount=p->bufferCount;
+	ring.tickRate=(p->timerMatch+1)*DACSPI_TIME_CONSTANT(p->oscWaitStates,p->cvWaitStates);
+	ring.playHalf=1; // DMA restarts on the first half
+	
+	// prepare LLIs
+
+	for(j=0;j<ring.bufferCount;++j)
+	{
+		markerSource[j]=j;
+		for(i=0;i<DACSPI_CHANNEL_COUNT;++i)
+			buildLLIs(j,i);
+	}
+
+	// interrupt triggers
+	
+	muxLli[(1)*DACSPI_CHANNEL_COUNT].Control|=GPDMA_DMACCxControl_I;
+	muxLli[(ring.bufferCount/2+1)*DACSPI_CHANNEL_COUNT].Control|=GPDMA_DMACCxControl_I;
+	
+	TIM_MATCHCFG_Type tm;
+	
+	tm.MatchChannel=0;
+	tm.IntOnMatch=DISABLE;
+	tm.ResetOnMatch=ENABLE;
+	tm.StopOnMatch=DISABLE;
+	tm.ExtMatchOutputType=0;
+	tm.MatchValue=dacspiProfiles[profile].timerMatch;
+
+	TIM_ConfigMatch(LPC_TIM3,&tm);
+	
+	// start
+	
+	TIM_Cmd(LPC_TIM3,ENABLE);
+	
+	LPC_GPDMACH0->CSrcAddr=muxLli[0].SrcAddr;
+	LPC_GPDMACH0->CDestAddr=muxLli[0].DstAddr;
+	LPC_GPDMACH0->CLLI=muxLli[0].NextLLI;
+	LPC_GPDMACH0->CControl=muxLli[0].Control;
+
+	LPC_GPDMACH0->CConfig=DACSPI_DMACONFIG;
 	
+	// wait until all CV DACs inits are processed
+	while(marker!=markerSource[0]);
+	while(marker!=markerSource[ring.bufferCount-1]);
+	
+	if(enableIRQ)
+		NVIC_EnableIRQ(DMA_IRQn);
+}
+
+void dacspi_init(void)
+{
 	// reset
 	
 	TIM_Cmd(LPC_TIM3,DISABLE);
@@ -209,7 +354,7 @@ void dacspi_init(void)
 	SSP_Cmd(LPC_SSP2,DISABLE);
 
 	memset(&dacspi,0,sizeof(dacspi));
-	memcpy(dacspi.spiMuxCommands,spiMuxCommandsConst,sizeof(spiMuxCommandsConst));
+	buildMuxCommands();
 
 	// init SPI mux
 
@@ -241,24 +386,12 @@ void dacspi_init(void)
 	dacspi.sselPre=0;
 	dacspi.sselPost=4;
 		
+	// the ring starts as if its last slot just played
 	LPC_GPIO1->FIOCLR=SPIMUX_VAL(1,1,1);
+	LPC_GPIO1->FIOSET=SPIMUX_ADDR(dacspiBoard.slots[DACSPI_CHANNEL_COUNT-1].mux);
 	GPIO_SetDir(SPIMUX_PORT_ABC,1<<8,1);
 	GPIO_ClearValue(SPIMUX_PORT_ABC,1<<8);
 
-	// prepare LLIs
-
-	for(j=0;j<DACSPI_BUFFER_COUNT;++j)
-	{
-		markerSource[j]=j;
-		for(i=0;i<DACSPI_CHANNEL_COUNT;++i)
-			buildLLIs(j,i);
-	}
-
-	// interrupt triggers
-	
-	lli[(1)*DACSPI_CHANNEL_COUNT][0].Control|=GPDMA_DMACCxControl_I;
-	lli[(DACSPI_BUFFER_COUNT/2+1)*DACSPI_CHANNEL_COUNT][0].Control|=GPDMA_DMACCxControl_I;
-	
 	// GPDMA & timer
 	
 	CLKPWR_ConfigPPWR(CLKPWR_PCONP_PCGPDMA,ENABLE);
@@ -276,34 +409,77 @@ void dacspi_init(void)
 	
 	TIM_Init(LPC_TIM3,TIM_TIMER_MODE,&tim);
 	
-	TIM_MATCHCFG_Type tm;
-	
-	tm.MatchChannel=0;
-	tm.IntOnMatch=DISABLE;
-	tm.ResetOnMatch=ENABLE;
-	tm.StopOnMatch=DISABLE;
-	tm.ExtMatchOutputType=0;
-	tm.MatchValue=DACSPI_TIMER_MATCH;
-
-	TIM_ConfigMatch(LPC_TIM3,&tm);
-	
 	NVIC_SetPriority(DMA_IRQn,1);
-	NVIC_EnableIRQ(DMA_IRQn);
+	NVIC_SetPriority(PendSV_IRQn,(1<<__NVIC_PRIO_BITS)-1); // lowest
 
-	// start
-	
-	TIM_Cmd(LPC_TIM3,ENABLE);
-	
-	LPC_GPDMACH0->CSrcAddr=lli[0][0].SrcAddr;
-	LPC_GPDMACH0->CDestAddr=lli[0][0].DstAddr;
-	LPC_GPDMACH0->CLLI=lli[0][0].NextLLI;
-	LPC_GPDMACH0->CControl=lli[0][0].Control;
+	startRing(dpStandard,1);
 
-	LPC_GPDMACH0->CConfig=DACSPI_DMACONFIG;
-	
-	// wait until all CV DACs inits are processed
-	while(marker!=markerSource[0]);
-	while(marker!=markerSource[DACSPI_BUFFER_COUNT-1]);
+	rprintf(0,"sampling at %d Hz, cv update at %d Hz, %d samples per interrupt\n",dacspi_getSampleRate(),dacspi_getUpdateHz(),dacspi_getBlockSize());
+}
+
+void dacspi_setProfile(dacspiProfile_t profile)
+{
+	if(profile>=dpCount)
+		profile=dpStandard;
 	
-	rprintf(0,"sampling at %d Hz, cv update at %d Hz\n",SYNTH_MASTER_CLOCK/DACSPI_TICK_RATE, DACSPI_UPDATE_HZ);
-}
\ No newline at end of file
+	// the DMA interrupt stays masked if it was (eg. during the benchmark)
+	startRing(profile,(NVIC->ISER[DMA_IRQn>>5]>>(DMA_IRQn&0x1f))&1);
+}
+
+dacspiProfile_t dacspi_getProfile(void)
+{
+	return ring.profile;
+}
+
+int32_t dacspi_getBlockSize(void)
+{
+	return ring.bufferCount/2;
+}
+
+uint32_t dacspi_getTickRate(void)
+{
+	return ring.tickRate;
+}
+
+uint32_t dacspi_getSampleRate(void)
+{
+	return SYNTH_MASTER_CLOCK/ring.tickRate;
+}
+
+uint32_t dacspi_getUpdateHz(void)
+{
+	return SYNTH_MASTER_CLOCK/(DACSPI_CV_COUNT*ring.tickRate);
+}
+
+uint32_t dacspi_getTimestamp(void)
+{
+	uint32_t start;
+	int32_t pos;
+	int8_t half;
+
+	// the DMA interrupt might preempt us
+	do
+	{
+		start=ring.playStart;
+		half=ring.playHalf;
+		pos=marker;
+	}
+	while(start!=ring.playStart);
+
+	if(pos>=ring.bufferCount/2)
+	{
+		pos-=ring.bufferCount/2;
+		half^=1;
+	}
+
+	// the DMA entered the next half, its interrupt is still pending
+	if(half)
+		start+=ring.bufferCount/2;
+
+	return start+pos;
+}
+
+uint32_t dacspi_getBlockTimestamp(void)
+{
+	return ring.playStart;
+}
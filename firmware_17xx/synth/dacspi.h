@@ -3,19 +3,61 @@
 
 #include "synth.h"
 
-#define DACSPI_BUFFER_COUNT 64
-#define DACSPI_CV_COUNT 16
-#define DACSPI_CHANNEL_COUNT 7
-#define DACSPI_OSC_CHANNEL_WAIT_STATES 9
-#define DACSPI_CV_CHANNEL_WAIT_STATES 3
-#define DACSPI_TIMER_MATCH 24
-#define DACSPI_TIME_CONSTANT ((DACSPI_CHANNEL_COUNT-1)*(1+1+DACSPI_OSC_CHANNEL_WAIT_STATES)+(1+1+4+DACSPI_CV_CHANNEL_WAIT_STATES)) // one tick per channel per DMA access
+#define DACSPI_BUFFER_COUNT 64 // largest DAC ring, see profiles
+#define DACSPI_CV_COUNT 16 // per CV DAC, also the samples per CV update
+#define DACSPI_CHANNEL_COUNT 7 // SPI mux slots per voice board
+#define DACSPI_BOARD_VOICE_COUNT 6
+#define DACSPI_BOARD_COUNT ((SYNTH_VOICE_COUNT+DACSPI_BOARD_VOICE_COUNT-1)/DACSPI_BOARD_VOICE_COUNT)
+#define DACSPI_CV_CHANNEL_COUNT (DACSPI_BOARD_COUNT*DACSPI_CV_COUNT) // board b CV DAC has channels b*16 to b*16+15
+#define DACSPI_TIME_CONSTANT(oscWS,cvWS) ((DACSPI_CHANNEL_COUNT-1)*(1+1+(oscWS))+(1+1+4+(cvWS))) // one tick per channel per DMA access
 
-#define DACSPI_TICK_RATE ((uint32_t)((DACSPI_TIMER_MATCH+1)*DACSPI_TIME_CONSTANT))
+typedef enum
+{
+	dpStandard=0,dpLowLatency=1,dpHighRate=2,dpPowerSave=3,
 
-#define DACSPI_UPDATE_HZ (SYNTH_MASTER_CLOCK/(DACSPI_CV_COUNT*DACSPI_TICK_RATE))
+	// /!\ this must stay last
+	dpCount
+} dacspiProfile_t;
+
+// DAC ring size and DMA pacing; wait states pad each channel so that its SPI
+// transfer is done before the mux moves on, they depend on the timer period
+struct dacspiProfile_s
+{
+	uint8_t bufferCount; // multiple of DACSPI_CV_COUNT*2, up to DACSPI_BUFFER_COUNT
+	uint8_t timerMatch; // timer ticks per DMA access, minus one
+	uint8_t oscWaitStates;
+	uint8_t cvWaitStates;
+};
+
+extern const struct dacspiProfile_s dacspiProfiles[dpCount];
+
+// DACs of a voice board behind its SPI mux: one A / B oscillators DAC per
+// voice and the CV DAC; chained boards repeat the layout with their voices
+// and CV channels offset by the board index
+struct dacspiBoard_s
+{
+	struct
+	{
+		uint8_t mux; // SPI mux address
+		int8_t voice; // on the board, -1 for the CV DAC
+	} slots[DACSPI_CHANNEL_COUNT]; // DMA order, each step only sets or only clears mux lines
+	
+	uint8_t ampCV[DACSPI_BOARD_VOICE_COUNT];
+	uint8_t cutoffCV[DACSPI_BOARD_VOICE_COUNT];
+	uint8_t globalCV[cvCount]; // CVs the board voices share, UINT8_MAX for per voice ones
+};
+
+extern const struct dacspiBoard_s dacspiBoard;
 
 void dacspi_init(void);
+void dacspi_setProfile(dacspiProfile_t profile); // rebuilds & restarts the DAC ring
+dacspiProfile_t dacspi_getProfile(void);
+int32_t dacspi_getBlockSize(void); // samples per DMA interrupt, ie. half the ring
+uint32_t dacspi_getTickRate(void); // SYNTH_MASTER_CLOCK cycles per sample
+uint32_t dacspi_getSampleRate(void);
+uint32_t dacspi_getUpdateHz(void); // CVs update rate
+uint32_t dacspi_getTimestamp(void); // sample being played, ISR safe
+uint32_t dacspi_getBlockTimestamp(void); // first sample of the block being played
 void dacspi_setOscValue(int32_t buffer, int channel, uint16_t value); // 16bit value
 void dacspi_setCVValue(int channel, uint16_t value, int8_t noDblBuf); // 16bit value
 
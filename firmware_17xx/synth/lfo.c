@@ -16,7 +16,7 @@ static inline void updateSpeed(struct lfo_s * lfo)
 {
 	int32_t spd;
 	
-	spd=((1LL<<24)*scan_potFrom16bits(lfo->bpmCV))/(DACSPI_UPDATE_HZ*30);
+	spd=((1LL<<24)*scan_potFrom16bits(lfo->bpmCV))/(dacspi_getUpdateHz()*30);
 	spd<<=lfo->speedShift;
 
 	lfo->speed=spd;
@@ -58,6 +58,12 @@ void lfo_setSpeedShift(struct lfo_s * lfo, int8_t shift)
 	}
 }
 
+void lfo_refreshSpeed(struct lfo_s * lfo)
+{
+	updateSpeed(lfo);
+	updateIncrement(lfo);
+}
+
 int16_t inline lfo_getOutput(struct lfo_s * lfo)
 {
 	return lfo->output;
@@ -29,6 +29,7 @@ struct lfo_s
 void lfo_setCVs(struct lfo_s * lfo, uint16_t spd, uint16_t lvl);
 void lfo_setShape(struct lfo_s * lfo, lfoShape_t shape, uint8_t halfPeriods); // set halfPeriods to 0 for unlimited periods
 void lfo_setSpeedShift(struct lfo_s * lfo, int8_t shift);
+void lfo_refreshSpeed(struct lfo_s * lfo); // after a DAC profile change
 
 int16_t lfo_getOutput(struct lfo_s * lfo);
 const char * lfo_shapeName(lfoShape_t shape);
@@ -0,0 +1,537 @@
+////////////////////////////////////////////////////////////////////////////////
+// Log structured key / value store on a reserved flash region
+////////////////////////////////////////////////////////////////////////////////
+
+// Each sector starts with a header and a checkpoint of the whole key index,
+// records follow. Headers are programmed last, a sector without a valid one
+// is blank or was torn while opening. Header sequence numbers are
+// lap*LOGSTORE_SECTOR_COUNT+sector: sectors up to the head are on the lap of
+// sector 0, the ones after it on the previous lap, so mounting is a binary
+// search for the head, then its checkpoint and a replay of its records.
+// Before the oldest sectors come round again, their live records are copied
+// to the head.
+
+#include <stddef.h>
+
+#include "logstore.h"
+
+#include "w25q.h"
+#include "nor.h"
+#include "ff.h"
+#include "utils.h"
+
+#define LOGSTORE_MAGIC 0x314c5343 // "CSL1"
+#define LOGSTORE_BLANK_KEY 0xffff
+#define LOGSTORE_RESERVED_SECTORS 2 // only garbage collection can open those
+#define LOGSTORE_GC_FREE_SECTORS 8 // garbage collection keeps that many free
+#define LOGSTORE_CHUNK 64 // flash to flash copies & compares
+
+#define ALIGN4(x) (((x)+3)&~3)
+
+struct sectorHeader_s
+{
+	uint32_t magic;
+	uint32_t seq; // lap*LOGSTORE_SECTOR_COUNT+sector
+	uint16_t keyCount; // checkpoint entries following the header
+	uint16_t reserved;
+	uint32_t checkpointCrc;
+	uint32_t crc; // of the above
+};
+
+struct entry_s
+{
+	uint16_t key;
+	uint16_t sector;
+	uint16_t offset; // of the record header
+	uint16_t size;
+};
+
+struct recordHeader_s
+{
+	uint16_t key;
+	uint16_t size; // 0: key removed
+	uint32_t crc; // of key, size & payload
+};
+
+static struct
+{
+	struct entry_s index[LOGSTORE_MAX_KEYS]; // sorted by key
+	uint16_t keyCount;
+	uint32_t firstSector; // W25Q sector of the region start
+	uint32_t headSeq;
+	uint16_t writePos; // in the head sector
+	int8_t mounted;
+	int8_t nextErased; // the sector after the head is blank, or being erased
+} logstore EXT_RAM;
+
+static uint32_t crc32(uint32_t crc, const void * data, uint32_t size)
+{
+	const uint8_t * p=data;
+
+	crc=~crc;
+	while(size--)
+	{
+		crc^=*p++;
+		for(int8_t i=0;i<8;++i)
+			crc=(crc>>1)^(0xedb88320&-(crc&1));
+	}
+
+	return ~crc;
+}
+
+static inline uint16_t headSector(void)
+{
+	return logstore.headSeq%LOGSTORE_SECTOR_COUNT;
+}
+
+static inline uint32_t address(uint16_t sector, uint16_t offset)
+{
+	return ((logstore.firstSector+sector)<<W25Q_SECTOR_BITS)+offset;
+}
+
+static inline uint16_t recordLength(uint16_t size)
+{
+	return ALIGN4(sizeof(struct recordHeader_s)+size);
+}
+
+static inline uint16_t checkpointEnd(uint16_t keyCount)
+{
+	return ALIGN4(sizeof(struct sectorHeader_s)+keyCount*sizeof(struct entry_s));
+}
+
+static inline uint32_t headerCrc(const struct recordHeader_s * rh)
+{
+	return crc32(0,rh,offsetof(struct recordHeader_s,crc));
+}
+
+// where key is or would go
+static uint16_t findEntry(uint16_t key)
+{
+	uint16_t lo=0,hi=logstore.keyCount;
+
+	while(lo<hi)
+	{
+		uint16_t mid=(lo+hi)/2;
+
+		if(logstore.index[mid].key<key)
+			lo=mid+1;
+		else
+			hi=mid;
+	}
+
+	return lo;
+}
+
+static struct entry_s * getEntry(uint16_t key)
+{
+	uint16_t i=findEntry(key);
+
+	if(i<logstore.keyCount && logstore.index[i].key==key)
+		return &logstore.index[i];
+
+	return NULL;
+}
+
+static int8_t applyRecord(uint16_t key, uint16_t sector, uint16_t offset, uint16_t size)
+{
+	uint16_t i=findEntry(key);
+	struct entry_s * e=&logstore.index[i];
+	int8_t found=i<logstore.keyCount && e->key==key;
+
+	if(!size)
+	{
+		if(found)
+		{
+			memmove(e,e+1,(logstore.keyCount-i-1)*sizeof(struct entry_s));
+			--logstore.keyCount;
+		}
+		return 1;
+	}
+
+	if(!found)
+	{
+		if(logstore.keyCount>=LOGSTORE_MAX_KEYS)
+			return 0;
+
+		memmove(e+1,e,(logstore.keyCount-i)*sizeof(struct entry_s));
+		++logstore.keyCount;
+		e->key=key;
+	}
+
+	e->sector=sector;
+	e->offset=offset;
+	e->size=size;
+
+	return 1;
+}
+
+static int8_t readHeader(uint16_t sector, struct sectorHeader_s * h)
+{
+	W25Q_read(address(sector,0),(uint8_t *)h,sizeof(struct sectorHeader_s));
+
+	return h->magic==LOGSTORE_MAGIC &&
+			h->seq%LOGSTORE_SECTOR_COUNT==sector &&
+			h->keyCount<=LOGSTORE_MAX_KEYS &&
+			h->crc==crc32(0,h,offsetof(struct sectorHeader_s,crc));
+}
+
+static uint32_t flashPayloadCrc(const struct recordHeader_s * rh, uint32_t addr)
+{
+	uint8_t buf[LOGSTORE_CHUNK];
+	uint32_t crc=headerCrc(rh);
+
+	for(uint16_t done=0;done<rh->size;done+=LOGSTORE_CHUNK)
+	{
+		uint16_t count=MIN(rh->size-done,LOGSTORE_CHUNK);
+
+		W25Q_read(addr+done,buf,count);
+		crc=crc32(crc,buf,count);
+	}
+
+	return crc;
+}
+
+static int8_t sameAsFlash(const struct entry_s * e, const uint8_t * data)
+{
+	uint8_t buf[LOGSTORE_CHUNK];
+	uint32_t addr=address(e->sector,e->offset+sizeof(struct recordHeader_s));
+
+	for(uint16_t done=0;done<e->size;done+=LOGSTORE_CHUNK)
+	{
+		uint16_t count=MIN(e->size-done,LOGSTORE_CHUNK);
+
+		W25Q_read(addr+done,buf,count);
+		if(memcmp(buf,&data[done],count))
+			return 0;
+	}
+
+	return 1;
+}
+
+// sectors that can be opened before reaching the one of the oldest live record
+static uint16_t freeSectors(uint16_t * oldestSector)
+{
+	uint16_t head=headSector(),oldest=0,age;
+
+	for(uint16_t i=0;i<logstore.keyCount;++i)
+	{
+		age=(head+LOGSTORE_SECTOR_COUNT-logstore.index[i].sector)%LOGSTORE_SECTOR_COUNT;
+		oldest=MAX(oldest,age);
+	}
+
+	if(oldestSector)
+		*oldestSector=(head+LOGSTORE_SECTOR_COUNT-oldest)%LOGSTORE_SECTOR_COUNT;
+
+	return LOGSTORE_SECTOR_COUNT-1-oldest;
+}
+
+static int8_t openNext(uint16_t reserved)
+{
+	struct sectorHeader_s h;
+	uint16_t next=(headSector()+1)%LOGSTORE_SECTOR_COUNT;
+	uint16_t checkpointSize=logstore.keyCount*sizeof(struct entry_s);
+
+	if(freeSectors(NULL)<=reserved)
+		return 0;
+
+	if(logstore.nextErased)
+		W25Q_wait(); // only blocks when saves come too close to each other
+	else
+		W25Q_eraseSector(logstore.firstSector+next);
+
+	h.magic=LOGSTORE_MAGIC;
+	h.seq=logstore.headSeq+1;
+	h.keyCount=logstore.keyCount;
+	h.reserved=0xffff;
+	h.checkpointCrc=crc32(0,logstore.index,checkpointSize);
+	h.crc=crc32(0,&h,offsetof(struct sectorHeader_s,crc));
+
+	// the header validates the sector, it goes last
+	W25Q_program(address(next,sizeof(h)),(const uint8_t *)logstore.index,checkpointSize);
+	W25Q_program(address(next,0),(const uint8_t *)&h,sizeof(h));
+
+	logstore.headSeq=h.seq;
+	logstore.writePos=checkpointEnd(h.keyCount);
+	logstore.nextErased=0;
+
+	return 1;
+}
+
+static int8_t reserve(uint16_t length, uint16_t reserved)
+{
+	// a checkpoint and a record always fit in a sector
+	if(logstore.writePos+length<=W25Q_SECTOR_SIZE)
+		return 1;
+
+	return openNext(reserved);
+}
+
+// moves the oldest live record to the head
+static void collect(void)
+{
+	uint8_t buf[LOGSTORE_CHUNK];
+	uint16_t oldestSector,length;
+	uint32_t from,to;
+	struct entry_s * e=NULL;
+
+	freeSectors(&oldestSector);
+
+	for(uint16_t i=0;i<logstore.keyCount && !e;++i)
+		if(logstore.index[i].sector==oldestSector)
+			e=&logstore.index[i];
+
+	if(!e || oldestSector==headSector())
+		return;
+
+	length=sizeof(struct recordHeader_s)+e->size;
+
+	if(!reserve(length,0))
+		return;
+
+	// records don't depend on where they are, the bytes are moved as they are
+	from=address(e->sector,e->offset);
+	to=address(headSector(),logstore.writePos);
+
+	for(uint16_t done=0;done<length;done+=LOGSTORE_CHUNK)
+	{
+		uint16_t count=MIN(length-done,LOGSTORE_CHUNK);
+
+		W25Q_read(from+done,buf,count);
+		W25Q_program(to+done,buf,count);
+	}
+
+	e->sector=headSector();
+	e->offset=logstore.writePos;
+	logstore.writePos+=ALIGN4(length);
+}
+
+static int8_t mount(void)
+{
+	struct sectorHeader_s h;
+	uint16_t head,pos;
+	uint32_t lap;
+
+	if(readHeader(0,&h))
+	{
+		uint16_t lo=0,hi=LOGSTORE_SECTOR_COUNT-1;
+
+		lap=h.seq/LOGSTORE_SECTOR_COUNT;
+
+		while(lo<hi)
+		{
+			uint16_t mid=(lo+hi+1)/2;
+
+			if(readHeader(mid,&h) && h.seq/LOGSTORE_SECTOR_COUNT==lap)
+				lo=mid;
+			else
+				hi=mid-1;
+		}
+
+		head=lo;
+	}
+	else if(readHeader(LOGSTORE_SECTOR_COUNT-1,&h))
+	{
+		// sector 0 was about to be opened
+		head=LOGSTORE_SECTOR_COUNT-1;
+	}
+	else
+	{
+		// blank, the first record opens sector 0
+		logstore.headSeq=LOGSTORE_SECTOR_COUNT-1;
+		logstore.writePos=W25Q_SECTOR_SIZE;
+		return 1;
+	}
+
+	if(!readHeader(head,&h))
+		return 0;
+
+	W25Q_read(address(head,sizeof(h)),(uint8_t *)logstore.index,h.keyCount*sizeof(struct entry_s));
+	if(crc32(0,logstore.index,h.keyCount*sizeof(struct entry_s))!=h.checkpointCrc)
+		return 0;
+
+	logstore.keyCount=h.keyCount;
+	logstore.headSeq=h.seq;
+
+	// replay the records of the head, up to blank flash or a torn one
+	for(pos=checkpointEnd(h.keyCount);pos+sizeof(struct recordHeader_s)<=W25Q_SECTOR_SIZE;)
+	{
+		struct recordHeader_s rh;
+
+		W25Q_read(address(head,pos),(uint8_t *)&rh,sizeof(rh));
+
+		if(rh.key==LOGSTORE_BLANK_KEY && rh.size==0xffff && rh.crc==0xffffffff)
+			break;
+
+		if(rh.size>LOGSTORE_MAX_SIZE || pos+recordLength(rh.size)>W25Q_SECTOR_SIZE ||
+				flashPayloadCrc(&rh,address(head,pos+sizeof(rh)))!=rh.crc ||
+				!applyRecord(rh.key,head,pos,rh.size))
+		{
+			// the sector takes no more records
+			pos=W25Q_SECTOR_SIZE;
+			break;
+		}
+
+		pos+=recordLength(rh.size);
+	}
+
+	logstore.writePos=pos;
+
+	return 1;
+}
+
+// the region is a preallocated file made of a single cluster run
+static int8_t openRegion(void)
+{
+	FIL f;
+	DWORD linkMap[4]; // size, one fragment, terminator
+	struct sectorHeader_s h;
+	uint32_t size=LOGSTORE_SECTOR_COUNT*W25Q_SECTOR_SIZE;
+	int8_t created,res=0;
+
+	if(f_open(&f,LOGSTORE_PATH,FA_READ|FA_WRITE|FA_OPEN_ALWAYS))
+		return 0;
+
+	// expands the file, its data isn't written
+	created=!f_size(&f);
+	if(created)
+		f_lseek(&f,size);
+
+	linkMap[0]=sizeof(linkMap)/sizeof(DWORD);
+	f.cltbl=linkMap;
+
+	if(f_size(&f)==size && !f_lseek(&f,CREATE_LINKMAP) && linkMap[1]*f.fs->csize>=LOGSTORE_SECTOR_COUNT)
+	{
+		logstore.firstSector=f.fs->database+(linkMap[2]-2)*f.fs->csize;
+		res=1;
+	}
+
+	f.cltbl=NULL;
+	f_close(&f);
+
+	if(!res)
+	{
+		// fragmented volume, will be tried again on next mount
+		if(created)
+			f_unlink(LOGSTORE_PATH);
+		return 0;
+	}
+
+	if(created)
+	{
+		nor_releaseSectors(logstore.firstSector,LOGSTORE_SECTOR_COUNT);
+
+		// a deleted store might have been there
+		for(uint16_t s=0;s<LOGSTORE_SECTOR_COUNT;++s)
+			if(readHeader(s,&h))
+				W25Q_eraseSector(logstore.firstSector+s);
+	}
+
+	return 1;
+}
+
+int8_t logstore_init(void)
+{
+	W25Q_wait(); // erase ahead of the previous mount
+
+	memset(&logstore,0,sizeof(logstore));
+
+	if(!openRegion() || !mount())
+	{
+		memset(&logstore,0,sizeof(logstore));
+		rprintf(0,"logstore: not mounted, text files only\n");
+		return 0;
+	}
+
+	logstore.mounted=1;
+
+#ifdef DEBUG
+	rprintf(0,"logstore: %d keys, head %d\n",logstore.keyCount,headSector());
+#endif
+
+	return 1;
+}
+
+void logstore_update(void)
+{
+	if(!logstore.mounted || W25Q_isBusy())
+		return;
+
+	// blank sector for the next open, so that saves never wait on an erase
+	if(!logstore.nextErased)
+	{
+		if(freeSectors(NULL))
+		{
+			W25Q_eraseSectorAsync(logstore.firstSector+(headSector()+1)%LOGSTORE_SECTOR_COUNT);
+			logstore.nextErased=1;
+		}
+		return;
+	}
+
+	if(freeSectors(NULL)<LOGSTORE_GC_FREE_SECTORS)
+		collect();
+}
+
+int32_t logstore_getSize(uint16_t key)
+{
+	struct entry_s * e;
+
+	if(!logstore.mounted || !(e=getEntry(key)))
+		return -1;
+
+	return e->size;
+}
+
+int8_t logstore_read(uint16_t key, void * data, uint16_t size)
+{
+	struct recordHeader_s rh;
+	struct entry_s * e;
+
+	if(!logstore.mounted || !(e=getEntry(key)) || e->size!=size)
+		return 0;
+
+	W25Q_read(address(e->sector,e->offset),(uint8_t *)&rh,sizeof(rh));
+	W25Q_read(address(e->sector,e->offset+sizeof(rh)),data,size);
+
+	return rh.key==key && rh.size==size && rh.crc==crc32(headerCrc(&rh),data,size);
+}
+
+int8_t logstore_write(uint16_t key, const void * data, uint16_t size)
+{
+	struct recordHeader_s rh;
+	struct entry_s * e;
+	uint16_t pos;
+
+	if(!logstore.mounted || size>LOGSTORE_MAX_SIZE || key==LOGSTORE_BLANK_KEY)
+		return 0;
+
+	e=getEntry(key);
+
+	// unchanged
+	if(e?(e->size==size && sameAsFlash(e,data)):!size)
+		return 1;
+
+	if(!e && logstore.keyCount>=LOGSTORE_MAX_KEYS)
+		return 0;
+
+	if(!reserve(recordLength(size),LOGSTORE_RESERVED_SECTORS))
+		return 0;
+
+	rh.key=key;
+	rh.size=size;
+	rh.crc=crc32(headerCrc(&rh),data,size);
+
+	// header first, a torn payload then fails its CRC instead of looking blank
+	pos=logstore.writePos;
+	W25Q_program(address(headSector(),pos),(const uint8_t *)&rh,sizeof(rh));
+	W25Q_program(address(headSector(),pos+sizeof(rh)),data,size);
+
+	logstore.writePos+=recordLength(size);
+	applyRecord(key,headSector(),pos,size);
+
+	return 1;
+}
+
+int8_t logstore_remove(uint16_t key)
+{
+	return logstore_write(key,NULL,0);
+}
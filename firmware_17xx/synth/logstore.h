@@ -0,0 +1,29 @@
+#ifndef LOGSTORE_H
+#define	LOGSTORE_H
+
+#include "synth.h"
+
+// Log structured key / value store, for the objects saved often (settings,
+// presets, sequencer tracks): records are appended with a CRC, erase blocks
+// are used round robin, so wear spreads over the whole region, and erases only
+// ever happen ahead of time, from logstore_update().
+//
+// The region is a preallocated contiguous file on the FatFs volume, accessed
+// as raw flash sectors; FatFs keeps the rest (waves, text files, USB disk).
+
+#define LOGSTORE_PATH "/overcycler.store"
+#define LOGSTORE_SECTOR_COUNT 256 // 1MB
+#define LOGSTORE_MAX_KEYS 128
+#define LOGSTORE_MAX_SIZE 1024 // per record
+
+#define LOGSTORE_KEY(type,id) (((type)<<12)|(id)) // 4 bits type, 12 bits id
+
+int8_t logstore_init(void); // (re)mount, FatFs must be mounted
+void logstore_update(void); // main loop: erase ahead, garbage collection
+
+int32_t logstore_getSize(uint16_t key); // -1: no such key
+int8_t logstore_read(uint16_t key, void * data, uint16_t size); // whole record, size must match
+int8_t logstore_write(uint16_t key, const void * data, uint16_t size); // 0: not mounted or full
+int8_t logstore_remove(uint16_t key);
+
+#endif	/* LOGSTORE_H */
@@ -2,19 +2,32 @@
 // MIDI handling
 ////////////////////////////////////////////////////////////////////////////////
 
+#include <stddef.h>
+
 #include "midi.h"
 
 #include "storage.h"
 #include "ui.h"
 #include "arp.h"
 #include "seq.h"
+#include "dacspi.h"
+#include "sysex.h"
+#include "uart_midi.h"
 
 #include "../xnormidi/midi_device.h"
+#include "../xnormidi/bytequeue/bytequeue.h"
+#include "../usb/usb_midi.h"
 
 #define NOTE_TRANSPOSE_OFFSET -12
 
 #define PENDING_UPDATE_TIMEOUT (TICKER_HZ/5)
 
+#define MIDI_STAMP_COUNT 32 // power of 2
+
+#define MIDI_OUT_QUEUE_SIZE 256 // power of 2, ~80ms at 31250 bauds
+
+#define REFRESH_PRESET_MODIFIED 0x8000 // along refreshFlags_t
+
 enum midiCC_e
 {
 	ccNone=0,ccFree,
@@ -177,14 +190,70 @@ const struct midiCC_s midiCCs[128]={
 	{ccNone},
 };
 
+struct midiAction_s;
+
+// returns what the change needs refreshed, 0 when nothing changed
+typedef uint16_t (*midiActionFunc_t)(const struct midiAction_s * a, midiPort_t port, int8_t part, uint8_t value);
+
+// what a CC does, resolved from midiCCs[] once by midi_init()
+struct midiAction_s
+{
+	midiActionFunc_t apply;
+	uint16_t offset; // preset parameter, if any, in the part struct preset_s
+	uint8_t steps; // stepped parameters value count
+	int8_t number;
+	uint16_t refresh;
+};
+
+// channel messages, by status high nibble (0x8-0xe)
+typedef void (*midiHandler_t)(midiPort_t port, int8_t part, uint8_t d1, uint8_t d2);
+
+struct midiMessage_s
+{
+	uint8_t length;
+	midiHandler_t handler;
+};
+
+// per port input decoding state
+struct midiParser_s
+{
+	uint8_t status; // running status, 0 when there's none
+	uint8_t length;
+	uint8_t count;
+	uint8_t data[2];
+	int8_t inSysex;
+};
+
+// input timestamps, one per midi_newData() call, written by the UART / USB
+// interrupts and read by the control rate task
+struct midiStamps_s
+{
+	uint32_t time[MIDI_STAMP_COUNT];
+	uint8_t count[MIDI_STAMP_COUNT];
+	volatile uint16_t head,tail;
+};
+
 static struct
 {
 	MidiDevice device[mpCount];
+	struct midiStamps_s stamps[mpCount];
+	struct midiParser_s parser[mpCount];
+	struct midiAction_s ccActions[128];
 	int8_t isNrpnStepped[mpCount];
 	int8_t currentNrpn[mpCount];
 	uint32_t presetTimeout;
+	uint32_t partPresetTimeout[SYNTH_PART_COUNT]; // layers
+	uint16_t pendingRefresh[SYNTH_PART_COUNT]; // parameter changes, applied once per CV tick
 	uint32_t pendingBankWaveTimeout[abxCount];
-} midi EXT_RAM;
+
+	// MIDI out, filled from any context, drained by the UART
+	byteQueue_t outQueue;
+	uint8_t outData[MIDI_OUT_QUEUE_SIZE];
+	uint8_t outRunningStatus;
+	uint32_t outDrops;
+	uint16_t echoedContinuous[cpCount];
+	uint8_t echoedStepped[spCount];
+} midi;
 
 static uint16_t combineBytes(uint8_t first, uint8_t second)
 {
@@ -200,77 +269,140 @@ static int8_t filterChannel(uint8_t channel)
 	return settings.midiReceiveChannel<0 || (channel&MIDI_CHANMASK)==settings.midiReceiveChannel;
 }
 
-static midiPort_t getPort(MidiDevice * device)
+// layers with voices have their own channel, -1 if none
+static int8_t getChannelLayer(uint8_t channel)
 {
-	for(midiPort_t port=0;port<mpCount;++port)
-		if(device==&midi.device[port])
-			return port;
+	for(int8_t part=1;part<SYNTH_PART_COUNT;++part)
+		if(settings.parts[part].midiChannel==(channel&MIDI_CHANMASK) && assigner_getVoiceMask(part))
+			return part;
 	return -1;
 }
 
-static int8_t setContinuousParameterCoarse(continuousParameter_t param, uint8_t value)
+static uint8_t getOutputChannel(void)
 {
-	if((currentPreset.continuousParameters[param]>>9)!=value)
+	return MAX(0,settings.midiReceiveChannel);
+}
+
+static int16_t findCC(enum midiCC_e type, int8_t number)
+{
+	for(int16_t cc=0;cc<128;++cc)
+		if(midiCCs[cc].type==type && midiCCs[cc].number==number)
+			return cc;
+	return -1;
+}
+
+static int8_t sendOutput(const uint8_t * data, uint16_t count)
+{
+	int8_t res=0;
+
+	// whole messages or nothing, they can come from any context
+	BLOCK_INT(1)
 	{
-		currentPreset.continuousParameters[param]&=0x01fc;
-		currentPreset.continuousParameters[param]|=(uint16_t)value<<9;
-		return 1;	
+		if(bytequeue_room(&midi.outQueue)<count)
+		{
+			++midi.outDrops;
+		}
+		else
+		{
+			for(uint16_t i=0;i<count;++i)
+			{
+				uint8_t b=data[i];
+
+				// running status, cancelled by system common / SysEx, not by realtime
+				if(b>=0x80 && b<0xf0)
+				{
+					if(b==midi.outRunningStatus)
+						continue;
+					midi.outRunningStatus=b;
+				}
+				else if(b>=0xf0 && b<0xf8)
+				{
+					midi.outRunningStatus=0;
+				}
+
+				bytequeue_enqueue(&midi.outQueue,b);
+			}
+
+			uartMidi_startTransmit();
+			res=1;
+		}
+	}
+
+	return res;
+}
+
+static uint16_t parameterRefresh(int8_t isStepped, uint8_t param)
+{
+	return synth_getParameterRefresh(isStepped,param)|REFRESH_PRESET_MODIFIED;
+}
+
+static uint16_t setContinuousParameterCoarse(struct preset_s * p, continuousParameter_t param, uint8_t value)
+{
+	if((p->continuousParameters[param]>>9)!=value)
+	{
+		p->continuousParameters[param]&=0x01fc;
+		p->continuousParameters[param]|=(uint16_t)value<<9;
+		return parameterRefresh(0,param);	
 	}
 	return 0;	
 }
 
-static int8_t setContinuousParameterFine(continuousParameter_t param, uint8_t value)
+static uint16_t setContinuousParameterFine(struct preset_s * p, continuousParameter_t param, uint8_t value)
 {
-	if(((currentPreset.continuousParameters[param]>>2)&0x7f)!=value)
+	if(((p->continuousParameters[param]>>2)&0x7f)!=value)
 	{
-		currentPreset.continuousParameters[param]&=0xfe00;
-		currentPreset.continuousParameters[param]|=(uint16_t)value<<2;
-		return 1;	
+		p->continuousParameters[param]&=0xfe00;
+		p->continuousParameters[param]|=(uint16_t)value<<2;
+		return parameterRefresh(0,param);	
 	}
 	return 0;	
 }
 
-static int8_t setSteppedParameter(steppedParameter_t param, uint8_t value, int8_t isRaw)
+static void steppedParameterChanged(int8_t part, steppedParameter_t param, uint8_t value)
+{
+	// waveforms are shared, they follow the main part
+	if(part && sp2abx[param]!=abxNone)
+		return;
+	
+	switch(param)
+	{
+		case spABank_Unsaved:
+		case spBBank_Unsaved:
+		case spAXOvrBank_Unsaved:
+		case spBXOvrBank_Unsaved:
+			synth_getBankName(value,currentPreset.oscBank[sp2abx[param]]);
+			midi.pendingBankWaveTimeout[sp2abx[param]]=currentTick+PENDING_UPDATE_TIMEOUT;
+			break;
+		case spAWave_Unsaved:
+		case spBWave_Unsaved:
+		case spAXOvrWave_Unsaved:
+		case spBXOvrWave_Unsaved:
+			synth_getWaveName(value,currentPreset.oscWave[sp2abx[param]]);
+			midi.pendingBankWaveTimeout[sp2abx[param]]=currentTick+PENDING_UPDATE_TIMEOUT;
+			break;
+		case spUnison:
+			synth_updateAssignerPattern(part);
+			break;
+		default:
+			/* nothing */;
+	}
+}
+
+static uint16_t setSteppedParameter(int8_t part, steppedParameter_t param, uint8_t value, int8_t isRaw)
 {
-	int8_t changed=0;
+	struct preset_s * p=synth_getPartPreset(part);
 	uint16_t v=value;
 	
 	if(!isRaw)
 		v=(v*steppedParametersSteps[param].param)>>7;
 
-	if(currentPreset.steppedParameters[param]!=v)
-	{
-		currentPreset.steppedParameters[param]=v;
-		changed=1;	
-	}
+	if(p->steppedParameters[param]==v)
+		return 0;
 	
-	if(changed)
-	{
-		switch(param)
-		{
-			case spABank_Unsaved:
-			case spBBank_Unsaved:
-			case spAXOvrBank_Unsaved:
-			case spBXOvrBank_Unsaved:
-				synth_getBankName(value,currentPreset.oscBank[sp2abx[param]]);
-				midi.pendingBankWaveTimeout[sp2abx[param]]=currentTick+PENDING_UPDATE_TIMEOUT;
-				break;
-			case spAWave_Unsaved:
-			case spBWave_Unsaved:
-			case spAXOvrWave_Unsaved:
-			case spBXOvrWave_Unsaved:
-				synth_getWaveName(value,currentPreset.oscWave[sp2abx[param]]);
-				midi.pendingBankWaveTimeout[sp2abx[param]]=currentTick+PENDING_UPDATE_TIMEOUT;
-				break;
-			case spUnison:
-				synth_updateAssignerPattern();
-				break;
-			default:
-				/* nothing */;
-		}
-	}
+	p->steppedParameters[param]=v;
+	steppedParameterChanged(part,param,value);
 
-	return changed;
+	return parameterRefresh(1,param);
 }
 
 static int8_t setCurrentNrpn(int8_t port, uint8_t param)
@@ -278,13 +410,10 @@ static int8_t setCurrentNrpn(int8_t port, uint8_t param)
 	return midi.currentNrpn[port]=MAX(0,MIN((midi.isNrpnStepped[port]?spCount:cpCount)-1,param));
 }
 
-static void noteOnEvent(MidiDevice * device, uint8_t channel, uint8_t note, uint8_t velocity)
+static void noteOnEvent(midiPort_t port, int8_t part, uint8_t note, uint8_t velocity)
 {
 	int16_t intNote;
 	
-	if(!filterChannel(channel))
-		return;
-	
 #ifdef DEBUG_
 	print("midi note on  ");
 	phex(note);
@@ -293,6 +422,13 @@ static void noteOnEvent(MidiDevice * device, uint8_t channel, uint8_t note, uint
 
 	note+=NOTE_TRANSPOSE_OFFSET;
 	
+	// layers play straight, no transpose, arpeggiator or sequencer
+	if(part)
+	{
+		assigner_assignNote(part,note,velocity!=0,(((uint32_t)velocity+1)<<9)-1,1);
+		return;
+	}
+	
 	if(ui_isTransposing())
 	{
 		ui_setTranspose(note-MIDDLE_C_NOTE);
@@ -307,17 +443,14 @@ static void noteOnEvent(MidiDevice * device, uint8_t channel, uint8_t note, uint
 
 		intNote=note+ui_getTranspose();
 		intNote=MAX(0,MIN(127,intNote));
-		assigner_assignNote(intNote,velocity!=0,(((uint32_t)velocity+1)<<9)-1,1);
+		assigner_assignNote(0,intNote,velocity!=0,(((uint32_t)velocity+1)<<9)-1,1);
 	}
 }
 
-static void noteOffEvent(MidiDevice * device, uint8_t channel, uint8_t note, uint8_t velocity)
+static void noteOffEvent(midiPort_t port, int8_t part, uint8_t note, uint8_t velocity)
 {
 	int16_t intNote;
 	
-	if(!filterChannel(channel))
-		return;
-	
 #ifdef DEBUG_
 	print("midi note off ");
 	phex(note);
@@ -326,6 +459,12 @@ static void noteOffEvent(MidiDevice * device, uint8_t channel, uint8_t note, uin
 
 	note+=NOTE_TRANSPOSE_OFFSET;
 	
+	if(part)
+	{
+		assigner_assignNote(part,note,0,0,1);
+		return;
+	}
+	
 	if(!arp_assignNote(note,0))
 	{
 		// sequencer note input		
@@ -334,129 +473,241 @@ static void noteOffEvent(MidiDevice * device, uint8_t channel, uint8_t note, uin
 
 		intNote=note+ui_getTranspose();
 		intNote=MAX(0,MIN(127,intNote));
-		assigner_assignNote(intNote,0,0,1);
+		assigner_assignNote(0,intNote,0,0,1);
 	}
 }
 
-static void ccEvent(MidiDevice * device, uint8_t channel, uint8_t control, uint8_t value)
+////////////////////////////////////////////////////////////////////////////////
+// CC actions
+////////////////////////////////////////////////////////////////////////////////
+
+static uint16_t applyNone(const struct midiAction_s * a, midiPort_t port, int8_t part, uint8_t value)
 {
-	int8_t port,change=0;
-	struct midiCC_s cc;
+	return 0;
+}
+
+static uint16_t applyModWheel(const struct midiAction_s * a, midiPort_t port, int8_t part, uint8_t value)
+{
+	synth_wheelEvent(part,0,value<<9,2);
+	return 0;
+}
+
+static uint16_t applyHoldPedal(const struct midiAction_s * a, midiPort_t port, int8_t part, uint8_t value)
+{
+	assigner_holdEvent(part,value);
+	return 0;
+}
+
+static uint16_t applyAllSoundOff(const struct midiAction_s * a, midiPort_t port, int8_t part, uint8_t value)
+{
+	assigner_panicOff();
+	return 0;
+}
+
+static uint16_t applyAllNotesOff(const struct midiAction_s * a, midiPort_t port, int8_t part, uint8_t value)
+{
+	assigner_allKeysOff(part);
+	return 0;
+}
+
+static uint16_t applyBank(const struct midiAction_s * a, midiPort_t port, int8_t part, uint8_t value)
+{
+	if(part)
+	{
+		settings.parts[part].presetNumber=(settings.parts[part].presetNumber%100)+(value%10)*100;
+		midi.partPresetTimeout[part]=currentTick+PENDING_UPDATE_TIMEOUT;
+	}
+	else
+	{
+		settings.presetNumber=(settings.presetNumber%100)+(value%10)*100;
+		midi.presetTimeout=currentTick+PENDING_UPDATE_TIMEOUT;
+	}
+	return 0;
+}
+
+static uint16_t applyContinuousCoarse(const struct midiAction_s * a, midiPort_t port, int8_t part, uint8_t value)
+{
+	uint16_t * p=(uint16_t *)((uint8_t *)synth_getPartPreset(part)+a->offset);
 	
-	if(!filterChannel(channel))
-		return;
+	if((*p>>9)==value)
+		return 0;
 	
-#ifdef DEBUG_
-	print("midi cc ");
-	phex(control);
-	print(" value ");
-	phex(value);
-	print("\n");
-#endif
+	*p=(*p&0x01fc)|((uint16_t)value<<9);
+	return a->refresh;
+}
+
+static uint16_t applyContinuousFine(const struct midiAction_s * a, midiPort_t port, int8_t part, uint8_t value)
+{
+	uint16_t * p=(uint16_t *)((uint8_t *)synth_getPartPreset(part)+a->offset);
 	
-	port=getPort(device);
-	if(port<0)
-		return;
+	if(((*p>>2)&0x7f)==value)
+		return 0;
+	
+	*p=(*p&0xfe00)|((uint16_t)value<<2);
+	return a->refresh;
+}
+
+static uint16_t applyStepped(const struct midiAction_s * a, midiPort_t port, int8_t part, uint8_t value)
+{
+	uint8_t * p=(uint8_t *)synth_getPartPreset(part)+a->offset;
+	uint8_t v=(value*a->steps)>>7;
+	
+	if(*p==v)
+		return 0;
 	
-	cc=midiCCs[control&0x7f];
+	*p=v;
+	steppedParameterChanged(part,a->number,value);
+	return a->refresh;
+}
+
+static uint16_t applyNRPNCoarse(const struct midiAction_s * a, midiPort_t port, int8_t part, uint8_t value)
+{
+	midi.isNrpnStepped[port]=value&1;
+	setCurrentNrpn(port,midi.currentNrpn[port]);
+	return 0;
+}
+
+static uint16_t applyNRPNFine(const struct midiAction_s * a, midiPort_t port, int8_t part, uint8_t value)
+{
+	setCurrentNrpn(port,value);
+	return 0;
+}
+
+static uint16_t applyDataIncrement(const struct midiAction_s * a, midiPort_t port, int8_t part, uint8_t value)
+{
+	struct preset_s * p=synth_getPartPreset(part);
 	
-	switch(cc.type)
+	if(midi.isNrpnStepped[port])
 	{
-		case ccModWheel:
-			synth_wheelEvent(0,value<<9,2);
-			break;
-		case ccHoldPedal:
-			assigner_holdEvent(value);
-			break;
-		case ccAllSoundOff:
-			assigner_panicOff();
-			break;
-		case ccAllNotesOff:
-			assigner_allKeysOff();
-			break;
-		case ccBankCoarse:
-		case ccBankFine:
-			settings.presetNumber=(settings.presetNumber%100)+(value%10)*100;
-			midi.presetTimeout=currentTick+PENDING_UPDATE_TIMEOUT;
-			break;
-		case ccContinuousCoarse:
-			change=setContinuousParameterCoarse(cc.number,value);
-			break;
-		case ccContinuousFine:
-			change=setContinuousParameterFine(cc.number,value);
-			break;
-		case ccStepped:
-			change=setSteppedParameter(cc.number,value,0);
-			break;
-		case ccNRPNCoarse:
-			midi.isNrpnStepped[port]=value&1;
-			setCurrentNrpn(port,midi.currentNrpn[port]);
-			break;
-		case ccNRPNFine:
-			setCurrentNrpn(port,value);
-			break;
-		case ccDataIncrement:
-			if(midi.isNrpnStepped[port])
-			{
-				steppedParameter_t s=midi.currentNrpn[port];
-				change=setSteppedParameter(s,MIN(steppedParametersSteps[s].param-1,currentPreset.steppedParameters[s]+1),1);
-			}
-			else
-			{
-				uint8_t v=currentPreset.continuousParameters[midi.currentNrpn[port]]>>9;
-				change=setContinuousParameterCoarse(midi.currentNrpn[port],MIN(INT8_MAX,v+1));
-			}
-			break;
-		case ccDataDecrement:
-			if(midi.isNrpnStepped[port])
-			{
-				steppedParameter_t s=midi.currentNrpn[port];
-				change=setSteppedParameter(s,MAX(0,currentPreset.steppedParameters[s]-1),1);
-			}
-			else
-			{
-				uint8_t v=currentPreset.continuousParameters[midi.currentNrpn[port]]>>9;
-				change=setContinuousParameterCoarse(midi.currentNrpn[port],MAX(0,v-1));
-			}
-			break;
-		case ccDataCoarse:
-			if(midi.isNrpnStepped[port])
-			{
-				change=setSteppedParameter(midi.currentNrpn[port],value,0);
-			}
-			else
-			{
-				change=setContinuousParameterCoarse(midi.currentNrpn[port],value);
-			}
-			break;
-		case ccDataFine:
-			if(midi.isNrpnStepped[port])
-			{
-				/* stepped parameters dont have fine setting */;
-			}
-			else
-			{
-				change=setContinuousParameterFine(midi.currentNrpn[port],value);
-			}
-			break;
-		case ccNone:
-		case ccFree:
-			/* nothing */;
+		steppedParameter_t s=midi.currentNrpn[port];
+		return setSteppedParameter(part,s,MIN(steppedParametersSteps[s].param-1,p->steppedParameters[s]+1),1);
+	}
+	else
+	{
+		uint8_t v=p->continuousParameters[midi.currentNrpn[port]]>>9;
+		return setContinuousParameterCoarse(p,midi.currentNrpn[port],MIN(INT8_MAX,v+1));
 	}
+}
 
-	if(change)
+static uint16_t applyDataDecrement(const struct midiAction_s * a, midiPort_t port, int8_t part, uint8_t value)
+{
+	struct preset_s * p=synth_getPartPreset(part);
+	
+	if(midi.isNrpnStepped[port])
+	{
+		steppedParameter_t s=midi.currentNrpn[port];
+		return setSteppedParameter(part,s,MAX(0,p->steppedParameters[s]-1),1);
+	}
+	else
 	{
-		ui_setPresetModified(1);
-		synth_refreshFullState(0);
+		uint8_t v=p->continuousParameters[midi.currentNrpn[port]]>>9;
+		return setContinuousParameterCoarse(p,midi.currentNrpn[port],MAX(0,v-1));
 	}
 }
 
-static void progchangeEvent(MidiDevice * device, uint8_t channel, uint8_t program)
+static uint16_t applyDataCoarse(const struct midiAction_s * a, midiPort_t port, int8_t part, uint8_t value)
 {
-	if(!filterChannel(channel))
+	if(midi.isNrpnStepped[port])
+		return setSteppedParameter(part,midi.currentNrpn[port],value,0);
+	else
+		return setContinuousParameterCoarse(synth_getPartPreset(part),midi.currentNrpn[port],value);
+}
+
+static uint16_t applyDataFine(const struct midiAction_s * a, midiPort_t port, int8_t part, uint8_t value)
+{
+	// stepped parameters dont have fine setting
+	if(midi.isNrpnStepped[port])
+		return 0;
+	else
+		return setContinuousParameterFine(synth_getPartPreset(part),midi.currentNrpn[port],value);
+}
+
+static const midiActionFunc_t ccActionFuncs[]=
+{
+	[ccNone]=applyNone,
+	[ccFree]=applyNone,
+	[ccContinuousCoarse]=applyContinuousCoarse,
+	[ccContinuousFine]=applyContinuousFine,
+	[ccStepped]=applyStepped,
+	[ccModWheel]=applyModWheel,
+	[ccHoldPedal]=applyHoldPedal,
+	[ccAllSoundOff]=applyAllSoundOff,
+	[ccAllNotesOff]=applyAllNotesOff,
+	[ccDataCoarse]=applyDataCoarse,
+	[ccDataFine]=applyDataFine,
+	[ccDataIncrement]=applyDataIncrement,
+	[ccDataDecrement]=applyDataDecrement,
+	[ccNRPNCoarse]=applyNRPNCoarse,
+	[ccNRPNFine]=applyNRPNFine,
+	[ccBankCoarse]=applyBank,
+	[ccBankFine]=applyBank,
+};
+
+static void initCCActions(void)
+{
+	for(int16_t cc=0;cc<128;++cc)
+	{
+		struct midiAction_s * a=&midi.ccActions[cc];
+		struct midiCC_s c=midiCCs[cc];
+		
+		a->apply=ccActionFuncs[c.type];
+		a->number=c.number;
+		
+		switch(c.type)
+		{
+			case ccContinuousCoarse:
+			case ccContinuousFine:
+				a->offset=offsetof(struct preset_s,continuousParameters)+c.number*sizeof(uint16_t);
+				a->refresh=parameterRefresh(0,c.number);
+				break;
+			case ccStepped:
+				a->offset=offsetof(struct preset_s,steppedParameters)+c.number;
+				a->steps=steppedParametersSteps[c.number].param;
+				a->refresh=parameterRefresh(1,c.number);
+				break;
+			default:
+				/* nothing */;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Channel messages
+////////////////////////////////////////////////////////////////////////////////
+
+static void ccEvent(midiPort_t port, int8_t part, uint8_t control, uint8_t value)
+{
+	const struct midiAction_s * a=&midi.ccActions[control];
+	
+#ifdef DEBUG_
+	print("midi cc ");
+	phex(control);
+	print(" value ");
+	phex(value);
+	print("\n");
+#endif
+	
+	// a sweep only costs its refresh once per CV tick, see midi_processInput()
+	midi.pendingRefresh[part]|=a->apply(a,port,part,value);
+}
+
+static void progchangeEvent(midiPort_t port, int8_t part, uint8_t program, uint8_t unused)
+{
+	uint16_t newPresetNumber;
+	
+	if(part)
+	{
+		newPresetNumber=(((settings.parts[part].presetNumber/100)%10)*100)+program;
+		
+		if(program<100 && newPresetNumber!=settings.parts[part].presetNumber)
+		{
+			settings.parts[part].presetNumber=newPresetNumber;
+			midi.partPresetTimeout[part]=currentTick+PENDING_UPDATE_TIMEOUT;
+		}
 		return;
+	}
 	
-	uint16_t newPresetNumber=(((settings.presetNumber/100)%10)*100)+program;
+	newPresetNumber=(((settings.presetNumber/100)%10)*100)+program;
 
 	if(program<100 && newPresetNumber!=settings.presetNumber)
 	{
@@ -465,31 +716,171 @@ static void progchangeEvent(MidiDevice * device, uint8_t channel, uint8_t progra
 	}
 }
 
-static void pitchBendEvent(MidiDevice * device, uint8_t channel, uint8_t v1, uint8_t v2)
+static void pitchBendEvent(midiPort_t port, int8_t part, uint8_t v1, uint8_t v2)
 {
-	if(!filterChannel(channel))
-		return;
-
 	int16_t value;
 	
 	value=combineBytes(v1,v2);
 	value-=0x2000;
 	value<<=2;
 	
-	synth_wheelEvent(value,0,1);
+	synth_wheelEvent(part,value,0,1);
 }
 
-static void chanpressureEvent(MidiDevice * device, uint8_t channel, uint8_t pressure)
+static void chanpressureEvent(midiPort_t port, int8_t part, uint8_t pressure, uint8_t unused)
 {
-	if(!filterChannel(channel))
-		return;
+	synth_pressureEvent(part,pressure<<9);
+}
+
+static const struct midiMessage_s channelMessages[8]=
+{
+	{2,noteOffEvent},
+	{2,noteOnEvent},
+	{2,NULL}, // poly aftertouch
+	{2,ccEvent},
+	{1,progchangeEvent},
+	{1,chanpressureEvent},
+	{2,pitchBendEvent},
+	{0,NULL}, // system, decoded apart
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Input decoding
+////////////////////////////////////////////////////////////////////////////////
+
+static void thru(const uint8_t * data, uint8_t count)
+{
+	if(settings.midiThru)
+		sendOutput(data,count);
+}
+
+static void dispatchMessage(midiPort_t port, struct midiParser_s * p)
+{
+	uint8_t data[3]={p->status,p->data[0],p->data[1]};
+
+	if(p->status<0xf0)
+	{
+		midiHandler_t handler=channelMessages[(p->status>>4)&7].handler;
+		int8_t part;
+		
+		if(handler)
+		{
+			if((part=getChannelLayer(p->status))>0)
+				handler(port,part,p->data[0],p->data[1]);
+			else if(filterChannel(p->status))
+				handler(port,0,p->data[0],p->data[1]);
+		}
+	}
+	else
+	{
+		// system common, no running status
+		p->status=0;
+	}
+
+	thru(data,1+p->length);
+}
+
+static FORCEINLINE void decodeByte(midiPort_t port, struct midiParser_s * p, uint8_t b)
+{
+	if(b<0x80)
+	{
+		// data byte
+		if(p->inSysex)
+		{
+			sysex_input(port,b);
+		}
+		else if(p->status)
+		{
+			p->data[p->count++]=b;
+			if(p->count>=p->length)
+			{
+				p->count=0;
+				dispatchMessage(port,p);
+			}
+		}
+	}
+	else if(b>=0xf8)
+	{
+		// realtime, can be anywhere, even within other messages
+		synth_realtimeEvent(port,b);
+		thru(&b,1);
+	}
+	else if(b<0xf0)
+	{
+		p->status=b;
+		p->length=channelMessages[(b>>4)&7].length;
+		p->count=0;
+		p->inSysex=0;
+	}
+	else
+	{
+		// system common / SysEx, they cancel running status
+		p->status=0;
+		p->count=0;
+		
+		switch(b)
+		{
+			case 0xf0:
+				// not forwarded, it couldn't be merged without holding everything else
+				p->inSysex=1;
+				sysex_input(port,b);
+				break;
+			case 0xf7:
+				if(p->inSysex)
+					sysex_input(port,b);
+				p->inSysex=0;
+				break;
+			case 0xf1: // MTC quarter frame
+			case 0xf3: // song select
+				p->status=b;
+				p->length=1;
+				p->inSysex=0;
+				break;
+			case 0xf2: // song position
+				p->status=b;
+				p->length=2;
+				p->inSysex=0;
+				break;
+			case 0xf6: // tune request
+				p->inSysex=0;
+				thru(&b,1);
+				break;
+			default:
+				p->inSysex=0;
+		}
+	}
+}
+
+static void decodeInput(midiPort_t port, uint16_t count)
+{
+	byteQueue_t * q=&midi.device[port].input_queue;
+	struct midiParser_s * p=&midi.parser[port];
+	const uint8_t * data;
+	uint16_t len;
+
+	// straight from the queue, one contiguous run at a time
+	while(count && (len=bytequeue_peek(q,&data)))
+	{
+		len=MIN(len,count);
+		
+		for(uint16_t i=0;i<len;++i)
+			decodeByte(port,p,data[i]);
+		
+		bytequeue_consume(q,len);
+		count-=len;
+	}
+}
+
+static void uartSend(MidiDevice * device, uint16_t count, uint8_t b0, uint8_t b1, uint8_t b2)
+{
+	uint8_t data[3]={b0,b1,b2};
 
-	synth_pressureEvent(pressure<<9);
+	sendOutput(data,count);
 }
 
-static void realtimeEvent(MidiDevice * device, uint8_t event)
+static void usbSend(MidiDevice * device, uint16_t count, uint8_t b0, uint8_t b1, uint8_t b2)
 {
-	synth_realtimeEvent(getPort(device),event);
+	usb_midi_send(count,b0,b1,b2);
 }
 
 void midi_init(void)
@@ -499,31 +890,187 @@ void midi_init(void)
 	for(abx_t abx=0;abx<abxCount;++abx)
 		midi.pendingBankWaveTimeout[abx]=UINT32_MAX;
 	midi.presetTimeout=UINT32_MAX;
+	for(int8_t part=0;part<SYNTH_PART_COUNT;++part)
+		midi.partPresetTimeout[part]=UINT32_MAX;
+
+	// xnormidi only queues input and sends, decoding is done here
+	for(midiPort_t port=0;port<mpCount;++port)
+		midi_device_init(&midi.device[port]);
+	
+	initCCActions();
+	
+	bytequeue_init(&midi.outQueue,midi.outData,MIDI_OUT_QUEUE_SIZE);
+	memset(midi.echoedContinuous,0xff,sizeof(midi.echoedContinuous));
+	memset(midi.echoedStepped,0xff,sizeof(midi.echoedStepped));
+	
+	midi_device_set_send_func(&midi.device[mpUART],uartSend);
+	midi_device_set_send_func(&midi.device[mpUSB],usbSend);
+
+	sysex_init();
+}
+
+static int8_t newInput(midiPort_t port, uint8_t * data, uint8_t count)
+{
+	struct midiStamps_s * s=&midi.stamps[port];
+	uint32_t time=dacspi_getTimestamp();
+	uint16_t head=s->head;
+	
+	// whole messages or nothing
+	if((uint16_t)(head-s->tail)>=MIDI_STAMP_COUNT || !midi_device_input(&midi.device[port],count,data))
+		return 0;
+	
+	s->time[head&(MIDI_STAMP_COUNT-1)]=time;
+	s->count[head&(MIDI_STAMP_COUNT-1)]=count;
+	__DMB();
+	s->head=head+1;
+	
+	return 1;
+}
 
+void midi_processInput(uint32_t dueTime)
+{
 	for(midiPort_t port=0;port<mpCount;++port)
 	{
-		MidiDevice * d = &midi.device[port];
+		struct midiStamps_s * s=&midi.stamps[port];
+		uint16_t tail=s->tail;
+
+		// only what was received before dueTime, in order
+		while(tail!=s->head)
+		{
+			__DMB();
+			
+			if((int32_t)(s->time[tail&(MIDI_STAMP_COUNT-1)]-dueTime)>=0)
+				break;
+			
+			decodeInput(port,s->count[tail&(MIDI_STAMP_COUNT-1)]);
+			s->tail=++tail;
+		}
+	}
+	
+	// coalesced parameter changes, each affected subsystem refreshed once
+	for(int8_t part=0;part<SYNTH_PART_COUNT;++part)
+		if(midi.pendingRefresh[part])
+		{
+			if(!part)
+				ui_setPresetModified(1);
+			synth_refreshState(part,midi.pendingRefresh[part]&rfAll);
+			midi.pendingRefresh[part]=0;
+		}
+}
+
+void midi_newData(midiPort_t port, uint8_t data)
+{
+	newInput(port,&data,1);
+}
+
+int8_t midi_newDataBulk(midiPort_t port, uint8_t * data, uint8_t count)
+{
+	return newInput(port,data,count);
+}
+
+void midi_sendSysex(midiPort_t port, uint8_t * data, uint16_t count)
+{
+	// in one go on the UART, so that thru or notes can't end up in the middle
+	if(port==mpUART)
+		sendOutput(data,count);
+	else
+		midi_send_array(&midi.device[port],count,data);
+}
+
+void midi_sendNote(uint8_t note, int8_t gate, uint16_t velocity)
+{
+	uint8_t data[3];
+	int16_t n=note-NOTE_TRANSPOSE_OFFSET;
+	
+	if(n<0 || n>127)
+		return;
+	
+	// note offs as zero velocity note ons, for running status
+	data[0]=MIDI_NOTEON|getOutputChannel();
+	data[1]=n;
+	data[2]=gate?MAX(1,velocity>>9):0;
+	
+	sendOutput(data,3);
+}
+
+void midi_echoParameter(int8_t isStepped, uint8_t param)
+{
+	uint8_t data[12],len=0,status=MIDI_CC|getOutputChannel();
+	int16_t cc=findCC(isStepped?ccStepped:ccContinuousCoarse,param);
+	uint16_t v;
+	
+	if(isStepped)
+	{
+		uint8_t steps=steppedParametersSteps[param].param;
+		
+		if(midi.echoedStepped[param]==currentPreset.steppedParameters[param])
+			return;
+		midi.echoedStepped[param]=currentPreset.steppedParameters[param];
 		
-		midi_device_init(d);
-		midi_register_noteon_callback(d,noteOnEvent);
-		midi_register_noteoff_callback(d,noteOffEvent);
-		midi_register_cc_callback(d,ccEvent);
-		midi_register_progchange_callback(d,progchangeEvent);
-		midi_register_pitchbend_callback(d,pitchBendEvent);
-		midi_register_chanpressure_callback(d,chanpressureEvent);
-		midi_register_realtime_callback(d,realtimeEvent);
+		// smallest value that setSteppedParameter() maps back to this step
+		v=MIN(INT8_MAX,((currentPreset.steppedParameters[param]<<7)+steps-1)/steps)<<7;
+	}
+	else
+	{
+		// 14 bits, only the coarse part has a CC
+		v=currentPreset.continuousParameters[param]>>2;
+		if(cc>=0)
+			v&=~0x7f;
+
+		if(midi.echoedContinuous[param]==v)
+			return;
+		midi.echoedContinuous[param]=v;
+	}
+	
+	if(cc<0)
+	{
+		data[len++]=status;
+		data[len++]=99;
+		data[len++]=isStepped;
+		data[len++]=status;
+		data[len++]=98;
+		data[len++]=param;
+		cc=6;
+	}
+	
+	data[len++]=status;
+	data[len++]=cc;
+	data[len++]=v>>7;
+	
+	if(cc==6 && !isStepped)
+	{
+		data[len++]=status;
+		data[len++]=38;
+		data[len++]=v&0x7f;
 	}
+	
+	sendOutput(data,len);
 }
 
-void midi_processInput(void)
+int16_t midi_getOutput(uint8_t * data, int16_t maxCount)
 {
-	for(midiPort_t port=0;port<mpCount;++port)
-		midi_device_process(&midi.device[port]);
+	const uint8_t * p;
+	int16_t count=0,len;
+	
+	while(count<maxCount && (len=bytequeue_peek(&midi.outQueue,&p)))
+	{
+		len=MIN(len,maxCount-count);
+		memcpy(&data[count],p,len);
+		bytequeue_consume(&midi.outQueue,len);
+		count+=len;
+	}
+	
+	return count;
 }
 
-void midi_newData(midiPort_t port, uint8_t data)
+uint32_t midi_getOutputDrops(void)
+{
+	return midi.outDrops;
+}
+
+void midi_reloadPreset(void)
 {
-	midi_device_input(&midi.device[port],1,&data);
+	midi.presetTimeout=currentTick;
 }
 
 void midi_update(void)
@@ -543,19 +1090,37 @@ void midi_update(void)
 	// pending program change updates
 	
 	if(currentTick>midi.presetTimeout)
+	{
+		// flash reads first, interrupts blocked the switch then is RAM only
+		synth_prefetchPreset(settings.presetNumber);
+
 		BLOCK_INT(1)
 		{
 			// temporarily silence voices
 			for(int8_t v=0;v<SYNTH_VOICE_COUNT;++v)
 				synth_refreshCV(v,cvAmp,0,1);
 			
-			settings_save();		
-
 			preset_loadCurrent(settings.presetNumber);
 			ui_setPresetModified(0);	
 
-			synth_refreshFullState(1);
+			synth_refreshFullState(0);
+		}
+
+		synth_refreshAllWaveforms();
 
-			midi.presetTimeout=UINT32_MAX;
+		settings_save();		
+		midi.presetTimeout=UINT32_MAX;
+	}
+	
+	for(int8_t part=1;part<SYNTH_PART_COUNT;++part)
+		if(currentTick>midi.partPresetTimeout[part])
+		{
+			settings_save();
+			synth_loadPartPreset(part);
+			midi.partPresetTimeout[part]=UINT32_MAX;
 		}
+	
+	// bulk transfers
+	
+	sysex_update();
 }
\ No newline at end of file
@@ -1,21 +1,30 @@
-#ifndef MIDI_H
-#define	MIDI_H
-
-#include <stdint.h>
-#include "../xnormidi/midi.h"
-
-typedef enum
-{
-	mpUART=0,mpUSB=1,
-			
-	// /!\ this must stay last
-	mpCount
-} midiPort_t;
-
-void midi_init(void);
-void midi_update(void);
-void midi_processInput(void);
-void midi_newData(midiPort_t port, uint8_t data);
-
-#endif	/* MIDI_H */
-
+#ifndef MIDI_H
+#define	MIDI_H
+
+#include <stdint.h>
+#include "../xnormidi/midi.h"
+
+typedef enum
+{
+	mpUART=0,mpUSB=1,
+			
+	// /!\ this must stay last
+	mpCount
+} midiPort_t;
+
+void midi_init(void);
+void midi_update(void);
+void midi_processInput(uint32_t dueTime); // input timestamped before dueTime
+void midi_newData(midiPort_t port, uint8_t data);
+int8_t midi_newDataBulk(midiPort_t port, uint8_t * data, uint8_t count);
+void midi_sendSysex(midiPort_t port, uint8_t * data, uint16_t count);
+void midi_reloadPreset(void); // current preset, on next midi_update()
+
+// MIDI out, on the UART
+void midi_sendNote(uint8_t note, int8_t gate, uint16_t velocity);
+void midi_echoParameter(int8_t isStepped, uint8_t param); // if its value changed since the last echo
+int16_t midi_getOutput(uint8_t * data, int16_t maxCount); // UART transmit side
+uint32_t midi_getOutputDrops(void);
+
+#endif	/* MIDI_H */
+
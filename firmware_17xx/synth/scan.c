@@ -40,7 +40,7 @@
 #define MIXSCAN_SPI_FREQUENCY (SCAN_MASTERMIX_SAMPLERATE*4*SCAN_ADC_BITS*2)
 #define MIXSCAN_ADC_CHANNEL 10
 
-static EXT_RAM GPDMA_LLI_Type lli[POT_SAMPLES*SCAN_POT_COUNT][2];
+static EXT_RAM_DMA GPDMA_LLI_Type lli[POT_SAMPLES*SCAN_POT_COUNT][2];
 
 static struct
 {
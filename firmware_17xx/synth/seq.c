@@ -60,7 +60,8 @@ static void finishPreviousNotes(struct track *tp)
 		n=s+SCANNER_BASE_NOTE+tp->previousTranspose;
 
 		// send note to assigner, velocity at half (MIDI value 64)
-		assigner_assignNote(n,0,0,0);
+		assigner_assignNote(0,n,0,0,0);
+		midi_sendNote(n,0,0);
 
 		tp->prevEventIndex=(tp->prevEventIndex+1)%tp->eventCount;
 		s=tp->events[tp->prevEventIndex];
@@ -99,7 +100,8 @@ static FORCEINLINE void playStep(int8_t track)
 			n=s+SCANNER_BASE_NOTE+seq.transpose;
 
 			// send note to assigner, velocity at half (MIDI value 64)
-			assigner_assignNote(n,1,HALF_RANGE,0);
+			assigner_assignNote(0,n,1,HALF_RANGE,0);
+			midi_sendNote(n,1,HALF_RANGE);
 		}
 		tp->eventIndex=(tp->eventIndex+1)%tp->eventCount;
 		s=tp->events[tp->eventIndex];
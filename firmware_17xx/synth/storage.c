@@ -2,6 +2,12 @@
 // Presets and settings storage, relies on low level page storage system
 ////////////////////////////////////////////////////////////////////////////////
 
+// Saves go to the log store as compact binary records, config text files are
+// the import / export format: storage_importText() evicts stored objects that
+// got a text file (USB disk, SysEx load), which then wins until the object is
+// saved again, it's then removed. Text is also the fallback when the store
+// isn't there or is full.
+
 #include "storage.h"
 #include "lfo.h"
 #include "seq.h"
@@ -11,14 +17,21 @@
 #include "dacspi.h"
 #include "main.h"
 #include "midi.h"
+#include "logstore.h"
 #include "ff.h"
 
 #include <ctype.h>
-#include <alloca.h>
+#include <stddef.h>
 
 #define SAVE_INT " = %d\n"
 #define SAVE_STR " = %s\n"
 
+#define SETTINGS_PATH "/overcycler.conf"
+
+#define STORE_SETTINGS LOGSTORE_KEY(1,0)
+#define STORE_PRESET(number) LOGSTORE_KEY(2,number)
+#define STORE_SEQUENCE(bank,track) LOGSTORE_KEY(3,(bank)*SEQ_TRACK_COUNT+(track))
+
 const struct namedParam_s continuousParametersZeroCentered[cpCount] = 
 {
 	{"cpAFreq",0},
@@ -118,18 +131,220 @@ const struct namedParam_s steppedParametersSteps[spCount] =
 	{NULL,128},
 	{"spLFOTrig",7},
 	{"spLFO2Trig",7},
+	{"spDacProfile",4},
 };
 
 struct settings_s settings;
 struct preset_s currentPreset;
 
-struct loadLL_s
+////////////////////////////////////////////////////////////////////////////////
+// Binary records
+////////////////////////////////////////////////////////////////////////////////
+
+// A version byte, then blocks of: field id, element width (0: string),
+// element count, little endian data. Ids index a field table, so a load is a
+// single pass; unknown blocks are skipped and missing ones keep their default,
+// older & newer records thus load fine as long as ids are only ever appended.
+
+#define BIN_VERSION 1
+#define BIN_MAX_SIZE 768 // ~590 bytes for a 32 voices preset
+
+struct binField_s
+{
+	uint16_t offset;
+	uint8_t width; // bytes per element, 0: string
+	uint8_t count; // elements, or string buffer size
+	uint8_t stride; // between elements, 0: width
+	int8_t isSigned;
+	int32_t min,max; // min>max: not clamped
+};
+
+#define BIN_FIELD_TYPE(s,f) __typeof__(((struct s *)0)->f)
+#define BIN_INTS(s,f,n,st,mn,mx) {offsetof(struct s,f),sizeof(BIN_FIELD_TYPE(s,f)),n,st,(BIN_FIELD_TYPE(s,f))-1<0,mn,mx}
+#define BIN_INT(s,f,mn,mx) BIN_INTS(s,f,1,0,mn,mx)
+#define BIN_STR(s,f) {offsetof(struct s,f),0,sizeof(BIN_FIELD_TYPE(s,f)),0,0,0,-1}
+
+typedef enum
 {
-	char *name,*strValue;
-	struct loadLL_s *next;
+	bpPresetName=0,bpOscBank=1,bpOscWave=5,bpContinuous=9,bpStepped=10,bpVoicePattern=11,
+
+	// /!\ append only, this must stay last
+	bpCount
+} binPresetField_t;
+
+static const struct binField_s presetFields[bpCount] =
+{
+	[bpPresetName]=BIN_STR(preset_s,presetName),
+	[bpOscBank]=BIN_STR(preset_s,oscBank[0]),
+	[bpOscBank+1]=BIN_STR(preset_s,oscBank[1]),
+	[bpOscBank+2]=BIN_STR(preset_s,oscBank[2]),
+	[bpOscBank+3]=BIN_STR(preset_s,oscBank[3]),
+	[bpOscWave]=BIN_STR(preset_s,oscWave[0]),
+	[bpOscWave+1]=BIN_STR(preset_s,oscWave[1]),
+	[bpOscWave+2]=BIN_STR(preset_s,oscWave[2]),
+	[bpOscWave+3]=BIN_STR(preset_s,oscWave[3]),
+	[bpContinuous]=BIN_INTS(preset_s,continuousParameters[0],cpCount,0,0,UINT16_MAX),
+	[bpStepped]=BIN_INTS(preset_s,steppedParameters[0],spCount,0,0,UINT8_MAX), // then to their step count
+	[bpVoicePattern]=BIN_INTS(preset_s,voicePattern[0],SYNTH_VOICE_COUNT,0,0,UINT8_MAX),
+};
+
+typedef enum
+{
+	bsPresetNumber=0,bsMidiReceiveChannel=1,bsVoiceMask=2,bsSyncMode=3,bsSequencerBank=4,bsSeqArpClock=5,
+	bsUsbMIDI=6,bsMidiThru=7,bsLcdContrast=8,
+	bsPartChannel=9,bsPartVoices=10,bsPartPreset=11,
+	bsTunes=12, // one per octave
+
+	// /!\ append only, this must stay last
+	bsCount=bsTunes+TUNER_OCTAVE_COUNT
+} binSettingsField_t;
+
+#define BIN_PART(f,mn,mx) BIN_INTS(settings_s,parts[0].f,SYNTH_PART_COUNT,sizeof(settings.parts[0]),mn,mx)
+#define BIN_TUNES(o) [bsTunes+(o)]=BIN_INTS(settings_s,tunes[o][0],TUNER_CV_COUNT,0,0,UINT16_MAX)
+
+static const struct binField_s settingsFields[bsCount] =
+{
+	[bsPresetNumber]=BIN_INT(settings_s,presetNumber,0,999),
+	[bsMidiReceiveChannel]=BIN_INT(settings_s,midiReceiveChannel,-1,MIDI_CHANMASK),
+	[bsVoiceMask]=BIN_INT(settings_s,voiceMask,0,-1), // masked after load
+	[bsSyncMode]=BIN_INT(settings_s,syncMode,0,symCount-1),
+	[bsSequencerBank]=BIN_INT(settings_s,sequencerBank,0,SEQ_BANK_COUNT-1),
+	[bsSeqArpClock]=BIN_INT(settings_s,seqArpClock,0,CLOCK_MAX_BPM),
+	[bsUsbMIDI]=BIN_INT(settings_s,usbMIDI,0,1),
+	[bsMidiThru]=BIN_INT(settings_s,midiThru,0,1),
+	[bsLcdContrast]=BIN_INT(settings_s,lcdContrast,0,UI_MAX_LCD_CONTRAST),
+	[bsPartChannel]=BIN_PART(midiChannel,-1,MIDI_CHANMASK),
+	[bsPartVoices]=BIN_PART(voiceCount,0,SYNTH_VOICE_COUNT-1),
+	[bsPartPreset]=BIN_PART(presetNumber,0,999),
+	BIN_TUNES(0),BIN_TUNES(1),BIN_TUNES(2),BIN_TUNES(3),
+	BIN_TUNES(4),BIN_TUNES(5),BIN_TUNES(6),BIN_TUNES(7),
 };
 
-typedef void (*parse_callback_t)(struct loadLL_s * ll);
+// text names of the scalar settings fields
+static const char * const settingsNames[bsPartChannel] =
+{
+	"presetNumber","midiReceiveChannel","voiceMask","syncMode","sequencerBank","seqArpClock",
+	"usbMIDI","midiThru","lcdContrast",
+};
+
+LOWERCODESIZE static void setField(const struct binField_s * f, void * dst, uint8_t index, int32_t v)
+{
+	if(f->min<=f->max)
+		v=MAX(f->min,MIN(f->max,v));
+
+	memcpy((uint8_t *)dst+f->offset+index*(f->stride?f->stride:f->width),&v,f->width);
+}
+
+LOWERCODESIZE static void setStrField(const struct binField_s * f, void * dst, const char * s, uint8_t len)
+{
+	char * d=(char *)dst+f->offset;
+
+	len=MIN(len,f->count-1);
+	memcpy(d,s,len);
+	memset(&d[len],0,f->count-len);
+}
+
+LOWERCODESIZE static uint16_t binEncode(const struct binField_s * fields, uint8_t fieldCount, const void * src, uint8_t * data)
+{
+	uint16_t pos=0;
+
+	data[pos++]=BIN_VERSION;
+
+	for(uint8_t id=0;id<fieldCount;++id)
+	{
+		const struct binField_s *f=&fields[id];
+		const uint8_t *s=(const uint8_t *)src+f->offset;
+		uint8_t count=f->width?f->count:strnlen((const char *)s,f->count-1);
+
+		data[pos++]=id;
+		data[pos++]=f->width;
+		data[pos++]=count;
+
+		if(!f->width)
+		{
+			memcpy(&data[pos],s,count);
+			pos+=count;
+		}
+		else
+		{
+			for(uint8_t i=0;i<count;++i)
+			{
+				memcpy(&data[pos],&s[i*(f->stride?f->stride:f->width)],f->width);
+				pos+=f->width;
+			}
+		}
+	}
+
+	return pos;
+}
+
+LOWERCODESIZE static int8_t binDecode(const struct binField_s * fields, uint8_t fieldCount, void * dst, const uint8_t * data, uint16_t size)
+{
+	uint16_t pos=1;
+
+	if(!size || data[0]!=BIN_VERSION)
+		return 0;
+
+	while(pos+3<=size)
+	{
+		const struct binField_s *f;
+		uint8_t id=data[pos],width=data[pos+1],count=data[pos+2];
+
+		pos+=3;
+		if(pos+(width?width:1)*count>size)
+			return 0;
+
+		// fields that changed type keep their default, like unknown ones
+		f=(id<fieldCount)?&fields[id]:NULL;
+		if(f && f->width==width)
+		{
+			if(!width)
+			{
+				setStrField(f,dst,(const char *)&data[pos],count);
+			}
+			else
+			{
+				for(uint8_t i=0;i<MIN(count,f->count);++i)
+				{
+					int32_t v=0;
+					memcpy(&v,&data[pos+i*width],width);
+					if(f->isSigned)
+						v=(width==1)?(int8_t)v:(width==2)?(int16_t)v:v;
+					setField(f,dst,i,v);
+				}
+			}
+		}
+
+		pos+=(width?width:1)*count;
+	}
+
+	return pos==size;
+}
+
+LOWERCODESIZE static int8_t loadRecord(uint16_t key, const struct binField_s * fields, uint8_t fieldCount, void * dst)
+{
+	uint8_t data[BIN_MAX_SIZE];
+	int32_t size;
+
+	size=logstore_getSize(key);
+	if(size<=0 || size>BIN_MAX_SIZE || !logstore_read(key,data,size))
+		return 0;
+
+	return binDecode(fields,fieldCount,dst,data,size);
+}
+
+LOWERCODESIZE static int8_t saveRecord(uint16_t key, const struct binField_s * fields, uint8_t fieldCount, const void * src)
+{
+	uint8_t data[BIN_MAX_SIZE];
+
+	return logstore_write(key,data,binEncode(fields,fieldCount,src,data));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Text files
+////////////////////////////////////////////////////////////////////////////////
+
+typedef void (*parse_callback_t)(const char * name, const char * value);
 
 LOWERCODESIZE static FRESULT prepareConfigFileSave(FIL *f, const char * fn)
 {
@@ -137,249 +352,354 @@ LOWERCODESIZE static FRESULT prepareConfigFileSave(FIL *f, const char * fn)
 	res=f_open(f,fn,FA_WRITE|FA_CREATE_ALWAYS);
 	if(res)
 		return res;
-		
-	f_printf(f,"# %s %s\n", synthName, synthVersion);	
+
+	f_printf(f,"# %s %s\n", synthName, synthVersion);
 	return 0;
 }
 
+// callback gets each "name = value" line, in file order
 LOWERCODESIZE static FRESULT parseConfigFile(const char * fn, parse_callback_t callback)
 {
 	FIL f;
 	FRESULT res;
-	struct loadLL_s *ll, *prev_ll=NULL, *first_ll=NULL;
 	char line[256];
 	char *p, *locName, *locValue;
-	
+
 	res=f_open(&f,fn,FA_READ|FA_OPEN_EXISTING);
 	if(res)
 		return res;
 
 	while(f_gets(line,sizeof(line),&f))
 	{
-		// alloc on stack, clear
-		
-		ll=alloca(sizeof(struct loadLL_s));
-		memset(ll,0,sizeof(struct loadLL_s));
-
-		// parse line
-		
-		locName=NULL;
 		locValue=NULL;
-		
+
 			// remove comments
 		p=strchr(line,'#');
 		if(p) *p='\n';
-				
+
 			// remove lf and trim (value) right
 		p=strchr(line,'\n');
 		if(p)
 		{
 			*p--='\0';
-			while(isspace(*p)) *p--='\0';
+			while(p>=line && isspace(*p)) *p--='\0';
 		}
-		
+
 			// trim name left
 		locName=line;
 		while(isspace(*locName)) ++locName;
-		
+
 		p=strchr(locName,'=');
 		if(p)
 		{
 			locValue=p+1;
-			
+
 			// trim name right
 			while(isspace(*p) || *p=='=') *p--='\0';
 
 			// trim value left
 			while(isspace(*locValue)) ++locValue;
 		}
-		
-		// alloc strings
-		
-		if(locName)
-		{
-			ll->name=alloca(strlen(locName)+1);
-			strcpy(ll->name,locName);
-		}
-		
+
 		if(locValue)
-		{
-			ll->strValue=alloca(strlen(locValue)+1);
-			strcpy(ll->strValue,locValue);
-		}
-		
-		// handle linked list
-		
-		if(!first_ll)
-			first_ll=ll;
-		
-		if(prev_ll)
-			prev_ll->next=ll;
-		prev_ll=ll;
+			callback(locName,locValue);
 	}
-	
-	if(callback) callback(first_ll);
-	
+
 	f_close(&f);
-	
+
 	return 0;
 }
 
-LOWERCODESIZE static const char * getStrValue(struct loadLL_s *ll, const char * name)
+LOWERCODESIZE static int8_t fileExists(const char * fn)
 {
-	while(ll && strcmp(name, ll->name)) ll=ll->next;
-	
-	if(ll)
-		return ll->strValue;
-	else
-		return NULL;
+	FIL f;
+	FRESULT res;
+
+	res=f_open(&f,fn,FA_READ|FA_OPEN_EXISTING);
+	if(res)
+		return res!=FR_NO_FILE;
+
+	f_close(&f);
+	return 1;
 }
 
-LOWERCODESIZE static void getSafeStrValue(struct loadLL_s *ll, const char * name, char * value, int size, int8_t allowEmpty)
+// "<prefix><number>...", -1 if it isn't, end then points after the number
+LOWERCODESIZE static int16_t getNameIndex(const char * name, const char * prefix, int base, const char ** end)
 {
-	const char *sv = getStrValue(ll,name);
-	if(sv && value && (sv[0]!='\0' || allowEmpty))
-	{
-		value[size-1]='\0';
-		strncpy(value,sv,size-1);
-	}
+	size_t len=strlen(prefix);
+	long v;
+	char *e;
+
+	if(strncmp(name,prefix,len) || !isxdigit(name[len]))
+		return -1;
+
+	v=strtol(&name[len],&e,base);
+	if(e==&name[len] || v>INT16_MAX)
+		return -1;
+
+	*end=e;
+	return v;
 }
 
-LOWERCODESIZE static void getIntValue(struct loadLL_s *ll, const char * name, void * value, int size)
+// continuous then stepped parameter numbers, sorted by name
+static uint8_t paramNames[cpCount+spCount];
+static uint8_t paramNameCount;
+
+static const char * getParamName(uint8_t param)
 {
-	const char *sv = getStrValue(ll,name);
-	if(sv && value)
-	{
-		int v=atoi(sv);
-		memcpy(value,&v,size);
-	}
+	return (param<cpCount)?continuousParametersZeroCentered[param].name:steppedParametersSteps[param-cpCount].name;
 }
 
-LOWERCODESIZE static void getSafeIntValue(struct loadLL_s *ll, const char * name, void * value, int size, int min, int max)
+LOWERCODESIZE static int16_t findParam(const char * name)
 {
-	const char *sv = getStrValue(ll,name);
-	if(sv && value)
+	int16_t lo,hi,mid,c;
+
+	// sorted on first use
+	if(!paramNameCount)
+		for(uint8_t param=0;param<cpCount+spCount;++param)
+			if(getParamName(param))
+			{
+				uint8_t i=paramNameCount++;
+				while(i>0 && strcmp(getParamName(paramNames[i-1]),getParamName(param))>0)
+				{
+					paramNames[i]=paramNames[i-1];
+					--i;
+				}
+				paramNames[i]=param;
+			}
+
+	lo=0;
+	hi=paramNameCount-1;
+	while(lo<=hi)
 	{
-		int v=MAX(min,MIN(max,atoi(sv)));
-		memcpy(value,&v,size);
+		mid=(lo+hi)/2;
+		c=strcmp(name,getParamName(paramNames[mid]));
+		if(!c)
+			return paramNames[mid];
+		if(c<0)
+			hi=mid-1;
+		else
+			lo=mid+1;
 	}
+
+	return -1;
 }
 
-LOWERCODESIZE static void getContinuousValue(struct loadLL_s *ll, continuousParameter_t cp)
+LOWERCODESIZE static FRESULT loadSettingsText(void)
 {
-	const struct namedParam_s *np=&continuousParametersZeroCentered[cp];
-	int v=scan_potFrom16bits(currentPreset.continuousParameters[cp]);
-	getIntValue(ll,np->name,&v,sizeof(v));
+	auto void load(const char * name, const char * value)
+	{
+		const char *s;
+		int16_t i,j;
+		int v=atoi(value);
 
-	if(np->param) v+=(SCAN_POT_MAX_VALUE+1)/2;
-	v=scan_potTo16bits(v);
-	
-	currentPreset.continuousParameters[cp]=MAX(0,MIN(UINT16_MAX,v));
+		for(i=0;i<bsPartChannel;++i)
+			if(!strcmp(name,settingsNames[i]))
+			{
+				setField(&settingsFields[i],&settings,0,v);
+				return;
+			}
+
+		if((i=getNameIndex(name,"part",10,&s))>=1 && i<SYNTH_PART_COUNT)
+		{
+			if(!strcmp(s,"Channel"))
+				setField(&settingsFields[bsPartChannel],&settings,i,v);
+			else if(!strcmp(s,"Voices"))
+				setField(&settingsFields[bsPartVoices],&settings,i,v);
+			else if(!strcmp(s,"Preset"))
+				setField(&settingsFields[bsPartPreset],&settings,i,v);
+		}
+		else if((i=getNameIndex(name,"tune_v",10,&s))>=0 && i<TUNER_CV_COUNT &&
+				(j=getNameIndex(s,"_o",10,&s))>=0 && j<TUNER_OCTAVE_COUNT && !*s)
+		{
+			setField(&settingsFields[bsTunes+j],&settings,i,v);
+		}
+	}
+
+	return parseConfigFile(SETTINGS_PATH,load);
 }
 
-LOWERCODESIZE static void getSteppedValue(struct loadLL_s *ll, steppedParameter_t sp)
+LOWERCODESIZE static FRESULT loadPresetText(struct preset_s * preset, const char * fn)
 {
-	const struct namedParam_s *np=&steppedParametersSteps[sp];
-	int v=currentPreset.steppedParameters[sp];
-	getIntValue(ll,np->name,&v,sizeof(v));
-	
-	currentPreset.steppedParameters[sp]=MAX(0,MIN(np->param-1,v));
+	int cpValues[cpCount];
+	FRESULT res;
+
+	auto void load(const char * name, const char * value)
+	{
+		const char *s;
+		int16_t i;
+
+		// empty strings keep their default
+		if(!strcmp(name,"presetName"))
+		{
+			if(*value)
+				setStrField(&presetFields[bpPresetName],preset,value,strlen(value));
+		}
+		else if((i=getNameIndex(name,"bank",10,&s))>=0 && i<abxCount && !*s)
+		{
+			if(*value)
+				setStrField(&presetFields[bpOscBank+i],preset,value,strlen(value));
+		}
+		else if((i=getNameIndex(name,"wave",10,&s))>=0 && i<abxCount && !*s)
+		{
+			if(*value)
+				setStrField(&presetFields[bpOscWave+i],preset,value,strlen(value));
+		}
+		else if((i=getNameIndex(name,"voicePattern",10,&s))>=0 && i<SYNTH_VOICE_COUNT && !*s)
+		{
+			setField(&presetFields[bpVoicePattern],preset,i,atoi(value));
+		}
+		else if((i=findParam(name))>=0)
+		{
+			if(i<cpCount)
+				cpValues[i]=atoi(value);
+			else
+				preset->steppedParameters[i-cpCount]=MAX(0,MIN(steppedParametersSteps[i-cpCount].param-1,atoi(value)));
+		}
+	}
+
+	// continuous parameters are saved as pot values, zero centered ones offset
+	for(continuousParameter_t cp=0;cp<cpCount;++cp)
+		cpValues[cp]=scan_potFrom16bits(preset->continuousParameters[cp]);
+
+	res=parseConfigFile(fn,load);
+	if(res)
+		return res;
+
+	for(continuousParameter_t cp=0;cp<cpCount;++cp)
+	{
+		int v=cpValues[cp];
+		if(continuousParametersZeroCentered[cp].param) v+=(SCAN_POT_MAX_VALUE+1)/2;
+		v=scan_potTo16bits(v);
+		preset->continuousParameters[cp]=MAX(0,MIN(UINT16_MAX,v));
+	}
+
+	return 0;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Settings
+////////////////////////////////////////////////////////////////////////////////
+
 LOWERCODESIZE int8_t settings_load(void)
 {
-	auto void load(struct loadLL_s * ll)
+	settings_loadDefault();
+
+	if(!loadRecord(STORE_SETTINGS,settingsFields,bsCount,&settings))
 	{
-		char buf[32];
-
-		getSafeIntValue(ll,"presetNumber",&settings.presetNumber,sizeof(settings.presetNumber),0,999);
-		getSafeIntValue(ll,"midiReceiveChannel",&settings.midiReceiveChannel,sizeof(settings.midiReceiveChannel),-1,MIDI_CHANMASK);
-		getSafeIntValue(ll,"voiceMask",&settings.voiceMask,sizeof(settings.voiceMask),0,(1<<SYNTH_VOICE_COUNT)-1);
-		getSafeIntValue(ll,"syncMode",&settings.syncMode,sizeof(settings.syncMode),0,symCount-1);
-		getSafeIntValue(ll,"sequencerBank",&settings.sequencerBank,sizeof(settings.sequencerBank),0,SEQ_BANK_COUNT-1);
-		getSafeIntValue(ll,"seqArpClock",&settings.seqArpClock,sizeof(settings.seqArpClock),0,CLOCK_MAX_BPM);
-		getSafeIntValue(ll,"usbMIDI",&settings.usbMIDI,sizeof(settings.usbMIDI),0,1);
-		getSafeIntValue(ll,"lcdContrast",&settings.lcdContrast,sizeof(settings.lcdContrast),0,UI_MAX_LCD_CONTRAST);
-
-		for(int8_t i=0;i<TUNER_CV_COUNT;++i)
-			for(int8_t j=0;j<TUNER_OCTAVE_COUNT;++j)
-			{
-				srprintf(buf,"tune_v%d_o%d",i,j);
-				getSafeIntValue(ll,buf,&settings.tunes[j][i],sizeof(settings.tunes[j][i]),0,UINT16_MAX);
-			}
+		settings_loadDefault();
+
+		if(loadSettingsText())
+		{
+			settings_loadDefault();
+			return 0;
+		}
 	}
-	
-	settings_loadDefault();
 
-	if(parseConfigFile("/overcycler.conf",load))
-		return 0;
-	else
-		return 1;
+	settings.voiceMask&=SYNTH_ALL_VOICES;
+	return 1;
 }
 
-LOWERCODESIZE void settings_save(void)
+LOWERCODESIZE static void saveSettingsText(const struct settings_s * s)
 {
 	FIL f;
-	if(prepareConfigFileSave(&f,"/overcycler.conf"))
+	if(prepareConfigFileSave(&f,SETTINGS_PATH))
 		return;
 
-	f_printf(&f,"presetNumber" SAVE_INT,settings.presetNumber);
-	f_printf(&f,"midiReceiveChannel" SAVE_INT,settings.midiReceiveChannel);
-	f_printf(&f,"voiceMask" SAVE_INT,settings.voiceMask);
-	f_printf(&f,"syncMode" SAVE_INT,settings.syncMode);
-	f_printf(&f,"sequencerBank" SAVE_INT,settings.sequencerBank);
-	f_printf(&f,"seqArpClock" SAVE_INT,settings.seqArpClock);
-	f_printf(&f,"usbMIDI" SAVE_INT,settings.usbMIDI);
-	f_printf(&f,"lcdContrast" SAVE_INT,settings.lcdContrast);
+	f_printf(&f,"presetNumber" SAVE_INT,s->presetNumber);
+	f_printf(&f,"midiReceiveChannel" SAVE_INT,s->midiReceiveChannel);
+	f_printf(&f,"voiceMask" SAVE_INT,s->voiceMask);
+	f_printf(&f,"syncMode" SAVE_INT,s->syncMode);
+	f_printf(&f,"sequencerBank" SAVE_INT,s->sequencerBank);
+	f_printf(&f,"seqArpClock" SAVE_INT,s->seqArpClock);
+	f_printf(&f,"usbMIDI" SAVE_INT,s->usbMIDI);
+	f_printf(&f,"midiThru" SAVE_INT,s->midiThru);
+	f_printf(&f,"lcdContrast" SAVE_INT,s->lcdContrast);
+	
+	for(int8_t p=1;p<SYNTH_PART_COUNT;++p)
+	{
+		f_printf(&f,"part%dChannel" SAVE_INT,p,s->parts[p].midiChannel);
+		f_printf(&f,"part%dVoices" SAVE_INT,p,s->parts[p].voiceCount);
+		f_printf(&f,"part%dPreset" SAVE_INT,p,s->parts[p].presetNumber);
+	}
 	
 	for(int8_t i=0;i<TUNER_CV_COUNT;++i)
 		for(int8_t j=0;j<TUNER_OCTAVE_COUNT;++j)
-			f_printf(&f,"tune_v%d_o%d" SAVE_INT,i,j,settings.tunes[j][i]);
+			f_printf(&f,"tune_v%d_o%d" SAVE_INT,i,j,s->tunes[j][i]);
 
 	f_close(&f);
 }
 
+LOWERCODESIZE void settings_save(void)
+{
+	if(saveRecord(STORE_SETTINGS,settingsFields,bsCount,&settings))
+		f_unlink(SETTINGS_PATH);
+	else
+		saveSettingsText(&settings);
+}
+
+LOWERCODESIZE int8_t settings_exportText(void)
+{
+	struct settings_s s=settings;
+	
+	if(fileExists(SETTINGS_PATH))
+		return 1;
+	
+	if(!loadRecord(STORE_SETTINGS,settingsFields,bsCount,&s))
+		return 0;
+	
+	saveSettingsText(&s);
+	return 1;
+}
+
 LOWERCODESIZE void settings_loadDefault(void)
 {
 	memset(&settings,0,sizeof(settings));
 
 	settings.midiReceiveChannel=-1;
-	settings.voiceMask=(1<<SYNTH_VOICE_COUNT)-1;
+	settings.voiceMask=SYNTH_ALL_VOICES;
 	settings.seqArpClock=CLOCK_MAX_BPM/2;
+	settings.midiThru=1;
 	settings.lcdContrast=UI_DEFAULT_LCD_CONTRAST;
 
+	for(int8_t p=0;p<SYNTH_PART_COUNT;++p)
+		settings.parts[p].midiChannel=-1;
+
 	tuner_init(); // use theoretical tuning
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Sequencer
+////////////////////////////////////////////////////////////////////////////////
+
+// tracks are stored as is, steps are a single byte array
+
 LOWERCODESIZE int8_t storage_loadSequencer(int8_t track, uint8_t * data, uint8_t size)
 {
-	auto void load(struct loadLL_s * ll)
+	auto void load(const char * name, const char * value)
 	{
-		char buf[32];
-		for(uint8_t i=0;i<size;++i)
-		{
-			srprintf(buf,"step%02x",i);
-			getSafeIntValue(ll,buf,&data[i],sizeof(data[i]),0,UINT8_MAX);
-		}
+		const char *s;
+		int16_t i;
+		
+		if((i=getNameIndex(name,"step",16,&s))>=0 && i<size && !*s)
+			data[i]=MAX(0,MIN(UINT8_MAX,atoi(value)));
 	}
 
 	char fn[256];
-	srprintf(fn,SYNTH_SEQUENCES_PATH "/sequence_%02d%c.conf",settings.sequencerBank,'a'+track);
-	if(parseConfigFile(fn,load))
-		return 0;
-	else
+
+	if(logstore_read(STORE_SEQUENCE(settings.sequencerBank,track),data,size))
 		return 1;
-}
 
-LOWERCODESIZE void storage_saveSequencer(int8_t track, uint8_t * data, uint8_t size)
+	srprintf(fn,SYNTH_SEQUENCES_PATH "/sequence_%02d%c.conf",settings.sequencerBank,'a'+track);
+	return !parseConfigFile(fn,load);
+}
+LOWERCODESIZE static void saveSequencerText(const char * fn, const uint8_t * data, uint8_t size)
 {
 	FIL f;
-	char buf[256];
 	
 	f_mkdir(SYNTH_SEQUENCES_PATH);
 	
-	srprintf(buf,SYNTH_SEQUENCES_PATH "/sequence_%02d%c.conf",settings.sequencerBank,'a'+track);
-	if(prepareConfigFileSave(&f,buf))
+	if(prepareConfigFileSave(&f,fn))
 		return;
 
 	for(uint8_t i=0;i<size;++i)
@@ -388,160 +708,357 @@ LOWERCODESIZE void storage_saveSequencer(int8_t track, uint8_t * data, uint8_t s
 	f_close(&f);
 }
 
-LOWERCODESIZE int8_t preset_loadCurrent(uint16_t number)
+LOWERCODESIZE void storage_saveSequencer(int8_t track, uint8_t * data, uint8_t size)
 {
-	auto void load(struct loadLL_s * ll)
-	{
-		char buf[32];
-		
-		getSafeStrValue(ll,"presetName",currentPreset.presetName,sizeof(currentPreset.presetName),0);
+	char fn[256];
+	
+	srprintf(fn,SYNTH_SEQUENCES_PATH "/sequence_%02d%c.conf",settings.sequencerBank,'a'+track);
+	
+	if(logstore_write(STORE_SEQUENCE(settings.sequencerBank,track),data,size))
+		f_unlink(fn);
+	else
+		saveSequencerText(fn,data,size);
+}
+
+LOWERCODESIZE int8_t storage_exportSequencer(uint16_t bank, int8_t track)
+{
+	uint8_t data[UINT8_MAX];
+	int32_t size;
+	char fn[256];
+	
+	srprintf(fn,SYNTH_SEQUENCES_PATH "/sequence_%02d%c.conf",bank,'a'+track);
+	if(fileExists(fn))
+		return 1;
+
+	size=logstore_getSize(STORE_SEQUENCE(bank,track));
+	if(size<0 || size>UINT8_MAX || !logstore_read(STORE_SEQUENCE(bank,track),data,size))
+		return 0;
+
+	saveSequencerText(fn,data,size);
+	return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Presets
+////////////////////////////////////////////////////////////////////////////////
+
+static void loadDefault(struct preset_s * p, int8_t makeSound);
+
+LOWERCODESIZE static void clampSteppedParameters(struct preset_s * preset)
+{
+	for(steppedParameter_t sp=0;sp<spCount;++sp)
+		preset->steppedParameters[sp]=MIN(steppedParametersSteps[sp].param-1,preset->steppedParameters[sp]);
+}
+
+// decoded presets: the current one & its neighbours (see synth_prefetchNeighbours()),
+// least recently used one evicted
+static struct
+{
+	struct preset_s presets[PRESET_CACHE_SIZE];
+	uint32_t lastUse[PRESET_CACHE_SIZE]; // 0: empty
+	int8_t found[PRESET_CACHE_SIZE]; // 0: the preset doesn't exist, defaults are cached
+	uint32_t useCount;
+} presetCache;
 
-		for(abx_t abx=0;abx<abxCount;++abx)
+static int8_t getCachedIndex(uint16_t number)
+{
+	for(int8_t i=0;i<PRESET_CACHE_SIZE;++i)
+		if(presetCache.lastUse[i] && presetCache.presets[i].loadedPresetNumber==number)
 		{
-			srprintf(buf,"bank%d",abx);
-			getSafeStrValue(ll,buf,currentPreset.oscBank[abx],MAX_FILENAME,0);
-			srprintf(buf,"wave%d",abx);
-			getSafeStrValue(ll,buf,currentPreset.oscWave[abx],MAX_FILENAME,0);
+			presetCache.lastUse[i]=++presetCache.useCount;
+			return i;
 		}
 
-		for(continuousParameter_t cp=0;cp<cpCount;++cp)
-			getContinuousValue(ll,cp);
+	return -1;
+}
+
+static struct preset_s * getCachedPreset(uint16_t number)
+{
+	int8_t i=getCachedIndex(number);
+	
+	return (i>=0)?&presetCache.presets[i]:NULL;
+}
+
+static void cachePreset(const struct preset_s * preset, int8_t found)
+{
+	int8_t lru=0;
+
+	for(int8_t i=1;i<PRESET_CACHE_SIZE;++i)
+		if(presetCache.lastUse[i]<presetCache.lastUse[lru])
+			lru=i;
 
-		for(steppedParameter_t sp=0;sp<spCount;++sp)
-			getSteppedValue(ll,sp);
+	presetCache.presets[lru]=*preset;
+	presetCache.found[lru]=found;
+	presetCache.lastUse[lru]=++presetCache.useCount;
+}
 
-		for(int8_t i=0;i<SYNTH_VOICE_COUNT;++i)
+static void forgetPreset(uint16_t number)
+{
+	for(int8_t i=0;i<PRESET_CACHE_SIZE;++i)
+		if(presetCache.presets[i].loadedPresetNumber==number)
+			presetCache.lastUse[i]=0;
+}
+
+LOWERCODESIZE static int8_t loadPreset(struct preset_s * preset, uint16_t number)
+{
+	char fn[256];
+
+	loadDefault(preset,1);
+
+	if(!loadRecord(STORE_PRESET(number),presetFields,bpCount,preset))
+	{
+		loadDefault(preset,1);
+
+		srprintf(fn,SYNTH_PRESETS_PATH "/preset_%04d.conf",number);
+		if(loadPresetText(preset,fn))
 		{
-			srprintf(buf,"voicePattern%d",i);
-			getSafeIntValue(ll,buf,&currentPreset.voicePattern[i],sizeof(currentPreset.voicePattern[i]),0,UINT8_MAX);
+			loadDefault(preset,1);
+			preset->loadedPresetNumber=number;
+			return 0;
 		}
-		
-		// reset wheels/pressure
-		synth_pressureEvent(0);
-		synth_wheelEvent(0,0,3);
 	}
-	
-	preset_loadDefault(1);
-	currentPreset.loadedPresetNumber=number;
 
-	char fn[256];
-	srprintf(fn,SYNTH_PRESETS_PATH "/preset_%04d.conf",number);
-	if(parseConfigFile(fn,load))
+	clampSteppedParameters(preset);
+	preset->loadedPresetNumber=number;
+	return 1;
+}
+
+int8_t preset_load(struct preset_s * preset, uint16_t number)
+{
+	int8_t i,found;
+
+	if((i=getCachedIndex(number))>=0)
+	{
+		*preset=presetCache.presets[i];
+		return presetCache.found[i];
+	}
+
+	found=loadPreset(preset,number);
+	cachePreset(preset,found);
+	return found;
+}
+
+// missing presets are cached too, as defaults: loads from the cache never read flash
+LOWERCODESIZE int8_t preset_prefetch(uint16_t number)
+{
+	struct preset_s p;
+
+	if(getCachedPreset(number))
 		return 0;
-	else
-		return 1;
+
+	cachePreset(&p,loadPreset(&p,number));
+	return 1;
 }
 
-LOWERCODESIZE void preset_saveCurrent(uint16_t number)
+const struct preset_s * preset_getCached(uint16_t number)
 {
-	FIL f;
-	char buf[256];
+	return getCachedPreset(number);
+}
+
+LOWERCODESIZE int8_t preset_loadCurrent(uint16_t number)
+{
+	int8_t res=preset_load(&currentPreset,number);
 	
-	currentPreset.loadedPresetNumber=number;
+	// reset wheels/pressure
+	if(res)
+	{
+		synth_pressureEvent(0,0);
+		synth_wheelEvent(0,0,0,3);
+	}
+	
+	return res;
+}
 
+LOWERCODESIZE static void savePresetText(const char * fn, const struct preset_s * p)
+{
+	FIL f;
+	
 	f_mkdir(SYNTH_PRESETS_PATH);
 	
-	srprintf(buf,SYNTH_PRESETS_PATH "/preset_%04d.conf",number);
-	if(prepareConfigFileSave(&f,buf))
+	if(prepareConfigFileSave(&f,fn))
 		return;
 
-	f_printf(&f,"presetName" SAVE_STR,currentPreset.presetName);
+	f_printf(&f,"presetName" SAVE_STR,p->presetName);
 
 	for(abx_t abx=0;abx<abxCount;++abx)
 	{
-		f_printf(&f,"bank%d" SAVE_STR,abx,currentPreset.oscBank[abx]);
-		f_printf(&f,"wave%d" SAVE_STR,abx,currentPreset.oscWave[abx]);
+		f_printf(&f,"bank%d" SAVE_STR,abx,p->oscBank[abx]);
+		f_printf(&f,"wave%d" SAVE_STR,abx,p->oscWave[abx]);
 	}
 	
 	for(continuousParameter_t cp=0;cp<cpCount;++cp)
 		if(continuousParametersZeroCentered[cp].name)
 			f_printf(&f,"%s" SAVE_INT,
 				continuousParametersZeroCentered[cp].name,
-				scan_potFrom16bits(currentPreset.continuousParameters[cp]+(continuousParametersZeroCentered[cp].param?INT16_MIN:0)));
+				scan_potFrom16bits(p->continuousParameters[cp]+(continuousParametersZeroCentered[cp].param?INT16_MIN:0)));
 
 	for(steppedParameter_t sp=0;sp<spCount;++sp)
 		if(steppedParametersSteps[sp].name)
 			f_printf(&f,"%s" SAVE_INT,
 				steppedParametersSteps[sp].name,
-				currentPreset.steppedParameters[sp]);
+				p->steppedParameters[sp]);
 
 	for(int8_t i=0;i<SYNTH_VOICE_COUNT;++i)
-		f_printf(&f,"voicePattern%d" SAVE_INT,i,currentPreset.voicePattern[i]);
+		f_printf(&f,"voicePattern%d" SAVE_INT,i,p->voicePattern[i]);
 	
 	f_close(&f);
 }
 
-LOWERCODESIZE int8_t preset_fileExists(uint16_t number)
+LOWERCODESIZE void preset_saveCurrent(uint16_t number)
 {
-	FIL f;
-	FRESULT res;
 	char fn[256];
+	
+	currentPreset.loadedPresetNumber=number;
+
 	srprintf(fn,SYNTH_PRESETS_PATH "/preset_%04d.conf",number);
 	
-	res=f_open(&f,fn,FA_READ|FA_OPEN_EXISTING);
-	if(res)
-		return res!=FR_NO_FILE;
+	forgetPreset(number);
 
-	f_close(&f);
+	if(saveRecord(STORE_PRESET(number),presetFields,bpCount,&currentPreset))
+		f_unlink(fn);
+	else
+		savePresetText(fn,&currentPreset);
+}
+
+LOWERCODESIZE int8_t preset_exportText(uint16_t number)
+{
+	struct preset_s p;
+	char fn[256];
+	
+	srprintf(fn,SYNTH_PRESETS_PATH "/preset_%04d.conf",number);
+	if(fileExists(fn))
+		return 1;
+	
+	loadDefault(&p,1);
+	if(!loadRecord(STORE_PRESET(number),presetFields,bpCount,&p))
+		return 0;
+	
+	clampSteppedParameters(&p);
+	savePresetText(fn,&p);
 	return 1;
 }
 
-LOWERCODESIZE void preset_loadDefault(int8_t makeSound)
+LOWERCODESIZE int8_t preset_fileExists(uint16_t number)
+{
+	char fn[256];
+	
+	if(logstore_getSize(STORE_PRESET(number))>=0)
+		return 1;
+	
+	srprintf(fn,SYNTH_PRESETS_PATH "/preset_%04d.conf",number);
+	return fileExists(fn);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Text imports
+////////////////////////////////////////////////////////////////////////////////
+
+// loads go to the store first, so text files that came in through the USB
+// disk or SysEx must evict the stored version of their object
+
+LOWERCODESIZE static int8_t readDirName(DIR * d, FILINFO * fi)
+{
+	if(f_readdir(d,fi) || !fi->fname[0])
+		return 0;
+
+	// lowercase long name, like the ones saved
+	if(!fi->lfname[0])
+		strcpy(fi->lfname,fi->fname);
+	for(char *p=fi->lfname;*p;++p)
+		*p=tolower(*p);
+
+	return 1;
+}
+
+LOWERCODESIZE void storage_importText(void)
+{
+	DIR d;
+	FILINFO fi;
+	char lfn[MAX_FILENAME];
+	const char *s;
+	int16_t n;
+
+	memset(&presetCache,0,sizeof(presetCache));
+
+	if(fileExists(SETTINGS_PATH))
+		logstore_remove(STORE_SETTINGS);
+
+	fi.lfname=lfn;
+	fi.lfsize=sizeof(lfn);
+
+	if(!f_opendir(&d,SYNTH_PRESETS_PATH))
+		while(readDirName(&d,&fi))
+			if((n=getNameIndex(lfn,"preset_",10,&s))>=0 && !strcmp(s,".conf"))
+				logstore_remove(STORE_PRESET(n));
+
+	if(!f_opendir(&d,SYNTH_SEQUENCES_PATH))
+		while(readDirName(&d,&fi))
+			if((n=getNameIndex(lfn,"sequence_",10,&s))>=0 && n<SEQ_BANK_COUNT &&
+					s[0]>='a' && s[0]<'a'+SEQ_TRACK_COUNT && !strcmp(&s[1],".conf"))
+				logstore_remove(STORE_SEQUENCE(n,s[0]-'a'));
+}
+
+LOWERCODESIZE static void loadDefault(struct preset_s * p, int8_t makeSound)
 {
 	int8_t i;
 
-	memset(&currentPreset,0,sizeof(struct preset_s));
-
-	currentPreset.continuousParameters[cpUnisonDetune]=512;
-	currentPreset.continuousParameters[cpMasterTune]=HALF_RANGE;
-	currentPreset.continuousParameters[cpDetune]=HALF_RANGE;
-
-	currentPreset.continuousParameters[cpABaseWMod]=HALF_RANGE;
-	currentPreset.continuousParameters[cpBBaseWMod]=HALF_RANGE;
-	currentPreset.continuousParameters[cpWModAEnv]=HALF_RANGE;
-	currentPreset.continuousParameters[cpWModBEnv]=HALF_RANGE;
-	currentPreset.continuousParameters[cpCutoff]=UINT16_MAX;
-	currentPreset.continuousParameters[cpFilEnvAmt]=HALF_RANGE;
-	currentPreset.continuousParameters[cpAmpSus]=UINT16_MAX;
-	currentPreset.continuousParameters[cpLFOPitchAmt]=scan_potTo16bits(100);
-	currentPreset.continuousParameters[cpLFOFreq]=scan_potTo16bits(5*60);
-	currentPreset.continuousParameters[cpLFO2Freq]=scan_potTo16bits(5*60);
-	currentPreset.continuousParameters[cpAmpLevel]=HALF_RANGE;
-
-	currentPreset.steppedParameters[spBenderTarget]=modPitch;
-	currentPreset.steppedParameters[spModwheelRange]=1; // low
-	currentPreset.steppedParameters[spChromaticPitch]=2; // octave
-	currentPreset.steppedParameters[spAssignerPriority]=apLast;
-	currentPreset.steppedParameters[spLFOShape]=lsTri;
-	currentPreset.steppedParameters[spLFOTargets]=otBoth;
-	currentPreset.steppedParameters[spLFO2Shape]=lsTri;
-	currentPreset.steppedParameters[spLFO2Targets]=otBoth;
-	currentPreset.steppedParameters[spPressureRange]=1; // low
-	currentPreset.steppedParameters[spPressureTarget]=modFilter;
-
-	currentPreset.steppedParameters[spVoiceCount]=SYNTH_VOICE_COUNT-1;
+	memset(p,0,sizeof(struct preset_s));
+
+	p->continuousParameters[cpUnisonDetune]=512;
+	p->continuousParameters[cpMasterTune]=HALF_RANGE;
+	p->continuousParameters[cpDetune]=HALF_RANGE;
+
+	p->continuousParameters[cpABaseWMod]=HALF_RANGE;
+	p->continuousParameters[cpBBaseWMod]=HALF_RANGE;
+	p->continuousParameters[cpWModAEnv]=HALF_RANGE;
+	p->continuousParameters[cpWModBEnv]=HALF_RANGE;
+	p->continuousParameters[cpCutoff]=UINT16_MAX;
+	p->continuousParameters[cpFilEnvAmt]=HALF_RANGE;
+	p->continuousParameters[cpAmpSus]=UINT16_MAX;
+	p->continuousParameters[cpLFOPitchAmt]=scan_potTo16bits(100);
+	p->continuousParameters[cpLFOFreq]=scan_potTo16bits(5*60);
+	p->continuousParameters[cpLFO2Freq]=scan_potTo16bits(5*60);
+	p->continuousParameters[cpAmpLevel]=HALF_RANGE;
+
+	p->steppedParameters[spBenderTarget]=modPitch;
+	p->steppedParameters[spModwheelRange]=1; // low
+	p->steppedParameters[spChromaticPitch]=2; // octave
+	p->steppedParameters[spAssignerPriority]=apLast;
+	p->steppedParameters[spLFOShape]=lsTri;
+	p->steppedParameters[spLFOTargets]=otBoth;
+	p->steppedParameters[spLFO2Shape]=lsTri;
+	p->steppedParameters[spLFO2Targets]=otBoth;
+	p->steppedParameters[spPressureRange]=1; // low
+	p->steppedParameters[spPressureTarget]=modFilter;
+
+	p->steppedParameters[spVoiceCount]=SYNTH_VOICE_COUNT-1;
 	
 	for(i=0;i<SYNTH_VOICE_COUNT;++i)
-		currentPreset.voicePattern[i]=(i==0)?0:ASSIGNER_NO_NOTE;	
+		p->voicePattern[i]=(i==0)?0:ASSIGNER_NO_NOTE;	
 
 	for(abx_t abx=0;abx<abxCount;++abx)
 	{
 		if(abx<abxACrossover)
 		{
-			strcpy(currentPreset.oscBank[abx],SYNTH_DEFAULT_MAIN_WAVE_BANK);
-			strcpy(currentPreset.oscWave[abx],SYNTH_DEFAULT_MAIN_WAVE_NAME);
+			strcpy(p->oscBank[abx],SYNTH_DEFAULT_MAIN_WAVE_BANK);
+			strcpy(p->oscWave[abx],SYNTH_DEFAULT_MAIN_WAVE_NAME);
 		}
 		else
 		{
-			strcpy(currentPreset.oscBank[abx],SYNTH_DEFAULT_XOVR_WAVE_BANK);
-			strcpy(currentPreset.oscWave[abx],SYNTH_DEFAULT_XOVR_WAVE_NAME);
+			strcpy(p->oscBank[abx],SYNTH_DEFAULT_XOVR_WAVE_BANK);
+			strcpy(p->oscWave[abx],SYNTH_DEFAULT_XOVR_WAVE_NAME);
 		}
 	}
 
-	strcpy(currentPreset.presetName,"<no name>");
+	strcpy(p->presetName,"<no name>");
 
 	if(makeSound)
 	{
-		currentPreset.continuousParameters[cpAVol]=HALF_RANGE;
+		p->continuousParameters[cpAVol]=HALF_RANGE;
 	}
 }
+
+LOWERCODESIZE void preset_loadDefault(int8_t makeSound)
+{
+	loadDefault(&currentPreset,makeSound);
+}
@@ -63,6 +63,8 @@ typedef enum
 	spBXOvrBank_Unsaved=38,spBXOvrWave_Unsaved=39,
 			
 	spLFOTrig=40, spLFO2Trig=41,
+	
+	spDacProfile=42,
 
 	// /!\ this must stay last
 	spCount
@@ -85,10 +87,20 @@ struct settings_s
 	uint16_t presetNumber;
 	
 	int8_t midiReceiveChannel; // -1: omni / 0-15: channel 1-16
-	uint8_t voiceMask;
+	voiceMask_t voiceMask;
 	
 	int8_t syncMode;
 	int8_t usbMIDI;
+	int8_t midiThru; // UART & USB input to MIDI out
+	
+	// multi-timbral layers, parts[0] is the main part: its channel & preset
+	// are midiReceiveChannel & presetNumber, it gets the voices left
+	struct
+	{
+		int8_t midiChannel; // 0-15: channel 1-16, -1: off
+		uint8_t voiceCount;
+		uint16_t presetNumber;
+	} parts[SYNTH_PART_COUNT];
 	
 	uint16_t sequencerBank;
 	uint16_t seqArpClock;
@@ -124,16 +136,26 @@ extern const struct namedParam_s steppedParametersSteps[spCount];
 
 int8_t settings_load(void);
 void settings_save(void);
+int8_t settings_exportText(void); // text file of the stored version, if there isn't one
 
+#define PRESET_CACHE_SIZE 2 // decoded presets kept in RAM, the current one & the next
+
+int8_t preset_load(struct preset_s * preset, uint16_t number); // any part snapshot
+int8_t preset_prefetch(uint16_t number); // to the cache, 1 if it was read from flash
+const struct preset_s * preset_getCached(uint16_t number); // NULL if it isn't
 int8_t preset_loadCurrent(uint16_t number);
 void preset_saveCurrent(uint16_t number);
 int8_t preset_fileExists(uint16_t number);
+int8_t preset_exportText(uint16_t number);
 
 void preset_loadDefault(int8_t makeSound);
 void settings_loadDefault(void);
 
 int8_t storage_loadSequencer(int8_t track, uint8_t * data, uint8_t size);
 void storage_saveSequencer(int8_t track, uint8_t * data, uint8_t size);
+int8_t storage_exportSequencer(uint16_t bank, int8_t track);
+
+void storage_importText(void); // text files on the volume replace the stored objects
 
 #endif	/* STORAGE_H */
 
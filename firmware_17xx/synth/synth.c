@@ -17,6 +17,7 @@
 #include "seq.h"
 #include "clock.h"
 #include "storage.h"
+#include "logstore.h"
 #include "vca_curves.h"
 #include "vcnoise_curves.h"
 #include "../xnormidi/midi.h"
@@ -28,6 +29,26 @@
 
 #define MAX_BANKS 128
 #define MAX_BANK_WAVES 256
+#define BANK_NAMES_POOL 1536 // bytes, the stock card uses 817
+#define WAVE_NAMES_POOL 5120 // bytes, the largest stock bank uses 4226
+
+#ifndef WAVE_SLOT_COUNT
+#define WAVE_SLOT_COUNT abxCount // 4.9KB each of main RAM, spares (prefetches) don't fit
+#endif
+#define WAVE_CHANNEL(abx) ((abx)>=abxACrossover?1:0) // of stereo files
+#define WAVE_OSC(abx) (((abx)==abxBMain || (abx)==abxBCrossover)?1:0)
+
+#define FRAME_SUBBLOCKS ((DACSPI_BUFFER_COUNT/2)/DACSPI_CV_COUNT) // per DMA interrupt, at most
+
+// everything the DMA interrupt needs to render DACSPI_CV_COUNT samples,
+// computed by the control rate task one block ahead
+struct paramFrame_s
+{
+	uint16_t cvs[DACSPI_CV_CHANNEL_COUNT]; // adjusted DAC values, per channel
+	uint16_t oscPitch[SYNTH_VOICE_COUNT][2];
+	uint16_t oscWMod[SYNTH_VOICE_COUNT][2];
+	oscWModTarget_t oscWModType[SYNTH_VOICE_COUNT][2];
+};
 
 volatile uint32_t currentTick=0; // 500hz
 
@@ -35,28 +56,81 @@ static struct
 {
 	int bankCount;
 	int curWaveCount;
-	char bankNames[MAX_BANKS][MAX_FILENAME];
-	char curWaveNames[MAX_BANK_WAVES][MAX_FILENAME];
+	// names are packed in the pools, the lists hold their offsets there
+	uint16_t bankNames[MAX_BANKS];
+	uint16_t curWaveNames[MAX_BANK_WAVES];
+	char bankPool[BANK_NAMES_POOL];
+	char curWavePool[WAVE_NAMES_POOL];
 	
 	int8_t bankSorted;
 	int8_t curWaveSorted;
 	abx_t curWaveABX;
 	char curWaveBank[128];
 	
-	uint16_t sampleData[abxCount][WTOSC_SAMPLE_COUNT];
+	struct waveSlot_s
+	{
+		char bank[MAX_FILENAME]; // empty: nothing loaded
+		char wave[MAX_FILENAME];
+		int8_t channel;
+		int16_t bankNum,waveNum; // in the bank & wave lists
+		uint32_t lastUse;
+		uint8_t generation; // of the prefetches it was loaded by
+		uint16_t data[WTOSC_SAMPLE_COUNT];
+	} slots[WAVE_SLOT_COUNT];
+	struct waveSlot_s * abxSlots[abxCount];
+	int8_t mutedOsc; // while its played slot is decoded into, -1: none
+	uint32_t useCount;
+	uint8_t generation;
+
+	uint16_t prefetchNumber;
+	uint8_t prefetchStep;
 
 	DIR curDir;
 	FILINFO curFile;
 	char lfname[MAX_FILENAME];
 } waveData;
 
+// a multi-timbral part: its preset, the voices it plays and what they share
+struct part_s
+{
+	struct preset_s * preset;
+	voiceMask_t voiceMask; // voices rendered with this part, 0 when it's off
+	struct lfo_s lfo[2];
+
+	struct
+	{
+		int16_t benderAmount;
+		uint16_t modwheelAmount;
+		uint16_t pressureAmount;
+		int16_t glideAmount;
+		int8_t gliding;
+
+		uint32_t modulationDelayStart;
+		uint16_t modulationDelayTickCount;
+		int8_t prevAnyPressed;
+	} state;
+
+	// synth_updateCVsEvent() terms that only change with the preset or the
+	// performance controls, recomputed by refreshCVTerms() when dirty
+	struct
+	{
+		volatile int8_t dirty;
+		int8_t resonanceModulated; // by LFOs, resoFactor & volumes are then per update
+		int32_t resVal,resoFactor;
+		uint16_t volumes[3]; // A, B, noise, before resonance compensation
+		int32_t lfoPitchAmt[2][2],lfoWModAmt[2][2]; // [lfo][osc], 0 when osc isn't targeted
+		int32_t wmodABase,wmodBBase;
+		int32_t filEnvAmt,wmodAEnvAmt,wmodBEnvAmt;
+		int8_t wmodAFreq,wmodBFreq;
+	} cvTerms;
+};
+
 static struct
 {
 	struct wtosc_s osc[SYNTH_VOICE_COUNT][2];
 	struct adsr_s filEnvs[SYNTH_VOICE_COUNT];
 	struct adsr_s ampEnvs[SYNTH_VOICE_COUNT];
 	struct adsr_s wmodEnvs[SYNTH_VOICE_COUNT];
-	struct lfo_s lfo[2];
 	
 	uint16_t oscANoteCV[SYNTH_VOICE_COUNT];
 	uint16_t oscBNoteCV[SYNTH_VOICE_COUNT];
@@ -66,22 +140,35 @@ static struct
 	uint16_t oscBTargetCV[SYNTH_VOICE_COUNT];
 	uint16_t filterTargetCV[SYNTH_VOICE_COUNT];
 
+	struct part_s part[SYNTH_PART_COUNT];
+	int8_t voicePart[SYNTH_VOICE_COUNT];
+
+	// CV DAC channels, from the voice board layout
 	struct
 	{
-		int16_t benderAmount;
-		uint16_t modwheelAmount;
-		uint16_t pressureAmount;
-		int16_t glideAmount;
-		int8_t gliding;
+		uint8_t amp,cutoff;
+	} voiceCVs[SYNTH_VOICE_COUNT];
 
-		uint32_t modulationDelayStart;
-		uint16_t modulationDelayTickCount;
+	// osc sync, from the main part
+	struct
+	{
+		syncMode_t modeMaster,modeSlave;
+		int16_t positions[DACSPI_BUFFER_COUNT/2];
+	} sync;
 
-		syncMode_t syncModeMaster,syncModeSlave;
-		int16_t syncPositions[DACSPI_BUFFER_COUNT/2];
-	} partState;
+	// double buffered parameter frames, the DMA interrupt renders from
+	// frames[front] while the control rate task fills the other one
+	struct
+	{
+		struct paramFrame_s frames[2][FRAME_SUBBLOCKS];
+		struct paramFrame_s * write; // being filled by synth_updateCVsEvent()
+		volatile int8_t front;
+		volatile int8_t ready; // back frames complete, to be swapped in
+	} pipeline;
 } synth;
 
+static struct preset_s layerPresets[SYNTH_PART_COUNT-1] EXT_RAM;
+
 extern const uint16_t attackCurveLookup[]; // for modulation delay
 
 const uint16_t extClockDividers[16] = {192,168,144,128,96,72,48,36,24,18,12,9,6,4,3,2};
@@ -124,7 +211,7 @@ const char * notesNames[12]=
 // Non speed critical internal code
 ////////////////////////////////////////////////////////////////////////////////
 
-static int32_t getStaticCV(cv_t cv)
+static int32_t getStaticCV(const struct part_s * pt, cv_t cv)
 {
 	static const modulationTarget_t cv2mod[cvCount]={modVolume,modVolume,modFilter,modNone,modPitch,modPitch,modWaveMod,modNone,modVolume};
 	modulationTarget_t mod=cv2mod[cv];
@@ -132,10 +219,10 @@ static int32_t getStaticCV(cv_t cv)
 	
 	if(mod!=modNone)
 	{
-		if(currentPreset.steppedParameters[spBenderTarget]==mod)
-			res+=synth.partState.benderAmount;
-		if(currentPreset.steppedParameters[spPressureTarget]==mod)
-			res+=(int32_t)synth.partState.pressureAmount*(mod==modPitch?-1:1); // pressure to pitch goes downwards
+		if(pt->preset->steppedParameters[spBenderTarget]==mod)
+			res+=pt->state.benderAmount;
+		if(pt->preset->steppedParameters[spPressureTarget]==mod)
+			res+=(int32_t)pt->state.pressureAmount*(mod==modPitch?-1:1); // pressure to pitch goes downwards
 	}
 	
 	return __SSAT(res,16);
@@ -161,8 +248,10 @@ static void handleFinishedVoices(void)
 	}
 }
 
-static void refreshTunedCVs(void)
+static void refreshTunedCVs(int8_t part)
 {
+	struct part_s * pt=&synth.part[part];
+	const struct preset_s * p=pt->preset;
 	uint16_t cva,cvb,cvf;
 	uint8_t note,baseCutoffNote,baseANote,baseBNote,trackingNote;
 	int8_t v;
@@ -177,14 +266,14 @@ static void refreshTunedCVs(void)
 	
 	// get raw values
 
-	mTuneRaw=currentPreset.continuousParameters[cpMasterTune];
-	detuneRaw=currentPreset.continuousParameters[cpDetune];
-	baseCutoffRaw=currentPreset.continuousParameters[cpCutoff];
-	baseAPitch=currentPreset.continuousParameters[cpAFreq]>>2;
-	baseBPitch=currentPreset.continuousParameters[cpBFreq]>>2;
-	unisonDetuneRaw=currentPreset.continuousParameters[cpUnisonDetune];
-	trackRaw=currentPreset.continuousParameters[cpFilKbdAmt];
-	chrom=currentPreset.steppedParameters[spChromaticPitch];
+	mTuneRaw=p->continuousParameters[cpMasterTune];
+	detuneRaw=p->continuousParameters[cpDetune];
+	baseCutoffRaw=p->continuousParameters[cpCutoff];
+	baseAPitch=p->continuousParameters[cpAFreq]>>2;
+	baseBPitch=p->continuousParameters[cpBFreq]>>2;
+	unisonDetuneRaw=p->continuousParameters[cpUnisonDetune];
+	trackRaw=p->continuousParameters[cpFilKbdAmt];
+	chrom=p->steppedParameters[spChromaticPitch];
 
 	// compute for oscs & filters
 
@@ -217,15 +306,18 @@ static void refreshTunedCVs(void)
 
 	for(v=0;v<SYNTH_VOICE_COUNT;++v)
 	{
+		if(!(pt->voiceMask&((voiceMask_t)1<<v)))
+			continue;
+		
 		note=MIDDLE_C_NOTE; // by default, rest the synth on scale middle (prevents analog glitches)
 		assigner_getAssignment(v,&note);
 		
 		// oscs
 		
-		add=getStaticCV(cvAPitch)+mTune-(detune>>1);
+		add=getStaticCV(pt,cvAPitch)+mTune-(detune>>1);
 		cva=satAddU16S32(tuner_computeCVFromNote(v,baseANote+note,baseAPitch,cvAPitch),add);
 		
-		add=getStaticCV(cvBPitch)+mTune+(detune>>1);
+		add=getStaticCV(pt,cvBPitch)+mTune+(detune>>1);
 		cvb=satAddU16S32(tuner_computeCVFromNote(v,baseBNote+note,baseBPitch,cvBPitch),add);
 		
 		unisonDetune=(1+(v>>1))*(v&1?-1:1)*(unisonDetuneRaw>>9);
@@ -236,12 +328,12 @@ static void refreshTunedCVs(void)
 		
 		trackingNote=MAX(0,baseCutoffNote+((((int8_t)note-MIDDLE_C_NOTE)*(trackRaw>>8))>>8));
 			
-		add=getStaticCV(cvCutoff);
+		add=getStaticCV(pt,cvCutoff);
 		cvf=satAddU16S32(tuner_computeCVFromNote(v,trackingNote,baseCutoff,cvCutoff),add);
 		
 		// glide
 		
-		if(synth.partState.gliding)
+		if(pt->state.gliding)
 		{
 			synth.oscATargetCV[v]=cva;
 			synth.oscBTargetCV[v]=cvb;
@@ -260,17 +352,69 @@ static void refreshTunedCVs(void)
 	}
 }
 
-static void refreshAssignerSettings(void)
+static voiceMask_t lowestVoices(voiceMask_t mask, int8_t count)
+{
+	voiceMask_t res=0;
+	
+	for(;mask && count>0;--count)
+	{
+		res|=mask&-mask;
+		mask&=mask-1;
+	}
+	
+	return res;
+}
+
+// layers take enabled voices from the top, in part order, the main part keeps the rest
+static void refreshPartVoices(void)
 {
-	static const uint8_t vc2msk[7]={1,3,7,15,31,63};
+	voiceMask_t free=settings.voiceMask;
+	int8_t part,v,count;
+	
+	memset(synth.voicePart,0,sizeof(synth.voicePart));
+	synth.part[0].voiceMask=SYNTH_ALL_VOICES;
+	
+	for(part=1;part<SYNTH_PART_COUNT;++part)
+	{
+		struct part_s * pt=&synth.part[part];
+		
+		pt->voiceMask=0;
+		if(settings.parts[part].midiChannel<0)
+			continue;
+		
+		count=settings.parts[part].voiceCount+1;
+		for(v=SYNTH_VOICE_COUNT-1;v>=0 && count;--v)
+			if(free&((voiceMask_t)1<<v))
+			{
+				free&=~((voiceMask_t)1<<v);
+				pt->voiceMask|=(voiceMask_t)1<<v;
+				synth.voicePart[v]=part;
+				--count;
+			}
+		
+		synth.part[0].voiceMask&=~pt->voiceMask;
+	}
+}
+
+static void refreshAssignerSettings(int8_t part)
+{
+	struct part_s * pt=&synth.part[part];
+	const struct preset_s * p=pt->preset;
+	voiceMask_t mask;
+	
+	if(part)
+		mask=lowestVoices(pt->voiceMask,p->steppedParameters[spVoiceCount]+1);
+	else
+		mask=lowestVoices(SYNTH_ALL_VOICES,p->steppedParameters[spVoiceCount]+1)&settings.voiceMask&pt->voiceMask;
  
-	assigner_setPattern(currentPreset.voicePattern,currentPreset.steppedParameters[spUnison]);
-	assigner_setPriority(currentPreset.steppedParameters[spAssignerPriority]);
-	assigner_setVoiceMask(vc2msk[currentPreset.steppedParameters[spVoiceCount]]&settings.voiceMask);
+	assigner_setPattern(part,p->voicePattern,p->steppedParameters[spUnison]);
+	assigner_setPriority(part,p->steppedParameters[spAssignerPriority]);
+	assigner_setVoiceMask(part,mask);
 }
 
-static void refreshEnvSettings(int8_t type)
+static void refreshEnvSettings(int8_t part, int8_t type)
 {
+	const struct preset_s * p=synth.part[part].preset;
 	uint16_t atk,dec,sus,rel;
 	int8_t slow,lin,loop;
 	int8_t i;
@@ -278,40 +422,43 @@ static void refreshEnvSettings(int8_t type)
 		
 	for(i=0;i<SYNTH_VOICE_COUNT;++i)
 	{
+		if(!(synth.part[part].voiceMask&((voiceMask_t)1<<i)))
+			continue;
+		
 		switch(type)
 		{
 		case 0:
 			a=&synth.ampEnvs[i];
-			slow=currentPreset.steppedParameters[spAmpEnvSlow];
-			lin=currentPreset.steppedParameters[spAmpEnvLin];
-			loop=currentPreset.steppedParameters[spAmpEnvLoop];
-
-			atk=currentPreset.continuousParameters[cpAmpAtt];
-			dec=currentPreset.continuousParameters[cpAmpDec];
-			sus=currentPreset.continuousParameters[cpAmpSus];
-			rel=currentPreset.continuousParameters[cpAmpRel];
+			slow=p->steppedParameters[spAmpEnvSlow];
+			lin=p->steppedParameters[spAmpEnvLin];
+			loop=p->steppedParameters[spAmpEnvLoop];
+
+			atk=p->continuousParameters[cpAmpAtt];
+			dec=p->continuousParameters[cpAmpDec];
+			sus=p->continuousParameters[cpAmpSus];
+			rel=p->continuousParameters[cpAmpRel];
 			break;
 		case 1:
 			a=&synth.filEnvs[i];
-			slow=currentPreset.steppedParameters[spFilEnvSlow];
-			lin=currentPreset.steppedParameters[spFilEnvLin];
-			loop=currentPreset.steppedParameters[spFilEnvLoop];
-
-			atk=currentPreset.continuousParameters[cpFilAtt];
-			dec=currentPreset.continuousParameters[cpFilDec];
-			sus=currentPreset.continuousParameters[cpFilSus];
-			rel=currentPreset.continuousParameters[cpFilRel];
+			slow=p->steppedParameters[spFilEnvSlow];
+			lin=p->steppedParameters[spFilEnvLin];
+			loop=p->steppedParameters[spFilEnvLoop];
+
+			atk=p->continuousParameters[cpFilAtt];
+			dec=p->continuousParameters[cpFilDec];
+			sus=p->continuousParameters[cpFilSus];
+			rel=p->continuousParameters[cpFilRel];
 			break;
 		case 2:
 			a=&synth.wmodEnvs[i];
-			slow=currentPreset.steppedParameters[spWModEnvSlow];
-			lin=currentPreset.steppedParameters[spWModEnvLin];
-			loop=currentPreset.steppedParameters[spWModEnvLoop];
-
-			atk=currentPreset.continuousParameters[cpWModAtt];
-			dec=currentPreset.continuousParameters[cpWModDec];
-			sus=currentPreset.continuousParameters[cpWModSus];
-			rel=currentPreset.continuousParameters[cpWModRel];
+			slow=p->steppedParameters[spWModEnvSlow];
+			lin=p->steppedParameters[spWModEnvLin];
+			loop=p->steppedParameters[spWModEnvLoop];
+
+			atk=p->continuousParameters[cpWModAtt];
+			dec=p->continuousParameters[cpWModDec];
+			sus=p->continuousParameters[cpWModSus];
+			rel=p->continuousParameters[cpWModRel];
 			break;
 		default:
 			return;
@@ -323,116 +470,132 @@ static void refreshEnvSettings(int8_t type)
 	}
 }
 
-static void refreshLfoSettings(void)
+static void refreshLfoSettings(int8_t part)
 {
 	static const uint8_t lt2per[] = {0,0,1,2,4,8,16};
+	struct part_s * pt=&synth.part[part];
+	const struct preset_s * p=pt->preset;
 	uint16_t lfoAmt,lfo2Amt,dlyAmt;
 	uint32_t elapsed;
 
-	lfo_setShape(&synth.lfo[0],currentPreset.steppedParameters[spLFOShape],lt2per[currentPreset.steppedParameters[spLFOTrig]]);
-	lfo_setShape(&synth.lfo[1],currentPreset.steppedParameters[spLFO2Shape],lt2per[currentPreset.steppedParameters[spLFO2Trig]]);
+	lfo_setShape(&pt->lfo[0],p->steppedParameters[spLFOShape],lt2per[p->steppedParameters[spLFOTrig]]);
+	lfo_setShape(&pt->lfo[1],p->steppedParameters[spLFO2Shape],lt2per[p->steppedParameters[spLFO2Trig]]);
 	
-	lfo_setSpeedShift(&synth.lfo[0],currentPreset.steppedParameters[spLFOSpeed]);
-	lfo_setSpeedShift(&synth.lfo[1],currentPreset.steppedParameters[spLFO2Speed]);
+	lfo_setSpeedShift(&pt->lfo[0],p->steppedParameters[spLFOSpeed]);
+	lfo_setSpeedShift(&pt->lfo[1],p->steppedParameters[spLFO2Speed]);
 
 	// wait modulationDelayTickCount then progressively increase over
 	// modulationDelayTickCount time, following an exponential curve
 	dlyAmt=0;
-	if(synth.partState.modulationDelayStart!=UINT32_MAX)
+	if(pt->state.modulationDelayStart!=UINT32_MAX)
 	{
-		if(currentPreset.continuousParameters[cpModDelay]<SCAN_POT_DEAD_ZONE)
+		if(p->continuousParameters[cpModDelay]<SCAN_POT_DEAD_ZONE)
 		{
 			dlyAmt=UINT16_MAX;
 		}
-		else if(currentTick>=synth.partState.modulationDelayStart+synth.partState.modulationDelayTickCount)
+		else if(currentTick>=pt->state.modulationDelayStart+pt->state.modulationDelayTickCount)
 		{
-			elapsed=currentTick-(synth.partState.modulationDelayStart+synth.partState.modulationDelayTickCount);
-			if(elapsed>=synth.partState.modulationDelayTickCount)
+			elapsed=currentTick-(pt->state.modulationDelayStart+pt->state.modulationDelayTickCount);
+			if(elapsed>=pt->state.modulationDelayTickCount)
 				dlyAmt=UINT16_MAX;
 			else
-				dlyAmt=attackCurveLookup[(elapsed<<8)/synth.partState.modulationDelayTickCount];
+				dlyAmt=attackCurveLookup[(elapsed<<8)/pt->state.modulationDelayTickCount];
 		}
 	}
 
-	lfoAmt=currentPreset.continuousParameters[cpLFOAmt];
-	if(currentPreset.steppedParameters[spPressureTarget]==modLFO1)
-		lfoAmt=satAddU16U16(lfoAmt,synth.partState.pressureAmount);
+	lfoAmt=p->continuousParameters[cpLFOAmt];
+	if(p->steppedParameters[spPressureTarget]==modLFO1)
+		lfoAmt=satAddU16U16(lfoAmt,pt->state.pressureAmount);
 
-	lfo2Amt=currentPreset.continuousParameters[cpLFO2Amt];
-	if(currentPreset.steppedParameters[spPressureTarget]==modLFO2)
-		lfo2Amt=satAddU16U16(lfo2Amt,synth.partState.pressureAmount);
+	lfo2Amt=p->continuousParameters[cpLFO2Amt];
+	if(p->steppedParameters[spPressureTarget]==modLFO2)
+		lfo2Amt=satAddU16U16(lfo2Amt,pt->state.pressureAmount);
 
-	if(currentPreset.steppedParameters[spModwheelTarget]==0) // targeting lfo1?
+	if(p->steppedParameters[spModwheelTarget]==0) // targeting lfo1?
 	{
-		lfo_setCVs(&synth.lfo[0],
-				currentPreset.continuousParameters[cpLFOFreq],
-				satAddU16U16(lfoAmt,synth.partState.modwheelAmount));
-		lfo_setCVs(&synth.lfo[1],
-				 currentPreset.continuousParameters[cpLFO2Freq],
+		lfo_setCVs(&pt->lfo[0],
+				p->continuousParameters[cpLFOFreq],
+				satAddU16U16(lfoAmt,pt->state.modwheelAmount));
+		lfo_setCVs(&pt->lfo[1],
+				 p->continuousParameters[cpLFO2Freq],
 				 scaleU16U16(lfo2Amt,dlyAmt));
 	}
 	else
 	{
-		lfo_setCVs(&synth.lfo[0],
-				currentPreset.continuousParameters[cpLFOFreq],
+		lfo_setCVs(&pt->lfo[0],
+				p->continuousParameters[cpLFOFreq],
 				scaleU16U16(lfoAmt,dlyAmt));
-		lfo_setCVs(&synth.lfo[1],
-				currentPreset.continuousParameters[cpLFO2Freq],
-				satAddU16U16(lfo2Amt,synth.partState.modwheelAmount));
+		lfo_setCVs(&pt->lfo[1],
+				p->continuousParameters[cpLFO2Freq],
+				satAddU16U16(lfo2Amt,pt->state.modwheelAmount));
 	}
 }
 
-static void refreshModulationDelay(int8_t refreshTickCount)
+static void refreshModulationDelay(int8_t part, int8_t refreshTickCount)
 {
+	struct part_s * pt=&synth.part[part];
 	int8_t anyPressed, anyAssigned;
-	static int8_t prevAnyPressed=0;
 	
-	anyPressed=assigner_getAnyPressed();	
-	anyAssigned=assigner_getAnyAssigned();	
+	anyPressed=assigner_getAnyPressed(part);	
+	anyAssigned=assigner_getAnyAssigned(part);	
 
 	if(!anyAssigned)
 	{
-		synth.partState.modulationDelayStart=UINT32_MAX;
+		pt->state.modulationDelayStart=UINT32_MAX;
 	}
 
-	if(anyPressed && !prevAnyPressed)
+	if(anyPressed && !pt->state.prevAnyPressed)
 	{
-		synth.partState.modulationDelayStart=currentTick;
+		pt->state.modulationDelayStart=currentTick;
 	}
 
-	prevAnyPressed=anyPressed;
+	pt->state.prevAnyPressed=anyPressed;
 
 	if(refreshTickCount)
-		synth.partState.modulationDelayTickCount=exponentialCourse(UINT16_MAX-currentPreset.continuousParameters[cpModDelay],12000.0f,2500.0f);
+		pt->state.modulationDelayTickCount=exponentialCourse(UINT16_MAX-pt->preset->continuousParameters[cpModDelay],12000.0f,2500.0f);
 }
 
-static void refreshMisc(void)
+// waveforms, they are the main part ones
+static void refreshOscData(int8_t part)
 {
-	// clock
-
-	clock_updateSpeed();
+	struct part_s * pt=&synth.part[part];
+	const struct preset_s * p=pt->preset;
 
-	// glide
-
-	synth.partState.glideAmount=exponentialCourse(currentPreset.continuousParameters[cpGlide],11000.0f,2100.0f);
-	synth.partState.gliding=synth.partState.glideAmount<2000;
-
-	// waveforms
-	
 	for(int i=0;i<SYNTH_VOICE_COUNT;++i)
 	{
-		if (currentPreset.continuousParameters[cpAVol]>SCAN_POT_DEAD_ZONE)
-			wtosc_setSampleData(&synth.osc[i][0],waveData.sampleData[abxAMain],waveData.sampleData[abxACrossover]);
+		if(!(pt->voiceMask&((voiceMask_t)1<<i)))
+			continue;
+		
+		if (p->continuousParameters[cpAVol]>SCAN_POT_DEAD_ZONE && waveData.mutedOsc!=0)
+			wtosc_setSampleData(&synth.osc[i][0],waveData.abxSlots[abxAMain]->data,waveData.abxSlots[abxACrossover]->data);
 		else
 			wtosc_setSampleData(&synth.osc[i][0],NULL,NULL);
 			
-		if (currentPreset.continuousParameters[cpBVol]>SCAN_POT_DEAD_ZONE)
-			wtosc_setSampleData(&synth.osc[i][1],waveData.sampleData[abxBMain],waveData.sampleData[abxBCrossover]);
+		if (p->continuousParameters[cpBVol]>SCAN_POT_DEAD_ZONE && waveData.mutedOsc!=1)
+			wtosc_setSampleData(&synth.osc[i][1],waveData.abxSlots[abxBMain]->data,waveData.abxSlots[abxBCrossover]->data);
 		else
 			wtosc_setSampleData(&synth.osc[i][1],NULL,NULL);
 	}
 }
 
+static void refreshMisc(int8_t part)
+{
+	struct part_s * pt=&synth.part[part];
+	const struct preset_s * p=pt->preset;
+
+	// clock
+
+	if(!part)
+		clock_updateSpeed();
+
+	// glide
+
+	pt->state.glideAmount=exponentialCourse(p->continuousParameters[cpGlide],11000.0f,2100.0f);
+	pt->state.gliding=pt->state.glideAmount<2000;
+
+	refreshOscData(part);
+}
+
 static void handleBitInputs(void)
 {
 	uint32_t cur;
@@ -444,8 +607,8 @@ static void handleBitInputs(void)
 	 
 	if(arp_getMode()==amOff && currentPreset.steppedParameters[spUnison] && !(cur&BIT_INPUT_FOOTSWITCH) && last&BIT_INPUT_FOOTSWITCH)
 	{
-		assigner_latchPattern();
-		assigner_getPattern( currentPreset.voicePattern,NULL);
+		assigner_latchPattern(0);
+		assigner_getPattern(0,currentPreset.voicePattern,NULL);
 	}
 	else if((cur&BIT_INPUT_FOOTSWITCH)!=(last&BIT_INPUT_FOOTSWITCH))
 	{
@@ -455,7 +618,7 @@ static void handleBitInputs(void)
 		}
 		else
 		{
-			assigner_holdEvent((cur&BIT_INPUT_FOOTSWITCH)?0:1);
+			assigner_holdEvent(0,(cur&BIT_INPUT_FOOTSWITCH)?0:1);
 		}
 	}
 
@@ -464,20 +627,207 @@ static void handleBitInputs(void)
 	last=cur;
 }
 
+static void refreshDacProfile(void)
+{
+	if(currentPreset.steppedParameters[spDacProfile]==dacspi_getProfile())
+		return;
+	
+	dacspi_setProfile(currentPreset.steppedParameters[spDacProfile]);
+
+	// oscillators & LFOs depend on the sample rate, envelopes are refreshed by refreshEnvSettings()
+	
+	for(int i=0;i<SYNTH_VOICE_COUNT;++i)
+	{
+		wtosc_init(&synth.osc[i][0],i*2);
+		wtosc_init(&synth.osc[i][1],i*2+1);
+	}
+	
+	for(int8_t part=0;part<SYNTH_PART_COUNT;++part)
+	{
+		lfo_refreshSpeed(&synth.part[part].lfo[0]);
+		lfo_refreshSpeed(&synth.part[part].lfo[1]);
+	}
+}
+
 void synth_refreshFullState(int8_t refreshWaveforms)
 {
+	refreshDacProfile();
+
 	if(refreshWaveforms)
-		for(abx_t abx=0;abx<abxCount;++abx)
-			synth_refreshWaveforms(abx);
-	
-	refreshModulationDelay(1);
-	refreshAssignerSettings();
-	refreshLfoSettings();
-	refreshEnvSettings(0);
-	refreshEnvSettings(1);
-	refreshEnvSettings(2);
-	refreshMisc();
-	refreshTunedCVs();
+		synth_refreshAllWaveforms();
+	
+	synth_refreshParts();
+}
+
+void synth_refreshAllWaveforms(void)
+{
+	for(abx_t abx=0;abx<abxCount;++abx)
+		synth_refreshWaveforms(abx);
+}
+
+void synth_refreshParts(void)
+{
+	refreshPartVoices();
+	
+	// layers first, the voices they take are released from the main part
+	for(int8_t part=SYNTH_PART_COUNT-1;part>=0;--part)
+		if(synth.part[part].voiceMask)
+			synth_refreshState(part,rfAll&~rfDacProfile);
+		else
+			assigner_setVoiceMask(part,0);
+}
+
+void synth_refreshState(int8_t part, uint16_t flags)
+{
+	if(flags&rfCVTerms)
+		synth.part[part].cvTerms.dirty=1;
+	
+	if(flags&rfDacProfile)
+		refreshDacProfile();
+	if(flags&rfModDelay)
+		refreshModulationDelay(part,1);
+	if(flags&rfAssigner)
+		refreshAssignerSettings(part);
+	if(flags&rfLfo)
+		refreshLfoSettings(part);
+	if(flags&rfAmpEnv)
+		refreshEnvSettings(part,0);
+	if(flags&rfFilEnv)
+		refreshEnvSettings(part,1);
+	if(flags&rfWModEnv)
+		refreshEnvSettings(part,2);
+	if(flags&rfMisc)
+		refreshMisc(part);
+	if(flags&rfTunedCVs)
+		refreshTunedCVs(part);
+}
+
+uint16_t synth_getParameterRefresh(int8_t isStepped, uint8_t param)
+{
+	if(isStepped)
+	{
+		switch(param)
+		{
+			case spAWModType:
+			case spBWModType:
+			case spLFOTargets:
+			case spLFO2Targets:
+				return rfCVTerms;
+			case spLFOShape:
+			case spLFOSpeed:
+			case spLFOTrig:
+			case spLFO2Shape:
+			case spLFO2Speed:
+			case spLFO2Trig:
+			case spModwheelTarget:
+				return rfLfo;
+			case spAmpEnvSlow:
+			case spAmpEnvLin:
+			case spAmpEnvLoop:
+				return rfAmpEnv;
+			case spFilEnvSlow:
+			case spFilEnvLin:
+			case spFilEnvLoop:
+				return rfFilEnv;
+			case spWModEnvSlow:
+			case spWModEnvLin:
+			case spWModEnvLoop:
+				return rfWModEnv;
+			case spUnison:
+			case spAssignerPriority:
+			case spVoiceCount:
+				return rfAssigner;
+			case spChromaticPitch:
+				return rfTunedCVs;
+			case spBenderTarget:
+				return rfCVTerms|rfTunedCVs; // getStaticCV()
+			case spPressureTarget:
+				return rfLfo|rfCVTerms|rfTunedCVs;
+			case spABank_Unsaved:
+			case spAWave_Unsaved:
+			case spBBank_Unsaved:
+			case spBWave_Unsaved:
+			case spAXOvrBank_Unsaved:
+			case spAXOvrWave_Unsaved:
+			case spBXOvrBank_Unsaved:
+			case spBXOvrWave_Unsaved:
+			case spBenderRange:
+			case spModwheelRange:
+			case spPressureRange:
+			case spOscSync:
+			case spPresetType:
+			case spPresetStyle:
+				return rfNone; // used as is, or refreshed apart
+			default:
+				return rfAll;
+		}
+	}
+	else
+	{
+		switch(param)
+		{
+			case cpAFreq:
+			case cpBFreq:
+			case cpDetune:
+			case cpCutoff:
+			case cpFilKbdAmt:
+			case cpMasterTune:
+			case cpUnisonDetune:
+				return rfTunedCVs;
+			case cpAVol:
+			case cpBVol:
+				return rfCVTerms|rfMisc;
+			case cpABaseWMod:
+			case cpBBaseWMod:
+			case cpResonance:
+			case cpNoiseVol:
+			case cpFilEnvAmt:
+			case cpWModAEnv:
+			case cpWModBEnv:
+			case cpLFOPitchAmt:
+			case cpLFOWModAmt:
+			case cpLFO2PitchAmt:
+			case cpLFO2WModAmt:
+			case cpLFOResAmt:
+			case cpLFO2ResAmt:
+				return rfCVTerms;
+			case cpAmpAtt:
+			case cpAmpDec:
+			case cpAmpSus:
+			case cpAmpRel:
+				return rfAmpEnv;
+			case cpFilAtt:
+			case cpFilDec:
+			case cpFilSus:
+			case cpFilRel:
+				return rfFilEnv;
+			case cpWModAtt:
+			case cpWModDec:
+			case cpWModSus:
+			case cpWModRel:
+				return rfWModEnv;
+			case cpLFOFreq:
+			case cpLFOAmt:
+			case cpLFO2Freq:
+			case cpLFO2Amt:
+				return rfLfo;
+			case cpModDelay:
+				return rfModDelay|rfLfo;
+			case cpGlide:
+				return rfMisc|rfTunedCVs;
+			case cpLFOFilAmt:
+			case cpLFOAmpAmt:
+			case cpLFO2FilAmt:
+			case cpLFO2AmpAmt:
+			case cpAmpLevel:
+			case cpAmpVelocity:
+			case cpFilVelocity:
+			case cpWModVelocity:
+				return rfNone; // used as is
+			default:
+				return rfAll;
+		}
+	}
 }
 
 int32_t synth_getVisualEnvelope(int8_t voice)
@@ -490,7 +840,7 @@ int32_t synth_getVisualEnvelope(int8_t voice)
 
 uint16_t * synth_getWaveformData(abx_t abx)
 {
-	return &waveData.sampleData[abx][0];
+	return waveData.abxSlots[abx]->data;
 }
 
 int synth_getBankCount(void)
@@ -511,7 +861,7 @@ int8_t synth_getBankName(int bankIndex, char * res)
 		return 0;
 	}
 	
-	strcpy(res,waveData.bankNames[bankIndex]);
+	strcpy(res,&waveData.bankPool[waveData.bankNames[bankIndex]]);
 	return 1;
 }
 
@@ -523,17 +873,48 @@ int8_t synth_getWaveName(int waveIndex, char * res)
 		return 0;
 	}
 	
-	strcpy(res,waveData.curWaveNames[waveIndex]);
+	strcpy(res,&waveData.curWavePool[waveData.curWaveNames[waveIndex]]);
+	return 1;
+}
+
+static const char * sortedPool;
+
+static int nameOffsetCompare(const void * a,const void * b)
+{
+	return stringCompare(&sortedPool[*(const uint16_t*)a],&sortedPool[*(const uint16_t*)b]);
+}
+
+// appends curFile's name to a pool, returns 0 when it doesn't fit
+static int8_t addName(char * pool, int poolSize, int * used, uint16_t * offset)
+{
+	const char * name;
+	int len;
+	
+	name=strlen(waveData.curFile.lfname)?waveData.curFile.lfname:waveData.curFile.fname;
+	len=strlen(name)+1;
+
+	if(*used+len>poolSize)
+		return 0;
+	
+	memcpy(&pool[*used],name,len);
+	*offset=*used;
+	*used+=len;
 	return 1;
 }
 
 int8_t synth_refreshBankNames(int8_t sort, int8_t force)
 {
+	int used=0;
 	FRESULT res;
 	
 	if(waveData.bankSorted==sort && !force) // already loaded and same state
 		return 1;
 	
+	// waveforms files could have changed too, played ones are reloaded by synth_refreshWaveforms()
+	if(force)
+		for(int8_t i=0;i<WAVE_SLOT_COUNT;++i)
+			waveData.slots[i].bank[0]=0;
+	
 	waveData.bankCount=0;
 
 	if((res=f_opendir(&waveData.curDir,SYNTH_WAVEDATA_PATH)))
@@ -549,10 +930,8 @@ int8_t synth_refreshBankNames(int8_t sort, int8_t force)
 	{
 		if(strcmp(waveData.curFile.fname,".") && strcmp(waveData.curFile.fname,".."))
 		{
-			if(strlen(waveData.curFile.lfname))
-				strncpy(waveData.bankNames[waveData.bankCount],waveData.curFile.lfname,MAX_FILENAME);
-			else
-				strncpy(waveData.bankNames[waveData.bankCount],waveData.curFile.fname,MAX_FILENAME);
+			if(!addName(waveData.bankPool,BANK_NAMES_POOL,&used,&waveData.bankNames[waveData.bankCount]))
+				break;
 			
 			++waveData.bankCount;
 		}
@@ -563,7 +942,10 @@ int8_t synth_refreshBankNames(int8_t sort, int8_t force)
 	}
 	
 	if(sort)
-		qsort(waveData.bankNames,waveData.bankCount,sizeof(waveData.bankNames[0]),stringCompare);
+	{
+		sortedPool=waveData.bankPool;
+		qsort(waveData.bankNames,waveData.bankCount,sizeof(waveData.bankNames[0]),nameOffsetCompare);
+	}
 	
 	waveData.bankSorted=sort;
 	
@@ -574,13 +956,14 @@ int8_t synth_refreshBankNames(int8_t sort, int8_t force)
 	return 1;
 }
 
-void synth_refreshCurWaveNames(abx_t abx, int8_t sort)
+static void refreshWaveNames(const char * bank, abx_t abx, int8_t sort)
 {
 	FRESULT res;
 	char fn[128];
+	int used=0;
 	
 	strcpy(fn,SYNTH_WAVEDATA_PATH "/");
-	strcat(fn,currentPreset.oscBank[abx]);
+	strcat(fn,bank);
 	
 	if(!strcmp(waveData.curWaveBank,fn) && waveData.curWaveSorted==sort && waveData.curWaveABX==abx) // already loaded and same state
 		return;
@@ -604,10 +987,8 @@ void synth_refreshCurWaveNames(abx_t abx, int8_t sort)
 	{
 		if(strstr(waveData.curFile.fname,".WAV") || strstr(waveData.curFile.fname,".wav"))
 		{
-			if(strlen(waveData.curFile.lfname))
-				strncpy(waveData.curWaveNames[waveData.curWaveCount],waveData.curFile.lfname,MAX_FILENAME);
-			else
-				strncpy(waveData.curWaveNames[waveData.curWaveCount],waveData.curFile.fname,MAX_FILENAME);
+			if(!addName(waveData.curWavePool,WAVE_NAMES_POOL,&used,&waveData.curWaveNames[waveData.curWaveCount]))
+				break;
 			
 			++waveData.curWaveCount;
 		}
@@ -618,7 +999,10 @@ void synth_refreshCurWaveNames(abx_t abx, int8_t sort)
 	}
 
 	if(sort)
-		qsort(waveData.curWaveNames,waveData.curWaveCount,sizeof(waveData.curWaveNames[0]),stringCompare);
+	{
+		sortedPool=waveData.curWavePool;
+		qsort(waveData.curWaveNames,waveData.curWaveCount,sizeof(waveData.curWaveNames[0]),nameOffsetCompare);
+	}
 
 	waveData.curWaveSorted=sort;
 	waveData.curWaveABX=abx;
@@ -629,87 +1013,334 @@ void synth_refreshCurWaveNames(abx_t abx, int8_t sort)
 #endif		
 }
 
-void synth_refreshWaveforms(abx_t abx)
+void synth_refreshCurWaveNames(abx_t abx, int8_t sort)
+{
+	refreshWaveNames(currentPreset.oscBank[abx],abx,sort);
+}
+
+// waveforms are kept decoded & resampled in slots, each abx plays one, the
+// spare ones, if WAVE_SLOT_COUNT allows for any, keep previous & prefetched
+// waveforms: program changes to them are then a pointer swap
+
+static struct waveSlot_s * findWaveSlot(const char * bank, const char * wave, int8_t channel)
+{
+	for(int8_t i=0;i<WAVE_SLOT_COUNT;++i)
+	{
+		struct waveSlot_s * s=&waveData.slots[i];
+		if(s->bank[0] && s->channel==channel && !strcmp(s->bank,bank) && !strcmp(s->wave,wave))
+			return s;
+	}
+	
+	return NULL;
+}
+
+static int8_t isWaveSlotPlayed(struct waveSlot_s * s)
+{
+	for(abx_t abx=0;abx<abxCount;++abx)
+		if(waveData.abxSlots[abx]==s)
+			return 1;
+
+	return 0;
+}
+
+// least recently used one, prefetches for the current preset can be kept
+static struct waveSlot_s * getFreeWaveSlot(int8_t keepPrefetched)
+{
+	struct waveSlot_s * best=NULL;
+	
+	for(int8_t i=0;i<WAVE_SLOT_COUNT;++i)
+	{
+		struct waveSlot_s * s=&waveData.slots[i];
+		
+		if(isWaveSlotPlayed(s) || (keepPrefetched && s->generation==waveData.generation))
+			continue;
+		
+		if(!best || s->lastUse<best->lastUse)
+			best=s;
+	}
+	
+	return best;
+}
+
+static void playWaveSlot(abx_t abx, struct waveSlot_s * s)
 {
-	int i, chanOffset,bankNum,waveNum;
+	int8_t osc=WAVE_OSC(abx);
+	
+	s->lastUse=++waveData.useCount;
+	waveData.abxSlots[abx]=s;
+	
+	// oscillators playing it, muted ones are refreshed by refreshMisc()
+	for(int8_t v=0;v<SYNTH_VOICE_COUNT;++v)
+	{
+		struct wtosc_s * o=&synth.osc[v][osc];
+
+		if(o->mainData)
+			wtosc_setSampleData(o,(abx<abxACrossover)?s->data:o->mainData,(abx<abxACrossover)?o->crossoverData:s->data);
+	}
+}
+
+static void getWaveIndexes(const char * bank, const char * wave, abx_t abx, int16_t * bankNum, int16_t * waveNum)
+{
+	int i;
+	
+	*bankNum=0;
+	synth_refreshBankNames(1,0);
+	for(i=0;i<synth_getBankCount();++i)
+		if(!strcmp(bank,&waveData.bankPool[waveData.bankNames[i]]))
+		{
+			*bankNum=i;
+			break;
+		}
+
+	*waveNum=0;
+	refreshWaveNames(bank,abx,1);
+	for(i=0;i<synth_getCurWaveCount();++i)
+		if(!strcmp(wave,&waveData.curWavePool[waveData.curWaveNames[i]]))
+		{
+			*waveNum=i;
+			break;
+		}
+}
+
+static int8_t loadWave(struct waveSlot_s * slot, const char * bank, const char * wave, abx_t abx)
+{
+	int i, j, count, chanOffset;
 	char fn[256];
 	wave_reader wr;
 	int32_t d;
 	int32_t smpCnt=0, chanCnt=0;
-	int16_t data[WTOSC_SAMPLE_COUNT];
+	int16_t chunk[64];
 	
 	strcpy(fn,SYNTH_WAVEDATA_PATH "/");
-	strcat(fn,currentPreset.oscBank[abx]);
+	strcat(fn,bank);
 	strcat(fn,"/");
-	strcat(fn,currentPreset.oscWave[abx]);
+	strcat(fn,wave);
 
 #ifdef DEBUG
 	rprintf(0,"loading %s\n",fn);
 #endif		
 	
-	if(wave_reader_open(fn,&wr)==WR_NO_ERROR)
+	if(wave_reader_open(fn,&wr)!=WR_NO_ERROR)
+		return 0;
+
+	if(wave_reader_get_format(&wr)==1 && wave_reader_get_sample_bits(&wr)==16) // linear 16Bits PCM
 	{
-		if(wave_reader_get_format(&wr)==1 && wave_reader_get_sample_bits(&wr)==16) // linear 16Bits PCM
-		{
-			smpCnt=wave_reader_get_num_samples(&wr);
-			smpCnt=MIN(smpCnt,WTOSC_SAMPLE_COUNT);
-		}
+		smpCnt=wave_reader_get_num_samples(&wr);
+		smpCnt=MIN(smpCnt,WTOSC_SAMPLE_COUNT);
+	}
+
+	chanCnt=wave_reader_get_num_channels(&wr);
 	
-		chanCnt=wave_reader_get_num_channels(&wr);
-		
-		wave_reader_get_samples(&wr,smpCnt,data);
-		wave_reader_close(&wr);
-		
 #ifdef DEBUG
-		rprintf(0,"smpCnt %d chanCnt %d\n",smpCnt,chanCnt);
+	rprintf(0,"smpCnt %d chanCnt %d\n",smpCnt,chanCnt);
 #endif		
-		
-		smpCnt/=chanCnt; // we want only one channel
-		chanOffset=(chanCnt>1 && abx>=abxACrossover)?1:0;
+	
+	if(chanCnt<1 || chanCnt>(int32_t)(sizeof(chunk)/sizeof(chunk[0])) || smpCnt<chanCnt)
+	{
+		// not a waveform, the slot is left as is
+		wave_reader_close(&wr);
+		return 0;
+	}
+	
+	smpCnt/=chanCnt; // we want only one channel
+	chanOffset=(chanCnt>1 && abx>=abxACrossover)?1:0;
+	slot->bank[0]=0;
 
-		for(i=0;i<smpCnt;++i)
+	// decoded to the start of the slot a few frames at a time, then resampled
+	// in place: no 4.8KB buffer, callers mute a played slot meanwhile
+	for(i=0;i<smpCnt;i+=count)
+	{
+		count=MIN(smpCnt-i,(int32_t)(sizeof(chunk)/sizeof(chunk[0]))/chanCnt);
+		if(wave_reader_get_samples(&wr,count,chunk))
 		{
-			d=data[i*chanCnt+chanOffset];
+			// half decoded: silent and empty, until something else is loaded there
+			for(i=0;i<WTOSC_SAMPLE_COUNT;++i)
+				slot->data[i]=-INT16_MIN;
+			
+			wave_reader_close(&wr);
+			return 0;
+		}
+		
+		for(j=0;j<count;++j)
+		{
+			d=chunk[j*chanCnt+chanOffset];
 			d=(d*(INT16_MAX-WTOSC_SAMPLES_GUARD_BAND))>>15;
 			d-=INT16_MIN;
-			data[i]=d;
+			slot->data[i+j]=d;
 		}
-		
-		resample(data,waveData.sampleData[abx],smpCnt,WTOSC_SAMPLE_COUNT);
 	}
+
+	wave_reader_close(&wr);
 	
-	// also recompute bank/wave indexes
+	resampleInPlace(slot->data,smpCnt,WTOSC_SAMPLE_COUNT);
+	wtosc_buildMipmaps(slot->data);
+
+	strcpy(slot->bank,bank);
+	strcpy(slot->wave,wave);
+	slot->channel=WAVE_CHANNEL(abx);
+	slot->lastUse=++waveData.useCount;
+	getWaveIndexes(bank,wave,abx,&slot->bankNum,&slot->waveNum);
+	
+	return 1;
+}
 
-	bankNum=0;
-	synth_refreshBankNames(1,0);
-	for(i=0;i<synth_getBankCount();++i)
-		if(!strcmp(currentPreset.oscBank[abx],waveData.bankNames[i]))
+// into a slot that isn't played, prefetched ones are kept; 1 if flash was read
+static int8_t prefetchWave(const char * bank, const char * wave, abx_t abx)
+{
+	struct waveSlot_s * s;
+	
+	if((s=findWaveSlot(bank,wave,WAVE_CHANNEL(abx))))
+	{
+		s->generation=waveData.generation;
+		return 0;
+	}
+	
+	if(!(s=getFreeWaveSlot(1)))
+		return 0;
+
+	s->generation=waveData.generation;
+	loadWave(s,bank,wave,abx);
+	return 1;
+}
+
+static void muteOsc(int8_t osc)
+{
+	BLOCK_INT(1)
+	{
+		waveData.mutedOsc=osc;
+		for(int8_t part=0;part<SYNTH_PART_COUNT;++part)
+			refreshOscData(part);
+	}
+}
+
+void synth_refreshWaveforms(abx_t abx)
+{
+	const char * bank=currentPreset.oscBank[abx];
+	const char * wave=currentPreset.oscWave[abx];
+	struct waveSlot_s * s;
+	int16_t bankNum,waveNum;
+	
+	if(!(s=findWaveSlot(bank,wave,WAVE_CHANNEL(abx))))
+	{
+		if((s=getFreeWaveSlot(0)))
 		{
-			bankNum=i;
-			break;
+			if(!loadWave(s,bank,wave,abx))
+				s=NULL;
 		}
-
-	waveNum=0;
-	synth_refreshCurWaveNames(abx,1);
-	for(i=0;i<synth_getCurWaveCount();++i)
-		if(!strcmp(currentPreset.oscWave[abx],waveData.curWaveNames[i]))
+		else
 		{
-			waveNum=i;
-			break;
+			// no spare, every slot is played once: the abx's own one isn't
+			// shared, its oscillator is muted while it's decoded into
+			s=waveData.abxSlots[abx];
+			muteOsc(WAVE_OSC(abx));
+			if(!loadWave(s,bank,wave,abx))
+				s=NULL;
+			muteOsc(-1);
 		}
+	}
+	
+	if(s)
+	{
+		playWaveSlot(abx,s);
+		bankNum=s->bankNum;
+		waveNum=s->waveNum;
+	}
+	else
+	{
+		// previous waveform stays, or silence if it was overwritten
+		getWaveIndexes(bank,wave,abx,&bankNum,&waveNum);
+	}
 
 	currentPreset.steppedParameters[abx2bsp[abx]]=bankNum;
 	currentPreset.steppedParameters[abx2wsp[abx]]=waveNum;
 }	
 
-void synth_updateAssignerPattern(void)
+void synth_prefetchPreset(uint16_t number)
+{
+	const struct preset_s * p;
+	
+	preset_prefetch(number);
+	if(!(p=preset_getCached(number)))
+		return;
+	
+	++waveData.generation;
+	for(abx_t abx=0;abx<abxCount;++abx)
+		prefetchWave(p->oscBank[abx],p->oscWave[abx],abx);
+}
+
+int8_t synth_prefetchNeighbours(void)
+{
+	static const int8_t offsets[]={1,-1,2};
+	const struct preset_s * p;
+	uint16_t number;
+	int8_t step;
+	
+	if(settings.presetNumber!=waveData.prefetchNumber)
+	{
+		waveData.prefetchNumber=settings.presetNumber;
+		waveData.prefetchStep=0;
+		++waveData.generation;
+	}
+
+	// each neighbour preset the cache has room for, then its waveforms
+	while(waveData.prefetchStep<MIN(sizeof(offsets),PRESET_CACHE_SIZE-1)*(abxCount+1))
+	{
+		step=waveData.prefetchStep++;
+		number=(settings.presetNumber+offsets[step/(abxCount+1)]+1000)%1000;
+		
+		if(!(step%(abxCount+1)))
+		{
+			if(preset_prefetch(number))
+				return 1;
+		}
+		else if((p=preset_getCached(number)))
+		{
+			abx_t abx=step%(abxCount+1)-1;
+			if(prefetchWave(p->oscBank[abx],p->oscWave[abx],abx))
+				return 1;
+		}
+	}
+	
+	return 0;
+}	
+
+void synth_updateAssignerPattern(int8_t part)
 {
-	if(currentPreset.steppedParameters[spUnison])
-		assigner_latchPattern();
+	struct preset_s * p=synth.part[part].preset;
+	
+	if(p->steppedParameters[spUnison])
+		assigner_latchPattern(part);
 	else
-		assigner_setPoly();
+		assigner_setPoly(part);
+
+	assigner_getPattern(part,p->voicePattern,NULL);
+}
+
+struct preset_s * synth_getPartPreset(int8_t part)
+{
+	return synth.part[part].preset;
+}
 
-	assigner_getPattern(currentPreset.voicePattern,NULL);
+void synth_loadPartPreset(int8_t part)
+{
+	// layers only, the main part is currentPreset
+	if(!part)
+		return;
+	
+	// flash reads first, interrupts blocked the load then is a copy from the cache
+	preset_prefetch(settings.parts[part].presetNumber);
+	
+	BLOCK_INT(1)
+	{
+		preset_load(synth.part[part].preset,settings.parts[part].presetNumber);
+		
+		if(synth.part[part].voiceMask)
+		{
+			synth_refreshState(part,rfAll&~rfDacProfile);
+			synth_pressureEvent(part,0);
+			synth_wheelEvent(part,0,0,3);
+		}
+	}
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -756,10 +1387,16 @@ static FORCEINLINE uint16_t adjustCV(cv_t cv, uint32_t value)
 	return value;
 }
 
+static FORCEINLINE void setCV(uint16_t channel, uint16_t v, int8_t noDblBuf)
+{
+	if(noDblBuf)
+		dacspi_setCVValue(channel,v,1);
+	else
+		synth.pipeline.write->cvs[channel]=v;
+}
+
 FORCEINLINE void synth_refreshCV(int8_t voice, cv_t cv, uint32_t value, int8_t noDblBuf)
 {
-	static const uint8_t ampVoice2CV[SYNTH_VOICE_COUNT]={0,1,2,3,8,9};
-	static const uint8_t cutoffVoice2CV[SYNTH_VOICE_COUNT]={4,15,14,13,12,11};
 	uint16_t v,channel;
 	
 	value=__USAT(value,16);
@@ -768,31 +1405,77 @@ FORCEINLINE void synth_refreshCV(int8_t voice, cv_t cv, uint32_t value, int8_t n
 	switch(cv)
 	{
 	case cvAmp:
-		channel=ampVoice2CV[voice];
-		break;
-	case cvNoiseVol:
-		channel=10;
-		break;
-	case cvResonance:
-		channel=5;
+		channel=synth.voiceCVs[voice].amp;
 		break;
 	case cvCutoff:
-		channel=cutoffVoice2CV[voice];
-		break;
-	case cvAVol:
-		channel=6;
-		break;
-	case cvBVol:
-		channel=7;
+		channel=synth.voiceCVs[voice].cutoff;
 		break;
 	default:
-		return;
+		channel=dacspiBoard.globalCV[cv];
+		if(channel==UINT8_MAX)
+			return;
+		
+		// every board has its own
+		for(int8_t b=1;b<DACSPI_BOARD_COUNT;++b)
+			setCV(b*DACSPI_CV_COUNT+channel,v,noDblBuf);
 	}
 	
-	dacspi_setCVValue(channel,v,noDblBuf);
+	setCV(channel,v,noDblBuf);
+}
+
+static void refreshCVTerms(struct part_s * pt)
+{
+	const struct preset_s * p=pt->preset;
+	int32_t val;
+	int8_t lfoTargets[2];
+	
+	// resonance
+
+	pt->cvTerms.resonanceModulated=p->continuousParameters[cpLFOResAmt] || p->continuousParameters[cpLFO2ResAmt];
+	pt->cvTerms.resVal=p->continuousParameters[cpResonance];
+	pt->cvTerms.resoFactor=(35*UINT16_MAX+170*(uint32_t)MAX(0,pt->cvTerms.resVal-2500))/(100*256);
+
+	pt->cvTerms.volumes[0]=scaleU16U16(p->continuousParameters[cpAVol],(getStaticCV(pt,cvAVol)-INT16_MIN));
+	pt->cvTerms.volumes[1]=scaleU16U16(p->continuousParameters[cpBVol],(getStaticCV(pt,cvBVol)-INT16_MIN));
+	pt->cvTerms.volumes[2]=scaleU16U16(p->continuousParameters[cpNoiseVol],(getStaticCV(pt,cvNoiseVol)-INT16_MIN));
+
+	// LFOs targets
+
+	lfoTargets[0]=p->steppedParameters[spLFOTargets];
+	lfoTargets[1]=p->steppedParameters[spLFO2Targets];
+
+	for(int8_t l=0;l<2;++l)
+		for(int8_t o=0;o<2;++o)
+		{
+			int8_t targeted=lfoTargets[l]&(o?otB:otA);
+			
+			pt->cvTerms.lfoPitchAmt[l][o]=targeted?p->continuousParameters[l?cpLFO2PitchAmt:cpLFOPitchAmt]:0;
+			pt->cvTerms.lfoWModAmt[l][o]=targeted?p->continuousParameters[l?cpLFO2WModAmt:cpLFOWModAmt]:0;
+		}
+
+	// wave mod base
+
+	pt->cvTerms.wmodAFreq=p->steppedParameters[spAWModType]==wmFrequency;
+	pt->cvTerms.wmodBFreq=p->steppedParameters[spBWModType]==wmFrequency;
+
+	val=p->continuousParameters[cpABaseWMod];
+	if(pt->cvTerms.wmodAFreq)
+		val=((val-HALF_RANGE)>>1)+HALF_RANGE; // half scale for freq mod
+	pt->cvTerms.wmodABase=val+getStaticCV(pt,cvWaveMod);
+
+	val=p->continuousParameters[cpBBaseWMod];
+	if(pt->cvTerms.wmodBFreq)
+		val=((val-HALF_RANGE)>>1)+HALF_RANGE; // half scale for freq mod
+	pt->cvTerms.wmodBBase=val+getStaticCV(pt,cvWaveMod);
+
+	// envelope amounts
+
+	pt->cvTerms.filEnvAmt=p->continuousParameters[cpFilEnvAmt]+INT16_MIN;
+	pt->cvTerms.wmodAEnvAmt=p->continuousParameters[cpWModAEnv]+INT16_MIN;
+	pt->cvTerms.wmodBEnvAmt=p->continuousParameters[cpWModBEnv]+INT16_MIN;
 }
 
-static FORCEINLINE void refreshVoice(int8_t v,int32_t wmodAEnvAmt,int32_t wmodBEnvAmt,int32_t filEnvAmt,int32_t pitchAVal,int32_t pitchBVal,int32_t wmodAVal,int32_t wmodBVal,int32_t filterVal,int32_t ampVal)
+static FORCEINLINE void refreshVoice(const struct part_s * pt,int8_t v,int32_t pitchAVal,int32_t pitchBVal,int32_t wmodAVal,int32_t wmodBVal,int32_t filterVal,int32_t ampVal)
 {
 	int32_t vpa,vpb,vma,vmb,vf,vamp;
 
@@ -805,39 +1488,41 @@ static FORCEINLINE void refreshVoice(int8_t v,int32_t wmodAEnvAmt,int32_t wmodBE
 	// filter
 
 	vf=filterVal;
-	vf+=scaleU16S16(synth.filEnvs[v].output,filEnvAmt);
+	vf+=scaleU16S16(synth.filEnvs[v].output,pt->cvTerms.filEnvAmt);
 	vf+=synth.filterNoteCV[v];
 	synth_refreshCV(v,cvCutoff,vf,0);
 
 	// oscs
 	
 	vma=wmodAVal;
-	vma+=scaleU16S16(synth.wmodEnvs[v].output,wmodAEnvAmt);
+	vma+=scaleU16S16(synth.wmodEnvs[v].output,pt->cvTerms.wmodAEnvAmt);
 	vma=__USAT(vma,16);
 
 	vmb=wmodBVal;
-	vmb+=scaleU16S16(synth.wmodEnvs[v].output,wmodBEnvAmt);
+	vmb+=scaleU16S16(synth.wmodEnvs[v].output,pt->cvTerms.wmodBEnvAmt);
 	vmb=__USAT(vmb,16);
 
 	vpa=pitchAVal;
-	if(currentPreset.steppedParameters[spAWModType]==wmFrequency)
+	if(pt->cvTerms.wmodAFreq)
 		vpa+=vma-HALF_RANGE;
 
 	vpb=pitchBVal;
-	if(currentPreset.steppedParameters[spBWModType]==wmFrequency)
+	if(pt->cvTerms.wmodBFreq)
 		vpb+=vmb-HALF_RANGE;
 
 	// osc A
 
 	vpa+=synth.oscANoteCV[v];
-	vpa=__USAT(vpa,16);
-	wtosc_setParameters(&synth.osc[v][0],vpa,currentPreset.steppedParameters[spAWModType],vma);
+	synth.pipeline.write->oscPitch[v][0]=__USAT(vpa,16);
+	synth.pipeline.write->oscWMod[v][0]=vma;
+	synth.pipeline.write->oscWModType[v][0]=pt->preset->steppedParameters[spAWModType];
 
 	// osc B
 
 	vpb+=synth.oscBNoteCV[v];
-	vpb=__USAT(vpb,16);
-	wtosc_setParameters(&synth.osc[v][1],vpb,currentPreset.steppedParameters[spBWModType],vmb);
+	synth.pipeline.write->oscPitch[v][1]=__USAT(vpb,16);
+	synth.pipeline.write->oscWMod[v][1]=vmb;
+	synth.pipeline.write->oscWModType[v][1]=pt->preset->steppedParameters[spBWModType];
 
 	// amplifier
 	
@@ -856,12 +1541,17 @@ void synth_init(void)
 	srandom(0x42381337);
 
 	memset(&synth,0,sizeof(synth));
+	synth.pipeline.write=&synth.pipeline.frames[1][0];
 	memset(&waveData,0,sizeof(waveData));
 	for(i=0;i<DACSPI_BUFFER_COUNT/2;++i)
-		synth.partState.syncPositions[i]=INT16_MIN;
+		synth.sync.positions[i]=INT16_MIN;
 	waveData.bankSorted=-1;
 	waveData.curWaveSorted=-1;
 	waveData.curWaveABX=-1;
+	for(i=0;i<abxCount;++i)
+		waveData.abxSlots[i]=&waveData.slots[i];
+	waveData.mutedOsc=-1;
+	waveData.prefetchNumber=UINT16_MAX;
 
 	// init footswitch in
 
@@ -876,6 +1566,16 @@ void synth_init(void)
 		wtosc_init(&synth.osc[i][1],i*2+1);
 	}
 
+	// voices CV channels, boards are chained 6 voices at a time
+	for(i=0;i<SYNTH_VOICE_COUNT;++i)
+	{
+		int8_t bv=i%DACSPI_BOARD_VOICE_COUNT;
+		uint8_t base=(i/DACSPI_BOARD_VOICE_COUNT)*DACSPI_CV_COUNT;
+		
+		synth.voiceCVs[i].amp=base+dacspiBoard.ampCV[bv];
+		synth.voiceCVs[i].cutoff=base+dacspiBoard.cutoffCV[bv];
+	}
+
 	// give it some memory
 	waveData.curFile.lfname=waveData.lfname;
 	waveData.curFile.lfsize=sizeof(waveData.lfname);
@@ -899,18 +1599,26 @@ void synth_init(void)
 		adsr_init(&synth.wmodEnvs[i]);
 	}
 
-	lfo_init(&synth.lfo[0]);
-	lfo_init(&synth.lfo[1]);
+	for(i=0;i<SYNTH_PART_COUNT;++i)
+	{
+		synth.part[i].preset=i?&layerPresets[i-1]:&currentPreset;
+		lfo_init(&synth.part[i].lfo[0]);
+		lfo_init(&synth.part[i].lfo[1]);
+	}
 
 	// load settings from storage & load static stuff
 
+	logstore_init();
 	settings_load();
 	synth_refreshBankNames(1,1);
 
-	// load last preset & do a full refresh
+	// load last presets & do a full refresh
 
 	preset_loadCurrent(settings.presetNumber);
 	ui_setPresetModified(0);
+	
+	for(i=1;i<SYNTH_PART_COUNT;++i)
+		preset_load(synth.part[i].preset,settings.parts[i].presetNumber);
 
 	synth_refreshFullState(1);
 
@@ -938,6 +1646,8 @@ void synth_update(void)
 	scan_update();
 	ui_update();
 	midi_update();
+	logstore_update();
+	synth_prefetchNeighbours();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -952,8 +1662,6 @@ void synth_tickTimerEvent(uint8_t phase)
 		case 0:
 			// bit inputs (footswitch)
 			handleBitInputs();
-			// midi
-			midi_processInput();
 			break;
 		case 1:
 			// assigner
@@ -965,9 +1673,10 @@ void synth_tickTimerEvent(uint8_t phase)
 			// glide
 			for(int8_t v=0;v<SYNTH_VOICE_COUNT;++v)
 			{
-				int16_t amt=synth.partState.glideAmount;
+				struct part_s * pt=&synth.part[synth.voicePart[v]];
+				int16_t amt=pt->state.glideAmount;
 
-				if(synth.partState.gliding)
+				if(pt->state.gliding)
 				{
 					computeGlide(&synth.oscANoteCV[v],synth.oscATargetCV[v],amt);
 					computeGlide(&synth.oscBNoteCV[v],synth.oscBTargetCV[v],amt);
@@ -976,9 +1685,11 @@ void synth_tickTimerEvent(uint8_t phase)
 			}
 			break;
 		case 3:
-			refreshLfoSettings();
-			synth.partState.syncModeMaster=currentPreset.steppedParameters[spOscSync]?osmMaster:osmNone;
-			synth.partState.syncModeSlave=currentPreset.steppedParameters[spOscSync]?osmSlave:osmNone;
+			for(int8_t part=0;part<SYNTH_PART_COUNT;++part)
+				if(synth.part[part].voiceMask)
+					refreshLfoSettings(part);
+			synth.sync.modeMaster=currentPreset.steppedParameters[spOscSync]?osmMaster:osmNone;
+			synth.sync.modeSlave=currentPreset.steppedParameters[spOscSync]?osmSlave:osmNone;
 			// 500hz tick counter
 			++currentTick;
 			break;
@@ -987,99 +1698,52 @@ void synth_tickTimerEvent(uint8_t phase)
 	}
 }
 
-// @ 4Khz from dacspi update
-void synth_updateCVsEvent(void)
+static FORCEINLINE void updatePartCVs(struct part_s * pt)
 {
-	int32_t val,pitchAVal,pitchBVal,wmodAVal,wmodBVal,filterVal,ampVal,wmodAEnvAmt,wmodBEnvAmt,filEnvAmt;
-	int32_t resoFactor=0, resVal=0;
-	
-	// global CVs update
-
-	auto uint32_t getResonanceCompensatedCV(continuousParameter_t cp, cv_t cv)
-	{
-		return scaleU16U16(currentPreset.continuousParameters[cp],(getStaticCV(cv)-INT16_MIN))*resoFactor/256;
-	}
-		
-	resVal=currentPreset.continuousParameters[cpResonance];
-	resVal+=scaleU16S16(currentPreset.continuousParameters[cpLFOResAmt],synth.lfo[0].output);
-	resVal+=scaleU16S16(currentPreset.continuousParameters[cpLFO2ResAmt],synth.lfo[1].output);
-	resVal=__USAT(resVal,16);
-
-		// compensate resonance lowering volume by abjusting pre filter mixer level
-	resoFactor=(35*UINT16_MAX+170*(uint32_t)MAX(0,resVal-2500))/(100*256);
-	
-	synth_refreshCV(-1,cvResonance,resVal>>1,0); // half scale is already oscillating
-	synth_refreshCV(-1,cvAVol,getResonanceCompensatedCV(cpAVol,cvAVol),0);
-	synth_refreshCV(-1,cvBVol,getResonanceCompensatedCV(cpBVol,cvBVol),0);
-	synth_refreshCV(-1,cvNoiseVol,getResonanceCompensatedCV(cpNoiseVol,cvNoiseVol),0);
+	const struct preset_s * p=pt->preset;
+	int32_t pitchAVal,pitchBVal,wmodAVal,wmodBVal,filterVal,ampVal;
 
 	// lfos
 		
-	lfo_update(&synth.lfo[0]);
-	lfo_update(&synth.lfo[1]);
+	lfo_update(&pt->lfo[0]);
+	lfo_update(&pt->lfo[1]);
 		
-	// global computations
+	// part computations
 	
 		// pitch
 
-	pitchAVal=pitchBVal=0;
-
-	val=scaleU16S16(currentPreset.continuousParameters[cpLFOPitchAmt],synth.lfo[0].output>>1);
-	if(currentPreset.steppedParameters[spLFOTargets]&otA)
-		pitchAVal+=val;
-	if(currentPreset.steppedParameters[spLFOTargets]&otB)
-		pitchBVal+=val;
+	pitchAVal=scaleU16S16(pt->cvTerms.lfoPitchAmt[0][0],pt->lfo[0].output>>1);
+	pitchAVal+=scaleU16S16(pt->cvTerms.lfoPitchAmt[1][0],pt->lfo[1].output>>1);
 
-	val=scaleU16S16(currentPreset.continuousParameters[cpLFO2PitchAmt],synth.lfo[1].output>>1);
-	if(currentPreset.steppedParameters[spLFO2Targets]&otA)
-		pitchAVal+=val;
-	if(currentPreset.steppedParameters[spLFO2Targets]&otB)
-		pitchBVal+=val;
+	pitchBVal=scaleU16S16(pt->cvTerms.lfoPitchAmt[0][1],pt->lfo[0].output>>1);
+	pitchBVal+=scaleU16S16(pt->cvTerms.lfoPitchAmt[1][1],pt->lfo[1].output>>1);
 
 		// filter
 
-	filterVal=scaleU16S16(currentPreset.continuousParameters[cpLFOFilAmt],synth.lfo[0].output);
-	filterVal+=scaleU16S16(currentPreset.continuousParameters[cpLFO2FilAmt],synth.lfo[1].output);
+	filterVal=scaleU16S16(p->continuousParameters[cpLFOFilAmt],pt->lfo[0].output);
+	filterVal+=scaleU16S16(p->continuousParameters[cpLFO2FilAmt],pt->lfo[1].output);
 	
 		// amplifier
 
 	ampVal=UINT16_MAX;
 
-	ampVal-=scaleU16U16(currentPreset.continuousParameters[cpLFOAmpAmt],synth.lfo[0].levelCV>>1);
-	ampVal+=scaleU16S16(currentPreset.continuousParameters[cpLFOAmpAmt],synth.lfo[0].output);
-
-	ampVal-=scaleU16U16(currentPreset.continuousParameters[cpLFO2AmpAmt],synth.lfo[1].levelCV>>1);
-	ampVal+=scaleU16S16(currentPreset.continuousParameters[cpLFO2AmpAmt],synth.lfo[1].output);
+	ampVal-=scaleU16U16(p->continuousParameters[cpLFOAmpAmt],pt->lfo[0].levelCV>>1);
+	ampVal+=scaleU16S16(p->continuousParameters[cpLFOAmpAmt],pt->lfo[0].output);
 
-	ampVal=scaleU16U16(ampVal,currentPreset.continuousParameters[cpAmpLevel]);
+	ampVal-=scaleU16U16(p->continuousParameters[cpLFO2AmpAmt],pt->lfo[1].levelCV>>1);
+	ampVal+=scaleU16S16(p->continuousParameters[cpLFO2AmpAmt],pt->lfo[1].output);
 
-		// misc
+	ampVal=scaleU16U16(ampVal,p->continuousParameters[cpAmpLevel]);
 
-	filEnvAmt=currentPreset.continuousParameters[cpFilEnvAmt];
-	filEnvAmt+=INT16_MIN;
+		// wave mod
 
-	wmodAVal=currentPreset.continuousParameters[cpABaseWMod];
-	if(currentPreset.steppedParameters[spAWModType]==wmFrequency)
-		wmodAVal=((wmodAVal-HALF_RANGE)>>1)+HALF_RANGE; // half scale for freq mod
-	if(currentPreset.steppedParameters[spLFOTargets]&otA)
-		wmodAVal+=scaleU16S16(currentPreset.continuousParameters[cpLFOWModAmt],synth.lfo[0].output);
-	if(currentPreset.steppedParameters[spLFO2Targets]&otA)
-		wmodAVal+=scaleU16S16(currentPreset.continuousParameters[cpLFO2WModAmt],synth.lfo[1].output);
-	wmodAVal+=getStaticCV(cvWaveMod);
+	wmodAVal=pt->cvTerms.wmodABase;
+	wmodAVal+=scaleU16S16(pt->cvTerms.lfoWModAmt[0][0],pt->lfo[0].output);
+	wmodAVal+=scaleU16S16(pt->cvTerms.lfoWModAmt[1][0],pt->lfo[1].output);
 
-	wmodBVal=currentPreset.continuousParameters[cpBBaseWMod];
-	if(currentPreset.steppedParameters[spBWModType]==wmFrequency)
-		wmodBVal=((wmodBVal-HALF_RANGE)>>1)+HALF_RANGE; // half scale for freq mod
-	if(currentPreset.steppedParameters[spLFOTargets]&otB)
-		wmodBVal+=scaleU16S16(currentPreset.continuousParameters[cpLFOWModAmt],synth.lfo[0].output);
-	if(currentPreset.steppedParameters[spLFO2Targets]&otB)
-		wmodBVal+=scaleU16S16(currentPreset.continuousParameters[cpLFO2WModAmt],synth.lfo[1].output);
-	wmodBVal+=getStaticCV(cvWaveMod);
-
-	wmodAEnvAmt=currentPreset.continuousParameters[cpWModAEnv];
-	wmodBEnvAmt=currentPreset.continuousParameters[cpWModBEnv];
-	wmodAEnvAmt+=INT16_MIN;
-	wmodBEnvAmt+=INT16_MIN;
+	wmodBVal=pt->cvTerms.wmodBBase;
+	wmodBVal+=scaleU16S16(pt->cvTerms.lfoWModAmt[0][1],pt->lfo[0].output);
+	wmodBVal+=scaleU16S16(pt->cvTerms.lfoWModAmt[1][1],pt->lfo[1].output);
 
 		// restrict range
 
@@ -1093,33 +1757,97 @@ void synth_updateCVsEvent(void)
 	// voices computations
 
 	for(int8_t v=0;v<SYNTH_VOICE_COUNT;++v)
-		refreshVoice(v,wmodAEnvAmt,wmodBEnvAmt,filEnvAmt,pitchAVal,pitchBVal,wmodAVal,wmodBVal,filterVal,ampVal);
+		if(pt->voiceMask&((voiceMask_t)1<<v))
+			refreshVoice(pt,v,pitchAVal,pitchBVal,wmodAVal,wmodBVal,filterVal,ampVal);
 }
 
-#define PROC_UPDATE_OSCS_VOICE(v) \
-FORCEINLINE static void updateOscsVoice##v(int32_t start, int32_t end) \
-{ \
-	wtosc_update(&synth.osc[v][0],start,end,synth.partState.syncModeMaster,synth.partState.syncPositions); \
-	wtosc_update(&synth.osc[v][1],start,end,synth.partState.syncModeSlave,synth.partState.syncPositions); \
-}
+// @ 4Khz from dacspi control rate task, one block ahead of synth_updateOscsEvent()
+void synth_updateCVsEvent(int8_t subBlock)
+{
+	struct part_s * mainPart=&synth.part[0];
+	int32_t resoFactor,resVal;
+	int8_t part;
+	
+	// the DMA interrupt might preempt us, it must not swap in a partial block
+	if(!subBlock)
+		synth.pipeline.ready=0;
+	synth.pipeline.write=&synth.pipeline.frames[synth.pipeline.front^1][subBlock];
+
+	// MIDI input, with a constant 3 blocks latency: what was received while
+	// the previous block played lands on the CV tick matching its timestamp
+	midi_processInput(dacspi_getBlockTimestamp()-dacspi_getBlockSize()+(subBlock+1)*DACSPI_CV_COUNT);
+
+	for(part=0;part<SYNTH_PART_COUNT;++part)
+		if(synth.part[part].cvTerms.dirty)
+		{
+			synth.part[part].cvTerms.dirty=0;
+			refreshCVTerms(&synth.part[part]);
+		}
+	
+	// global CVs update, they only exist once, so they follow the main part
+
+	resVal=mainPart->cvTerms.resVal;
+	resoFactor=mainPart->cvTerms.resoFactor;
+
+	if(mainPart->cvTerms.resonanceModulated)
+	{
+		resVal+=scaleU16S16(currentPreset.continuousParameters[cpLFOResAmt],mainPart->lfo[0].output);
+		resVal+=scaleU16S16(currentPreset.continuousParameters[cpLFO2ResAmt],mainPart->lfo[1].output);
+		resVal=__USAT(resVal,16);
+
+			// compensate resonance lowering volume by abjusting pre filter mixer level
+		resoFactor=(35*UINT16_MAX+170*(uint32_t)MAX(0,resVal-2500))/(100*256);
+	}
+	
+	synth_refreshCV(-1,cvResonance,resVal>>1,0); // half scale is already oscillating
+	synth_refreshCV(-1,cvAVol,mainPart->cvTerms.volumes[0]*resoFactor/256,0);
+	synth_refreshCV(-1,cvBVol,mainPart->cvTerms.volumes[1]*resoFactor/256,0);
+	synth_refreshCV(-1,cvNoiseVol,mainPart->cvTerms.volumes[2]*resoFactor/256,0);
+
+	// parts, each on its own voices
 
-PROC_UPDATE_OSCS_VOICE(0);
-PROC_UPDATE_OSCS_VOICE(1);
-PROC_UPDATE_OSCS_VOICE(2);
-PROC_UPDATE_OSCS_VOICE(3);
-PROC_UPDATE_OSCS_VOICE(4);
-PROC_UPDATE_OSCS_VOICE(5);
+	for(part=0;part<SYNTH_PART_COUNT;++part)
+		if(synth.part[part].voiceMask)
+			updatePartCVs(&synth.part[part]);
+
+	if(subBlock==dacspi_getBlockSize()/DACSPI_CV_COUNT-1)
+	{
+		__DMB();
+		synth.pipeline.ready=1;
+	}
+}
 
 void synth_updateOscsEvent(int32_t start, int32_t count)
 {
 	int32_t end=start+count-1;
+	int8_t subBlock=(start%dacspi_getBlockSize())/DACSPI_CV_COUNT;
+	struct paramFrame_s * f;
+	
+	// swap in the block the control rate task prepared, if it could
+	// complete it in time (otherwise the previous one is played again)
 
-	updateOscsVoice0(start,end);
-	updateOscsVoice1(start,end);
-	updateOscsVoice2(start,end);
-	updateOscsVoice3(start,end);
-	updateOscsVoice4(start,end);
-	updateOscsVoice5(start,end);
+	if(!subBlock && synth.pipeline.ready)
+	{
+		synth.pipeline.front^=1;
+		synth.pipeline.ready=0;
+	}
+	
+	f=&synth.pipeline.frames[synth.pipeline.front][subBlock];
+
+	for(int8_t c=0;c<DACSPI_CV_CHANNEL_COUNT;++c)
+		dacspi_setCVValue(c,f->cvs[c],0);
+
+	for(int8_t v=0;v<SYNTH_VOICE_COUNT;++v)
+	{
+		wtosc_setParameters(&synth.osc[v][0],f->oscPitch[v][0],f->oscWModType[v][0],f->oscWMod[v][0]);
+		wtosc_setParameters(&synth.osc[v][1],f->oscPitch[v][1],f->oscWModType[v][1],f->oscWMod[v][1]);
+	}
+
+	for(int8_t v=0;v<SYNTH_VOICE_COUNT;++v)
+	{
+		wtosc_update(&synth.osc[v][0],start,end,synth.sync.modeMaster,synth.sync.positions);
+		wtosc_update(&synth.osc[v][1],start,end,synth.sync.modeSlave,synth.sync.positions);
+	}
 }
 
 void synth_assignerEvent(uint8_t note, int8_t gate, int8_t voice, uint16_t velocity, uint8_t flags)
@@ -1128,16 +1856,19 @@ void synth_assignerEvent(uint8_t note, int8_t gate, int8_t voice, uint16_t veloc
 	rprintf(0,"assign note %d gate %d voice %d velocity %d flags %d\n",note,gate,voice,velocity,flags);
 #endif
 
+	int8_t part=synth.voicePart[voice];
+	struct part_s * pt=&synth.part[part];
+	const struct preset_s * p=pt->preset;
 	uint16_t velAmt;
 	
 	// mod delay
-	refreshModulationDelay(0);
+	refreshModulationDelay(part,0);
 
 	// prepare CVs
-	refreshTunedCVs();
+	refreshTunedCVs(part);
 
 	// set gates (don't retrigger gate, unless we're arpeggiating)
-	if(!(flags&ASSIGNER_EVENT_FLAG_LEGATO) || arp_getMode()!=amOff)
+	if(!(flags&ASSIGNER_EVENT_FLAG_LEGATO) || (!part && arp_getMode()!=amOff))
 	{
 		adsr_setGate(&synth.wmodEnvs[voice],gate);
 		adsr_setGate(&synth.filEnvs[voice],gate);
@@ -1147,18 +1878,18 @@ void synth_assignerEvent(uint8_t note, int8_t gate, int8_t voice, uint16_t veloc
 	if(gate)
 	{
 		// handle velocity
-		velAmt=currentPreset.continuousParameters[cpWModVelocity];
+		velAmt=p->continuousParameters[cpWModVelocity];
 		adsr_setCVs(&synth.wmodEnvs[voice],0,0,0,0,(UINT16_MAX-velAmt)+scaleU16U16(velocity,velAmt),0x10);
-		velAmt=currentPreset.continuousParameters[cpFilVelocity];
+		velAmt=p->continuousParameters[cpFilVelocity];
 		adsr_setCVs(&synth.filEnvs[voice],0,0,0,0,(UINT16_MAX-velAmt)+scaleU16U16(velocity,velAmt),0x10);
-		velAmt=currentPreset.continuousParameters[cpAmpVelocity];
+		velAmt=p->continuousParameters[cpAmpVelocity];
 		adsr_setCVs(&synth.ampEnvs[voice],0,0,0,0,(UINT16_MAX-velAmt)+scaleU16U16(velocity,velAmt),0x10);
 		
 		// handle LFOs trigger
-		if(currentPreset.steppedParameters[spLFOTrig])
-			lfo_reset(&synth.lfo[0]);
-		if(currentPreset.steppedParameters[spLFO2Trig])
-			lfo_reset(&synth.lfo[1]);
+		if(p->steppedParameters[spLFOTrig])
+			lfo_reset(&pt->lfo[0]);
+		if(p->steppedParameters[spLFO2Trig])
+			lfo_reset(&pt->lfo[1]);
 	}
 }
 
@@ -1171,29 +1902,31 @@ void synth_uartMIDIEvent(uint8_t data)
 	midi_newData(mpUART, data);
 }
 
-void synth_usbMIDIEvent(uint8_t data)
+int8_t synth_usbMIDIEvents(uint8_t * data, uint8_t count)
 {
 #ifdef DEBUG_
-	rprintf(0,"usb midi %x\n",data);
+	rprintf(0,"usb midi %d bytes\n",count);
 #endif
 
-	midi_newData(mpUSB, data);
+	return midi_newDataBulk(mpUSB, data, count);
 }
 
-void synth_wheelEvent(int16_t bend, uint16_t modulation, uint8_t mask)
+void synth_wheelEvent(int8_t part, int16_t bend, uint16_t modulation, uint8_t mask)
 {
 	static const int8_t br[]={4,7,12,0};
 	static const int8_t mr[]={5,3,1,0};
+	struct part_s * pt=&synth.part[part];
+	const struct preset_s * p=pt->preset;
 
 #ifdef DEBUG_
-	rprintf(0,"wheel bend %d mod %d mask %d\n",bend,modulation,mask);
+	rprintf(0,"wheel part %d bend %d mod %d mask %d\n",part,bend,modulation,mask);
 #endif
 
 	if(mask&1)
 	{
-		uint8_t range=br[currentPreset.steppedParameters[spBenderRange]];
+		uint8_t range=br[p->steppedParameters[spBenderRange]];
 		
-		switch(currentPreset.steppedParameters[spBenderTarget])
+		switch(p->steppedParameters[spBenderTarget])
 		{
 			case modPitch:
 				bend=scaleU16S16(tuner_computeCVFromNote(0,range*2,0,cvAPitch)-tuner_computeCVFromNote(0,0,0,cvAPitch),bend);
@@ -1207,42 +1940,46 @@ void synth_wheelEvent(int16_t bend, uint16_t modulation, uint8_t mask)
 				break;
 		}
 
-		synth.partState.benderAmount=bend;
+		pt->state.benderAmount=bend;
+		pt->cvTerms.dirty=1;
 
-		if(currentPreset.steppedParameters[spBenderTarget]==modPitch ||
-				currentPreset.steppedParameters[spBenderTarget]==modFilter)
-			refreshTunedCVs();
+		if(p->steppedParameters[spBenderTarget]==modPitch ||
+				p->steppedParameters[spBenderTarget]==modFilter)
+			refreshTunedCVs(part);
 	}
 	
 	if(mask&2)
 	{
-		synth.partState.modwheelAmount=modulation>>mr[currentPreset.steppedParameters[spModwheelRange]];
-		refreshLfoSettings();
+		pt->state.modwheelAmount=modulation>>mr[p->steppedParameters[spModwheelRange]];
+		refreshLfoSettings(part);
 	}
 }
 
-void synth_pressureEvent(uint16_t pressure)
+void synth_pressureEvent(int8_t part, uint16_t pressure)
 {
 	static const int8_t pr[]={5,3,1,0};
+	struct part_s * pt=&synth.part[part];
+	const struct preset_s * p=pt->preset;
 
 #ifdef DEBUG_
-	rprintf(0,"pressure %d\n",pressure);
+	rprintf(0,"pressure part %d %d\n",part,pressure);
 #endif
 	
-	synth.partState.pressureAmount=pressure>>pr[currentPreset.steppedParameters[spPressureRange]];
+	pt->state.pressureAmount=pressure>>pr[p->steppedParameters[spPressureRange]];
+	pt->cvTerms.dirty=1;
 
-	switch(currentPreset.steppedParameters[spPressureTarget])
+	switch(p->steppedParameters[spPressureTarget])
 	{
 		case modPitch:
-			synth.partState.pressureAmount>>=2; // less modulation for pitch
-			refreshTunedCVs();
+			pt->state.pressureAmount>>=2; // less modulation for pitch
+			refreshTunedCVs(part);
 			break;
 		case modFilter:
-			refreshTunedCVs();
+			refreshTunedCVs(part);
 			break;
 		case modLFO1:
 		case modLFO2:
-			refreshLfoSettings();
+			refreshLfoSettings(part);
 			break;
 	}
 	
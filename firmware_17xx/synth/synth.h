@@ -5,7 +5,14 @@
 #include "midi.h"
 #include "utils.h"
 
-#define SYNTH_VOICE_COUNT 6
+#ifndef SYNTH_VOICE_COUNT
+#define SYNTH_VOICE_COUNT 6 // up to 32, voice boards are chained 6 voices at a time (see dacspi.h)
+#endif
+#if SYNTH_VOICE_COUNT>32
+#error "voice masks are 32 bit"
+#endif
+#define SYNTH_ALL_VOICES ((voiceMask_t)((1ULL<<SYNTH_VOICE_COUNT)-1))
+#define SYNTH_PART_COUNT 3 // multi-timbral parts, 0 is the main one (UI, sequencer, arpeggiator)
 //#define SYNTH_MASTER_CLOCK SystemCoreClock
 #define SYNTH_MASTER_CLOCK 120000000
 
@@ -29,6 +36,10 @@
 #define SCANNER_BASE_NOTE 12
 #define MIDDLE_C_NOTE 60
 
+struct preset_s;
+
+typedef uint32_t voiceMask_t; // one bit per voice
+
 typedef enum {
 	cvAVol=0,cvBVol=1,cvCutoff=2,cvResonance=3,cvAPitch=4,cvBPitch=5,cvWaveMod=6,cvAmp=7,cvNoiseVol=8,
 			
@@ -46,6 +57,16 @@ typedef enum
 	otNone=0,otA=1,otB=2,otBoth=3
 } oscTarget_t;
 
+// synth_refreshState() subsystems
+typedef enum
+{
+	rfNone=0,
+	rfCVTerms=1,rfDacProfile=2,rfModDelay=4,rfAssigner=8,rfLfo=16,
+	rfAmpEnv=32,rfFilEnv=64,rfWModEnv=128,rfMisc=256,rfTunedCVs=512,
+
+	rfAll=1023
+} refreshFlags_t;
+
 typedef enum
 {
 	abxNone=-1,abxAMain=0,abxBMain,abxACrossover,abxBCrossover,
@@ -55,13 +76,13 @@ typedef enum
 }abx_t;
 
 void synth_tickTimerEvent(uint8_t phase);
-void synth_updateCVsEvent(void);
-void synth_updateOscsEvent(int32_t start, int32_t count);
+void synth_updateCVsEvent(int8_t subBlock); // control rate, one block ahead
+void synth_updateOscsEvent(int32_t start, int32_t count); // audio rate
 void synth_uartMIDIEvent(uint8_t data);
-void synth_usbMIDIEvent(uint8_t data);
+int8_t synth_usbMIDIEvents(uint8_t * data, uint8_t count);
 void synth_assignerEvent(uint8_t note, int8_t gate, int8_t voice, uint16_t velocity, uint8_t flags);
-void synth_wheelEvent(int16_t bend, uint16_t modulation, uint8_t mask);
-void synth_pressureEvent(uint16_t pressure);
+void synth_wheelEvent(int8_t part, int16_t bend, uint16_t modulation, uint8_t mask);
+void synth_pressureEvent(int8_t part, uint16_t pressure);
 void synth_realtimeEvent(midiPort_t port, uint8_t midiEvent);
 void synth_clockEvent(void);
 
@@ -70,17 +91,25 @@ void synth_update(void);
 
 // synth.c internal api
 void synth_refreshFullState(int8_t refreshWaveforms);
+void synth_refreshState(int8_t part, uint16_t flags); // refreshFlags_t
+void synth_refreshParts(void); // after settings.parts / voiceMask changes
+uint16_t synth_getParameterRefresh(int8_t isStepped, uint8_t param); // what depends on a parameter
 int8_t synth_refreshBankNames(int8_t sort, int8_t force);
 void synth_refreshCurWaveNames(abx_t abx, int8_t sort);
 void synth_refreshWaveforms(abx_t abx);
+void synth_refreshAllWaveforms(void); // after a preset switch, interrupts on: slots not cached are decoded then
 int synth_getBankCount(void);
 int synth_getCurWaveCount(void);
 int8_t synth_getBankName(int bankIndex, char * res);
 int8_t synth_getWaveName(int waveIndex, char * res);
 int32_t synth_getVisualEnvelope(int8_t voice);
-uint16_t * synth_getWaveformData(abx_t abx);
+uint16_t * synth_getWaveformData(abx_t abx); // wtosc mipmap pyramid
 void synth_refreshCV(int8_t voice, cv_t cv, uint32_t v, int8_t noDblBuf);
-void synth_updateAssignerPattern(void);
+void synth_updateAssignerPattern(int8_t part);
+struct preset_s * synth_getPartPreset(int8_t part); // &currentPreset for the main part
+void synth_loadPartPreset(int8_t part); // settings.parts[part].presetNumber, main loop
+void synth_prefetchPreset(uint16_t number); // to RAM with its waveforms, ahead of a program change
+int8_t synth_prefetchNeighbours(void); // main loop, one file per call, 0: nothing left to load
 
 extern volatile uint32_t currentTick; // 500hz
 extern const uint16_t extClockDividers[16];
@@ -0,0 +1,592 @@
+////////////////////////////////////////////////////////////////////////////////
+// SysEx bulk load / dump of presets, settings, sequencer tracks and waves
+////////////////////////////////////////////////////////////////////////////////
+
+#include "sysex.h"
+
+#include "storage.h"
+#include "seq.h"
+#include "wave_reader.h"
+#include "ff.h"
+
+#include "../xnormidi/sysex_tools.h"
+
+#define SYSEX_HEADER_SIZE 4 // F0, manufacturer, device, command
+#define SYSEX_BUFFER_SIZE 160 // a full WriteData message
+#define SYSEX_TIMEOUT (2*TICKER_HZ)
+#define SYSEX_TEMP_NAME "SYSEX.TMP"
+#define SYSEX_MAX_NAME (2*MAX_FILENAME)
+#define SYSEX_MAX_PATH (SYSEX_MAX_NAME+32)
+
+#define WAV_HEADER_SIZE 44
+#define WAV_SAMPLE_RATE 44100
+
+typedef enum
+{
+	tsIdle=0,tsLoading,tsDumping
+} transferState_t;
+
+static struct
+{
+	// assembled by sysex_input() (PendSV), handled by sysex_update() (main loop)
+	uint8_t rx[SYSEX_BUFFER_SIZE];
+	uint16_t rxLen;
+	int8_t rxActive;
+	midiPort_t rxPort;
+	volatile int8_t rxReady;
+
+	// last message of a dump, kept for resends
+	uint8_t tx[SYSEX_BUFFER_SIZE];
+	uint16_t txLen;
+
+	transferState_t state;
+	midiPort_t port;
+	sysexObject_t object;
+	uint16_t index;
+	char name[SYSEX_MAX_NAME];
+	char path[SYSEX_MAX_PATH];
+	char tempPath[SYSEX_MAX_PATH];
+	uint32_t size,done;
+	uint16_t seq;
+	sysexCommand_t awaitedAck;
+	uint32_t lastActivity;
+
+	FIL f;
+	wave_reader wr;
+	FIL * file;
+} sysex;
+
+static uint16_t get14(const uint8_t * p)
+{
+	return p[0]|(p[1]<<7);
+}
+
+static void put14(uint8_t * p, uint16_t v)
+{
+	p[0]=v&0x7f;
+	p[1]=(v>>7)&0x7f;
+}
+
+static void putLE(uint8_t * p, uint32_t v, int8_t size)
+{
+	for(int8_t i=0;i<size;++i)
+		p[i]=v>>(i*8);
+}
+
+static uint8_t checksum(const uint8_t * data, uint16_t len)
+{
+	uint8_t chk=0;
+
+	while(len--)
+		chk^=*data++;
+
+	return chk&0x7f;
+}
+
+static uint16_t beginMessage(uint8_t * msg, sysexCommand_t command)
+{
+	msg[0]=0xf0;
+	msg[1]=SYSEX_ID_MANUFACTURER;
+	msg[2]=SYSEX_ID_DEVICE;
+	msg[3]=command;
+
+	return SYSEX_HEADER_SIZE;
+}
+
+static void sendAck(midiPort_t port, sysexCommand_t command, uint16_t seq, sysexStatus_t status)
+{
+	uint8_t msg[SYSEX_HEADER_SIZE+5];
+	uint16_t len=beginMessage(msg,scAck);
+
+	msg[len++]=command;
+	put14(&msg[len],seq);
+	len+=2;
+	msg[len++]=status;
+	msg[len++]=0xf7;
+
+	midi_sendSysex(port,msg,len);
+}
+
+static void sendTx(uint16_t len)
+{
+	sysex.tx[len++]=0xf7;
+	sysex.txLen=len;
+
+	midi_sendSysex(sysex.port,sysex.tx,sysex.txLen);
+}
+
+static void getName(uint16_t offset)
+{
+	uint16_t len=0;
+
+	// name runs up to F7
+	while(offset+1<sysex.rxLen && len<SYSEX_MAX_NAME-1)
+		sysex.name[len++]=sysex.rx[offset++];
+
+	sysex.name[len]=0;
+}
+
+static int8_t buildPaths(void)
+{
+	char * p;
+
+	switch(sysex.object)
+	{
+	case soPreset:
+		if(sysex.index>999)
+			return 0;
+		srprintf(sysex.path,SYNTH_PRESETS_PATH "/preset_%04d.conf",sysex.index);
+		break;
+	case soSettings:
+		strcpy(sysex.path,"/overcycler.conf");
+		break;
+	case soSequence:
+		if(sysex.index>=SEQ_BANK_COUNT*SEQ_TRACK_COUNT)
+			return 0;
+		srprintf(sysex.path,SYNTH_SEQUENCES_PATH "/sequence_%02d%c.conf",sysex.index/SEQ_TRACK_COUNT,'a'+sysex.index%SEQ_TRACK_COUNT);
+		break;
+	case soWave:
+		// "<bank>/<wave>", nothing else
+		p=strchr(sysex.name,'/');
+		if(!p || p==sysex.name || !p[1] || strchr(p+1,'/') || strstr(sysex.name,"..") || strchr(sysex.name,'\\'))
+			return 0;
+		srprintf(sysex.path,SYNTH_WAVEDATA_PATH "/%s",sysex.name);
+		break;
+	default:
+		return 0;
+	}
+
+	// temp file next to the destination
+	strcpy(sysex.tempPath,sysex.path);
+	strcpy(strrchr(sysex.tempPath,'/')+1,SYSEX_TEMP_NAME);
+
+	return 1;
+}
+
+static void endTransfer(void)
+{
+	if(sysex.state!=tsIdle)
+		f_close(sysex.file);
+
+	if(sysex.state==tsLoading)
+		f_unlink(sysex.tempPath);
+
+	sysex.state=tsIdle;
+}
+
+// stored objects are dumped as text, like the loads are
+static void exportObject(void)
+{
+	switch(sysex.object)
+	{
+	case soPreset:
+		preset_exportText(sysex.index);
+		break;
+	case soSettings:
+		settings_exportText();
+		break;
+	case soSequence:
+		storage_exportSequencer(sysex.index/SEQ_TRACK_COUNT,sysex.index%SEQ_TRACK_COUNT);
+		break;
+	default:
+		;
+	}
+}
+
+static void reloadObject(void)
+{
+	char * wave;
+
+	switch(sysex.object)
+	{
+	case soPreset:
+		if(sysex.index==settings.presetNumber)
+			midi_reloadPreset();
+		break;
+	case soSettings:
+		settings_load();
+		synth_refreshFullState(0);
+		break;
+	case soSequence:
+		// tracks are read from flash when they start
+		break;
+	case soWave:
+		synth_refreshBankNames(1,1);
+
+		wave=strchr(sysex.name,'/');
+		*wave++=0;
+
+		for(abx_t abx=0;abx<abxCount;++abx)
+			if(!strcmp(currentPreset.oscBank[abx],sysex.name) && !strcmp(currentPreset.oscWave[abx],wave))
+				synth_refreshWaveforms(abx);
+		break;
+	default:
+		;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Loads (host -> synth)
+////////////////////////////////////////////////////////////////////////////////
+
+static sysexStatus_t loadBegin(void)
+{
+	uint8_t header[WAV_HEADER_SIZE];
+	UINT bw;
+	char * p;
+
+	if(sysex.rxLen<SYSEX_HEADER_SIZE+7)
+		return ssBadRequest;
+
+	sysex.object=sysex.rx[4];
+	sysex.index=get14(&sysex.rx[5]);
+	sysex.size=get14(&sysex.rx[7])|((uint32_t)sysex.rx[9]<<14);
+	getName(10);
+
+	if(!buildPaths() || (sysex.object==soWave && (sysex.size&1)))
+		return ssBadRequest;
+
+	// create missing folders
+	for(p=strchr(sysex.path+1,'/');p;p=strchr(p+1,'/'))
+	{
+		*p=0;
+		f_mkdir(sysex.path);
+		*p='/';
+	}
+
+	sysex.file=&sysex.f;
+	if(f_open(sysex.file,sysex.tempPath,FA_WRITE|FA_CREATE_ALWAYS))
+		return ssIO;
+
+	sysex.state=tsLoading;
+	sysex.done=0;
+	sysex.seq=0;
+
+	if(sysex.object==soWave)
+	{
+		memcpy(&header[0],"RIFF",4);
+		putLE(&header[4],WAV_HEADER_SIZE-8+sysex.size,4);
+		memcpy(&header[8],"WAVEfmt ",8);
+		putLE(&header[16],16,4); // fmt chunk size
+		putLE(&header[20],1,2); // linear PCM
+		putLE(&header[22],1,2); // mono
+		putLE(&header[24],WAV_SAMPLE_RATE,4);
+		putLE(&header[28],WAV_SAMPLE_RATE*sizeof(int16_t),4);
+		putLE(&header[32],sizeof(int16_t),2);
+		putLE(&header[34],16,2);
+		memcpy(&header[36],"data",4);
+		putLE(&header[40],sysex.size,4);
+
+		if(f_write(sysex.file,header,WAV_HEADER_SIZE,&bw) || bw!=WAV_HEADER_SIZE)
+			return ssIO;
+	}
+
+	return ssOk;
+}
+
+static sysexStatus_t loadData(uint16_t seq)
+{
+	uint8_t data[SYSEX_CHUNK_SIZE];
+	uint16_t encLen,len;
+	UINT bw;
+
+	if(sysex.state!=tsLoading || sysex.rxLen<SYSEX_HEADER_SIZE+4)
+		return ssBadRequest;
+
+	encLen=sysex.rxLen-SYSEX_HEADER_SIZE-4; // seq, checksum, F7
+
+	if(checksum(&sysex.rx[SYSEX_HEADER_SIZE],encLen+2)!=sysex.rx[sysex.rxLen-2])
+		return ssChecksum;
+
+	// lost ack, the host resent what we already have
+	if(seq==((sysex.seq-1)&0x3fff))
+		return ssOk;
+
+	if(seq!=sysex.seq)
+		return ssSequence;
+
+	if(sysex_decoded_length(encLen)>SYSEX_CHUNK_SIZE)
+		return ssBadRequest;
+
+	len=sysex_decode(data,&sysex.rx[SYSEX_HEADER_SIZE+2],encLen);
+
+	if(sysex.done+len>sysex.size)
+		return ssBadRequest;
+
+	if(f_write(sysex.file,data,len,&bw) || bw!=len)
+		return ssIO;
+
+	sysex.done+=len;
+	sysex.seq=(sysex.seq+1)&0x3fff;
+
+	return ssOk;
+}
+
+static sysexStatus_t loadEnd(void)
+{
+	FRESULT res;
+
+	if(sysex.state!=tsLoading || sysex.done!=sysex.size)
+		return ssBadRequest;
+
+	res=f_close(sysex.file);
+	sysex.state=tsIdle;
+
+	// only replace the object once it was fully received
+	if(!res)
+	{
+		f_unlink(sysex.path);
+		res=f_rename(sysex.tempPath,sysex.path);
+	}
+
+	if(res)
+	{
+		f_unlink(sysex.tempPath);
+		return ssIO;
+	}
+
+	// the text file now replaces the stored object
+	if(sysex.object!=soWave)
+		storage_importText();
+
+	reloadObject();
+
+	return ssOk;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Dumps (synth -> host)
+////////////////////////////////////////////////////////////////////////////////
+
+static void dumpNext(void)
+{
+	uint8_t data[SYSEX_CHUNK_SIZE];
+	uint16_t len,encLen;
+	UINT br;
+
+	if(sysex.done>=sysex.size)
+	{
+		sysex.awaitedAck=scWriteEnd;
+		sendTx(beginMessage(sysex.tx,scWriteEnd));
+		return;
+	}
+
+	if(f_read(sysex.file,data,MIN(sysex.size-sysex.done,SYSEX_CHUNK_SIZE),&br) || !br)
+	{
+		sendAck(sysex.port,scReadRequest,sysex.seq,ssIO);
+		endTransfer();
+		return;
+	}
+
+	len=beginMessage(sysex.tx,scWriteData);
+	put14(&sysex.tx[len],sysex.seq);
+	encLen=sysex_encode(&sysex.tx[len+2],data,br);
+	sysex.tx[len+2+encLen]=checksum(&sysex.tx[len],encLen+2);
+
+	sysex.done+=br;
+	sysex.awaitedAck=scWriteData;
+	sendTx(len+3+encLen);
+}
+
+static sysexStatus_t dumpBegin(void)
+{
+	uint16_t len;
+
+	if(sysex.rxLen<SYSEX_HEADER_SIZE+4)
+		return ssBadRequest;
+
+	sysex.object=sysex.rx[4];
+	sysex.index=get14(&sysex.rx[5]);
+	getName(7);
+
+	if(!buildPaths())
+		return ssBadRequest;
+
+	if(sysex.object==soWave)
+	{
+		if(wave_reader_open(sysex.path,&sysex.wr)!=WR_NO_ERROR)
+			return ssIO;
+
+		// raw samples, as they are loaded
+		if(wave_reader_get_format(&sysex.wr)!=1 || wave_reader_get_sample_bits(&sysex.wr)!=16 || wave_reader_get_num_channels(&sysex.wr)!=1)
+		{
+			wave_reader_close(&sysex.wr);
+			return ssBadRequest;
+		}
+
+		sysex.file=&sysex.wr.fp;
+		sysex.size=wave_reader_get_num_samples(&sysex.wr)*sizeof(int16_t);
+	}
+	else
+	{
+		exportObject();
+		
+		sysex.file=&sysex.f;
+		if(f_open(sysex.file,sysex.path,FA_READ|FA_OPEN_EXISTING))
+			return ssIO;
+
+		sysex.size=f_size(sysex.file);
+	}
+
+	sysex.state=tsDumping;
+	sysex.done=0;
+	sysex.seq=0;
+
+	len=beginMessage(sysex.tx,scWriteBegin);
+	sysex.tx[len++]=sysex.object;
+	put14(&sysex.tx[len],sysex.index);
+	len+=2;
+	put14(&sysex.tx[len],sysex.size);
+	len+=2;
+	sysex.tx[len++]=(sysex.size>>14)&0x7f;
+	for(char * p=sysex.name;*p;++p)
+		sysex.tx[len++]=*p&0x7f;
+
+	sysex.awaitedAck=scWriteBegin;
+	sendTx(len);
+
+	return ssOk;
+}
+
+static void dumpAck(void)
+{
+	sysexCommand_t command=sysex.rx[4];
+	uint16_t seq=get14(&sysex.rx[5]);
+
+	if(sysex.state!=tsDumping || sysex.rxPort!=sysex.port || command!=sysex.awaitedAck || (command==scWriteData && seq!=sysex.seq))
+		return;
+
+	if(sysex.rx[7]!=ssOk)
+	{
+		midi_sendSysex(sysex.port,sysex.tx,sysex.txLen);
+		return;
+	}
+
+	switch(command)
+	{
+	case scWriteBegin:
+		dumpNext();
+		break;
+	case scWriteData:
+		sysex.seq=(sysex.seq+1)&0x3fff;
+		dumpNext();
+		break;
+	default:
+		endTransfer();
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Synth interface
+////////////////////////////////////////////////////////////////////////////////
+
+void sysex_init(void)
+{
+	memset(&sysex,0,sizeof(sysex));
+}
+
+void sysex_input(midiPort_t port, uint8_t b)
+{
+	// a new message, ignored while the previous one is still being handled
+	if(b==0xf0)
+	{
+		sysex.rxActive=!sysex.rxReady;
+		sysex.rxPort=port;
+		sysex.rxLen=0;
+	}
+
+	if(!sysex.rxActive || port!=sysex.rxPort)
+		return;
+
+	if(sysex.rxLen>=SYSEX_BUFFER_SIZE)
+	{
+		sysex.rxActive=0;
+		return;
+	}
+
+	sysex.rx[sysex.rxLen++]=b;
+
+	if(b==0xf7)
+	{
+		sysex.rxActive=0;
+
+		if(sysex.rxLen>SYSEX_HEADER_SIZE && sysex.rx[1]==SYSEX_ID_MANUFACTURER && sysex.rx[2]==SYSEX_ID_DEVICE)
+		{
+			__DMB();
+			sysex.rxReady=1;
+		}
+	}
+}
+
+void sysex_update(void)
+{
+	sysexCommand_t command;
+	sysexStatus_t status;
+	midiPort_t port;
+	uint16_t seq=0;
+
+	if(!sysex.rxReady)
+	{
+		if(sysex.state!=tsIdle && currentTick-sysex.lastActivity>SYSEX_TIMEOUT)
+		{
+#ifdef DEBUG
+			rprintf(0,"sysex timeout\n");
+#endif
+			endTransfer();
+		}
+		return;
+	}
+
+	__DMB();
+
+	port=sysex.rxPort;
+	command=sysex.rx[3];
+
+	if(sysex.state!=tsIdle && port!=sysex.port && command!=scAck)
+	{
+		sendAck(port,command,0,ssBusy);
+		sysex.rxReady=0;
+		return;
+	}
+
+	sysex.lastActivity=currentTick;
+
+	switch(command)
+	{
+	case scWriteBegin:
+		endTransfer();
+		sysex.port=port;
+		status=loadBegin();
+		if(status!=ssOk)
+			endTransfer();
+		sendAck(port,command,0,status);
+		break;
+	case scWriteData:
+		seq=get14(&sysex.rx[4]);
+		status=loadData(seq);
+		if(status==ssIO || status==ssBadRequest)
+			endTransfer();
+		sendAck(port,command,seq,status);
+		break;
+	case scWriteEnd:
+		status=loadEnd();
+		endTransfer();
+		sendAck(port,command,sysex.seq,status);
+		break;
+	case scReadRequest:
+		endTransfer();
+		sysex.port=port;
+		status=dumpBegin();
+		if(status!=ssOk)
+			sendAck(port,command,0,status);
+		break;
+	case scAck:
+		if(sysex.rxLen>=SYSEX_HEADER_SIZE+5)
+			dumpAck();
+		break;
+	default:
+		sendAck(port,command,0,ssBadRequest);
+	}
+
+	sysex.rxReady=0;
+}
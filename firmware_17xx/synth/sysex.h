@@ -0,0 +1,53 @@
+#ifndef SYSEX_H
+#define	SYSEX_H
+
+#include "synth.h"
+
+// Bulk transfers of on-flash objects, all messages are:
+//   F0 7D 4F <command> <payload> F7
+// 14 bits values are sent LSB first, 7 bits at a time.
+//
+//   WriteBegin  <object> <index:2> <size:3> <name...>
+//   WriteData   <seq:2> <7 bit encoded chunk, up to SYSEX_CHUNK_SIZE bytes> <checksum>
+//   WriteEnd
+//   ReadRequest <object> <index:2> <name...>
+//   Ack         <command> <seq:2> <status>
+//
+// A load is WriteBegin / WriteData... / WriteEnd from the host, each message
+// acked by the synth, the host only sends the next one once its ack came back.
+// A dump (ReadRequest) is the same sequence from the synth, acked by the host.
+// checksum is the XOR of seq & encoded bytes. The synth resends on a failed
+// ack, a host resends or nacks the expected seq after a timeout.
+//
+// Objects are their file on flash: config text for presets, settings and
+// sequencer tracks (exported from the log store first), raw signed 16 bits mono samples for waves (name is
+// "<bank>/<wave>"), the wav header is added / skipped by the synth.
+
+#define SYSEX_ID_MANUFACTURER 0x7d // non commercial
+#define SYSEX_ID_DEVICE 0x4f
+
+#define SYSEX_CHUNK_SIZE 128
+
+typedef enum
+{
+	scWriteBegin=1,scWriteData=2,scWriteEnd=3,scReadRequest=4,scAck=0x7e
+} sysexCommand_t;
+
+typedef enum
+{
+	soPreset=0,soSettings=1,soSequence=2,soWave=3,
+
+	// /!\ this must stay last
+	soCount
+} sysexObject_t;
+
+typedef enum
+{
+	ssOk=0,ssChecksum=1,ssSequence=2,ssIO=3,ssBadRequest=4,ssBusy=5
+} sysexStatus_t;
+
+void sysex_init(void);
+void sysex_update(void);
+void sysex_input(midiPort_t port, uint8_t b); // F0 ... F7, one byte at a time
+
+#endif	/* SYSEX_H */
@@ -4,15 +4,45 @@
 
 #include "uart_midi.h"
 
+static volatile int8_t txBusy;
+
+// MIDI out bytes in the 16 bytes transmit FIFO, refilled each time it empties
+static void fillTxFifo(void)
+{
+	uint8_t data[UART_TX_FIFO_SIZE];
+	int16_t count;
+
+	count=midi_getOutput(data,UART_TX_FIFO_SIZE);
+
+	for(int16_t i=0;i<count;++i)
+		LPC_UART2->THR=data[i];
+
+	txBusy=count>0;
+}
+
 __attribute__ ((used)) void UART2_IRQHandler(void)
 {
-	LPC_UART2->IIR; // acknowledge interrupt
-	synth_uartMIDIEvent(UART_ReceiveByte(LPC_UART2));
+	uint32_t iir=LPC_UART2->IIR; // acknowledge interrupt
+
+	if((iir&UART_IIR_INTID_MASK)==UART_IIR_INTID_THRE)
+		fillTxFifo();
+	else
+		synth_uartMIDIEvent(UART_ReceiveByte(LPC_UART2));
+}
+
+void uartMidi_startTransmit(void)
+{
+	BLOCK_INT(1)
+	{
+		if(!txBusy)
+			fillTxFifo();
+	}
 }
 
 void uartMidi_init(void)
 {
 	CLKPWR_ConfigPPWR(CLKPWR_PCONP_PCUART2,ENABLE);
+	PINSEL_ConfigPin(0,10,1);
 	PINSEL_ConfigPin(0,11,1);
 
 	UART_CFG_Type uart;
@@ -27,11 +57,13 @@ void uartMidi_init(void)
 	UART_FIFOConfig(UART_2,&fifo);
 
 	UART_IntConfig(UART_2,UART_INTCFG_RBR,ENABLE);
-	UART_IntConfig(UART_2,UART_INTCFG_THRE,DISABLE);
+	UART_IntConfig(UART_2,UART_INTCFG_THRE,ENABLE);
 	UART_IntConfig(UART_2,UART_INTCFG_RLS,DISABLE);
 	UART_IntConfig(UART_2,UART_INTCFG_ABEO,DISABLE);
 	UART_IntConfig(UART_2,UART_INTCFG_ABTO,DISABLE);
 
+	UART_TxCmd(LPC_UART2,ENABLE);
+
 	NVIC_SetPriority(UART2_IRQn,2);
 	NVIC_EnableIRQ(UART2_IRQn);
 }
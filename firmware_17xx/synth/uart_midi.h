@@ -5,6 +5,7 @@
 #include "synth.h"
 
 void uartMidi_init(void);
+void uartMidi_startTransmit(void); // new bytes for midi_getOutput()
 
 #endif	/* UART_MIDI_H */
 
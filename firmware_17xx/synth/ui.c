@@ -9,6 +9,7 @@
 #include "lpc177x_8x_pinsel.h"
 #include "lpc177x_8x_dac.h"
 #include "storage.h"
+#include "logstore.h"
 #include "assigner.h"
 #include "arp.h"
 #include "seq.h"
@@ -254,7 +255,7 @@ static void drawVisualEnv(int lcd, int8_t voicePair, int8_t force)
 {
 	int8_t i,ve,ve2;
 	uint32_t veb;
-	static int8_t old_ve[SYNTH_VOICE_COUNT]={INT8_MIN,INT8_MIN,INT8_MIN,INT8_MIN,INT8_MIN,INT8_MIN};
+	static int8_t old_ve[SYNTH_VOICE_COUNT]={[0 ... SYNTH_VOICE_COUNT-1]=INT8_MIN};
 	
 	ve=synth_getVisualEnvelope(voicePair)>>11;
 	ve2=synth_getVisualEnvelope(voicePair+1)>>11;
@@ -1080,7 +1081,7 @@ static void scanEvent(int8_t source, uint16_t * forcedValue) // source: keypad (
 				ui.slowUpdateTimeoutNumber=prm->number;
 				break;
 			case spUnison:
-				synth_updateAssignerPattern();
+				synth_updateAssignerPattern(0);
 				break;
 			}
 		}
@@ -1114,7 +1115,9 @@ static void scanEvent(int8_t source, uint16_t * forcedValue) // source: keypad (
 			ui.slowUpdateTimeoutNumber=prm->number+0x80;
 			break;
 		case cnTune:
-			assigner_setVoiceMask(0); // ensure no note playing during tuning
+			// ensure no note playing during tuning
+			for(int8_t part=0;part<SYNTH_PART_COUNT;++part)
+				assigner_setVoiceMask(part,0);
 
 			ui.slowUpdateTimeout=currentTick+SLOW_UPDATE_TIMEOUT;
 			ui.slowUpdateTimeoutNumber=prm->number+0x80;
@@ -1283,6 +1286,9 @@ static void scanEvent(int8_t source, uint16_t * forcedValue) // source: keypad (
 	{
 		ui_setPresetModified(1);
 		synth_refreshFullState(0);
+
+		if(prm->type==ptCont || prm->type==ptStep)
+			midi_echoParameter(prm->type==ptStep,prm->number);
 	}
 	
 	if(settingsModified)
@@ -1336,20 +1342,25 @@ static void handleSlowUpdates(void)
 		preset_saveCurrent(settings.presetNumber);
 		break;
 	case 0x80+cnLoad:
+		synth_prefetchPreset(settings.presetNumber);
+
 		BLOCK_INT(1)
 		{
 			// temporarily silence voices
 			for(int8_t v=0;v<SYNTH_VOICE_COUNT;++v)
 				synth_refreshCV(v,cvAmp,0,1);					
 
-			settings_save();                
 			if(!preset_loadCurrent(settings.presetNumber))
 				preset_loadDefault(1);
 			ui_setPresetModified(0);	
 			ui.presetExistsWarning=0;
 
-			synth_refreshFullState(1);
+			synth_refreshFullState(0);
 		}
+
+		synth_refreshAllWaveforms();
+
+		settings_save();                
 		break;
 	case 0x80+cnLBas:
 		BLOCK_INT(1)
@@ -1361,8 +1372,10 @@ static void handleSlowUpdates(void)
 			preset_loadDefault(1);
 			ui_setPresetModified(1);
 
-			synth_refreshFullState(1);
+			synth_refreshFullState(0);
 		}
+
+		synth_refreshAllWaveforms();
 		break;
 	case 0x80+cnTune:
 		setPos(2,0,1);
@@ -1382,6 +1395,8 @@ static void handleSlowUpdates(void)
 			sendString(2,"Quitting USB Disk mode...              ");
 
 			// reload settings & load static stuff
+			logstore_init();
+			storage_importText();
 			settings_load();
 			synth_refreshBankNames(1,1);
 
@@ -1423,8 +1438,8 @@ void ui_setTranspose(int32_t transpose)
 		return;
 	
 	// prevent hanging notes on transposition changes
-	if(assigner_getAnyPressed())
-		assigner_allKeysOff();
+	if(assigner_getAnyPressed(0))
+		assigner_allKeysOff(0);
 	
 	ui.transpose=transpose;
 	seq_setTranspose(transpose);
@@ -1492,7 +1507,7 @@ void ui_init(void)
 	sendString(1,synthName);
 	setPos(1,0,1);
 	sendString(1,synthVersion);
-	rprintf(1,"Sampling at %d Hz", SYNTH_MASTER_CLOCK/DACSPI_TICK_RATE);
+	rprintf(1,"Sampling at %d Hz", dacspi_getSampleRate());
 	setPos(2,0,1);
 }
 
@@ -1562,7 +1577,7 @@ void ui_update(void)
 		}
 		else
 		{
-			drawWaveform(synth_getWaveformData(sp2abx[prm->number]),WTOSC_SAMPLE_COUNT,currentPreset.oscWave[sp2abx[prm->number]]);
+			drawWaveform(synth_getWaveformData(sp2abx[prm->number]),WTOSC_SAMPLE_COUNT/2,currentPreset.oscWave[sp2abx[prm->number]]);
 		}
 	}
 	else if(ui.activePage==upHelp)
@@ -296,7 +296,7 @@ const struct uiParam_s uiParameters[upCount][SCAN_POT_COUNT+(kbAsterisk-kbA+1)]
 		/* 2nd row of pots */
 		{.type=ptNone},
 		{.type=ptNone},
-		{.type=ptNone},
+		{.type=ptStep,.number=spDacProfile,.shortName="DAC ",.longName="DAC rate profile",.values={"Std ","LLat","HiSR","Eco "}},
 		{.type=ptStep,.number=spPresetType,.shortName="Type",.longName="Preset type",.values={"Othr","Bass","Pad","Strn","Brass","Keys","Lead","Arpg","Perc","FX  "}},
 		{.type=ptStep,.number=spPresetStyle,.shortName="Styl",.longName="Preset style",.values={"Othr","Neut","Clen","Real","Slky","Raw ","Hevy","Krch"}},
 		/* buttons (A,B,C,D,#,*) */
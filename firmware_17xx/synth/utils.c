@@ -99,6 +99,31 @@ void resample(const uint16_t * src, uint16_t * dst, uint16_t src_samples, uint16
 	}
 }
 
+// same output as resample(), src being the start of dst, src_samples<=dst_samples:
+// written backwards, so that source samples are always read before being overwritten
+void resampleInPlace(uint16_t * data, uint16_t src_samples, uint16_t dst_samples)
+{
+	const int8_t frac_shift=14;
+	int32_t increment, first[3], h[4];
+
+	if(src_samples==dst_samples)
+		return;
+
+	increment=(src_samples<<frac_shift)/dst_samples;
+
+	// resample() history before its first sample
+	for(int8_t k=0;k<3;++k)
+		first[k]=data[(src_samples-((increment*(k+1))>>frac_shift))%src_samples];
+
+	for(int32_t ds=dst_samples-1;ds>=0;--ds)
+	{
+		for(int8_t k=0;k<4;++k)
+			h[k]=(ds>=k)?data[((ds-k)*increment)>>frac_shift]:first[k-ds-1];
+
+		data[ds]=herp((ds*increment)&((1<<frac_shift)-1),h[0],h[1],h[2],h[3],frac_shift);
+	}
+}
+
 // phase is 20 bits, from bit 4 to bit 23
 inline uint16_t computeShape(uint32_t phase, const uint16_t lookup[], int8_t interpolate)
 {
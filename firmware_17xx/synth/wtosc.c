@@ -7,9 +7,6 @@
 #include "osc_curves.h"
 
 #define CLOCK SYNTH_MASTER_CLOCK
-#define TICK_RATE DACSPI_TICK_RATE
-
-#define MAX_SAMPLERATE (CLOCK/TICK_RATE)
 
 #define WIDTH_MOD_BITS 14
 #define FRAC_SHIFT 12
@@ -32,13 +29,24 @@ static FORCEINLINE void updatePeriodIncrement(struct wtosc_s * o, int8_t type)
 	{
 		o->period[0]=o->pendingPeriod[0];
 		o->period[1]=o->pendingPeriod[1];
+		o->alphaDiv[0]=o->pendingAlphaDiv[0];
+		o->alphaDiv[1]=o->pendingAlphaDiv[1];
 		o->increment[0]=o->pendingIncrement[0];
 		o->increment[1]=o->pendingIncrement[1];
+		o->levelOffset[0]=o->pendingLevelOffset[0];
+		o->levelOffset[1]=o->pendingLevelOffset[1];
+		o->levelShift[0]=o->pendingLevelShift[0];
+		o->levelShift[1]=o->pendingLevelShift[1];
 		
 		o->pendingUpdate=0;
 	}
 }
 
+static FORCEINLINE int32_t levelIndex(struct wtosc_s * o, int8_t half)
+{
+	return o->levelOffset[half]+(o->phase>>o->levelShift[half]);
+}
+
 static FORCEINLINE void handlePhaseUnderflow(struct wtosc_s * o, int32_t bufIdx, oscSyncMode_t syncMode, int16_t * syncPositions)
 {
 	if(o->phase<0)
@@ -66,363 +74,107 @@ static FORCEINLINE void handleSlaveSync(struct wtosc_s * o, int32_t bufIdx, int1
 	}
 }
 
-static FORCEINLINE int32_t handleCounterUnderflow_wmOff(struct wtosc_s * o, int32_t bufIdx, oscSyncMode_t syncMode, int16_t * syncPositions)
+static FORCEINLINE int32_t handleCounterUnderflow(struct wtosc_s * o, int32_t bufIdx, oscSyncMode_t syncMode, int16_t * syncPositions,
+		const oscWModTarget_t wmType, const int8_t hasData)
 {
-	int32_t curPeriod,curIncrement;
-	
-	curPeriod=o->period[0];
-	curIncrement=o->increment[0];
+	int32_t curPeriod,curIncrement,curAlphaDiv,smp,idx;
+	int8_t half=0;
 	
-	o->phase-=curIncrement;
+	// without data, the phase still has to follow width for sync
+	if(wmType==wmWidth || !hasData)
+		half=o->phase>=WTOSC_SAMPLE_COUNT/2?1:0;
 
-	handlePhaseUnderflow(o,bufIdx,syncMode,syncPositions);
-
-	o->counter+=curPeriod;
+	curPeriod=o->period[half];
+	curAlphaDiv=o->alphaDiv[half];
+	curIncrement=o->increment[half];
 
-	o->prevSample3=o->prevSample2;
-	o->prevSample2=o->prevSample;
-	o->prevSample=o->curSample;
-
-	o->curSample=o->mainData[o->phase];
-
-	return (1<<(FRAC_SHIFT*2))/curPeriod;
-}
-
-static FORCEINLINE int32_t handleCounterUnderflow_wmAliasing(struct wtosc_s * o, int32_t bufIdx, oscSyncMode_t syncMode, int16_t * syncPositions)
-{
-	int32_t curPeriod,curIncrement;
-	
-	curPeriod=o->period[0];
-	curIncrement=o->increment[0];
-	
 	o->phase-=curIncrement;
 
 	handlePhaseUnderflow(o,bufIdx,syncMode,syncPositions);
 
 	o->counter+=curPeriod;
 
-	o->prevSample3=o->prevSample2=o->curSample; // we want aliasing, so make interpolation less effective !
-	o->prevSample=o->curSample;
-
-	o->curSample=o->mainData[o->phase];
+	if(!hasData)
+		return 0; // no sample to fetch
 
-	return (1<<(FRAC_SHIFT*2))/curPeriod;
-}
-
-static FORCEINLINE int32_t handleCounterUnderflow_wmWidth(struct wtosc_s * o, int32_t bufIdx, oscSyncMode_t syncMode, int16_t * syncPositions)
-{
-	int32_t curPeriod,curIncrement;
-	
-	if(o->phase>=WTOSC_SAMPLE_COUNT/2)
+	if(wmType==wmAliasing)
 	{
-		curPeriod=o->period[1];
-		curIncrement=o->increment[1];
+		o->prevSample3=o->prevSample2=o->curSample; // we want aliasing, so make interpolation less effective !
+		o->prevSample=o->curSample;
 	}
 	else
 	{
-		curPeriod=o->period[0];
-		curIncrement=o->increment[0];
+		o->prevSample3=o->prevSample2;
+		o->prevSample2=o->prevSample;
+		o->prevSample=o->curSample;
 	}
 
-	o->phase-=curIncrement;
-
-	handlePhaseUnderflow(o,bufIdx,syncMode,syncPositions);
-
-	o->counter+=curPeriod;
-
-	o->prevSample3=o->prevSample2;
-	o->prevSample2=o->prevSample;
-	o->prevSample=o->curSample;
-
-	o->curSample=o->mainData[o->phase];
-
-	return (1<<(FRAC_SHIFT*2))/curPeriod;
-}
-
-static FORCEINLINE int32_t handleCounterUnderflow_wmCrossOver(struct wtosc_s * o, int32_t bufIdx, oscSyncMode_t syncMode, int16_t * syncPositions)
-{
-	int32_t curPeriod,curIncrement;
-	
-	curPeriod=o->period[0];
-	curIncrement=o->increment[0];
-	
-	o->phase-=curIncrement;
-
-	handlePhaseUnderflow(o,bufIdx,syncMode,syncPositions);
-
-	o->counter+=curPeriod;
-
-	o->prevSample3=o->prevSample2;
-	o->prevSample2=o->prevSample;
-	o->prevSample=o->curSample;
-
-	o->curSample=lerp16(o->mainData[o->phase],o->crossoverData[o->phase],o->crossover);
-
-	return (1<<(FRAC_SHIFT*2))/curPeriod;
-}
-
-
-static FORCEINLINE int32_t handleCounterUnderflow_wmFolder(struct wtosc_s * o, int32_t bufIdx, oscSyncMode_t syncMode, int16_t * syncPositions)
-{
-	int32_t curPeriod,curIncrement,smp;
-	
-	curPeriod=o->period[0];
-	curIncrement=o->increment[0];
-	
-	o->phase-=curIncrement;
-
-	handlePhaseUnderflow(o,bufIdx,syncMode,syncPositions);
+	idx=levelIndex(o,half);
 
-	o->counter+=curPeriod;
-
-	o->prevSample3=o->prevSample2;
-	o->prevSample2=o->prevSample;
-	o->prevSample=o->curSample;
-
-	smp=o->mainData[o->phase];
-	
-	// wave folder
-	smp+=INT16_MIN;
-	smp*=o->folder;
-	smp=(smp>>2)+(1<<24); // smp = smp * 0.25 + 0.25
-	smp-=(smp+(1<<25))&0xfc000000; // smp -= round(smp)
-	smp^=smp>>31; // smp = abs(smp)
-	smp>>=9;
-
-	o->curSample=smp;
-
-	return (1<<(FRAC_SHIFT*2))/curPeriod;
-}
-
-static FORCEINLINE int32_t handleCounterUnderflow_wmBitCrush(struct wtosc_s * o, int32_t bufIdx, oscSyncMode_t syncMode, int16_t * syncPositions)
-{
-	int32_t curPeriod,curIncrement,smp;
-	
-	curPeriod=o->period[0];
-	curIncrement=o->increment[0];
-	
-	o->phase-=curIncrement;
-
-	handlePhaseUnderflow(o,bufIdx,syncMode,syncPositions);
-
-	o->counter+=curPeriod;
-
-	o->prevSample3=o->prevSample2;
-	o->prevSample2=o->prevSample;
-	o->prevSample=o->curSample;
-
-	smp=o->mainData[o->phase];
-
-	// bit crusher
-	if(o->bitcrush>=0)
-		smp+=INT16_MIN;
-	smp=(smp<<1)+1;
-	smp/=o->bitcrush;
-	smp*=o->bitcrush;
-	smp>>=1;
-	if(o->bitcrush>=0)
-		smp-=INT16_MIN;
-
-	o->curSample=smp;
-
-	return (1<<(FRAC_SHIFT*2))/curPeriod;
-}
-
-static FORCEINLINE void update_slaveSync_noData(struct wtosc_s * o, int32_t startBuffer, int32_t endBuffer, oscSyncMode_t syncMode, int16_t *syncPositions)
-{
-	int32_t buf;
-
-	for(buf=startBuffer;buf<=endBuffer;++buf)
-	{
-		// silence DAC
-
-		dacspi_setOscValue(buf,o->channel,HALF_RANGE);
-	}
-}
-
-static FORCEINLINE void update_slaveSync_wmOff(struct wtosc_s * o, int32_t startBuffer, int32_t endBuffer, oscSyncMode_t syncMode, int16_t *syncPositions)
-{
-	uint16_t r;
-	int32_t buf;
-	int32_t alphaDiv;
-	
-	alphaDiv=(1<<(FRAC_SHIFT*2))/o->period[0];
-
-	for(buf=startBuffer;buf<=endBuffer;++buf)
-	{
-		int32_t bufIdx=buf-startBuffer;
-
-		// counter update
-
-		o->counter-=TICK_RATE;
-
-		// sync (slave side)
-
-		handleSlaveSync(o,bufIdx,syncPositions);
-
-		// counter underflow management
-
-		if(o->counter<0)
-			alphaDiv=handleCounterUnderflow_wmOff(o,bufIdx,osmNone,NULL);
-
-		// interpolate
-
-		r=herp((o->counter*alphaDiv)>>FRAC_SHIFT,o->curSample,o->prevSample,o->prevSample2,o->prevSample3,FRAC_SHIFT);
-
-		// send value to DAC
-
-		dacspi_setOscValue(buf,o->channel,r);
-	}
-}
-
-static FORCEINLINE void update_slaveSync_wmWidth(struct wtosc_s * o, int32_t startBuffer, int32_t endBuffer, oscSyncMode_t syncMode, int16_t *syncPositions)
-{
-	uint16_t r;
-	int32_t buf;
-	int32_t alphaDiv,curHalf;
-	
-	curHalf=o->phase>=WTOSC_SAMPLE_COUNT/2?1:0;
-	alphaDiv=(1<<(FRAC_SHIFT*2))/o->period[curHalf];
-
-	for(buf=startBuffer;buf<=endBuffer;++buf)
-	{
-		int32_t bufIdx=buf-startBuffer;
-
-		// counter update
-
-		o->counter-=TICK_RATE;
-
-		// sync (slave side)
-
-		handleSlaveSync(o,bufIdx,syncPositions);
-
-		// counter underflow management
-
-		if(o->counter<0)
-			alphaDiv=handleCounterUnderflow_wmWidth(o,bufIdx,osmNone,NULL);
-
-		// interpolate
-
-		r=herp((o->counter*alphaDiv)>>FRAC_SHIFT,o->curSample,o->prevSample,o->prevSample2,o->prevSample3,FRAC_SHIFT);
-
-		// send value to DAC
-
-		dacspi_setOscValue(buf,o->channel,r);
-	}
-}
-
-static FORCEINLINE void update_slaveSync_wmAliasing(struct wtosc_s * o, int32_t startBuffer, int32_t endBuffer, oscSyncMode_t syncMode, int16_t *syncPositions)
-{
-	uint16_t r;
-	int32_t buf;
-	int32_t alphaDiv;
-
-	alphaDiv=(1<<(FRAC_SHIFT*2))/o->period[0];
-
-	for(buf=startBuffer;buf<=endBuffer;++buf)
+	switch(wmType)
 	{
-		int32_t bufIdx=buf-startBuffer;
-
-		// counter update
-
-		o->counter-=TICK_RATE;
-
-		// sync (slave side)
-
-		handleSlaveSync(o,bufIdx,syncPositions);
-
-		// counter underflow management
-
-		if(o->counter<0)
-			alphaDiv=handleCounterUnderflow_wmAliasing(o,bufIdx,osmNone,NULL);
-
-		// interpolate
-
-		r=herp((o->counter*alphaDiv)>>FRAC_SHIFT,o->curSample,o->prevSample,o->prevSample2,o->prevSample3,FRAC_SHIFT);
-
-		// send value to DAC
+	case wmCrossOver:
+		smp=lerp16(o->mainData[idx],o->crossoverData[idx],o->crossover);
+		break;
+	case wmFolder:
+		smp=o->mainData[idx];
 
-		dacspi_setOscValue(buf,o->channel,r);
+		// wave folder
+		smp+=INT16_MIN;
+		smp*=o->folder;
+		smp=(smp>>2)+(1<<24); // smp = smp * 0.25 + 0.25
+		smp-=(smp+(1<<25))&0xfc000000; // smp -= round(smp)
+		smp^=smp>>31; // smp = abs(smp)
+		smp>>=9;
+		break;
+	case wmBitCrush:
+		smp=o->mainData[idx];
+
+		// bit crusher
+		if(o->bitcrush>=0)
+			smp+=INT16_MIN;
+		smp=(smp<<1)+1;
+		smp/=o->bitcrush;
+		smp*=o->bitcrush;
+		smp>>=1;
+		if(o->bitcrush>=0)
+			smp-=INT16_MIN;
+		break;
+	default:
+		smp=o->mainData[idx];
+		break;
 	}
-}
-
-static FORCEINLINE void update_slaveSync_wmCrossOver(struct wtosc_s * o, int32_t startBuffer, int32_t endBuffer, oscSyncMode_t syncMode, int16_t *syncPositions)
-{
-	uint16_t r;
-	int32_t buf;
-	int32_t alphaDiv;
-
-	alphaDiv=(1<<(FRAC_SHIFT*2))/o->period[0];
-
-	for(buf=startBuffer;buf<=endBuffer;++buf)
-	{
-		int32_t bufIdx=buf-startBuffer;
-
-		// counter update
-
-		o->counter-=TICK_RATE;
-
-		// sync (slave side)
-
-		handleSlaveSync(o,bufIdx,syncPositions);
-
-		// counter underflow management
-
-		if(o->counter<0)
-			alphaDiv=handleCounterUnderflow_wmCrossOver(o,bufIdx,osmNone,NULL);
 
-		// interpolate
-
-		r=herp((o->counter*alphaDiv)>>FRAC_SHIFT,o->curSample,o->prevSample,o->prevSample2,o->prevSample3,FRAC_SHIFT);
-
-		// send value to DAC
+	o->curSample=smp;
 
-		dacspi_setOscValue(buf,o->channel,r);
-	}
+	return curAlphaDiv;
 }
 
-static FORCEINLINE void update_slaveSync_wmFolder(struct wtosc_s * o, int32_t startBuffer, int32_t endBuffer, oscSyncMode_t syncMode, int16_t *syncPositions)
+// one kernel, specialised at compile time for each (wave mod, sync role, data
+// present) variant, see the dispatch table in wtosc_update()
+static FORCEINLINE void updateKernel(struct wtosc_s * o, int32_t startBuffer, int32_t endBuffer, oscSyncMode_t syncMode, int16_t *syncPositions,
+		const oscWModTarget_t wmType, const int8_t slave, const int8_t hasData)
 {
-	uint16_t r;
+	const int32_t tickRate=dacspi_getTickRate(); // DAC profile dependant
 	int32_t buf;
 	int32_t alphaDiv;
 
-	alphaDiv=(1<<(FRAC_SHIFT*2))/o->period[0];
-
-	for(buf=startBuffer;buf<=endBuffer;++buf)
+	if(slave && !hasData)
 	{
-		int32_t bufIdx=buf-startBuffer;
-
-		// counter update
-
-		o->counter-=TICK_RATE;
-
-		// sync (slave side)
-
-		handleSlaveSync(o,bufIdx,syncPositions);
-
-		// counter underflow management
-
-		if(o->counter<0)
-			alphaDiv=handleCounterUnderflow_wmFolder(o,bufIdx,osmNone,NULL);
-
-		// interpolate
+		for(buf=startBuffer;buf<=endBuffer;++buf)
+		{
+			// sync positions are consumed anyway, so they don't reach the next voice
 
-		r=herp((o->counter*alphaDiv)>>FRAC_SHIFT,o->curSample,o->prevSample,o->prevSample2,o->prevSample3,FRAC_SHIFT);
+			syncPositions[buf-startBuffer]=INT16_MIN;
 
-		// send value to DAC
+			// silence DAC
 
-		dacspi_setOscValue(buf,o->channel,r);
+			dacspi_setOscValue(buf,o->channel,HALF_RANGE);
+		}
+		return;
 	}
-}
 
-static FORCEINLINE void update_slaveSync_wmBitCrush(struct wtosc_s * o, int32_t startBuffer, int32_t endBuffer, oscSyncMode_t syncMode, int16_t *syncPositions)
-{
-	uint16_t r;
-	int32_t buf;
-	int32_t alphaDiv;
-
-	alphaDiv=(1<<(FRAC_SHIFT*2))/o->period[0];
+	alphaDiv=o->alphaDiv[(wmType==wmWidth && o->phase>=WTOSC_SAMPLE_COUNT/2)?1:0];
 
 	for(buf=startBuffer;buf<=endBuffer;++buf)
 	{
@@ -430,255 +182,132 @@ static FORCEINLINE void update_slaveSync_wmBitCrush(struct wtosc_s * o, int32_t
 
 		// counter update
 
-		o->counter-=TICK_RATE;
+		o->counter-=tickRate;
 
 		// sync (slave side)
 
-		handleSlaveSync(o,bufIdx,syncPositions);
+		if(slave)
+			handleSlaveSync(o,bufIdx,syncPositions);
 
 		// counter underflow management
 
 		if(o->counter<0)
-			alphaDiv=handleCounterUnderflow_wmBitCrush(o,bufIdx,osmNone,NULL);
-
-		// interpolate
+			alphaDiv=handleCounterUnderflow(o,bufIdx,syncMode,syncPositions,wmType,hasData);
 
-		r=herp((o->counter*alphaDiv)>>FRAC_SHIFT,o->curSample,o->prevSample,o->prevSample2,o->prevSample3,FRAC_SHIFT);
+		if(hasData)
+		{
+			// interpolate & send value to DAC
 
-		// send value to DAC
+			dacspi_setOscValue(buf,o->channel,herp((o->counter*alphaDiv)>>FRAC_SHIFT,o->curSample,o->prevSample,o->prevSample2,o->prevSample3,FRAC_SHIFT));
+		}
+		else
+		{
+			// silence DAC
 
-		dacspi_setOscValue(buf,o->channel,r);
+			dacspi_setOscValue(buf,o->channel,HALF_RANGE);
+		}
 	}
 }
 
-static FORCEINLINE void update_masterSync_noData(struct wtosc_s * o, int32_t startBuffer, int32_t endBuffer, oscSyncMode_t syncMode, int16_t *syncPositions)
-{
-	int32_t buf;
-
-	for(buf=startBuffer;buf<=endBuffer;++buf)
-	{
-		int32_t bufIdx=buf-startBuffer;
-
-		// counter update
-
-		o->counter-=TICK_RATE;
-
-		// counter underflow management
-
-		if(o->counter<0)
-			handleCounterUnderflow_wmWidth(o,bufIdx,syncMode,syncPositions); // needs wmWidth to handle all cases
-
-		// silence DAC
-
-		dacspi_setOscValue(buf,o->channel,HALF_RANGE);
-	}
+#define DEFINE_UPDATE(name,wmType,slave,hasData) \
+static void name(struct wtosc_s * o, int32_t startBuffer, int32_t endBuffer, oscSyncMode_t syncMode, int16_t *syncPositions) \
+{ \
+	updateKernel(o,startBuffer,endBuffer,syncMode,syncPositions,wmType,slave,hasData); \
 }
 
-static FORCEINLINE void update_masterSync_wmOff(struct wtosc_s * o, int32_t startBuffer, int32_t endBuffer, oscSyncMode_t syncMode, int16_t *syncPositions)
+// kernels (wmFrequency only acts on pitch, it runs the wmOff one)
+#define WTOSC_KERNELS \
+	KERNEL(wmOff) \
+	KERNEL(wmAliasing) \
+	KERNEL(wmWidth) \
+	KERNEL(wmCrossOver) \
+	KERNEL(wmFolder) \
+	KERNEL(wmBitCrush)
+
+// wave mod type -> kernel
+#define WTOSC_DISPATCH \
+	DISPATCH(wmOff,wmOff) \
+	DISPATCH(wmAliasing,wmAliasing) \
+	DISPATCH(wmWidth,wmWidth) \
+	DISPATCH(wmFrequency,wmOff) \
+	DISPATCH(wmCrossOver,wmCrossOver) \
+	DISPATCH(wmFolder,wmFolder) \
+	DISPATCH(wmBitCrush,wmBitCrush)
+
+#define KERNEL(wmType) \
+	DEFINE_UPDATE(update_masterSync_##wmType,wmType,0,1) \
+	DEFINE_UPDATE(update_slaveSync_##wmType,wmType,1,1)
+
+WTOSC_KERNELS
+DEFINE_UPDATE(update_masterSync_noData,wmOff,0,0) // variants without data ignore the wave mod
+DEFINE_UPDATE(update_slaveSync_noData,wmOff,1,0)
+
+#undef KERNEL
+
+// minIncrement is in WTOSC_SAMPLE_COUNT units, the level that plays it one
+// sample at a time is chosen, the top one has to skip samples and keeps to
+// divisors of its size so that cycles still loop on the same samples
+static FORCEINLINE int8_t selectLevel(int32_t minIncrement, int32_t * increment)
 {
-	uint16_t r;
-	int32_t buf;
-	int32_t alphaDiv;
+	static const uint8_t topLevelSteps[]={1,3,5,15,25,75};
+	int8_t level,i;
 
-	alphaDiv=(1<<(FRAC_SHIFT*2))/o->period[0];
+	level=(minIncrement>2)?32-__CLZ(minIncrement-1):1; // ceil(log2(minIncrement))
 
-	for(buf=startBuffer;buf<=endBuffer;++buf)
+	if(level<=WTOSC_LEVEL_COUNT)
 	{
-		int32_t bufIdx=buf-startBuffer;
-
-		// counter update
-
-		o->counter-=TICK_RATE;
-
-		// counter underflow management
-
-		if(o->counter<0)
-			alphaDiv=handleCounterUnderflow_wmOff(o,bufIdx,syncMode,syncPositions);
-
-		// interpolate
-
-		r=herp((o->counter*alphaDiv)>>FRAC_SHIFT,o->curSample,o->prevSample,o->prevSample2,o->prevSample3,FRAC_SHIFT);
-
-		// send value to DAC
-
-		dacspi_setOscValue(buf,o->channel,r);
+		*increment=1<<level;
+		return level;
 	}
-}
-
-static FORCEINLINE void update_masterSync_wmWidth(struct wtosc_s * o, int32_t startBuffer, int32_t endBuffer, oscSyncMode_t syncMode, int16_t *syncPositions)
-{
-	uint16_t r;
-	int32_t buf;
-	int32_t alphaDiv,curHalf;
-	
-	curHalf=o->phase>=WTOSC_SAMPLE_COUNT/2?1:0;
-	alphaDiv=(1<<(FRAC_SHIFT*2))/o->period[curHalf];
-
-	for(buf=startBuffer;buf<=endBuffer;++buf)
-	{
-		int32_t bufIdx=buf-startBuffer;
-
-		// counter update
 
-		o->counter-=TICK_RATE;
+	for(i=0;i<sizeof(topLevelSteps)-1 && (topLevelSteps[i]<<WTOSC_LEVEL_COUNT)<minIncrement;++i);
+	*increment=topLevelSteps[i]<<WTOSC_LEVEL_COUNT;
 
-		// sync (slave side)
-
-		handleSlaveSync(o,bufIdx,syncPositions);
-
-		// counter underflow management
-
-		if(o->counter<0)
-			alphaDiv=handleCounterUnderflow_wmWidth(o,bufIdx,syncMode,syncPositions);
-
-		// interpolate
-
-		r=herp((o->counter*alphaDiv)>>FRAC_SHIFT,o->curSample,o->prevSample,o->prevSample2,o->prevSample3,FRAC_SHIFT);
-
-		// send value to DAC
-
-		dacspi_setOscValue(buf,o->channel,r);
-	}
+	return WTOSC_LEVEL_COUNT;
 }
 
-static FORCEINLINE void update_masterSync_wmAliasing(struct wtosc_s * o, int32_t startBuffer, int32_t endBuffer, oscSyncMode_t syncMode, int16_t *syncPositions)
+// circular lowpass & decimation by 2, dst can overlap the start of src
+static void halfbandDecimate(uint16_t * src, uint16_t * dst, int32_t srcCount)
 {
-	uint16_t r;
-	int32_t buf;
-	int32_t alphaDiv;
-
-	alphaDiv=(1<<(FRAC_SHIFT*2))/o->period[0];
+	// 31 taps Blackman windowed halfband, 15 bits fixed point, odd taps only
+	// (even ones are 0, except for the 16384 center one)
+	static const int32_t taps[]={10265,-3012,1392,-661,288,-106,28,-2};
+	uint16_t head[sizeof(taps)/sizeof(taps[0])*4];
+	int32_t i,j,acc;
 
-	for(buf=startBuffer;buf<=endBuffer;++buf)
+	auto int32_t tap(int32_t idx)
 	{
-		int32_t bufIdx=buf-startBuffer;
-
-		// counter update
-
-		o->counter-=TICK_RATE;
-
-		// sync (slave side)
-
-		handleSlaveSync(o,bufIdx,syncPositions);
-
-		// counter underflow management
-
-		if(o->counter<0)
-			alphaDiv=handleCounterUnderflow_wmAliasing(o,bufIdx,syncMode,syncPositions);
-
-		// interpolate
-
-		r=herp((o->counter*alphaDiv)>>FRAC_SHIFT,o->curSample,o->prevSample,o->prevSample2,o->prevSample3,FRAC_SHIFT);
-
-		// send value to DAC
-
-		dacspi_setOscValue(buf,o->channel,r);
+		if(idx<0)
+			idx+=srcCount;
+		else if(idx>=srcCount)
+			idx-=srcCount;
+		
+		// the first samples are needed again once dst has overwritten them
+		return ((idx<sizeof(head)/sizeof(head[0]))?head[idx]:src[idx])+INT16_MIN;
 	}
-}
 
-static FORCEINLINE void update_masterSync_wmCrossOver(struct wtosc_s * o, int32_t startBuffer, int32_t endBuffer, oscSyncMode_t syncMode, int16_t *syncPositions)
-{
-	uint16_t r;
-	int32_t buf;
-	int32_t alphaDiv;
-
-	alphaDiv=(1<<(FRAC_SHIFT*2))/o->period[0];
+	memcpy(head,src,sizeof(head));
 
-	for(buf=startBuffer;buf<=endBuffer;++buf)
+	for(i=0;i<srcCount/2;++i)
 	{
-		int32_t bufIdx=buf-startBuffer;
-
-		// counter update
-
-		o->counter-=TICK_RATE;
-
-		// sync (slave side)
-
-		handleSlaveSync(o,bufIdx,syncPositions);
-
-		// counter underflow management
-
-		if(o->counter<0)
-			alphaDiv=handleCounterUnderflow_wmCrossOver(o,bufIdx,syncMode,syncPositions);
-
-		// interpolate
-
-		r=herp((o->counter*alphaDiv)>>FRAC_SHIFT,o->curSample,o->prevSample,o->prevSample2,o->prevSample3,FRAC_SHIFT);
-
-		// send value to DAC
+		acc=tap(i*2)<<14;
+		for(j=0;j<sizeof(taps)/sizeof(taps[0]);++j)
+			acc+=(tap(i*2-1-j*2)+tap(i*2+1+j*2))*taps[j];
 
-		dacspi_setOscValue(buf,o->channel,r);
+		acc=((acc+(1<<14))>>15)-INT16_MIN;
+		dst[i]=MIN(UINT16_MAX-WTOSC_SAMPLES_GUARD_BAND,MAX(WTOSC_SAMPLES_GUARD_BAND,acc));
 	}
 }
 
-static FORCEINLINE void update_masterSync_wmFolder(struct wtosc_s * o, int32_t startBuffer, int32_t endBuffer, oscSyncMode_t syncMode, int16_t *syncPositions)
+LOWERCODESIZE void wtosc_buildMipmaps(uint16_t * data)
 {
-	uint16_t r;
-	int32_t buf;
-	int32_t alphaDiv;
+	// level 1 overwrites level 0 (full size), each next level is computed
+	// from the previous one
 
-	alphaDiv=(1<<(FRAC_SHIFT*2))/o->period[0];
+	halfbandDecimate(data,data,WTOSC_SAMPLE_COUNT);
 
-	for(buf=startBuffer;buf<=endBuffer;++buf)
-	{
-		int32_t bufIdx=buf-startBuffer;
-
-		// counter update
-
-		o->counter-=TICK_RATE;
-
-		// sync (slave side)
-
-		handleSlaveSync(o,bufIdx,syncPositions);
-
-		// counter underflow management
-
-		if(o->counter<0)
-			alphaDiv=handleCounterUnderflow_wmFolder(o,bufIdx,syncMode,syncPositions);
-
-		// interpolate
-
-		r=herp((o->counter*alphaDiv)>>FRAC_SHIFT,o->curSample,o->prevSample,o->prevSample2,o->prevSample3,FRAC_SHIFT);
-
-		// send value to DAC
-
-		dacspi_setOscValue(buf,o->channel,r);
-	}
-}
-
-static FORCEINLINE void update_masterSync_wmBitCrush(struct wtosc_s * o, int32_t startBuffer, int32_t endBuffer, oscSyncMode_t syncMode, int16_t *syncPositions)
-{
-	uint16_t r;
-	int32_t buf;
-	int32_t alphaDiv;
-
-	alphaDiv=(1<<(FRAC_SHIFT*2))/o->period[0];
-
-	for(buf=startBuffer;buf<=endBuffer;++buf)
-	{
-		int32_t bufIdx=buf-startBuffer;
-
-		// counter update
-
-		o->counter-=TICK_RATE;
-
-		// sync (slave side)
-
-		handleSlaveSync(o,bufIdx,syncPositions);
-
-		// counter underflow management
-
-		if(o->counter<0)
-			alphaDiv=handleCounterUnderflow_wmBitCrush(o,bufIdx,syncMode,syncPositions);
-
-		// interpolate
-
-		r=herp((o->counter*alphaDiv)>>FRAC_SHIFT,o->curSample,o->prevSample,o->prevSample2,o->prevSample3,FRAC_SHIFT);
-
-		// send value to DAC
-
-		dacspi_setOscValue(buf,o->channel,r);
-	}
+	for(int8_t l=2;l<=WTOSC_LEVEL_COUNT;++l)
+		halfbandDecimate(&data[WTOSC_LEVEL_OFFSET(l-1)],&data[WTOSC_LEVEL_OFFSET(l)],WTOSC_SAMPLE_COUNT>>(l-1));
 }
 
 void wtosc_init(struct wtosc_s * o, int8_t channel)
@@ -703,7 +332,9 @@ FORCEINLINE void wtosc_setParameters(struct wtosc_s * o, uint16_t pitch, oscWMod
 	uint64_t frequency;
 	uint32_t sampleRate[2];
 	int32_t increment[2], period[2], aliasing_s, crossover_s, folder_s, bitcrush_s;
+	int8_t level;
 	uint16_t width;
+	const uint32_t maxSampleRate=dacspi_getSampleRate();
 	
 	pitch=MIN(WTOSC_HIGHEST_NOTE*WTOSC_CV_SEMITONE,pitch);
 	
@@ -762,19 +393,22 @@ FORCEINLINE void wtosc_setParameters(struct wtosc_s * o, uint16_t pitch, oscWMod
 		sampleRate[0]=frequency/((1<<WIDTH_MOD_BITS)-width);
 		sampleRate[1]=frequency/width;
 
-		increment[0]=1+(sampleRate[0]/MAX_SAMPLERATE);
-		increment[1]=1+(sampleRate[1]/MAX_SAMPLERATE);
+		for(int8_t i=0;i<2;++i)
+		{
+			level=selectLevel(1+(sampleRate[i]/maxSampleRate),&increment[i]);
+			increment[i]=MIN(WTOSC_SAMPLE_COUNT,increment[i]+aliasing_s);
 
-		increment[0]=oscIncModLUT[increment[0]];
-		increment[1]=oscIncModLUT[increment[1]];
+			o->pendingLevelOffset[i]=WTOSC_LEVEL_OFFSET(level);
+			o->pendingLevelShift[i]=level;
+		}
 
-		increment[0]=MIN(WTOSC_SAMPLE_COUNT,increment[0]+aliasing_s);
-		increment[1]=MIN(WTOSC_SAMPLE_COUNT,increment[1]+aliasing_s);
 		period[0]=CLOCK/(sampleRate[0]/increment[0]);
 		period[1]=CLOCK/(sampleRate[1]/increment[1]);	
 
 		o->pendingPeriod[0]=period[0];	
 		o->pendingPeriod[1]=period[1];	
+		o->pendingAlphaDiv[0]=(1<<(FRAC_SHIFT*2))/period[0];
+		o->pendingAlphaDiv[1]=(1<<(FRAC_SHIFT*2))/period[1];
 		o->pendingIncrement[0]=increment[0];
 		o->pendingIncrement[1]=increment[1];
 
@@ -799,16 +433,18 @@ void wtosc_update(struct wtosc_s * o, int32_t startBuffer, int32_t endBuffer, os
 {
 	typedef void(*update_t)(struct wtosc_s *, int32_t, int32_t, oscSyncMode_t, int16_t *);	
 
+	#define DISPATCH(wmType,kernel) \
+		[(wmType<<2)|0]=update_masterSync_noData, \
+		[(wmType<<2)|1]=update_masterSync_##kernel, \
+		[(wmType<<2)|2]=update_slaveSync_noData, \
+		[(wmType<<2)|3]=update_slaveSync_##kernel,
+
+	// indexed by (wave mod; slaveSync; data)
 	static const update_t update[wmCount*2*2] = {
-		// (noData; masterSync), (data; masterSync), (noData; slaveSync), (data; slaveSync), 
-		update_masterSync_noData,	update_masterSync_wmOff,		update_slaveSync_noData,	update_slaveSync_wmOff,
-		update_masterSync_noData,	update_masterSync_wmAliasing,	update_slaveSync_noData,	update_slaveSync_wmAliasing,
-		update_masterSync_noData,	update_masterSync_wmWidth,		update_slaveSync_noData,	update_slaveSync_wmWidth,
-		update_masterSync_noData,	update_masterSync_wmOff,		update_slaveSync_noData,	update_slaveSync_wmOff,
-		update_masterSync_noData,	update_masterSync_wmCrossOver,	update_slaveSync_noData,	update_slaveSync_wmCrossOver,
-		update_masterSync_noData,	update_masterSync_wmFolder,		update_slaveSync_noData,	update_slaveSync_wmFolder,
-		update_masterSync_noData,	update_masterSync_wmBitCrush,	update_slaveSync_noData,	update_slaveSync_wmBitCrush,
+		WTOSC_DISPATCH
 	};
+
+	#undef DISPATCH
 	
 	updatePeriodIncrement(o,2);
 	
@@ -8,6 +8,11 @@
 #define WTOSC_HIGHEST_NOTE 120
 #define WTOSC_SAMPLES_GUARD_BAND 4600 // about -1.3 decibels
 
+// sample data is a per octave mipmap pyramid, level 1 (WTOSC_SAMPLE_COUNT/2
+// samples) to WTOSC_LEVEL_COUNT, each one half the size of the previous one
+#define WTOSC_LEVEL_COUNT 5
+#define WTOSC_LEVEL_OFFSET(l) (WTOSC_SAMPLE_COUNT-(WTOSC_SAMPLE_COUNT>>((l)-1)))
+
 typedef enum
 {
 	wmOff=0,wmAliasing=1,wmWidth=2,wmFrequency=3,wmCrossOver=4,wmFolder=5,wmBitCrush=6,
@@ -22,7 +27,10 @@ struct wtosc_s
 	uint16_t * crossoverData;
 	
 	int32_t period[2],pendingPeriod[2]; // one per waveform half
-	int32_t increment[2],pendingIncrement[2];
+	int32_t alphaDiv[2],pendingAlphaDiv[2]; // (1<<(FRAC_SHIFT*2))/period, swapped in with period
+	int32_t increment[2],pendingIncrement[2]; // in WTOSC_SAMPLE_COUNT units
+	int32_t levelOffset[2],pendingLevelOffset[2];
+	int8_t levelShift[2],pendingLevelShift[2];
 	
 	int32_t counter;
 	int32_t phase;
@@ -47,8 +55,10 @@ typedef enum
 } oscSyncMode_t;
 
 void wtosc_init(struct wtosc_s * o, int8_t channel);
-// data must be persistent and be filled with values in the range
-// WTOSC_SAMPLES_GUARD_BAND..65535-WTOSC_SAMPLES_GUARD_BAND
+// turns WTOSC_SAMPLE_COUNT samples into the mipmap pyramid, in place
+void wtosc_buildMipmaps(uint16_t * data);
+// data must be persistent, built by wtosc_buildMipmaps() and be filled with
+// values in the range WTOSC_SAMPLES_GUARD_BAND..65535-WTOSC_SAMPLES_GUARD_BAND
 // this is because hermite interpolation will overshoot on sharp transitions
 void wtosc_setSampleData(struct wtosc_s * o, uint16_t * mainData, uint16_t * xovrData);
 void wtosc_setParameters(struct wtosc_s * o, uint16_t pitch, oscWModTarget_t wmType, uint16_t wmAmount);
@@ -17,6 +17,7 @@
 #include "synth/synth.h"
 #include "synth/ui.h"
 #include "synth/utils.h"
+#include "synth/bench.h"
 
 usbMode_t usbMode = umNone;
 FATFS fatFS;
@@ -156,6 +157,10 @@ int main(void)
 
 	synth_init();
 
+#ifdef SYNTH_BENCHMARK
+	bench_run();
+#endif
+
 	__enable_irq();
 	
 	rprintf(0,"done\n");
@@ -54,6 +54,9 @@ static inline void __restore_irq_stub(uint32_t basepri)
 #define STORAGE_PAGE_SIZE 512
 #define STORAGE_PAGE_COUNT 65536
 
+// peripheral SRAM, what only the GPDMA reads (descriptors) is grouped first, one region
+// for now: splitting it across the 2 AHB banks waits for target numbers, see BENCHMARKS.md
+#define EXT_RAM_DMA  __attribute__((section(".ext_ram_dma")))
 #define EXT_RAM  __attribute__((section(".ext_ram")))
 
 typedef enum
@@ -3,10 +3,19 @@
 #include "w25q.h"
 
 #include "main.h"
+#include "rprintf.h"
+
+#ifdef HOST_BUILD
+#include "host.h"
+#else
+#include "LPC177x_8x.h"
+#include "lpc177x_8x_gpdma.h"
 #include "lpc177x_8x_gpio.h"
 #include "lpc177x_8x_ssp.h"
+#include "lpc177x_8x_timer.h"
 #include "lpc177x_8x_pinsel.h"
-#include "rprintf.h"
+#include "lpc177x_8x_clkpwr.h"
+#endif
 
 #define CMD_WRITE_ENABLE 0x06
 #define CMD_WRITE_DISABLE 0x04
@@ -17,11 +26,110 @@
 #define CMD_FAST_READ 0x0B
 #define CMD_SECTOR_ERASE 0x20
 #define CMD_PAGE_PROGRAM 0x02
+#define CMD_ERASE_SUSPEND 0x75
+#define CMD_ERASE_RESUME 0x7A
 #define CMD_ENABLE_RESET 0x66
 #define CMD_RESET 0x99
 
 #define STATUS_BUSY 1
 
+// sector reads are GPDMA batches of up to W25Q_DMA_BATCH_SECTORS, all under a single FAST_READ,
+// the DMA interrupt chains them; LLIs move 2KB each (transfer sizes are 12bit)
+#define W25Q_DMA_CHUNK 2048
+#define W25Q_DMA_BATCH_SECTORS 4
+#define W25Q_DMA_LLI_COUNT (W25Q_DMA_BATCH_SECTORS*W25Q_SECTOR_SIZE/W25Q_DMA_CHUNK)
+
+static struct
+{
+	uint8_t * buffer;
+	uint32_t remaining; // sectors after the batch in flight
+	W25Q_callback_t callback;
+	volatile int8_t busy;
+} dmaRead;
+
+// background sector erase: other commands suspend it while they run, it then
+// resumes where it was
+static struct
+{
+	int8_t running; // might be done already, the status register tells
+	int8_t suspended;
+} erase;
+
+#ifdef HOST_BUILD
+
+////////////////////////////////////////////////////////////////////////////////
+// host: the W25Q device model of host_w25q.c sits behind the bus
+////////////////////////////////////////////////////////////////////////////////
+
+static inline void csSet(uint32_t dummy)
+{
+	host_w25q_select(0);
+}
+
+static inline uint32_t csClear(void)
+{
+	host_w25q_select(1);
+	return 0;
+}
+
+static uint8_t sendRead8(uint8_t value)
+{
+	return host_w25q_transfer(value);
+}
+
+static void busInit(void)
+{
+	host_w25q_init();
+}
+
+static void dmaStart(uint8_t * buffer, uint32_t size)
+{
+	host_w25q_startDMA(buffer,size);
+}
+
+static void dmaStop(void)
+{
+}
+
+static void dmaPoll(void)
+{
+	// the simulated GPDMA only moves when waited for, it runs W25Q_dmaInterrupt() when done
+	host_w25q_runDMA(W25Q_SECTOR_SIZE);
+}
+
+#else
+
+////////////////////////////////////////////////////////////////////////////////
+// SSP1, CS on P0.6
+////////////////////////////////////////////////////////////////////////////////
+
+// SSP1 Tx request line is the pot scan timer (see scan.c), so the dummy bytes
+// that clock sector reads out are sent by TIM1 paced transfers instead, like
+// the other GPDMA users; SSP1 Rx requests move the data
+#define DMA_CHANNEL_SSP0_TX__T1_MAT_0 2
+#define DMA_CHANNEL_SSP1_RX 5
+
+// 80 cycles per byte, 64 are needed at 15MHz: the FIFOs never over / underrun
+#define W25Q_TX_TIMER_MATCH 79
+
+#define W25Q_RX_DMACONFIG \
+		GPDMA_DMACCxConfig_E | \
+		GPDMA_DMACCxConfig_SrcPeripheral(DMA_CHANNEL_SSP1_RX) | \
+		GPDMA_DMACCxConfig_TransferType(2) | \
+		GPDMA_DMACCxConfig_ITC
+
+#define W25Q_TX_DMACONFIG \
+		GPDMA_DMACCxConfig_E | \
+		GPDMA_DMACCxConfig_DestPeripheral(DMA_CHANNEL_SSP0_TX__T1_MAT_0) | \
+		GPDMA_DMACCxConfig_TransferType(1)
+
+#define W25Q_DMA_RX_CH LPC_GPDMACH2
+#define W25Q_DMA_TX_CH LPC_GPDMACH3
+
+static EXT_RAM_DMA GPDMA_LLI_Type rxLli[W25Q_DMA_LLI_COUNT];
+static EXT_RAM_DMA GPDMA_LLI_Type txLli[W25Q_DMA_LLI_COUNT];
+static EXT_RAM_DMA uint8_t txDummy;
+
 static inline void csSet(uint32_t dummy)
 {
 	GPIO_OutputValue(0,1<<6,1);
@@ -38,8 +146,6 @@ static inline uint32_t csClear(void)
 	return 0;
 }
 
-#define HANDLE_CS for(uint32_t __ctr=1,__dummy=csClear();__ctr;csSet(__dummy),__ctr=0)
-
 static uint8_t sendRead8(uint8_t value)
 {
 	SSP_DATA_SETUP_Type sds;
@@ -58,6 +164,124 @@ static uint8_t sendRead8(uint8_t value)
 	return res;
 }
 
+static void busInit(void)
+{
+	//Configure pins and gpios
+	PINSEL_ConfigPin(0,6,0);
+	PINSEL_ConfigPin(0,7,2);
+	PINSEL_ConfigPin(0,8,2);
+	PINSEL_ConfigPin(0,9,2);
+	
+	GPIO_SetDir(0,1<<6,GPIO_DIRECTION_OUTPUT);
+	GPIO_OutputValue(0,1<<6,1);
+
+	// SSP Configuration structure variable
+	SSP_CFG_Type SSP_ConfigStruct;
+	// initialize SSP configuration structure to default
+	SSP_ConfigStructInit(&SSP_ConfigStruct);
+	SSP_ConfigStruct.ClockRate=15000000;
+	// Initialize SSP peripheral with parameter given in structure above
+	SSP_Init(LPC_SSP1,&SSP_ConfigStruct);
+	// Enable SD_SSP peripheral
+	SSP_Cmd(LPC_SSP1,ENABLE);
+	
+	// GPDMA & Tx pacing timer, storage comes up before dacspi
+	
+	CLKPWR_ConfigPPWR(CLKPWR_PCONP_PCGPDMA,ENABLE);
+
+	LPC_SC->DMAREQSEL|=1<<DMA_CHANNEL_SSP0_TX__T1_MAT_0;
+	LPC_GPDMA->Config=GPDMA_DMACConfig_E;
+	
+	TIM_TIMERCFG_Type tim;
+	TIM_MATCHCFG_Type tm;
+	
+	tim.PrescaleOption=TIM_PRESCALE_TICKVAL;
+	tim.PrescaleValue=1;
+
+	tm.MatchChannel=0;
+	tm.IntOnMatch=DISABLE;
+	tm.ResetOnMatch=ENABLE;
+	tm.StopOnMatch=DISABLE;
+	tm.ExtMatchOutputType=0;
+	tm.MatchValue=W25Q_TX_TIMER_MATCH;
+	
+	TIM_Init(LPC_TIM1,TIM_TIMER_MODE,&tim);
+	TIM_ConfigMatch(LPC_TIM1,&tm);
+}
+
+static void dmaStart(uint8_t * buffer, uint32_t size)
+{
+	int lliCount=size/W25Q_DMA_CHUNK;
+	
+	for(int i=0;i<lliCount;++i)
+	{
+		rxLli[i].SrcAddr=(uint32_t)&LPC_SSP1->DR;
+		rxLli[i].DstAddr=(uint32_t)&buffer[i*W25Q_DMA_CHUNK];
+		rxLli[i].NextLLI=(i<lliCount-1)?(uint32_t)&rxLli[i+1]:0;
+		rxLli[i].Control=
+			GPDMA_DMACCxControl_TransferSize(W25Q_DMA_CHUNK) |
+			GPDMA_DMACCxControl_SWidth(0) |
+			GPDMA_DMACCxControl_DWidth(0) |
+			GPDMA_DMACCxControl_DI;
+
+		txLli[i].SrcAddr=(uint32_t)&txDummy;
+		txLli[i].DstAddr=(uint32_t)&LPC_SSP1->DR;
+		txLli[i].NextLLI=(i<lliCount-1)?(uint32_t)&txLli[i+1]:0;
+		txLli[i].Control=
+			GPDMA_DMACCxControl_TransferSize(W25Q_DMA_CHUNK) |
+			GPDMA_DMACCxControl_SWidth(0) |
+			GPDMA_DMACCxControl_DWidth(0);
+	}
+	
+	// interrupt once the last byte is in
+	rxLli[lliCount-1].Control|=GPDMA_DMACCxControl_I;
+	
+	// Rx first, it has the higher priority channel too
+	
+	W25Q_DMA_RX_CH->CSrcAddr=rxLli[0].SrcAddr;
+	W25Q_DMA_RX_CH->CDestAddr=rxLli[0].DstAddr;
+	W25Q_DMA_RX_CH->CLLI=rxLli[0].NextLLI;
+	W25Q_DMA_RX_CH->CControl=rxLli[0].Control;
+	W25Q_DMA_RX_CH->CConfig=W25Q_RX_DMACONFIG;
+
+	W25Q_DMA_TX_CH->CSrcAddr=txLli[0].SrcAddr;
+	W25Q_DMA_TX_CH->CDestAddr=txLli[0].DstAddr;
+	W25Q_DMA_TX_CH->CLLI=txLli[0].NextLLI;
+	W25Q_DMA_TX_CH->CControl=txLli[0].Control;
+	W25Q_DMA_TX_CH->CConfig=W25Q_TX_DMACONFIG;
+	
+	// pacing keeps running between the batches of a read
+	
+	SSP_DMACmd(LPC_SSP1,SSP_DMA_RX,ENABLE);
+	TIM_Cmd(LPC_TIM1,ENABLE);
+}
+
+static void dmaStop(void)
+{
+	TIM_Cmd(LPC_TIM1,DISABLE);
+	SSP_DMACmd(LPC_SSP1,SSP_DMA_RX,DISABLE);
+	W25Q_DMA_RX_CH->CConfig=0;
+	W25Q_DMA_TX_CH->CConfig=0;
+}
+
+static void dmaPoll(void)
+{
+	// the DMA interrupt might not be enabled yet, or interrupts be off altogether
+	BLOCK_INT(1)
+	{
+		if(LPC_GPDMA->IntTCStat&W25Q_DMA_CHANNEL_MASK)
+		{
+			LPC_GPDMA->IntTCClear=W25Q_DMA_CHANNEL_MASK;
+			NVIC_ClearPendingIRQ(DMA_IRQn); // pends again by itself if the DAC ring is due too
+			W25Q_dmaInterrupt();
+		}
+	}
+}
+
+#endif
+
+#define HANDLE_CS for(uint32_t __ctr=1,__dummy=csClear();__ctr;csSet(__dummy),__ctr=0)
+
 static void send32(uint32_t value)
 {
 	sendRead8((value>>24)&0xff);
@@ -66,19 +290,22 @@ static void send32(uint32_t value)
 	sendRead8(value&0xff);
 }
 
-static int8_t waitBUSY(void)
+static uint8_t readStatus(void)
 {
 	uint8_t status;
 	
-	do
+	HANDLE_CS
 	{
-		HANDLE_CS
-		{
-			sendRead8(CMD_READ_STATUS);
-			status=sendRead8(0x00);
-		}
+		sendRead8(CMD_READ_STATUS);
+		status=sendRead8(0x00);
 	}
-	while(status&STATUS_BUSY);
+	
+	return status;
+}
+
+static int8_t waitBUSY(void)
+{
+	while(readStatus()&STATUS_BUSY);
 	
 	return 0;
 }
@@ -106,24 +333,166 @@ static void reset(void)
 	waitBUSY();
 }
 
-void W25Q_readSector(uint32_t index, uint8_t * buffer)
+static void suspendErase(void)
+{
+	if(!erase.running || erase.suspended)
+		return;
+	
+	if(!(readStatus()&STATUS_BUSY))
+	{
+		erase.running=0;
+		return;
+	}
+	
+	HANDLE_CS
+	{
+		sendRead8(CMD_ERASE_SUSPEND);
+	}
+	
+	waitBUSY(); // tSUS, 20us max
+	erase.suspended=1;
+}
+
+static void resumeErase(void)
 {
+	if(!erase.suspended)
+		return;
+	
+	HANDLE_CS
+	{
+		sendRead8(CMD_ERASE_RESUME);
+	}
+	
+	erase.suspended=0;
+}
+
+static void waitRead(void)
+{
+	while(dmaRead.busy)
+		dmaPoll();
+}
+
+static void waitErase(void)
+{
+	if(!erase.running)
+		return;
+	
+	resumeErase();
+	waitBUSY();
+	erase.running=0;
+}
+
+static void startBatch(void)
+{
+	uint32_t count=(dmaRead.remaining<W25Q_DMA_BATCH_SECTORS)?dmaRead.remaining:W25Q_DMA_BATCH_SECTORS;
+	uint8_t * buffer=dmaRead.buffer;
+	
+	dmaRead.buffer+=count<<W25Q_SECTOR_BITS;
+	dmaRead.remaining-=count;
+
+	dmaStart(buffer,count<<W25Q_SECTOR_BITS);
+}
+
+void W25Q_dmaInterrupt(void)
+{
+	if(!dmaRead.busy)
+		return;
+	
+	// CS stays low, the flash carries on streaming from where the last batch ended
+	
+	if(dmaRead.remaining)
+	{
+		startBatch();
+		return;
+	}
+	
+	dmaStop();
+	csSet(0);
+	resumeErase();
+	
+	dmaRead.busy=0;
+	
+	if(dmaRead.callback)
+		dmaRead.callback();
+}
+
+int8_t W25Q_isBusy(void)
+{
+	if(dmaRead.busy)
+		return 1;
+	
+	if(erase.running && !(readStatus()&STATUS_BUSY))
+		erase.running=0;
+	
+	return erase.running;
+}
+
+void W25Q_wait(void)
+{
+	waitRead();
+	waitErase();
+}
+
+void W25Q_readSectorsAsync(uint32_t index, uint8_t * buffer, uint32_t count, W25Q_callback_t callback)
+{
+	waitRead();
+
+	if(!count)
+	{
+		if(callback)
+			callback();
+		return;
+	}
+	
+	dmaRead.buffer=buffer;
+	dmaRead.remaining=count;
+	dmaRead.callback=callback;
+	dmaRead.busy=1;
+	
+	suspendErase();
+	csClear();
+	
+	sendRead8(CMD_FAST_READ);
+	send32(index<<W25Q_SECTOR_BITS);
+	sendRead8(0x00); // dummy byte		
+
+	startBatch();
+}
+
+void W25Q_readSectors(uint32_t index, uint8_t * buffer, uint32_t count)
+{
+	W25Q_readSectorsAsync(index,buffer,count,NULL);
+	W25Q_wait();
+}
+
+void W25Q_read(uint32_t address, uint8_t * buffer, uint32_t size)
+{
+	waitRead();
+	suspendErase();
+	
 	HANDLE_CS
 	{
 		sendRead8(CMD_FAST_READ);
-		send32(index<<W25Q_SECTOR_BITS);
+		send32(address);
 		sendRead8(0x00); // dummy byte		
 		
-		for(int size=0;size<W25Q_SECTOR_SIZE;++size)
+		while(size--)
 		{
 			*buffer++=sendRead8(0x00);
 		}
 	}
+	
+	resumeErase();
 }
 
-void W25Q_writeSector(uint32_t index, const uint8_t * buffer)
+void W25Q_readSector(uint32_t index, uint8_t * buffer)
 {
-	// erase sector
+	W25Q_readSectors(index,buffer,1);
+}
+
+void W25Q_eraseSectorAsync(uint32_t index)
+{
+	W25Q_wait();
 	
 	enableWrites();
 	
@@ -132,26 +501,64 @@ void W25Q_writeSector(uint32_t index, const uint8_t * buffer)
 		sendRead8(CMD_SECTOR_ERASE);
 		send32(index<<W25Q_SECTOR_BITS);
 	}
-
-	waitBUSY();
 	
-	// program individual pages
+	erase.running=1;
+}
 
-	for(int pageAddr=0;pageAddr<W25Q_SECTOR_SIZE;pageAddr+=W25Q_PAGE_SIZE)
+void W25Q_eraseSector(uint32_t index)
+{
+	W25Q_eraseSectorAsync(index);
+	W25Q_wait();
+}
+
+void W25Q_program(uint32_t address, const uint8_t * buffer, uint32_t size)
+{
+	waitRead();
+	suspendErase();
+	
+	while(size)
 	{
-		enableWrites();
+		// a command can't cross a page boundary
+		uint32_t count=W25Q_PAGE_SIZE-(address&W25Q_PAGE_MASK);
+		if(count>size)
+			count=size;
 		
+		enableWrites();
+
 		HANDLE_CS
 		{
 			sendRead8(CMD_PAGE_PROGRAM);
-			send32((index<<W25Q_SECTOR_BITS)+pageAddr);
-			for(int size=0;size<W25Q_PAGE_SIZE;++size)
+			send32(address);
+			for(uint32_t i=0;i<count;++i)
 			{
 				sendRead8(*buffer++);
 			}
 		}
-		
+
 		waitBUSY();
+		
+		address+=count;
+		size-=count;
+	}
+	
+	resumeErase();
+}
+
+void W25Q_programPage(uint32_t address, const uint8_t * buffer)
+{
+	W25Q_program(address&~W25Q_PAGE_MASK,buffer,W25Q_PAGE_SIZE);
+}
+
+void W25Q_writeSector(uint32_t index, const uint8_t * buffer)
+{
+	W25Q_eraseSector(index);
+	
+	// program individual pages
+
+	for(int pageAddr=0;pageAddr<W25Q_SECTOR_SIZE;pageAddr+=W25Q_PAGE_SIZE)
+	{
+		W25Q_programPage((index<<W25Q_SECTOR_BITS)+pageAddr,buffer);
+		buffer+=W25Q_PAGE_SIZE;
 	}
 }
 
@@ -181,24 +588,7 @@ void W25Q_writeSector(uint32_t index, const uint8_t * buffer)
 
 int8_t W25Q_init(void)
 {
-	//Configure pins and gpios
-	PINSEL_ConfigPin(0,6,0);
-	PINSEL_ConfigPin(0,7,2);
-	PINSEL_ConfigPin(0,8,2);
-	PINSEL_ConfigPin(0,9,2);
-	
-	GPIO_SetDir(0,1<<6,GPIO_DIRECTION_OUTPUT);
-	GPIO_OutputValue(0,1<<6,1);
-
-	// SSP Configuration structure variable
-	SSP_CFG_Type SSP_ConfigStruct;
-	// initialize SSP configuration structure to default
-	SSP_ConfigStructInit(&SSP_ConfigStruct);
-	SSP_ConfigStruct.ClockRate=15000000;
-	// Initialize SSP peripheral with parameter given in structure above
-	SSP_Init(LPC_SSP1,&SSP_ConfigStruct);
-	// Enable SD_SSP peripheral
-	SSP_Cmd(LPC_SSP1,ENABLE);
+	busInit();
 	
 	// reset the W25Q
 
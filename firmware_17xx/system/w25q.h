@@ -13,8 +13,34 @@
 
 #define W25Q_SECTOR_COUNT 16384 // 64MB
 
+// GPDMA channel of sector reads, its interrupt status goes to W25Q_dmaInterrupt()
+#define W25Q_DMA_RX_CHANNEL 2
+#define W25Q_DMA_CHANNEL_MASK (1<<W25Q_DMA_RX_CHANNEL)
+
+typedef void (*W25Q_callback_t)(void);
+
+// sector runs are read by DMA under a single FAST_READ command; the async
+// version returns right away, callback (can be NULL) then runs from the DMA
+// interrupt. Any other call waits for the pending read first.
+// W25Q_isBusy() / W25Q_wait() cover background erases too.
+void W25Q_readSectorsAsync(uint32_t index, uint8_t * buffer, uint32_t count, W25Q_callback_t callback);
+void W25Q_readSectors(uint32_t index, uint8_t * buffer, uint32_t count);
+int8_t W25Q_isBusy(void);
+void W25Q_wait(void);
+void W25Q_dmaInterrupt(void);
+
 void W25Q_readSector(uint32_t index, uint8_t * buffer);
-void W25Q_writeSector(uint32_t index, const uint8_t * buffer);
+void W25Q_read(uint32_t address, uint8_t * buffer, uint32_t size); // polled, small reads
+void W25Q_writeSector(uint32_t index, const uint8_t * buffer); // erase & program
+
+// programming can only clear bits, erasing sets them all
+void W25Q_eraseSector(uint32_t index);
+void W25Q_programPage(uint32_t address, const uint8_t * buffer);
+void W25Q_program(uint32_t address, const uint8_t * buffer, uint32_t size); // any span, split on pages
+
+// the erase runs while the call returns; reads & programs elsewhere suspend it
+// meanwhile, the sector itself must be left alone until W25Q_isBusy() clears
+void W25Q_eraseSectorAsync(uint32_t index);
 
 int8_t W25Q_init(void);
 
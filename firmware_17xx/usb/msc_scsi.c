@@ -335,7 +335,8 @@ U8 * SCSIHandleData(U8 *pbCDB, U8 iCDBLen, U8 *pbData, U32 dwOffset)
 			// write new block
 			dwBlockNr = dwLBA + (dwOffset / BLOCKSIZE);
 			DBG("W");
-			if (disk_write(0, abBlockBuf, dwBlockNr, 1) > 0) {
+			// no write-back over USB, the host can unplug at any time
+			if (disk_write(0, abBlockBuf, dwBlockNr, 1) > 0 || disk_ioctl(0, CTRL_SYNC, NULL) > 0) {
 				dwSense = WRITE_ERROR;
 				DBG("disk_write failed\n");
 				return NULL;
@@ -1,9 +1,13 @@
+#include <string.h>
+
 #include "usb_midi.h"
 
 #include "usb_debug.h"
 #include "usbapi.h"
 
+#include "main.h"
 #include "synth/synth.h"
+#include "xnormidi/bytequeue/bytequeue.h"
 
 #define MIDI_BULK_OUT_EP	0x01
 #define MIDI_BULK_IN_EP		0x81
@@ -13,8 +17,23 @@
 #define MIDI_JACK_USB_IN 0x03
 #define MIDI_JACK_DEV_IN 0x04
 
+#define MIDI_BULK_PACKET_SIZE 64
+#define MIDI_EVENT_SIZE 4
+#define MIDI_TX_QUEUE_SIZE 256 // power of 2, multiple of MIDI_EVENT_SIZE
+
 #define LE_WORD(x)		((x)&0xFF),((x)>>8)
 
+static struct usbMidiStats_s stats;
+
+// bulk IN: whole events queued by usb_midi_send(), drained by the USB interrupt
+static struct
+{
+	byteQueue_t queue;
+	uint8_t data[MIDI_TX_QUEUE_SIZE];
+	volatile int8_t busy; // a packet is being sent
+	int8_t started;
+} tx;
+
 static const U8 abDescriptors[] = {
 
 // device descriptor	
@@ -36,7 +55,7 @@ static const U8 abDescriptors[] = {
 // configuration descriptor
 	0x09,
 	DESC_CONFIGURATION,
-	LE_WORD(9+9+9+9+7+6+9+9+5),	// wTotalLength
+	LE_WORD(9+9+9+9+7+6+9+6+9+9+5+9+5),	// wTotalLength
 	0x02,					// bNumInterfaces
 	0x01,					// bConfigurationValue
 	0x00,					// iConfiguration
@@ -68,7 +87,7 @@ static const U8 abDescriptors[] = {
 	DESC_INTERFACE,
 	0x01,					// bInterfaceNumber
 	0x00,					// bAlternateSetting
-	0x01,					// bNumEndPoints
+	0x02,					// bNumEndPoints
 	0x01,					// bInterfaceClass = AUDIO
 	0x03,					// bInterfaceSubClass = MIDISTREAMING
 	0x00,					// bInterfaceProtocol
@@ -79,7 +98,7 @@ static const U8 abDescriptors[] = {
 	0x24,        // bDescriptorType (See Next Line)
 	0x01,        // bDescriptorSubtype (CS_INTERFACE -> MS_HEADER)
 	0x00, 0x01,  // bcdMSC 1.00
-	LE_WORD(7+6+9), // wTotalLength
+	LE_WORD(7+6+9+6+9), // wTotalLength
 
 //MIDI In Jack 1
 	0x06,        // bLength
@@ -100,12 +119,31 @@ static const U8 abDescriptors[] = {
 	0x00,        // baSourcePin(1)
 	0x00,        // iJack
 	
+//MIDI In Jack 3
+	0x06,        // bLength
+	0x24,        // bDescriptorType (See Next Line)
+	0x02,        // bDescriptorSubtype (CS_INTERFACE -> MIDI_IN_JACK)
+	0x02,        // bJackType (EXTERNAL)
+	MIDI_JACK_DEV_OUT, // bJackID
+	0x00,        // iJack
+
+//MIDI Out Jack 4
+	0x09,        // bLength
+	0x24,        // bDescriptorType (See Next Line)
+	0x03,        // bDescriptorSubtype (CS_INTERFACE -> MIDI_OUT_JACK)
+	0x01,        // bJackType (EMBEDDED)
+	MIDI_JACK_USB_IN, // bJackID
+	0x01,        // bNrInputPins
+	MIDI_JACK_DEV_OUT, // baSourceID(1)
+	0x01,        // baSourcePin(1)
+	0x00,        // iJack
+	
 // OUT EP
 	0x09,
 	DESC_ENDPOINT,
 	MIDI_BULK_OUT_EP,		// bEndpointAddress
 	0x02,					// bmAttributes = bulk
-	LE_WORD(4),				// wMaxPacketSize (size of MIDI packet)
+	LE_WORD(MIDI_BULK_PACKET_SIZE),	// wMaxPacketSize (up to 16 MIDI events)
 	0x00,					// bInterval
 	0x00,        // bRefresh
 	0x00,        // bSyncAddress	
@@ -117,6 +155,23 @@ static const U8 abDescriptors[] = {
 	0x01,        // bNumEmbMIDIJack (num of MIDI **IN** Jacks)
 	MIDI_JACK_USB_OUT, // BaAssocJackID(1) 1
 
+// IN EP
+	0x09,
+	DESC_ENDPOINT,
+	MIDI_BULK_IN_EP,		// bEndpointAddress
+	0x02,					// bmAttributes = bulk
+	LE_WORD(MIDI_BULK_PACKET_SIZE),	// wMaxPacketSize
+	0x00,					// bInterval
+	0x00,        // bRefresh
+	0x00,        // bSyncAddress	
+
+//Class-specific MS Bulk IN Descriptor
+	0x05,        // bLength
+	0x25,        // bDescriptorType (See Next Line)
+	0x01,        // bDescriptorSubtype (CS_ENDPOINT -> MS_GENERAL)
+	0x01,        // bNumEmbMIDIJack (num of MIDI **OUT** Jacks)
+	MIDI_JACK_USB_IN, // BaAssocJackID(1) 3
+
 // string descriptors
 	0x04,
 	DESC_STRING,
@@ -138,9 +193,55 @@ static const U8 abDescriptors[] = {
 	0, 0
 };
 
+int usb_midi_decode(const U8 * packet, int len, U8 * midiBytes)
+{
+	static const U8 cin2size[16] = {0,0,2,3,3,1,2,3,3,3,3,3,2,2,3,1};
+	const U8 * ev;
+	int count = 0;
+	
+	// a truncated trailing event is lost
+	if (len & (MIDI_EVENT_SIZE - 1)) {
+		++stats.drops;
+	}
+	
+	for (ev = packet; ev + MIDI_EVENT_SIZE <= packet + len; ev += MIDI_EVENT_SIZE) {
+		U8 size = cin2size[ev[0] & 0xf];
+		
+		// CIN 0 / 1 are reserved, but some hosts pad transfers with zeroed events
+		if (!size) {
+			if (ev[0] | ev[1] | ev[2] | ev[3]) {
+				++stats.drops;
+			}
+			continue;
+		}
+
+		// always copy 3 bytes, the unused ones get overwritten by the next event
+		midiBytes[count] = ev[1];
+		midiBytes[count + 1] = ev[2];
+		midiBytes[count + 2] = ev[3];
+		count += size;
+		++stats.events;
+	}
+	
+	return count;
+}
+
+void usb_midi_getStats(struct usbMidiStats_s * s)
+{
+	*s = stats;
+}
+
+void usb_midi_resetStats(void)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
 void MIDIBulkOut(U8 bEP, U8 bEPStatus)
 {
-	const U8 code2size[16] = {0,0,2,3,3,1,2,3,3,3,3,3,2,2,3,1};
+	U8 packet[MIDI_BULK_PACKET_SIZE];
+	U8 midiBytes[MIDI_BULK_PACKET_SIZE / MIDI_EVENT_SIZE * 3];
+	U32 events;
+	int len, count;
 	
 	DBG("MIDIBulkOut %x %x\n", bEP, bEPStatus);
 	
@@ -149,20 +250,102 @@ void MIDIBulkOut(U8 bEP, U8 bEPStatus)
 		return;
 	}
 	
-	int len;
-	U8 cmdBuf[4];
+	// drain the whole packet, all its events are queued at once
+	len = USBHwEPRead(bEP, packet, sizeof(packet));
+	if (len <= 0) {
+		return;
+	}
+	
+	++stats.packets;
+	events = stats.events;
 	
-	len = USBHwEPRead(bEP, cmdBuf, sizeof(cmdBuf));
+	count = usb_midi_decode(packet, len, midiBytes);
 	
-	if(len>=sizeof(cmdBuf))
+	if (count && !synth_usbMIDIEvents(midiBytes, count)) {
+		// MIDI input queue full, the whole packet is lost
+		stats.drops += stats.events - events;
+	}
+}
+
+static void sendNextPacket(void)
+{
+	U8 packet[MIDI_BULK_PACKET_SIZE];
+	const uint8_t * data;
+	int len = 0, run, n;
+	
+	// the queue only holds whole events, so do both runs around its end
+	for (run = 0; run < 2; ++run) {
+		n = bytequeue_peek(&tx.queue, &data);
+		if (n > MIDI_BULK_PACKET_SIZE - len) {
+			n = MIDI_BULK_PACKET_SIZE - len;
+		}
+		memcpy(&packet[len], data, n);
+		bytequeue_consume(&tx.queue, n);
+		len += n;
+	}
+	
+	tx.busy = len > 0;
+	
+	if (len) {
+		USBHwEPWrite(MIDI_BULK_IN_EP, packet, len);
+	}
+}
+
+void MIDIBulkIn(U8 bEP, U8 bEPStatus)
+{
+	DBG("MIDIBulkIn %x %x\n", bEP, bEPStatus);
+	
+	// previous packet sent
+	sendNextPacket();
+}
+
+void usb_midi_send(uint8_t count, uint8_t b0, uint8_t b1, uint8_t b2)
+{
+	U8 event[MIDI_EVENT_SIZE] = {0, b0, (count > 1) ? b1 : 0, (count > 2) ? b2 : 0};
+	
+	if (!tx.started) {
+		return;
+	}
+	
+	// Code Index Number, from the xnormidi send_func chunks (SysEx comes
+	// in chunks of 3, the last one holds F7)
+	if (b0 >= 0x80 && b0 < 0xf0) {
+		event[0] = b0 >> 4;
+	} else if (b0 >= 0xf8) {
+		event[0] = 0xf;
+	} else if ((count == 1 && b0 == 0xf7) || b0 == 0xf6) {
+		event[0] = 0x5;
+	} else if (count == 2 && b1 == 0xf7) {
+		event[0] = 0x6;
+	} else if (count == 3 && b2 == 0xf7) {
+		event[0] = 0x7;
+	} else if (b0 == 0xf0 || b0 < 0x80) {
+		event[0] = 0x4;
+	} else {
+		event[0] = (count == 2) ? 0x2 : 0x3;
+	}
+	
+	if (bytequeue_room(&tx.queue) < MIDI_EVENT_SIZE) {
+		++stats.txDrops;
+		return;
+	}
+	
+	bytequeue_enqueue_bulk(&tx.queue, event, MIDI_EVENT_SIZE);
+	
+	BLOCK_INT(1)
 	{
-		for(U8 p = 0; p < code2size[cmdBuf[0] & 0xf]; ++p)
-			synth_usbMIDIEvent(cmdBuf[1+p]);
+		if (!tx.busy) {
+			sendNextPacket();
+		}
 	}
 }
 
 void usb_midi_start(void)
 {
+	bytequeue_init(&tx.queue, tx.data, MIDI_TX_QUEUE_SIZE);
+	tx.busy = 0;
+	tx.started = 1;
+	
 	// initialise stack
 	USBInit();
 	
@@ -171,6 +354,7 @@ void usb_midi_start(void)
 
 	// register endpoint handlers
 	USBHwRegisterEPIntHandler(MIDI_BULK_OUT_EP, MIDIBulkOut);
+	USBHwRegisterEPIntHandler(MIDI_BULK_IN_EP, MIDIBulkIn);
 
 	// connect to bus
 	USBHwConnect(TRUE);
@@ -1,7 +1,27 @@
 #ifndef USB_MIDI_H
 #define USB_MIDI_H
 
+#include <stdint.h>
+
+struct usbMidiStats_s
+{
+	uint32_t packets; // bulk OUT packets received
+	uint32_t events; // 4 bytes USB-MIDI events decoded
+	uint32_t drops; // events lost (reserved CIN, truncated, MIDI input queue full)
+	uint32_t txDrops; // events not sent (bulk IN queue full)
+};
+
 void usb_midi_start(void);
 
-#endif /* USB_MIDI_H */
+// queues a MIDI message for the bulk IN endpoint, takes xnormidi send_func
+// chunks (up to 3 bytes, SysEx in several calls)
+void usb_midi_send(uint8_t count, uint8_t b0, uint8_t b1, uint8_t b2);
 
+// decodes all the events of a bulk OUT packet into a MIDI byte stream,
+// midiBytes must hold len*3/4 bytes, returns the stream length
+int usb_midi_decode(const uint8_t * packet, int len, uint8_t * midiBytes);
+
+void usb_midi_getStats(struct usbMidiStats_s * s);
+void usb_midi_resetStats(void);
+
+#endif /* USB_MIDI_H */
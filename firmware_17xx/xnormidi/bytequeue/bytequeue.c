@@ -1,4 +1,4 @@
-//this is a single reader [maybe multiple writer?] byte queue
+//this is a single reader, single writer byte queue, lock free
 //Copyright 2008 Alex Norman
 //writen by Alex Norman 
 //
@@ -18,48 +18,63 @@
 //along with avr-bytequeue.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "bytequeue.h"
-#include "interrupt_setting.h"
+
+//index publication: a plain 16bit load / store on the Cortex-M3, plus a DMB
+#define LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
 
 void bytequeue_init(byteQueue_t * queue, uint8_t * dataArray, byteQueueIndex_t arrayLen){
-   queue->length = arrayLen;
+   queue->mask = arrayLen - 1;
    queue->data = dataArray;
    queue->start = queue->end = 0;
 }
 
 bool bytequeue_enqueue(byteQueue_t * queue, uint8_t item){
-   interrupt_setting_t setting = store_and_clear_interrupt();
+   byteQueueIndex_t end = queue->end; //only we write it
    //full
-   if(((queue->end + 1) % queue->length) == queue->start){
-      restore_interrupt_setting(setting);
+   if((byteQueueIndex_t)(end - LOAD_ACQUIRE(&queue->start)) > queue->mask)
       return false;
-   } else {
-      queue->data[queue->end] = item;
-      queue->end = (queue->end + 1) % queue->length;
-      restore_interrupt_setting(setting);
-      return true;
-   }
+   queue->data[end & queue->mask] = item;
+   STORE_RELEASE(&queue->end, (byteQueueIndex_t)(end + 1));
+   return true;
+}
+
+byteQueueIndex_t bytequeue_room(byteQueue_t * queue){
+   return queue->mask + 1 - (byteQueueIndex_t)(queue->end - LOAD_ACQUIRE(&queue->start));
+}
+
+byteQueueIndex_t bytequeue_enqueue_bulk(byteQueue_t * queue, const uint8_t * items, byteQueueIndex_t cnt){
+   byteQueueIndex_t end = queue->end;
+   byteQueueIndex_t room = bytequeue_room(queue);
+   byteQueueIndex_t i;
+   if(cnt > room)
+      cnt = room;
+   for(i = 0; i < cnt; i++)
+      queue->data[(end + i) & queue->mask] = items[i];
+   STORE_RELEASE(&queue->end, (byteQueueIndex_t)(end + cnt));
+   return cnt;
 }
 
 byteQueueIndex_t bytequeue_length(byteQueue_t * queue){
-   byteQueueIndex_t len;
-   interrupt_setting_t setting = store_and_clear_interrupt();
-   if(queue->end >= queue->start)
-      len = queue->end - queue->start;
-   else
-      len = (queue->length - queue->start) + queue->end;
-   restore_interrupt_setting(setting);
-   return len;
+   return LOAD_ACQUIRE(&queue->end) - queue->start;
 }
 
-//we don't need to avoid interrupts if there is only one reader
+//only valid for index < bytequeue_length()
 uint8_t bytequeue_get(byteQueue_t * queue, byteQueueIndex_t index){
-   return queue->data[(queue->start + index) % queue->length];
+   return queue->data[(queue->start + index) & queue->mask];
 }
 
-//we just update the start index to remove elements
-void bytequeue_remove(byteQueue_t * queue, byteQueueIndex_t numToRemove){
-   interrupt_setting_t setting = store_and_clear_interrupt();
-   queue->start = (queue->start + numToRemove) % queue->length;
-   restore_interrupt_setting(setting);
+byteQueueIndex_t bytequeue_peek(byteQueue_t * queue, const uint8_t ** data){
+   byteQueueIndex_t start = queue->start & queue->mask;
+   byteQueueIndex_t len = LOAD_ACQUIRE(&queue->end) - queue->start;
+   //stop at the end of the array
+   if(len > queue->mask + 1 - start)
+      len = queue->mask + 1 - start;
+   *data = &queue->data[start];
+   return len;
 }
 
+//we just update the start index to remove elements, the writer can reuse them right away
+void bytequeue_remove(byteQueue_t * queue, byteQueueIndex_t numToRemove){
+   STORE_RELEASE(&queue->start, (byteQueueIndex_t)(queue->start + numToRemove));
+}
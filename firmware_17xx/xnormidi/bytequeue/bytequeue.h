@@ -1,4 +1,4 @@
-//this is a single reader [maybe multiple writer?] byte queue
+//this is a single reader, single writer byte queue, lock free
 //Copyright 2008 Alex Norman
 //writen by Alex Norman 
 //
@@ -27,33 +27,51 @@ extern "C" {
 #include <inttypes.h>
 #include <stdbool.h>
 
-typedef uint8_t byteQueueIndex_t;
+//free running indices, the array length must be a power of 2 (at most 32768)
+typedef uint16_t byteQueueIndex_t;
 
+//the writer only ever stores end, the reader only ever stores start, each
+//publishes its index with release semantics and reads the other one's with
+//acquire semantics, so neither needs to mask interrupts
 typedef struct {
 	byteQueueIndex_t start;
 	byteQueueIndex_t end;
-	byteQueueIndex_t length;
+	byteQueueIndex_t mask;
 	uint8_t * data;
 } byteQueue_t;
 
 //you must have a queue, an array of data which the queue will use, and the length of that array
 void bytequeue_init(byteQueue_t * queue, uint8_t * dataArray, byteQueueIndex_t arrayLen);
 
+//writer side
+
 //add an item to the queue, returns false if the queue is full
 bool bytequeue_enqueue(byteQueue_t * queue, uint8_t item);
 
+//free space, it can only grow until the next enqueue
+byteQueueIndex_t bytequeue_room(byteQueue_t * queue);
+
+//add up to cnt items at once, returns how many fit
+byteQueueIndex_t bytequeue_enqueue_bulk(byteQueue_t * queue, const uint8_t * items, byteQueueIndex_t cnt);
+
+//reader side
+
 //get the length of the queue
 byteQueueIndex_t bytequeue_length(byteQueue_t * queue);
 
 //this grabs data at the index given [starting at queue->start]
 uint8_t bytequeue_get(byteQueue_t * queue, byteQueueIndex_t index);
 
+//points data to the oldest items, returns how many can be read there
+//contiguously (0 when empty, a second peek gets the rest after a wrap)
+byteQueueIndex_t bytequeue_peek(byteQueue_t * queue, const uint8_t ** data);
+
 //update the index in the queue to reflect data that has been dealt with 
 void bytequeue_remove(byteQueue_t * queue, byteQueueIndex_t numToRemove);
+#define bytequeue_consume bytequeue_remove
 
 #ifdef __cplusplus
 }
 #endif 
 
 #endif
-
@@ -61,6 +61,18 @@ void midi_device_init(MidiDevice * device); // [implementation in midi_device.c]
 */
 void midi_device_process(MidiDevice * device); // [implementation in midi_device.c]
 
+/**
+ * @brief Process part of the input data
+ *
+ * Same as midi_device_process, but only the oldest count bytes are processed,
+ * so that input can be applied at the time it was received.  The pre input
+ * process callback isn't called.
+ *
+ * @param device the device to process
+ * @param count the number of bytes to process, at most
+*/
+void midi_device_process_bytes(MidiDevice * device, uint16_t count); // [implementation in midi_device.c]
+
 /**@}*/
 
 /**
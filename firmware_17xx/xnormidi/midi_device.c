@@ -58,10 +58,12 @@ void midi_device_init(MidiDevice * device){
    device->pre_input_process_callback = NULL;
 }
 
-void midi_device_input(MidiDevice * device, uint8_t cnt, uint8_t * input) {
-   uint8_t i;
-   for (i = 0; i < cnt; i++)
-      bytequeue_enqueue(&device->input_queue, input[i]);
+bool midi_device_input(MidiDevice * device, uint8_t cnt, uint8_t * input) {
+   //all or nothing, a partly queued message would corrupt the stream
+   if(bytequeue_room(&device->input_queue) < cnt)
+      return false;
+   bytequeue_enqueue_bulk(&device->input_queue, input, cnt);
+   return true;
 }
 
 void midi_device_set_send_func(MidiDevice * device, midi_var_byte_func_t send_func){
@@ -77,14 +79,23 @@ void midi_device_process(MidiDevice * device) {
    if(device->pre_input_process_callback)
       device->pre_input_process_callback(device);
 
-   //pull stuff off the queue and process
-   byteQueueIndex_t len = bytequeue_length(&device->input_queue);
-   uint16_t i;
-   //TODO limit number of bytes processed?
-   for(i = 0; i < len; i++) {
-      uint8_t val = bytequeue_get(&device->input_queue, 0);
-      midi_process_byte(device, val);
-      bytequeue_remove(&device->input_queue, 1);
+   midi_device_process_bytes(device, UINT16_MAX);
+}
+
+void midi_device_process_bytes(MidiDevice * device, uint16_t count) {
+   //pull stuff off the queue and process, one contiguous run at a time (a
+   //second one when the data wraps around the end of the array)
+   uint8_t run;
+   for(run = 0; run < 2 && count; run++) {
+      const uint8_t * data;
+      byteQueueIndex_t len = bytequeue_peek(&device->input_queue, &data);
+      byteQueueIndex_t i;
+      if(len > count)
+         len = count;
+      for(i = 0; i < len; i++)
+         midi_process_byte(device, data[i]);
+      bytequeue_consume(&device->input_queue, len);
+      count -= len;
    }
 }
 
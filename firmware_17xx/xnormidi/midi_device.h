@@ -49,7 +49,7 @@ extern "C" {
 
 #include "midi_function_types.h"
 #include "bytequeue/bytequeue.h"
-#define MIDI_INPUT_QUEUE_LENGTH 192
+#define MIDI_INPUT_QUEUE_LENGTH 256 // power of 2, see bytequeue.h
 
 typedef enum {
    IDLE, 
@@ -121,8 +121,10 @@ struct _midi_device {
  * @param device the midi device to associate the input with
  * @param cnt the number of bytes you are processing
  * @param input the bytes to process
+ * @return false, with nothing queued, when the bytes don't all fit in the
+ * input queue
  */
-void midi_device_input(MidiDevice * device, uint8_t cnt, uint8_t * input);
+bool midi_device_input(MidiDevice * device, uint8_t cnt, uint8_t * input);
 
 /**
  * @brief Set the callback function that will be used for sending output
@@ -0,0 +1,154 @@
+#include "bytequeue_test.h"
+#include <inttypes.h>
+#include <thread>
+
+#include "bytequeue/bytequeue.h"
+
+#define SIZE 64
+#define STRESS_BYTES 16000000
+
+CPPUNIT_TEST_SUITE_REGISTRATION( ByteQueueTest );
+
+//the byte expected at position i of a stream, period is prime so that it
+//never lines up with the queue size
+static uint8_t streamByte(uint32_t i) {
+   return (i * 7 + (i / 251)) & 0xFF;
+}
+
+void ByteQueueTest::testFull() {
+   uint8_t data[SIZE];
+   byteQueue_t q;
+   bytequeue_init(&q, data, SIZE);
+
+   CPPUNIT_ASSERT_EQUAL((byteQueueIndex_t)0, bytequeue_length(&q));
+
+   //all the array is usable
+   for(unsigned int i = 0; i < SIZE; i++)
+      CPPUNIT_ASSERT(bytequeue_enqueue(&q, i));
+   CPPUNIT_ASSERT(!bytequeue_enqueue(&q, 0xFF));
+   CPPUNIT_ASSERT_EQUAL((byteQueueIndex_t)SIZE, bytequeue_length(&q));
+
+   for(unsigned int i = 0; i < SIZE; i++)
+      CPPUNIT_ASSERT_EQUAL((uint8_t)i, bytequeue_get(&q, i));
+
+   bytequeue_remove(&q, 1);
+   CPPUNIT_ASSERT(bytequeue_enqueue(&q, 0xFF));
+   CPPUNIT_ASSERT(!bytequeue_enqueue(&q, 0xFF));
+   CPPUNIT_ASSERT_EQUAL((uint8_t)0xFF, bytequeue_get(&q, SIZE - 1));
+}
+
+void ByteQueueTest::testPeekWrap() {
+   uint8_t data[SIZE];
+   const uint8_t * run;
+   byteQueue_t q;
+   bytequeue_init(&q, data, SIZE);
+
+   CPPUNIT_ASSERT_EQUAL((byteQueueIndex_t)0, bytequeue_peek(&q, &run));
+
+   //go around the 16 bits indices more than once, with runs crossing the array end
+   uint32_t in = 0, out = 0;
+   for(unsigned int pass = 0; pass < 3000; pass++) {
+      unsigned int cnt = 1 + pass % (SIZE - 1);
+      for(unsigned int i = 0; i < cnt; i++)
+         CPPUNIT_ASSERT(bytequeue_enqueue(&q, streamByte(in++)));
+
+      byteQueueIndex_t len = bytequeue_peek(&q, &run);
+      CPPUNIT_ASSERT(len > 0 && len <= cnt);
+      CPPUNIT_ASSERT(run >= data && run + len <= data + SIZE);
+      for(unsigned int i = 0; i < len; i++)
+         CPPUNIT_ASSERT_EQUAL(streamByte(out++), run[i]);
+      bytequeue_consume(&q, len);
+
+      //the rest is at the start of the array
+      if(len < cnt) {
+         CPPUNIT_ASSERT_EQUAL((byteQueueIndex_t)(cnt - len), bytequeue_peek(&q, &run));
+         CPPUNIT_ASSERT(run == data);
+         for(unsigned int i = 0; i < cnt - len; i++)
+            CPPUNIT_ASSERT_EQUAL(streamByte(out++), run[i]);
+         bytequeue_consume(&q, cnt - len);
+      }
+
+      CPPUNIT_ASSERT_EQUAL((byteQueueIndex_t)0, bytequeue_length(&q));
+   }
+   CPPUNIT_ASSERT(in > 65536);
+}
+
+void ByteQueueTest::testBulk() {
+   uint8_t data[SIZE];
+   uint8_t items[SIZE * 2];
+   byteQueue_t q;
+   bytequeue_init(&q, data, SIZE);
+
+   for(unsigned int i = 0; i < sizeof(items); i++)
+      items[i] = streamByte(i);
+
+   CPPUNIT_ASSERT_EQUAL((byteQueueIndex_t)10, bytequeue_enqueue_bulk(&q, items, 10));
+   bytequeue_consume(&q, 7);
+
+   //only what fits is taken
+   CPPUNIT_ASSERT_EQUAL((byteQueueIndex_t)(SIZE - 3), bytequeue_enqueue_bulk(&q, &items[10], sizeof(items) - 10));
+   CPPUNIT_ASSERT_EQUAL((byteQueueIndex_t)0, bytequeue_enqueue_bulk(&q, items, 1));
+   CPPUNIT_ASSERT_EQUAL((byteQueueIndex_t)SIZE, bytequeue_length(&q));
+
+   for(unsigned int i = 0; i < SIZE; i++)
+      CPPUNIT_ASSERT_EQUAL(streamByte(7 + i), bytequeue_get(&q, i));
+}
+
+//a writer thread (the MIDI interrupt) and a reader thread (the main loop)
+//hammer the queue, the reader checks every byte arrives once and in order
+void ByteQueueTest::testThreadedStress() {
+   static uint8_t data[SIZE];
+   static byteQueue_t q;
+   bytequeue_init(&q, data, SIZE);
+
+   std::thread writer([]() {
+      uint8_t chunk[SIZE / 2];
+      uint32_t i = 0;
+      while(i < STRESS_BYTES) {
+         //alternate single bytes & bulk writes of varying sizes
+         byteQueueIndex_t done;
+         if(i & 1) {
+            done = bytequeue_enqueue(&q, streamByte(i));
+         } else {
+            byteQueueIndex_t cnt = 1 + (i / 3) % (SIZE / 2);
+            if(cnt > STRESS_BYTES - i)
+               cnt = STRESS_BYTES - i;
+            for(unsigned int j = 0; j < cnt; j++)
+               chunk[j] = streamByte(i + j);
+            done = bytequeue_enqueue_bulk(&q, chunk, cnt);
+         }
+         i += done;
+         //full, also keeps single core hosts moving
+         if(!done)
+            std::this_thread::yield();
+      }
+   });
+
+   uint32_t out = 0, errors = 0, maxLen = 0;
+   while(out < STRESS_BYTES) {
+      const uint8_t * run;
+      byteQueueIndex_t len = bytequeue_peek(&q, &run);
+      if(!len) {
+         std::this_thread::yield();
+         continue;
+      }
+      if(len > maxLen)
+         maxLen = len;
+      for(unsigned int i = 0; i < len; i++)
+         errors += run[i] != streamByte(out + i);
+      out += len;
+      //consume a bit less from time to time, what's left must come back first
+      if(len > 1 && (out & 0x10)) {
+         out--;
+         len--;
+      }
+      bytequeue_consume(&q, len);
+   }
+
+   writer.join();
+
+   CPPUNIT_ASSERT_EQUAL((uint32_t)0, errors);
+   CPPUNIT_ASSERT_EQUAL((uint32_t)STRESS_BYTES, out);
+   CPPUNIT_ASSERT_EQUAL((byteQueueIndex_t)0, bytequeue_length(&q));
+   CPPUNIT_ASSERT(maxLen <= SIZE);
+}
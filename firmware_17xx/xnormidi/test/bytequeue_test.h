@@ -0,0 +1,22 @@
+#ifndef BYTEQUEUE_TEST_H
+#define BYTEQUEUE_TEST_H
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class ByteQueueTest : public CppUnit::TestCase { 
+      CPPUNIT_TEST_SUITE( ByteQueueTest );
+      CPPUNIT_TEST( testFull );
+      CPPUNIT_TEST( testPeekWrap );
+      CPPUNIT_TEST( testBulk );
+      CPPUNIT_TEST( testThreadedStress );
+      CPPUNIT_TEST_SUITE_END(); 
+
+   public:
+
+      void testFull();
+      void testPeekWrap();
+      void testBulk();
+      void testThreadedStress();
+};
+
+#endif